@@ -1,7 +1,10 @@
 #include <stdlib.h>
+#include <math.h>
+#include <bitfield/bitfield.h>
 #include <canutil/read.h>
 #include <pb_encode.h>
 #include "can/canread.h"
+#include "can/snapshot.h"
 #include "config.h"
 #include "util/log.h"
 #include "util/timer.h"
@@ -14,6 +17,10 @@ using openxc::pipeline::publish;
 
 namespace pipeline = openxc::pipeline;
 namespace time = openxc::util::time;
+namespace snapshot = openxc::can::snapshot;
+
+// The largest integer magnitude a float can hold without rounding
+#define FLOAT_EXACT_INTEGER_LIMIT 16777216.0
 
 float openxc::can::read::parseSignalBitfield(CanSignal* signal,
         const CanMessage* message) {
@@ -93,6 +100,14 @@ void openxc::can::read::publishVehicleMessage(const char* name,
     publishVehicleMessage(name, value, NULL, pipeline);
 }
 
+void openxc::can::read::publishSignal(const CanSignal* signal,
+        const CanSignal* signals, openxc_DynamicField* value,
+        openxc::pipeline::Pipeline* pipeline) {
+    if(!pipeline::publishSignal(pipeline, signal - signals, value, NULL)) {
+        publishVehicleMessage(signal->genericName, value, pipeline);
+    }
+}
+
 void openxc::can::read::publishNumericalMessage(const char* name, float value,
         openxc::pipeline::Pipeline* pipeline) {
     openxc_DynamicField decodedValue = payload::wrapNumber(value);
@@ -158,40 +173,153 @@ void openxc::can::read::passthroughMessage(CanBus* bus, CanMessage* message,
     }
 }
 
-void openxc::can::read::translateSignal(CanSignal* signal,
-        const CanMessage* message,
-        CanSignal* signals, int signalCount,
-        openxc::pipeline::Pipeline* pipeline) {
-    if(signal == NULL || message == NULL) {
-        return;
+void openxc::can::read::initializeFixedPoint(CanSignal* signals,
+        int signalCount) {
+    int exactSignals = 0;
+    for(int i = 0; i < signalCount; i++) {
+        CanSignal* signal = &signals[i];
+        // If every intermediate result fits in a float without rounding,
+        // floating point math gives the same answer as integer math.
+        signal->fixedPointExact = signal->bitSize <= 24 &&
+                signal->factor == floorf(signal->factor) &&
+                signal->offset == floorf(signal->offset) &&
+                fabs(signal->factor) < FLOAT_EXACT_INTEGER_LIMIT &&
+                ((1 << signal->bitSize) - 1) * fabs(signal->factor) +
+                    fabs(signal->offset) < FLOAT_EXACT_INTEGER_LIMIT;
+        if(signal->fixedPointExact) {
+            signal->fixedPointFactor = (int32_t) signal->factor;
+            signal->fixedPointOffset = (int32_t) signal->offset;
+            ++exactSignals;
+        }
     }
+    debug("%d of %d signals can be decoded with integer math", exactSignals,
+            signalCount);
+}
 
-    float value = parseSignalBitfield(signal, message);
+/* Private: Decide if a signal should be published, given whether or not its
+ * value has changed since it was last received. See shouldSend(CanSignal*,
+ * float).
+ */
+static bool shouldSendChange(CanSignal* signal, bool changed) {
+    bool send = true;
+    if(time::conditionalTick(&signal->frequencyClock) ||
+            (changed && signal->forceSendChanged)) {
+        if(signal->received && !signal->sendSame && !changed) {
+            send = false;
+        }
+    } else {
+        send = false;
+    }
+    return send;
+}
+
+/* Private: Translate and publish a signal, given the raw value of its bit field
+ * from a CAN message.
+ */
+static void translateRawValue(CanSignal* signal, uint64_t rawValue,
+        CanSignal* signals, int signalCount, Pipeline* pipeline) {
+    float value;
+    bool changed;
+    if(getConfiguration()->fixedPointDecode && signal->received &&
+            signal->fixedPointExact && signal->fixedPointFactor != 0) {
+        // Each raw integer has its own exact value, so compare the raw
+        // integers, and only calculate the new value if they differ.
+        changed = rawValue != signal->lastRawValue;
+        value = changed ? (float)((int32_t) rawValue *
+                    signal->fixedPointFactor + signal->fixedPointOffset) :
+                signal->lastValue;
+    } else {
+        value = rawValue * signal->factor + signal->offset;
+        changed = value != signal->lastValue;
+    }
 
     bool send = true;
     // Must call the decoders every time, regardless of if we are going to
     // decide to send the signal or not.
     openxc_DynamicField decodedValue = openxc::can::read::decodeSignal(signal,
             value, signals, signalCount, &send);
-    if(send && shouldSend(signal, value)) {
-        openxc::can::read::publishVehicleMessage(signal->genericName, &decodedValue, pipeline);
+    if(send && snapshot::enabled()) {
+        // Hold on to the latest value until the next snapshot, instead of
+        // publishing every change. A value that can't be held in the snapshot
+        // is published right away, like usual.
+        send = !snapshot::update(signal, signals, &decodedValue,
+                changed || signal->sendSame || !signal->received);
+    }
+    // Don't bother building a message for a signal nobody subscribed to. This
+    // is checked last so the signal's send frequency is tracked the same
+    // either way.
+    if(send && shouldSendChange(signal, changed) &&
+            pipeline::signalSubscribed(pipeline, signal - signals)) {
+        openxc::can::read::publishSignal(signal, signals, &decodedValue,
+                pipeline);
     }
     signal->received = true;
     signal->lastValue = value;
+    signal->lastRawValue = (uint32_t) rawValue;
 }
 
-bool openxc::can::read::shouldSend(CanSignal* signal, float value) {
-    bool send = true;
-    if(time::conditionalTick(&signal->frequencyClock) ||
-            (value != signal->lastValue && signal->forceSendChanged)) {
-        if(signal->received && !signal->sendSame
-                && value == signal->lastValue) {
-            send = false;
+void openxc::can::read::translateSignal(CanSignal* signal,
+        const CanMessage* message,
+        CanSignal* signals, int signalCount,
+        openxc::pipeline::Pipeline* pipeline) {
+    if(signal == NULL || message == NULL) {
+        return;
+    }
+
+    translateRawValue(signal, get_bitfield(message->data, CAN_MESSAGE_SIZE,
+                signal->bitPosition, signal->bitSize), signals, signalCount,
+            pipeline);
+}
+
+bool openxc::can::read::translateMessage(CanBus* bus,
+        const CanMessage* message, CanSignal* signals, int signalCount,
+        Pipeline* pipeline) {
+    if(bus == NULL || message == NULL || signals == NULL ||
+            bus->indexedSignals != signals) {
+        return false;
+    }
+
+    const CanMessageIndexEntry* entry = lookupMessageIndexEntry(bus,
+            message->id, message->format);
+    if(entry == NULL) {
+        return false;
+    }
+
+    if(entry->extractionCount == 0 && entry->signalCount > 0) {
+        // There was no room for a plan, so do it the slow way
+        CanMessageDefinition* definition =
+                &bus->indexedMessages[entry->messageIndex];
+        for(int i = entry->signalStart;
+                i < entry->signalStart + entry->signalCount; i++) {
+            if(signals[i].message == definition) {
+                translateSignal(&signals[i], message, signals, signalCount,
+                        pipeline);
+            }
         }
-    } else {
-        send = false;
+        return true;
     }
-    return send;
+
+    uint64_t data = 0;
+    for(int i = 0; i < CAN_MESSAGE_SIZE; i++) {
+        data = (data << 8) | message->data[i];
+    }
+
+    for(int i = 0; i < entry->extractionCount; i++) {
+        const SignalExtraction* extraction = &entry->extractions[i];
+        CanSignal* signal = &signals[extraction->signalIndex];
+        if(extraction->rightShift < 64) {
+            translateRawValue(signal,
+                    (data << extraction->leftShift) >> extraction->rightShift,
+                    signals, signalCount, pipeline);
+        } else {
+            translateSignal(signal, message, signals, signalCount, pipeline);
+        }
+    }
+    return true;
+}
+
+bool openxc::can::read::shouldSend(CanSignal* signal, float value) {
+    return shouldSendChange(signal, value != signal->lastValue);
 }
 
 openxc_DynamicField openxc::can::read::decodeSignal(CanSignal* signal,
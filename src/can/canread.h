@@ -30,6 +30,42 @@ void translateSignal(CanSignal* signal,
         const CanMessage* message, CanSignal* signals, int signalCount,
         openxc::pipeline::Pipeline* pipeline);
 
+/* Public: Parse every signal from a received CAN message, and translate and
+ *      publish each of them just like translateSignal(...).
+ *
+ * This uses the extraction plan built for the message by
+ * openxc::can::buildMessageIndex(...) to load the message data once and extract
+ * each signal with a pair of shifts, instead of parsing the data from scratch
+ * for each signal. The signals are translated in the same order as they appear
+ * in the signals array.
+ *
+ * bus - The CAN bus the message was received on.
+ * message - The received CAN message.
+ * signals - An array of all active signals. This must be the same array the
+ *      message index was built from.
+ * signalCount - The length of the signals array.
+ * pipeline - The pipeline to send the translated messages on.
+ *
+ * Returns true if the message is in the message index and its signals were
+ * translated. If false, nothing was translated - the message index hasn't been
+ * built for this bus and signals array, or the message isn't predefined.
+ */
+bool translateMessage(CanBus* bus, const CanMessage* message,
+        CanSignal* signals, int signalCount,
+        openxc::pipeline::Pipeline* pipeline);
+
+/* Public: Pre-scale the factor and offset of each signal for the fixed-point
+ * decode path (see the fixedPointDecode configuration option).
+ *
+ * Signals with an integer factor and offset whose values always fit in a float
+ * without rounding are marked so their values are calculated with integer math.
+ * The other signals still use floating point math when their value changes.
+ *
+ * signals - The list of all signals.
+ * signalCount - The length of the signals array.
+ */
+void initializeFixedPoint(CanSignal* signals, int signalCount);
+
 /* Public: Publish a CAN message to the pipeline without any parsing or
  * processing - just encapsulate it in a VehicleMessage.
  *
@@ -62,6 +98,22 @@ void passthroughMessage(CanBus* bus, CanMessage* message,
 void publishVehicleMessage(const char* name, openxc_DynamicField* value,
         openxc_DynamicField* event, openxc::pipeline::Pipeline* pipeline);
 
+/* Public: Publish a decoded value of a signal to the pipeline.
+ *
+ * If the configuration defers serialization, only a compact record of the
+ * value is queued in the pipeline, and the message is built and serialized for
+ * each endpoint when the pipeline is processed. Otherwise, or if the value
+ * can't be recorded, this is the same as publishVehicleMessage(...) with the
+ * signal's generic name.
+ *
+ * signal - The signal the value is from.
+ * signals - An array of all active signals.
+ * value - The value returned by the signal's decoder.
+ * pipeline - The pipeline to publish the message.
+ */
+void publishSignal(const CanSignal* signal, const CanSignal* signals,
+        openxc_DynamicField* value, openxc::pipeline::Pipeline* pipeline);
+
 /* Public: Publish a simple vehicle message to the pipeline with no event.
  *
  * This is a shortcut for publishVehicleMessage(const char*, openxc_DynamicField*,
@@ -1,32 +1,211 @@
 #include "can/canutil.h"
 #include "can/canwrite.h"
 #include "util/log.h"
+#include "util/metrics.h"
 #include "config.h"
 
 #define BUS_STATS_LOG_FREQUENCY_S 15
 #define CAN_MESSAGE_TOTAL_BIT_SIZE 128
+#define MESSAGE_INDEX_EXTENDED_FLAG 0x80000000
+// The number of acceptance filter slots configureDefaultFilters(...) leaves
+// free for filters added at runtime, e.g. for diagnostic responses.
+#define RESERVED_ACCEPTANCE_FILTERS 4
+#define MESSAGE_INDEX_KEY(id, format) ((id) | \
+        ((format) == CanMessageFormat::EXTENDED ? MESSAGE_INDEX_EXTENDED_FLAG : 0))
 
 namespace time = openxc::util::time;
 namespace statistics = openxc::util::statistics;
 namespace config = openxc::config;
+namespace metrics = openxc::util::metrics;
 
 using openxc::util::log::debug;
 using openxc::util::statistics::DeltaStatistic;
 
 const int openxc::can::CAN_ACTIVE_TIMEOUT_S = 5;
 
-void openxc::can::initializeCommon(CanBus* bus) {
+static CanMessageIndexEntry MESSAGE_INDEX[MAX_MESSAGE_INDEX_SIZE];
+static SignalExtraction SIGNAL_EXTRACTIONS[MAX_SIGNAL_EXTRACTION_COUNT];
+
+static CanMessage CAN1_RECEIVE_QUEUE_ELEMENTS[CAN1_RECEIVE_QUEUE_SIZE + 1];
+static CanMessage CAN2_RECEIVE_QUEUE_ELEMENTS[CAN2_RECEIVE_QUEUE_SIZE + 1];
+static CanMessage CAN1_SEND_QUEUE_ELEMENTS[CAN1_SEND_QUEUE_SIZE + 1];
+static CanMessage CAN2_SEND_QUEUE_ELEMENTS[CAN2_SEND_QUEUE_SIZE + 1];
+
+/* Private: A slot in an open addressing hash table of names - the index of
+ * the named item in the array the table was built from, or
+ * EMPTY_NAME_INDEX_SLOT. Only the index is kept, to save RAM - most names that
+ * don't match differ in their first few characters, so probing a slot that
+ * holds another name is cheap.
+ */
+typedef uint16_t NameIndexSlot;
+
+#define EMPTY_NAME_INDEX_SLOT 0xffff
+
+/* Private: A hash table for looking up items in an array by name.
+ *
+ * slots - Static memory for the table, a power of 2 in length.
+ * size - The length of the slots array.
+ * used - The number of non-empty slots.
+ * complete - True if every name in the array made it into the table.
+ * candidates - The array the table was built from - lookups in any other array
+ *      can't use the table.
+ * candidateCount - The length of the candidates array.
+ */
+typedef struct {
+    NameIndexSlot* slots;
+    uint16_t size;
+    uint16_t used;
+    bool complete;
+    void* candidates;
+    int candidateCount;
+} NameIndex;
+
+static NameIndexSlot SIGNAL_NAME_SLOTS[SIGNAL_NAME_INDEX_SIZE];
+static NameIndexSlot COMMAND_NAME_SLOTS[COMMAND_NAME_INDEX_SIZE];
+static NameIndexSlot SIGNAL_STATE_NAME_SLOTS[SIGNAL_STATE_NAME_INDEX_SIZE];
+
+static NameIndex SIGNAL_NAME_INDEX = {SIGNAL_NAME_SLOTS,
+        SIGNAL_NAME_INDEX_SIZE};
+static NameIndex COMMAND_NAME_INDEX = {COMMAND_NAME_SLOTS,
+        COMMAND_NAME_INDEX_SIZE};
+// The candidates for the state index are the signals - each slot refers to
+// a state in the states array of the signal it was added for.
+static NameIndex SIGNAL_STATE_NAME_INDEX = {SIGNAL_STATE_NAME_SLOTS,
+        SIGNAL_STATE_NAME_INDEX_SIZE};
+// True if more than one signal in the signal name index has the same name, so
+// a later one might be writable when the indexed one isn't.
+static bool SIGNAL_NAMES_DUPLICATED;
+
+bool queue_CanMessage_push(queue_CanMessage* queue, CanMessage value) {
+    uint16_t next = (queue->head + 1) % (queue->maxLength + 1);
+    if(queue->elements == NULL || next == queue->tail) {
+        ++queue->overflowCount;
+        queue->lastOverflowTime = time::systemTimeMs();
+        return false;
+    }
+
+    queue->elements[queue->head] = value;
+    queue->head = next;
+
+    uint16_t length = queue_CanMessage_length(queue);
+    if(length > queue->highWaterMark) {
+        queue->highWaterMark = length;
+    }
+    return true;
+}
+
+CanMessage queue_CanMessage_pop(queue_CanMessage* queue) {
+    if(queue->elements == NULL) {
+        CanMessage empty = {0};
+        return empty;
+    }
+    CanMessage value = queue->elements[queue->tail];
+    queue->tail = (queue->tail + 1) % (queue->maxLength + 1);
+    return value;
+}
+
+CanMessage queue_CanMessage_peek(queue_CanMessage* queue) {
+    if(queue->elements == NULL) {
+        CanMessage empty = {0};
+        return empty;
+    }
+    return queue->elements[queue->tail];
+}
+
+void queue_CanMessage_init(queue_CanMessage* queue) {
+    queue->head = 0;
+    queue->tail = 0;
+    queue->highWaterMark = 0;
+    queue->overflowCount = 0;
+    queue->lastOverflowTime = 0;
+}
+
+int queue_CanMessage_length(queue_CanMessage* queue) {
+    return (queue->maxLength + 1 + queue->head - queue->tail) %
+            (queue->maxLength + 1);
+}
+
+int queue_CanMessage_available(queue_CanMessage* queue) {
+    return queue->maxLength - queue_CanMessage_length(queue);
+}
+
+bool queue_CanMessage_full(queue_CanMessage* queue) {
+    return queue_CanMessage_length(queue) == queue->maxLength;
+}
+
+bool queue_CanMessage_empty(queue_CanMessage* queue) {
+    return queue->head == queue->tail;
+}
+
+void queue_CanMessage_snapshot(queue_CanMessage* queue, CanMessage* snapshot,
+        int max) {
+    int length = queue_CanMessage_length(queue);
+    for(int i = 0; i < length && i < max; i++) {
+        snapshot[i] = queue->elements[(queue->tail + i) %
+                (queue->maxLength + 1)];
+    }
+}
+
+/* Private: Assign storage to a CAN message queue and empty it.
+ */
+static void initializeQueue(QUEUE_TYPE(CanMessage)* queue,
+        CanMessage* elements, uint16_t maxLength) {
+    queue->elements = elements;
+    queue->maxLength = maxLength;
+    QUEUE_INIT(CanMessage, queue);
+}
+
+static int receiveQueueLength(void* bus) {
+    return QUEUE_LENGTH(CanMessage, &((CanBus*) bus)->receiveQueue);
+}
+
+static int sendQueueLength(void* bus) {
+    return QUEUE_LENGTH(CanMessage, &((CanBus*) bus)->sendQueue);
+}
+
+bool openxc::can::initializeCommon(CanBus* bus) {
     debug("Initializing CAN node %d...", bus->address);
-    QUEUE_INIT(CanMessage, &bus->receiveQueue);
-    QUEUE_INIT(CanMessage, &bus->sendQueue);
+    bool supported = true;
+    if(bus->address == 1) {
+        initializeQueue(&bus->receiveQueue, CAN1_RECEIVE_QUEUE_ELEMENTS,
+                CAN1_RECEIVE_QUEUE_SIZE);
+        initializeQueue(&bus->sendQueue, CAN1_SEND_QUEUE_ELEMENTS,
+                CAN1_SEND_QUEUE_SIZE);
+    } else if(bus->address == 2) {
+        initializeQueue(&bus->receiveQueue, CAN2_RECEIVE_QUEUE_ELEMENTS,
+                CAN2_RECEIVE_QUEUE_SIZE);
+        initializeQueue(&bus->sendQueue, CAN2_SEND_QUEUE_ELEMENTS,
+                CAN2_SEND_QUEUE_SIZE);
+    } else {
+        // Sharing another controller's storage would let the buses overwrite
+        // each other's messages, so the bus is left disabled instead
+        debug("No CAN queue storage for bus address %d - it must be 1 or 2, "
+                "not initializing the bus", bus->address);
+        initializeQueue(&bus->receiveQueue, NULL, 0);
+        initializeQueue(&bus->sendQueue, NULL, 0);
+        supported = false;
+    }
 
     LIST_INIT(&bus->acceptanceFilters);
     LIST_INIT(&bus->freeAcceptanceFilters);
+    memset(bus->standardFilterBitmap, 0, sizeof(bus->standardFilterBitmap));
+    bus->extendedFilterRangeCounts[0] = 0;
+    bus->extendedFilterRangeCounts[1] = 0;
+    bus->activeExtendedFilterRanges = 0;
+    bus->acceptanceFilterUpdateDepth = 0;
+    bus->acceptanceFiltersDirty = false;
+    bus->acceptanceFilterRebuilds = 0;
     for(size_t i = 0; i < MAX_ACCEPTANCE_FILTERS; i++) {
         LIST_INSERT_HEAD(&bus->freeAcceptanceFilters,
                 &bus->acceptanceFilterEntries[i], entries);
     }
 
+    bus->messageIndex = NULL;
+    bus->messageIndexSize = 0;
+    bus->messageIndexComplete = false;
+    bus->indexedMessages = NULL;
+    bus->indexedSignals = NULL;
+
     bus->writeHandler = openxc::can::write::sendMessage;
     bus->lastMessageReceived = 0;
     LIST_INIT(&bus->dynamicMessages);
@@ -42,6 +221,24 @@ void openxc::can::initializeCommon(CanBus* bus) {
     statistics::initialize(&bus->receivedDataStats);
     statistics::initialize(&bus->sendQueueStats);
     statistics::initialize(&bus->receiveQueueStats);
+    statistics::initialize(&bus->acceptanceFilterRebuildTimeStats);
+    statistics::initialize(&bus->receiveBatchStats);
+    statistics::initialize(&bus->receiveTimeStats);
+    statistics::initialize(&bus->receiveLatency);
+
+    metrics::registerCounter("can", bus->address, "messages_received",
+            &bus->messagesReceived);
+    metrics::registerCounter("can", bus->address, "messages_dropped",
+            &bus->messagesDropped);
+    metrics::registerCounter("can", bus->address, "filter_rebuilds",
+            &bus->acceptanceFilterRebuilds);
+    metrics::registerGauge("can", bus->address, "receive_queue_length",
+            receiveQueueLength, bus);
+    metrics::registerGauge("can", bus->address, "send_queue_length",
+            sendQueueLength, bus);
+    metrics::registerHistogram("can", bus->address, "receive_latency_us",
+            &bus->receiveLatency);
+    return supported;
 }
 
 void openxc::can::destroy(CanBus* bus) {
@@ -64,14 +261,117 @@ static int lookup(void* key,
     return -1;
 }
 
+/* Private: Calculate the 32-bit FNV-1a hash of a string.
+ *
+ * seed - An additional value to mix in to the hash, e.g. to key the same name
+ *      differently for each signal.
+ */
+static uint32_t hashName(const char* name, uint32_t seed) {
+    uint32_t hash = 2166136261u ^ seed;
+    while(*name != '\0') {
+        hash ^= (uint8_t) *name++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void resetNameIndex(NameIndex* index, void* candidates,
+        int candidateCount) {
+    for(int i = 0; i < index->size; i++) {
+        index->slots[i] = EMPTY_NAME_INDEX_SLOT;
+    }
+    index->used = 0;
+    index->complete = true;
+    index->candidates = candidates;
+    index->candidateCount = candidateCount;
+}
+
+/* Private: Find an item in a name index, probing linearly from the slot for
+ * the hash until the item or an empty slot is found.
+ *
+ * Returns the index of the item in the candidates array, or -1 if not found.
+ */
+static int searchNameIndex(const NameIndex* index, uint32_t hash, void* key,
+        bool (*comparator)(void* key, int index, void* candidates),
+        void* candidates) {
+    uint16_t mask = index->size - 1;
+    for(uint16_t i = 0, slot = hash & mask; i < index->size;
+            i++, slot = (slot + 1) & mask) {
+        if(index->slots[slot] == EMPTY_NAME_INDEX_SLOT) {
+            break;
+        }
+
+        if(comparator(key, index->slots[slot], candidates)) {
+            return index->slots[slot];
+        }
+    }
+    return -1;
+}
+
+/* Private: Add an item to a name index, unless the name is already there -
+ * the first item with a name wins, to match a linear search.
+ *
+ * Returns false if the index is too full to add the item.
+ */
+static bool insertNameIndex(NameIndex* index, uint32_t hash, int itemIndex,
+        void* key, bool (*comparator)(void* key, int index, void* candidates),
+        void* candidates) {
+    if(searchNameIndex(index, hash, key, comparator, candidates) != -1) {
+        return true;
+    }
+
+    if(index->used >= index->size / 4 * 3) {
+        index->complete = false;
+        return false;
+    }
+
+    uint16_t mask = index->size - 1;
+    uint16_t slot = hash & mask;
+    while(index->slots[slot] != EMPTY_NAME_INDEX_SLOT) {
+        slot = (slot + 1) & mask;
+    }
+    index->slots[slot] = itemIndex;
+    ++index->used;
+    return true;
+}
+
+static bool nameIndexUsable(const NameIndex* index, void* candidates,
+        int candidateCount) {
+    return index->complete && candidates != NULL &&
+        index->candidates == candidates &&
+        index->candidateCount == candidateCount;
+}
+
 static bool signalStateNameComparator(void* name, int index, void* states) {
     return !strcmp((const char*)name, ((CanSignalState*)states)[index].name);
 }
 
+/* Private: Compare a name to a state of a signal, for the state name index,
+ * where a slot may refer to a state of another signal - which could be past
+ * the end of this signal's states.
+ */
+static bool indexedSignalStateNameComparator(void* name, int index,
+        void* signal) {
+    return index < ((CanSignal*)signal)->stateCount &&
+        signalStateNameComparator(name, index,
+                (void*)((CanSignal*)signal)->states);
+}
+
 const CanSignalState* openxc::can::lookupSignalState(const char* name,
         const CanSignal* signal) {
-    int index = lookup((void*)name, signalStateNameComparator,
-            (void*)signal->states, signal->stateCount);
+    int index;
+    CanSignal* signals = (CanSignal*) SIGNAL_STATE_NAME_INDEX.candidates;
+    if(SIGNAL_STATE_NAME_INDEX.complete && signals != NULL &&
+            signal >= signals &&
+            signal < signals + SIGNAL_STATE_NAME_INDEX.candidateCount) {
+        index = searchNameIndex(&SIGNAL_STATE_NAME_INDEX,
+                hashName(name, signal - signals), (void*)name,
+                indexedSignalStateNameComparator, (void*)signal);
+    } else {
+        index = lookup((void*)name, signalStateNameComparator,
+                (void*)signal->states, signal->stateCount);
+    }
+
     if(index != -1) {
         return &signal->states[index];
     } else {
@@ -94,6 +394,57 @@ const CanSignalState* openxc::can::lookupSignalState(int value,
     }
 }
 
+bool openxc::can::packSignalValue(const CanSignal* signal,
+        const openxc_DynamicField* value, uint8_t* type, float* packed) {
+    if(!value->has_type) {
+        return false;
+    }
+
+    if(value->type == openxc_DynamicField_Type_NUM &&
+            value->has_numeric_value && !value->has_boolean_value &&
+            !value->has_string_value) {
+        *packed = value->numeric_value;
+        if(*packed != value->numeric_value) {
+            return false;
+        }
+    } else if(value->type == openxc_DynamicField_Type_BOOL &&
+            value->has_boolean_value && !value->has_numeric_value &&
+            !value->has_string_value) {
+        *packed = value->boolean_value ? 1 : 0;
+    } else if(value->type == openxc_DynamicField_Type_STRING &&
+            value->has_string_value && !value->has_numeric_value &&
+            !value->has_boolean_value) {
+        const CanSignalState* state = lookupSignalState(value->string_value,
+                signal);
+        if(state == NULL) {
+            return false;
+        }
+        *packed = state - signal->states;
+    } else {
+        return false;
+    }
+    *type = value->type;
+    return true;
+}
+
+openxc_DynamicField openxc::can::unpackSignalValue(const CanSignal* signal,
+        uint8_t type, float packed) {
+    openxc_DynamicField value = {0};
+    value.has_type = true;
+    value.type = (openxc_DynamicField_Type) type;
+    if(type == openxc_DynamicField_Type_STRING) {
+        value.has_string_value = true;
+        strcpy(value.string_value, signal->states[(int) packed].name);
+    } else if(type == openxc_DynamicField_Type_BOOL) {
+        value.has_boolean_value = true;
+        value.boolean_value = packed != 0;
+    } else {
+        value.has_numeric_value = true;
+        value.numeric_value = packed;
+    }
+    return value;
+}
+
 static bool signalComparator(void* name, int index, void* signals) {
     return !strcmp((const char*)name, ((CanSignal*)signals)[index].genericName);
 }
@@ -106,11 +457,21 @@ static bool writableSignalComparator(void* name, int index, void* signals) {
 CanSignal* openxc::can::lookupSignal(const char* name, CanSignal* signals,
         int signalCount, bool writable) {
     bool (*comparator)(void* key, int index, void* candidates) =
-            signalComparator;
-    if(writable) {
-        comparator = writableSignalComparator;
+            writable ? writableSignalComparator : signalComparator;
+    int index = -1;
+    if(nameIndexUsable(&SIGNAL_NAME_INDEX, signals, signalCount)) {
+        index = searchNameIndex(&SIGNAL_NAME_INDEX, hashName(name, 0),
+                (void*)name, signalComparator, (void*)signals);
+        // Only the first signal with a name is indexed, so if it's not
+        // writable a later one with the same name might be
+        if(index != -1 && !comparator((void*)name, index, (void*)signals)) {
+            index = SIGNAL_NAMES_DUPLICATED ? lookup((void*)name, comparator,
+                    (void*)signals, signalCount) : -1;
+        }
+    } else {
+        index = lookup((void*)name, comparator, (void*)signals, signalCount);
     }
-    int index = lookup((void*)name, comparator, (void*)signals, signalCount);
+
     if(index != -1) {
         return &signals[index];
     } else {
@@ -130,8 +491,15 @@ static bool commandComparator(void* name, int index, void* commands) {
 
 CanCommand* openxc::can::lookupCommand(const char* name, CanCommand* commands,
         int commandCount) {
-    int index = lookup((void*)name, commandComparator, (void*)commands,
-            commandCount);
+    int index;
+    if(nameIndexUsable(&COMMAND_NAME_INDEX, commands, commandCount)) {
+        index = searchNameIndex(&COMMAND_NAME_INDEX, hashName(name, 0),
+                (void*)name, commandComparator, (void*)commands);
+    } else {
+        index = lookup((void*)name, commandComparator, (void*)commands,
+                commandCount);
+    }
+
     if(index != -1) {
         return &commands[index];
     } else {
@@ -139,11 +507,58 @@ CanCommand* openxc::can::lookupCommand(const char* name, CanCommand* commands,
     }
 }
 
+bool openxc::can::buildNameIndex(CanSignal* signals, int signalCount,
+        CanCommand* commands, int commandCount) {
+    resetNameIndex(&SIGNAL_NAME_INDEX, signals, signalCount);
+    resetNameIndex(&SIGNAL_STATE_NAME_INDEX, signals, signalCount);
+    resetNameIndex(&COMMAND_NAME_INDEX, commands, commandCount);
+    SIGNAL_NAMES_DUPLICATED = false;
+
+    for(int i = 0; i < signalCount; i++) {
+        CanSignal* signal = &signals[i];
+        uint32_t hash = hashName(signal->genericName, 0);
+        if(searchNameIndex(&SIGNAL_NAME_INDEX, hash,
+                    (void*)signal->genericName, signalComparator,
+                    signals) != -1) {
+            SIGNAL_NAMES_DUPLICATED = true;
+        }
+        insertNameIndex(&SIGNAL_NAME_INDEX, hash, i,
+                (void*)signal->genericName, signalComparator, signals);
+
+        for(int j = 0; j < signal->stateCount; j++) {
+            if(signal->states[j].name == NULL) {
+                continue;
+            }
+            insertNameIndex(&SIGNAL_STATE_NAME_INDEX,
+                    hashName(signal->states[j].name, i), j,
+                    (void*)signal->states[j].name,
+                    indexedSignalStateNameComparator, (void*)signal);
+        }
+    }
+
+    for(int i = 0; i < commandCount; i++) {
+        insertNameIndex(&COMMAND_NAME_INDEX, hashName(
+                    commands[i].genericName, 0), i,
+                (void*)commands[i].genericName, commandComparator, commands);
+    }
+
+    bool complete = SIGNAL_NAME_INDEX.complete &&
+            COMMAND_NAME_INDEX.complete && SIGNAL_STATE_NAME_INDEX.complete;
+    if(!complete) {
+        debug("Name index full, some lookups will use a linear search");
+    }
+    return complete;
+}
+
 /* Private: Retreive a CanMessage struct from the array given the message's ID
  * and the bus it should occur on.
  *
+ * This is the fallback when the message index for the bus wasn't built from
+ * the same array.
+ *
  * bus - The CanBus to search for the message.
  * id - The ID of the CAN message.
+ * format - The format of the ID of the message.
  * messages - The list of CAN messages to search.
  * messageCount - The length of the messages array.
  *
@@ -152,25 +567,184 @@ CanCommand* openxc::can::lookupCommand(const char* name, CanCommand* commands,
 static CanMessageDefinition* lookupMessage(CanBus* bus, uint32_t id,
         CanMessageFormat format,
         CanMessageDefinition* messages, int messageCount) {
-    CanMessageDefinition* message = NULL;
     for(int i = 0; i < messageCount; i++) {
-        if(messages[i].bus == bus && messages[i].id == id) {
-            message = &messages[i];
+        if(messages[i].bus == bus && messages[i].id == id &&
+                messages[i].format == format) {
+            return &messages[i];
         }
     }
-    return message;
+    return NULL;
+}
+
+/* Private: Binary search a sorted slice of the message index.
+ *
+ * Returns the position of the entry with the given key, or -1 if not found.
+ */
+static int searchMessageIndex(const CanMessageIndexEntry* index, int size,
+        uint32_t key) {
+    int low = 0;
+    int high = size - 1;
+    while(low <= high) {
+        int middle = low + (high - low) / 2;
+        if(index[middle].key < key) {
+            low = middle + 1;
+        } else if(index[middle].key > key) {
+            high = middle - 1;
+        } else {
+            return middle;
+        }
+    }
+    return -1;
+}
+
+/* Private: Build the plan for extracting the signals of each message in the
+ * message index, in the shared SIGNAL_EXTRACTIONS table.
+ */
+static void buildExtractionPlans(CanBus* buses, const int busCount,
+        CanMessageDefinition* messages, CanSignal* signals) {
+    int used = 0;
+    for(int i = 0; i < busCount; i++) {
+        CanBus* bus = &buses[i];
+        for(int j = 0; j < bus->messageIndexSize; j++) {
+            CanMessageIndexEntry* entry = &bus->messageIndex[j];
+            CanMessageDefinition* message = &messages[entry->messageIndex];
+            int count = 0;
+            for(int k = entry->signalStart;
+                    k < entry->signalStart + entry->signalCount; k++) {
+                if(signals[k].message == message) {
+                    ++count;
+                }
+            }
+
+            if(count > 0xff || used + count > MAX_SIGNAL_EXTRACTION_COUNT) {
+                debug("No room to plan extraction of signals in message 0x%x",
+                        message->id);
+                continue;
+            }
+
+            entry->extractions = &SIGNAL_EXTRACTIONS[used];
+            for(int k = entry->signalStart;
+                    k < entry->signalStart + entry->signalCount; k++) {
+                CanSignal* signal = &signals[k];
+                if(signal->message == message) {
+                    SIGNAL_EXTRACTIONS[used++] = {(uint16_t) k,
+                        signal->bitPosition,
+                        // a right shift of 64 or more is undefined, so flag
+                        // signals that don't fit with an out of range shift
+                        (uint8_t) (signal->bitSize > 0 &&
+                            signal->bitPosition + signal->bitSize <=
+                                CAN_MESSAGE_SIZE * 8 ?
+                            64 - signal->bitSize : 0xff)};
+                }
+            }
+            entry->extractionCount = count;
+        }
+    }
+}
+
+bool openxc::can::buildMessageIndex(CanBus* buses, const int busCount,
+        CanMessageDefinition* messages, int messageCount,
+        CanSignal* signals, int signalCount) {
+    bool complete = true;
+    int used = 0;
+    for(int i = 0; i < busCount; i++) {
+        CanBus* bus = &buses[i];
+        bus->messageIndex = &MESSAGE_INDEX[used];
+        bus->messageIndexSize = 0;
+        bus->messageIndexComplete = true;
+        bus->indexedMessages = messages;
+        bus->indexedSignals = signals;
+
+        for(int j = 0; j < messageCount; j++) {
+            if(messages[j].bus != bus) {
+                continue;
+            }
+
+            if(used >= MAX_MESSAGE_INDEX_SIZE) {
+                bus->messageIndexComplete = false;
+                complete = false;
+                break;
+            }
+
+            // Insertion sort - this only runs when the message set is
+            // activated, and the arrays are already mostly sorted by ID.
+            uint32_t key = MESSAGE_INDEX_KEY(messages[j].id,
+                    messages[j].format);
+            int position = bus->messageIndexSize;
+            while(position > 0 && bus->messageIndex[position - 1].key > key) {
+                bus->messageIndex[position] = bus->messageIndex[position - 1];
+                --position;
+            }
+            bus->messageIndex[position] = {key, (uint16_t) j, 0, 0, 0, NULL};
+            ++bus->messageIndexSize;
+            ++used;
+        }
+
+        if(!bus->messageIndexComplete) {
+            debug("Message index full, bus %d will use a linear search",
+                    bus->address);
+        }
+    }
+
+    for(int i = 0; i < signalCount; i++) {
+        CanMessageDefinition* message = signals[i].message;
+        if(message == NULL || message < messages ||
+                message >= messages + messageCount ||
+                message->bus == NULL || message->bus->indexedMessages !=
+                    messages) {
+            continue;
+        }
+
+        int position = searchMessageIndex(message->bus->messageIndex,
+                message->bus->messageIndexSize,
+                MESSAGE_INDEX_KEY(message->id, message->format));
+        if(position == -1) {
+            continue;
+        }
+
+        CanMessageIndexEntry* entry = &message->bus->messageIndex[position];
+        if(entry->signalCount == 0) {
+            entry->signalStart = i;
+        }
+        entry->signalCount = i - entry->signalStart + 1;
+    }
+
+    buildExtractionPlans(buses, busCount, messages, signals);
+    return complete;
+}
+
+const CanMessageIndexEntry* openxc::can::lookupMessageIndexEntry(CanBus* bus,
+        uint32_t id, CanMessageFormat format) {
+    int position = searchMessageIndex(bus->messageIndex,
+            bus->messageIndexSize, MESSAGE_INDEX_KEY(id, format));
+    if(position != -1) {
+        return &bus->messageIndex[position];
+    }
+    return NULL;
 }
 
 CanMessageDefinition* openxc::can::lookupMessageDefinition(CanBus* bus,
         uint32_t id, CanMessageFormat format,
         CanMessageDefinition* predefinedMessages,
         int predefinedMessageCount) {
-    CanMessageDefinition* message = lookupMessage(bus, id, format,
-            predefinedMessages, predefinedMessageCount);
+    CanMessageDefinition* message = NULL;
+    if(predefinedMessages != NULL && bus->messageIndexComplete &&
+            bus->indexedMessages == predefinedMessages) {
+        const CanMessageIndexEntry* entry = lookupMessageIndexEntry(bus, id,
+                format);
+        if(entry != NULL && entry->messageIndex < predefinedMessageCount) {
+            message = &predefinedMessages[entry->messageIndex];
+        }
+    } else {
+        message = lookupMessage(bus, id, format, predefinedMessages,
+                predefinedMessageCount);
+    }
+
     if(message == NULL) {
         CanMessageDefinitionListEntry* entry;
         LIST_FOREACH(entry, &bus->dynamicMessages, entries) {
-            if(entry->definition.id == id) {
+            if(entry->definition.id == id &&
+                    entry->definition.format == format) {
                 message = &entry->definition;
                 break;
             }
@@ -201,6 +775,7 @@ bool openxc::can::registerMessageDefinition(CanBus* bus, uint32_t id,
         LIST_REMOVE(entry, entries);
         entry->definition.bus = bus;
         entry->definition.id = id;
+        entry->definition.format = format;
         entry->definition.frequencyClock = {bus->maxMessageFrequency};
         entry->definition.forceSendChanged = true;
 
@@ -214,7 +789,7 @@ bool openxc::can::unregisterMessageDefinition(CanBus* bus, uint32_t id,
         CanMessageFormat format) {
     CanMessageDefinitionListEntry* entry, *match = NULL;
     LIST_FOREACH(entry, &bus->dynamicMessages, entries) {
-        if(entry->definition.id == id) {
+        if(entry->definition.id == id && entry->definition.format == format) {
             match = entry;
             break;
         }
@@ -285,13 +860,25 @@ void openxc::can::logBusStatistics(CanBus* buses, const int busCount) {
                         QUEUE_LENGTH(CanMessage, &bus->receiveQueue),
                         statistics::exponentialMovingAverage(
                             &bus->receiveQueueStats) /
-                                QUEUE_MAX_LENGTH(CanMessage) * 100);
+                                bus->receiveQueue.maxLength * 100);
                 debug("CAN%d Tx queue length: %d, avg: %f percent",
                         bus->address,
                         QUEUE_LENGTH(CanMessage, &bus->sendQueue),
                         statistics::exponentialMovingAverage(
                             &bus->sendQueueStats) /
-                                QUEUE_MAX_LENGTH(CanMessage) * 100);
+                                bus->sendQueue.maxLength * 100);
+                debug("CAN%d Rx queue high water mark: %d / %d, "
+                        "overflows: %d (last at %lums)", bus->address,
+                        bus->receiveQueue.highWaterMark,
+                        bus->receiveQueue.maxLength,
+                        bus->receiveQueue.overflowCount,
+                        bus->receiveQueue.lastOverflowTime);
+                debug("CAN%d Tx queue high water mark: %d / %d, "
+                        "overflows: %d (last at %lums)", bus->address,
+                        bus->sendQueue.highWaterMark,
+                        bus->sendQueue.maxLength,
+                        bus->sendQueue.overflowCount,
+                        bus->sendQueue.lastOverflowTime);
                 debug("CAN%d msgs Rx: %d (%dKB)",
                         bus->address, bus->receivedMessageStats.total,
                         bus->receivedDataStats.total);
@@ -307,6 +894,37 @@ void openxc::can::logBusStatistics(CanBus* buses, const int busCount) {
                             BUS_STATS_LOG_FREQUENCY_S);
             }
 
+            if(statistics::maximum(&bus->receiveBatchStats) > 0) {
+                debug("CAN%d msgs processed per loop avg: %f, max: %d",
+                        bus->address,
+                        statistics::exponentialMovingAverage(
+                            &bus->receiveBatchStats),
+                        statistics::maximum(&bus->receiveBatchStats));
+                debug("CAN%d processing time per loop avg: %fus, max: %dus "
+                        "(budget %dus)", bus->address,
+                        statistics::exponentialMovingAverage(
+                            &bus->receiveTimeStats),
+                        statistics::maximum(&bus->receiveTimeStats),
+                        config::getConfiguration()->canReceiveBudgetUs);
+            }
+
+            if(bus->receiveLatency.count > 0) {
+                debug("CAN%d Rx queue latency p50: %luus, p99: %luus, "
+                        "max: %luus", bus->address,
+                        statistics::percentile(&bus->receiveLatency, 50),
+                        statistics::percentile(&bus->receiveLatency, 99),
+                        statistics::maximum(&bus->receiveLatency));
+            }
+
+            if(bus->acceptanceFilterRebuilds > 0) {
+                debug("CAN%d AF table rebuilds: %d, avg: %fus, max: %dus",
+                        bus->address, bus->acceptanceFilterRebuilds,
+                        statistics::exponentialMovingAverage(
+                            &bus->acceptanceFilterRebuildTimeStats),
+                        statistics::maximum(
+                            &bus->acceptanceFilterRebuildTimeStats));
+            }
+
             totalMessages += bus->totalMessageStats.total;
             messagesReceived += bus->messagesReceived;
             messagesDropped += bus->messagesDropped;
@@ -336,23 +954,79 @@ void openxc::can::logBusStatistics(CanBus* buses, const int busCount) {
         lastTimeLogged = time::systemTimeMs();
 
         for(int i = 0; i < busCount; i++) {
-            if(QUEUE_LENGTH(CanMessage, &buses[i].receiveQueue) ==
-                    QUEUE_MAX_LENGTH(CanMessage)) {
+            if(QUEUE_FULL(CanMessage, &buses[i].receiveQueue)) {
                 debug("Dropped CAN messages while running stats on bus %d", i);
             }
         }
     }
 }
 
+/* Private: Add an acceptance filter for each run of IDs set in a bitmap of
+ * standard CAN IDs, or just count the runs if bus is NULL.
+ *
+ * ids - A bitmap with a bit set for each standard ID to accept.
+ * maxGap - The largest number of unset IDs allowed inside a run. When this is
+ *      greater than 0, the filters also accept the IDs in those gaps.
+ * bus - The CanBus to add the filters to, or NULL to only count the runs.
+ * buses - An array of all active CanBus instances.
+ * busCount - The length of the buses array.
+ *
+ * Returns the number of runs, or -1 if a filter couldn't be added.
+ */
+static int addStandardFilterRuns(const uint32_t* ids, uint32_t maxGap,
+        CanBus* bus, CanBus* buses, const int busCount) {
+    int runCount = 0;
+    bool inRun = false;
+    uint32_t first = 0;
+    uint32_t last = 0;
+    for(uint32_t id = 0; id <= CAN_STANDARD_ID_COUNT; id++) {
+        bool endOfIds = id == CAN_STANDARD_ID_COUNT;
+        bool present = !endOfIds && (ids[id / 32] & (1UL << (id % 32))) != 0;
+        if(inRun && (endOfIds || (present && id - last - 1 > maxGap))) {
+            ++runCount;
+            inRun = false;
+            if(bus != NULL && !openxc::can::addAcceptanceFilterRange(bus,
+                        first, last, CanMessageFormat::STANDARD, buses,
+                        busCount)) {
+                debug("Couldn't add filter 0x%x - 0x%x to bus %d", first,
+                        last, bus->address);
+                return -1;
+            }
+        }
+
+        if(present) {
+            if(!inRun) {
+                first = id;
+                inRun = true;
+            }
+            last = id;
+        }
+    }
+    return runCount;
+}
+
 bool openxc::can::configureDefaultFilters(CanBus* bus,
         const CanMessageDefinition* messages, const int messageCount,
         CanBus* buses, const int busCount) {
     uint8_t filterCount = 0;
     bool status = true;
+    beginAcceptanceFilterUpdate(bus);
+    // Make sure the table is rebuilt at least once, even with no filters.
+    bus->acceptanceFiltersDirty = true;
     if(messageCount > 0) {
+        // Standard IDs are collected and added as ranges after the others, so
+        // consecutive IDs only use 1 filter slot.
+        uint32_t standardIds[CAN_STANDARD_ID_COUNT / 32] = {0};
         for(int i = 0; i < messageCount; i++) {
             if(messages[i].bus == bus) {
                 ++filterCount;
+                if(messages[i].format == CanMessageFormat::STANDARD &&
+                        messages[i].id < CAN_STANDARD_ID_COUNT) {
+                    standardIds[messages[i].id / 32] |=
+                            1UL << (messages[i].id % 32);
+                    continue;
+                }
+
                 status = status && addAcceptanceFilter(bus, messages[i].id,
                         messages[i].format, buses, busCount);
                 if(!status) {
@@ -363,12 +1037,94 @@ bool openxc::can::configureDefaultFilters(CanBus* bus,
             }
         }
 
+        if(status) {
+            int availableSlots = -RESERVED_ACCEPTANCE_FILTERS;
+            AcceptanceFilterListEntry* entry;
+            LIST_FOREACH(entry, &bus->freeAcceptanceFilters, entries) {
+                ++availableSlots;
+            }
+
+            // If there are too many separate IDs to give each run its own
+            // slot, allow larger and larger gaps inside of a run. The IDs in
+            // the gaps are accepted too, which is still much better than
+            // bypassing the filters altogether.
+            uint32_t maxGap = 0;
+            while(maxGap < CAN_STANDARD_ID_COUNT &&
+                    addStandardFilterRuns(standardIds, maxGap, NULL, buses,
+                        busCount) > availableSlots) {
+                maxGap = maxGap * 2 + 1;
+            }
+
+            if(maxGap > 0) {
+                debug("Not enough AF slots on bus %d - filters will also "
+                        "accept gaps of up to %d IDs", bus->address, maxGap);
+            }
+            status = addStandardFilterRuns(standardIds, maxGap, bus, buses,
+                    busCount) >= 0;
+        }
+
         if(filterCount > 0) {
             debug("Configured %d filters for bus %d", filterCount,
                     bus->address);
         }
     }
-    status &= updateAcceptanceFilterTable(buses, busCount);
+    status &= commitAcceptanceFilterUpdate(bus, buses, busCount);
+    return status;
+}
+
+/* Private: Rebuild the copy of the active acceptance filters used by
+ * shouldAcceptMessage(...) from the bus's filter list.
+ *
+ * shouldAcceptMessage(...) may be called from an ISR while this runs. Each
+ * word of the standard ID bitmap is replaced with a single write, and the
+ * extended ranges are rebuilt in the copy that isn't in use before switching
+ * to it, so the ISR never misses an ID that was already active.
+ */
+static void updateSoftwareFilter(CanBus* bus) {
+    uint32_t bitmap[CAN_STANDARD_ID_COUNT / 32] = {0};
+    uint8_t next = !bus->activeExtendedFilterRanges;
+    AcceptanceFilterRange* ranges = bus->extendedFilterRanges[next];
+    int rangeCount = 0;
+
+    AcceptanceFilterListEntry* entry;
+    LIST_FOREACH(entry, &bus->acceptanceFilters, entries) {
+        if(entry->format == CanMessageFormat::STANDARD) {
+            for(uint32_t id = entry->filter; id <= entry->lastFilter &&
+                    id < CAN_STANDARD_ID_COUNT; id++) {
+                bitmap[id / 32] |= 1UL << (id % 32);
+            }
+        } else if(rangeCount < MAX_ACCEPTANCE_FILTERS) {
+            ranges[rangeCount].first = entry->filter;
+            ranges[rangeCount].last = entry->lastFilter;
+            ++rangeCount;
+        }
+    }
+
+    for(int i = 0; i < CAN_STANDARD_ID_COUNT / 32; i++) {
+        bus->standardFilterBitmap[i] = bitmap[i];
+    }
+
+    bus->extendedFilterRangeCounts[next] =
+            openxc::can::mergeAcceptanceFilterRanges(ranges, rangeCount,
+                    MAX_ACCEPTANCE_FILTERS);
+    bus->activeExtendedFilterRanges = next;
+}
+
+/* Private: Apply the active acceptance filters to the CAN controller after a
+ * change to the given bus, unless a batch of changes is in progress.
+ */
+static bool applyAcceptanceFilters(CanBus* bus, CanBus* buses,
+        const int busCount) {
+    if(bus->acceptanceFilterUpdateDepth > 0) {
+        bus->acceptanceFiltersDirty = true;
+        return true;
+    }
+
+    unsigned long startTime = time::systemTimeUs();
+    bool status = openxc::can::updateAcceptanceFilterTable(buses, busCount);
+    ++bus->acceptanceFilterRebuilds;
+    statistics::update(&bus->acceptanceFilterRebuildTimeStats,
+            time::elapsedUs(startTime));
     return status;
 }
 
@@ -380,14 +1136,156 @@ static AcceptanceFilterListEntry* popListEntry(AcceptanceFilterList* list) {
     return result;
 }
 
+/* Private: Save a copy of a bus's acceptance filters, in list order.
+ */
+static void saveAcceptanceFilters(CanBus* bus) {
+    int count = 0;
+    AcceptanceFilterListEntry* entry;
+    LIST_FOREACH(entry, &bus->acceptanceFilters, entries) {
+        SavedAcceptanceFilter* saved = &bus->savedAcceptanceFilters[count++];
+        saved->filter = entry->filter;
+        saved->lastFilter = entry->lastFilter;
+        saved->activeUserCount = entry->activeUserCount;
+        saved->format = entry->format;
+    }
+    bus->savedAcceptanceFilterCount = count;
+}
+
+/* Private: Replace a bus's acceptance filters with the copy saved by
+ * saveAcceptanceFilters(...).
+ */
+static void restoreAcceptanceFilters(CanBus* bus) {
+    AcceptanceFilterListEntry* entry;
+    while((entry = popListEntry(&bus->acceptanceFilters)) != NULL) {
+        LIST_INSERT_HEAD(&bus->freeAcceptanceFilters, entry, entries);
+    }
+
+    // Inserting at the head, so go backwards to keep the order
+    for(int i = bus->savedAcceptanceFilterCount - 1; i >= 0; i--) {
+        SavedAcceptanceFilter* saved = &bus->savedAcceptanceFilters[i];
+        entry = popListEntry(&bus->freeAcceptanceFilters);
+        entry->filter = saved->filter;
+        entry->lastFilter = saved->lastFilter;
+        entry->activeUserCount = saved->activeUserCount;
+        entry->format = (CanMessageFormat) saved->format;
+        LIST_INSERT_HEAD(&bus->acceptanceFilters, entry, entries);
+    }
+}
+
+void openxc::can::beginAcceptanceFilterUpdate(CanBus* bus) {
+    if(bus->acceptanceFilterUpdateDepth++ == 0) {
+        saveAcceptanceFilters(bus);
+    }
+}
+
+bool openxc::can::commitAcceptanceFilterUpdate(CanBus* bus, CanBus* buses,
+        const int busCount) {
+    if(bus->acceptanceFilterUpdateDepth == 0) {
+        debug("No acceptance filter update in progress on bus %d",
+                bus->address);
+        return false;
+    }
+
+    bool status = true;
+    if(--bus->acceptanceFilterUpdateDepth == 0) {
+        if(bus->acceptanceFiltersDirty) {
+            bus->acceptanceFiltersDirty = false;
+            status = applyAcceptanceFilters(bus, buses, busCount);
+        }
+
+        if(!status) {
+            debug("Restoring the acceptance filters on bus %d from before "
+                    "the update", bus->address);
+            restoreAcceptanceFilters(bus);
+            updateSoftwareFilter(bus);
+            applyAcceptanceFilters(bus, buses, busCount);
+        }
+    }
+    return status;
+}
+
+int openxc::can::mergeAcceptanceFilterRanges(AcceptanceFilterRange* ranges,
+        int rangeCount, int maxRanges) {
+    // There are at most a few dozen ranges, so an insertion sort is fine
+    for(int i = 1; i < rangeCount; i++) {
+        AcceptanceFilterRange range = ranges[i];
+        int j = i;
+        for(; j > 0 && ranges[j - 1].first > range.first; j--) {
+            ranges[j] = ranges[j - 1];
+        }
+        ranges[j] = range;
+    }
+
+    int count = 0;
+    for(int i = 0; i < rangeCount; i++) {
+        if(count > 0 && (ranges[i].first <= ranges[count - 1].last ||
+                    ranges[i].first - ranges[count - 1].last == 1)) {
+            if(ranges[i].last > ranges[count - 1].last) {
+                ranges[count - 1].last = ranges[i].last;
+            }
+        } else {
+            ranges[count++] = ranges[i];
+        }
+    }
+
+    if(maxRanges < 1) {
+        maxRanges = 1;
+    }
+
+    while(count > maxRanges) {
+        int closest = 0;
+        for(int i = 1; i < count - 1; i++) {
+            if(ranges[i + 1].first - ranges[i].last <
+                    ranges[closest + 1].first - ranges[closest].last) {
+                closest = i;
+            }
+        }
+
+        ranges[closest].last = ranges[closest + 1].last;
+        for(int i = closest + 1; i < count - 1; i++) {
+            ranges[i] = ranges[i + 1];
+        }
+        --count;
+    }
+    return count;
+}
+
+int openxc::can::optimizeAcceptanceFilters(CanBus* bus,
+        CanMessageFormat format, AcceptanceFilterRange* ranges,
+        int maxRanges) {
+    int rangeCount = 0;
+    AcceptanceFilterListEntry* entry;
+    LIST_FOREACH(entry, &bus->acceptanceFilters, entries) {
+        if(entry->format == format && rangeCount < MAX_ACCEPTANCE_FILTERS) {
+            ranges[rangeCount].first = entry->filter;
+            ranges[rangeCount].last = entry->lastFilter;
+            ++rangeCount;
+        }
+    }
+    return mergeAcceptanceFilterRanges(ranges, rangeCount, maxRanges);
+}
+
 bool openxc::can::addAcceptanceFilter(CanBus* bus, uint32_t id,
         CanMessageFormat format, CanBus* buses, int busCount) {
+    return addAcceptanceFilterRange(bus, id, id, format, buses, busCount);
+}
+
+bool openxc::can::addAcceptanceFilterRange(CanBus* bus, uint32_t firstId,
+        uint32_t lastId, CanMessageFormat format, CanBus* buses,
+        const int busCount) {
+    if(firstId > lastId) {
+        debug("Invalid acceptance filter range 0x%lx - 0x%lx", firstId,
+                lastId);
+        return false;
+    }
+
     AcceptanceFilterListEntry* entry;
     LIST_FOREACH(entry, &bus->acceptanceFilters, entries) {
-        if(entry->filter == id) {
+        if(entry->filter == firstId && entry->lastFilter == lastId &&
+                entry->format == format) {
             ++entry->activeUserCount;
             debug("Filter for 0x%x already exists -- bumped user count to %d",
-                    id, entry->activeUserCount);
+                    firstId, entry->activeUserCount);
             return true;
         }
     }
@@ -396,31 +1294,46 @@ bool openxc::can::addAcceptanceFilter(CanBus* bus, uint32_t id,
             &bus->freeAcceptanceFilters);
     if(availableFilter == NULL) {
         debug("All acceptance filter slots already taken, can't add 0x%lx",
-                id);
+                firstId);
         return false;
     }
 
-    availableFilter->filter = id;
+    availableFilter->filter = firstId;
+    availableFilter->lastFilter = lastId;
     availableFilter->format = format;
     availableFilter->activeUserCount = 1;
     LIST_INSERT_HEAD(&bus->acceptanceFilters, availableFilter, entries);
-    debug("Added acceptance filter for 0x%x on bus %d", availableFilter->filter,
-            bus->address);
-    bool status = updateAcceptanceFilterTable(buses, busCount);
+    if(firstId == lastId) {
+        debug("Added acceptance filter for 0x%x on bus %d", firstId,
+                bus->address);
+    } else {
+        debug("Added acceptance filter for 0x%x - 0x%x on bus %d", firstId,
+                lastId, bus->address);
+    }
+    updateSoftwareFilter(bus);
+    bool status = applyAcceptanceFilters(bus, buses, busCount);
     if(!status) {
         debug("Unable to update AF table after adding filter for 0x%x on bus %d",
                 availableFilter->filter, bus->address);
         LIST_REMOVE(availableFilter, entries);
         LIST_INSERT_HEAD(&bus->freeAcceptanceFilters, availableFilter, entries);
+        updateSoftwareFilter(bus);
     }
     return status;
 }
 
 void openxc::can::removeAcceptanceFilter(CanBus* bus, uint32_t id,
         CanMessageFormat format, CanBus* buses, const int busCount) {
+    removeAcceptanceFilterRange(bus, id, id, format, buses, busCount);
+}
+
+void openxc::can::removeAcceptanceFilterRange(CanBus* bus, uint32_t firstId,
+        uint32_t lastId, CanMessageFormat format, CanBus* buses,
+        const int busCount) {
     AcceptanceFilterListEntry* entry;
     LIST_FOREACH(entry, &bus->acceptanceFilters, entries) {
-        if(entry->filter == id) {
+        if(entry->filter == firstId && entry->lastFilter == lastId &&
+                entry->format == format) {
             break;
         }
     }
@@ -433,7 +1346,8 @@ void openxc::can::removeAcceptanceFilter(CanBus* bus, uint32_t id,
             debug("No active users - disabling filter");
             LIST_REMOVE(entry, entries);
             LIST_INSERT_HEAD(&bus->freeAcceptanceFilters, entry, entries);
-            updateAcceptanceFilterTable(buses, busCount);
+            updateSoftwareFilter(bus);
+            applyAcceptanceFilters(bus, buses, busCount);
         }
     }
 }
@@ -443,19 +1357,34 @@ bool openxc::can::setAcceptanceFilterStatus(CanBus* bus, bool enabled,
     bus->bypassFilters = !enabled;
     debug("CAN AF for bus %d is now %s", bus->address,
             bus->bypassFilters ? "bypassed" : "enabled");
-    return updateAcceptanceFilterTable(buses, busCount);
+    return applyAcceptanceFilters(bus, buses, busCount);
 }
 
-bool openxc::can::shouldAcceptMessage(CanBus* bus, uint32_t messageId) {
-    bool acceptMessage = bus->bypassFilters;
-    if(!acceptMessage) {
-        AcceptanceFilterListEntry* entry;
-        LIST_FOREACH(entry, &bus->acceptanceFilters, entries) {
-            if(entry->filter == messageId) {
-                acceptMessage = true;
-                break;
-            }
+bool openxc::can::shouldAcceptMessage(CanBus* bus, uint32_t messageId,
+        CanMessageFormat format) {
+    if(bus->bypassFilters) {
+        return true;
+    }
+
+    if(format == CanMessageFormat::STANDARD) {
+        return messageId < CAN_STANDARD_ID_COUNT &&
+            (bus->standardFilterBitmap[messageId / 32] &
+                (1UL << (messageId % 32))) != 0;
+    }
+
+    uint8_t active = bus->activeExtendedFilterRanges;
+    const AcceptanceFilterRange* ranges = bus->extendedFilterRanges[active];
+    int low = 0;
+    int high = bus->extendedFilterRangeCounts[active] - 1;
+    while(low <= high) {
+        int middle = low + (high - low) / 2;
+        if(ranges[middle].last < messageId) {
+            low = middle + 1;
+        } else if(ranges[middle].first > messageId) {
+            high = middle - 1;
+        } else {
+            return true;
         }
     }
-    return acceptMessage;
+    return false;
 }
@@ -13,11 +13,62 @@
 #include "openxc.pb.h"
 
 // TODO actual max is 32 but dropped to 24 for memory considerations
+//
+// On the PIC32 each list entry may need several of the 32 hardware filters,
+// since only an exact mask and an aligned 8 ID block mask are available. This
+// applies to extended IDs too: sparse 29-bit IDs that don't share a block take
+// one hardware filter each, and if the bus needs more than 32 it falls back to
+// bypass and filters in software.
 #define MAX_ACCEPTANCE_FILTERS 24
 // TODO this takes up a ton of memory
 #define MAX_DYNAMIC_MESSAGE_COUNT 12
+// The total number of predefined messages (across all buses) that can be
+// included in the message ID index. Messages beyond this still work, but
+// lookups on a bus with an incomplete index fall back to a linear search.
+#ifndef MAX_MESSAGE_INDEX_SIZE
+#define MAX_MESSAGE_INDEX_SIZE 160
+#endif
+// The total number of signals (across all messages) that can be included in
+// the signal extraction plans built with the message index. Signals in
+// messages beyond this are still translated, one at a time.
+#ifndef MAX_SIGNAL_EXTRACTION_COUNT
+#define MAX_SIGNAL_EXTRACTION_COUNT 256
+#endif
+// The number of slots in each of the hash tables for looking up signals,
+// commands and signal states by name. These must be powers of 2, and each
+// table is only used if it's at most 3/4 full - otherwise lookups fall back to
+// a linear search. The tables are built from the active message set at
+// runtime, so they can't be in flash - each slot takes 2 bytes of RAM.
+#ifndef SIGNAL_NAME_INDEX_SIZE
+#define SIGNAL_NAME_INDEX_SIZE 512
+#endif
+#ifndef COMMAND_NAME_INDEX_SIZE
+#define COMMAND_NAME_INDEX_SIZE 32
+#endif
+#ifndef SIGNAL_STATE_NAME_INDEX_SIZE
+#define SIGNAL_STATE_NAME_INDEX_SIZE 256
+#endif
+
+// The number of messages that fit in the receive and send queues of each CAN
+// bus, by controller address (a bus with any other address has no room in its
+// queues at all). Give a busy, high speed bus a deeper receive queue than a
+// slow one to ride out bursts of messages, e.g. when ECUs wake up.
+#ifndef CAN1_RECEIVE_QUEUE_SIZE
+#define CAN1_RECEIVE_QUEUE_SIZE 32
+#endif
+#ifndef CAN2_RECEIVE_QUEUE_SIZE
+#define CAN2_RECEIVE_QUEUE_SIZE 16
+#endif
+#ifndef CAN1_SEND_QUEUE_SIZE
+#define CAN1_SEND_QUEUE_SIZE 8
+#endif
+#ifndef CAN2_SEND_QUEUE_SIZE
+#define CAN2_SEND_QUEUE_SIZE 8
+#endif
 
 #define CAN_MESSAGE_SIZE 8
+// The number of possible 11-bit standard CAN IDs.
+#define CAN_STANDARD_ID_COUNT 2048
 
 /* Public: The type signature for a CAN signal decoder.
  *
@@ -109,6 +160,23 @@ typedef struct CanSignalState CanSignalState;
  * received    - True if this signal has ever been received.
  * lastValue   - The last received value of the signal. If 'received' is false,
  *      this value is undefined.
+ * hasDecimalPlaces - True if the signal's numeric values are sent in JSON with
+ *      decimalPlaces instead of the configuration's jsonDecimalPlaces.
+ * decimalPlaces - The number of decimal places for values of this signal that
+ *      aren't whole numbers, from 0 to MAX_DECIMAL_PLACES, or
+ *      SHORTEST_DECIMAL_PLACES. Only used if hasDecimalPlaces is true, and
+ *      the configuration's deferSerialization is on (the default) so the
+ *      pipeline knows which signal each value is from.
+ * lastRawValue - The last received value of the signal's bit field, before the
+ *      factor and offset were applied. It's only compared for signals with
+ *      fixedPointExact set, where different raw values can't give the same
+ *      value - others are compared by their decoded value instead. If
+ *      'received' is false, this value is undefined.
+ * fixedPointFactor - The factor as an integer, if fixedPointExact is true.
+ * fixedPointOffset - The offset as an integer, if fixedPointExact is true.
+ * fixedPointExact - True if the signal's value can be calculated exactly with
+ *      32-bit integer math from fixedPointFactor and fixedPointOffset. Set by
+ *      openxc::can::read::initializeFixedPoint(...).
  */
 struct CanSignal {
     struct CanMessageDefinition* message;
@@ -129,6 +197,14 @@ struct CanSignal {
     SignalEncoder encoder;
     bool received;
     float lastValue;
+    bool hasDecimalPlaces;
+    int8_t decimalPlaces;
+
+    // Private
+    uint32_t lastRawValue;
+    int32_t fixedPointFactor;
+    int32_t fixedPointOffset;
+    bool fixedPointExact;
 };
 typedef struct CanSignal CanSignal;
 
@@ -147,6 +223,11 @@ typedef struct CanSignal CanSignal;
  * lastValue - The last received value of the message. Defaults to undefined.
  *      This is required for the forceSendChanged functionality, as the stack
  *      needs to compare an incoming CAN message with the previous frame.
+ * indexedDecode - True if the signals in this message can be translated with
+ *      the extraction plan from the message index when the indexedDecode
+ *      configuration option is enabled. Defaults to false, which leaves the
+ *      message to the generated decodeCanMessage(...). Don't set this for a
+ *      message with a custom message handler, as the handler would be skipped.
  */
 struct CanMessageDefinition {
     struct CanBus* bus;
@@ -155,6 +236,7 @@ struct CanMessageDefinition {
     openxc::util::time::FrequencyClock frequencyClock;
     bool forceSendChanged;
     uint8_t lastValue[CAN_MESSAGE_SIZE];
+    bool indexedDecode;
 };
 typedef struct CanMessageDefinition CanMessageDefinition;
 
@@ -165,33 +247,102 @@ typedef struct CanMessageDefinition CanMessageDefinition;
  * format - the format of the message's ID.
  * data  - The message's data field.
  * length - the length of the data array (max 8).
+ * timestamp - the time (in microseconds, from systemTimeUs()) when the message
+ *      was received by the CAN interrupt handler, or 0 if it's not known (e.g.
+ *      for messages that are being sent).
  */
 struct CanMessage {
     uint32_t id;
     CanMessageFormat format;
     uint8_t data[CAN_MESSAGE_SIZE];
     uint8_t length;
+    unsigned long timestamp;
 };
 typedef struct CanMessage CanMessage;
 
-QUEUE_DECLARE(CanMessage, 8);
+/* Public: A queue of CanMessage structs to send to or received from a CanBus.
+ *
+ * This is declared by hand instead of with QUEUE_DECLARE, which gives every
+ * queue of the same element type the same size. Each of these queues has its
+ * own capacity and storage (assigned by initializeCommon(...)), and also
+ * tracks how close it has come to overflowing. It follows emqueue's naming, so
+ * the usual macros work with it, e.g. QUEUE_PUSH(CanMessage, queue, message).
+ *
+ * elements - Storage for the queue, maxLength + 1 messages long.
+ * maxLength - The maximum number of messages in the queue.
+ * head - The index where the next message will be pushed.
+ * tail - The index of the next message to pop.
+ * highWaterMark - The largest number of messages that have been in the queue
+ *      at once since it was initialized.
+ * overflowCount - The number of messages that were pushed when the queue was
+ *      full, and dropped.
+ * lastOverflowTime - The time (in ms) of the most recent overflow, or 0 if the
+ *      queue has never overflowed.
+ */
+typedef struct queue_CanMessage_s {
+    CanMessage* elements;
+    uint16_t maxLength;
+    volatile uint16_t head;
+    volatile uint16_t tail;
+    uint16_t highWaterMark;
+    unsigned int overflowCount;
+    unsigned long lastOverflowTime;
+} queue_CanMessage;
+
+bool queue_CanMessage_push(queue_CanMessage* queue, CanMessage value);
+CanMessage queue_CanMessage_pop(queue_CanMessage* queue);
+CanMessage queue_CanMessage_peek(queue_CanMessage* queue);
+void queue_CanMessage_init(queue_CanMessage* queue);
+int queue_CanMessage_length(queue_CanMessage* queue);
+int queue_CanMessage_available(queue_CanMessage* queue);
+bool queue_CanMessage_full(queue_CanMessage* queue);
+bool queue_CanMessage_empty(queue_CanMessage* queue);
+void queue_CanMessage_snapshot(queue_CanMessage* queue, CanMessage* snapshot,
+        int max);
+
+/* Public: An inclusive range of CAN message IDs.
+ *
+ * first - the first ID in the range.
+ * last - the last ID in the range. For a single ID, this is equal to first.
+ */
+typedef struct {
+    uint32_t first;
+    uint32_t last;
+} AcceptanceFilterRange;
 
 /* Private: An entry in the list of acceptance filters for each CanBus.
  *
  * This struct is meant to be used with a LIST type from <sys/queue.h>.
  *
- * filter - the value for the CAN acceptance filter.
+ * filter - the value for the CAN acceptance filter, or the first ID if this
+ *      filter is for a range of IDs.
+ * lastFilter - the last ID accepted by the filter. For a filter on a single
+ *      ID, this is equal to filter.
  * activeUserCount - The number of active consumers of this filter's messages.
  *      When 0, this filter can be removed.
  * format - the format of the ID for the filter.
  */
 struct AcceptanceFilterListEntry {
     uint32_t filter;
+    uint32_t lastFilter;
     uint8_t activeUserCount;
     CanMessageFormat format;
     LIST_ENTRY(AcceptanceFilterListEntry) entries;
 };
 
+/* Private: A copy of an acceptance filter's settings, saved when an update of
+ * the filters starts so the filter can be restored if the update fails.
+ *
+ * filter, lastFilter, activeUserCount - See AcceptanceFilterListEntry.
+ * format - The CanMessageFormat of the ID for the filter.
+ */
+typedef struct {
+    uint32_t filter;
+    uint32_t lastFilter;
+    uint8_t activeUserCount;
+    uint8_t format;
+} SavedAcceptanceFilter;
+
 /* Private: A type of list containing CAN acceptance filters.
  */
 LIST_HEAD(AcceptanceFilterList, AcceptanceFilterListEntry);
@@ -202,6 +353,54 @@ struct CanMessageDefinitionListEntry {
 };
 LIST_HEAD(CanMessageDefinitionList, CanMessageDefinitionListEntry);
 
+/* Private: One step of a message's plan for extracting all of its signals
+ * from the message data in a single pass.
+ *
+ * The raw value of the signal is (data << leftShift) >> rightShift, where data
+ * is the message's 8 data bytes loaded as a big-endian 64-bit integer.
+ *
+ * signalIndex - The index of the signal in the signals array the message index
+ *      was built from.
+ * leftShift - The signal's bitPosition, to drop the bits before it.
+ * rightShift - 64 - the signal's bitSize, to drop the bits after it. If this is
+ *      greater than 63, the signal doesn't fit in the message data and must be
+ *      extracted by the slower, general bitfield functions instead.
+ */
+struct SignalExtraction {
+    uint16_t signalIndex;
+    uint8_t leftShift;
+    uint8_t rightShift;
+};
+typedef struct SignalExtraction SignalExtraction;
+
+/* Private: An entry in the sorted message ID index for a CanBus.
+ *
+ * key - The message ID, with the top bit set if it's an EXTENDED format ID.
+ *      Entries for a bus are sorted in ascending order by this key.
+ * messageIndex - The index of the CanMessageDefinition in the predefined
+ *      messages array the index was built from.
+ * signalStart - The index of the first CanSignal for this message in the
+ *      signals array the index was built from.
+ * signalCount - The length of the span of signals starting at signalStart
+ *      that covers every signal for this message. Generated configurations
+ *      keep the signals for a message together, but if they aren't the span
+ *      will include signals from other messages, so check signal->message
+ *      when iterating. If 0, no signals are defined for this message.
+ * extractions - The extraction plan for the signals in this message, in the
+ *      same order as the signals array.
+ * extractionCount - The length of the extractions array. If this is 0 but
+ *      signalCount isn't, there wasn't room for this message's plan.
+ */
+struct CanMessageIndexEntry {
+    uint32_t key;
+    uint16_t messageIndex;
+    uint16_t signalStart;
+    uint16_t signalCount;
+    uint8_t extractionCount;
+    const SignalExtraction* extractions;
+};
+typedef struct CanMessageIndexEntry CanMessageIndexEntry;
+
 /* Public: A container for a CAN module paried with a certain bus.
  *
  * There are three things that control the operating mode of the CAN controller:
@@ -233,12 +432,44 @@ LIST_HEAD(CanMessageDefinitionList, CanMessageDefinitionListEntry);
  * freeAcceptanceFilters - a list of available slots for acceptance filters.
  * acceptanceFilterEntries - static memory allocated for entires in the
  *      acceptanceFilters and freeAcceptanceFilters list.
+ * standardFilterBitmap - a bit for each standard CAN ID, set if there is an
+ *      active acceptance filter for the ID. This mirrors acceptanceFilters so
+ *      shouldAcceptMessage(...) can check an ID in constant time from an ISR.
+ * extendedFilterRanges - two copies of the active acceptance filters for
+ *      extended CAN IDs, merged into non-overlapping ranges and sorted in
+ *      ascending order for a binary search. One copy is rebuilt while the
+ *      other is in use, so an ISR never sees a partially updated list.
+ * extendedFilterRangeCounts - the number of ranges in each copy of
+ *      extendedFilterRanges.
+ * activeExtendedFilterRanges - the index of the copy of extendedFilterRanges
+ *      in use.
+ * acceptanceFilterUpdateDepth - the number of nested, uncommitted
+ *      beginAcceptanceFilterUpdate(...) calls for this bus. While greater than
+ *      0, filter changes are not applied to the CAN controller.
+ * acceptanceFiltersDirty - true if the filters were changed during an update
+ *      and the CAN controller needs to be reconfigured when it's committed.
+ * savedAcceptanceFilters - the bus's filters when the outermost update
+ *      started, in list order. They're restored if the update fails.
+ * savedAcceptanceFilterCount - the number of filters in
+ *      savedAcceptanceFilters.
+ * acceptanceFilterRebuilds - A count of the number of times the CAN
+ *      controller's acceptance filter table was rebuilt because of changes to
+ *      this bus.
+ * acceptanceFilterRebuildTimeStats - The time in microseconds spent on each
+ *      rebuild of the acceptance filter table.
  * dynamicMessages - a list of CAN message IDs ever received on this bus. This
  *      is used for message frequency control and metrics.
  * freeMessageDefinitions - a list of available slots for dynamic message
  *      definitions.
  * definitionEntries - static memory allocated for entires in the
  *      dynamicMessages and freeMessageDefinitions list.
+ * messageIndex - the sorted slice of the shared message ID index for this bus,
+ *      or NULL if no index has been built.
+ * messageIndexSize - the number of entries in the messageIndex slice.
+ * messageIndexComplete - true if every predefined message on this bus made it
+ *      into the index. If false, lookups fall back to a linear search.
+ * indexedMessages - the predefined messages array the index was built from.
+ * indexedSignals - the signals array the index was built from.
  * writeHandler - a function that actually writes out a CanMessage object to the
  *      CAN interface (implementation is platform specific);
  * lastMessageReceived - the time (in ms) when the last CAN message was
@@ -248,8 +479,17 @@ LIST_HEAD(CanMessageDefinitionList, CanMessageDefinitionListEntry);
  * - i.e. we received an interrupt with a new CAN message but the incoming CAN
  *   message queue was full.
  * sendQueue - a queue of CanMessage instances that need to be written to CAN.
+ *      Its size is set by CAN1_SEND_QUEUE_SIZE or CAN2_SEND_QUEUE_SIZE.
  * receiveQueue - a queue of messages received from CAN that have yet to be
- *      translated.
+ *      translated. Its size is set by CAN1_RECEIVE_QUEUE_SIZE or
+ *      CAN2_RECEIVE_QUEUE_SIZE.
+ * receiveBatchStats - The number of messages taken from the receiveQueue on
+ *      each pass through the main loop that found it non-empty.
+ * receiveTimeStats - The time in microseconds spent processing those messages
+ *      on each pass.
+ * receiveLatency - A histogram of the time in microseconds that each received
+ *      message waited in the receiveQueue, from the interrupt handler to the
+ *      main loop.
  */
 struct CanBus {
     unsigned int speed;
@@ -264,13 +504,27 @@ struct CanBus {
     AcceptanceFilterList acceptanceFilters;
     AcceptanceFilterList freeAcceptanceFilters;
     AcceptanceFilterListEntry acceptanceFilterEntries[MAX_ACCEPTANCE_FILTERS];
+    uint32_t standardFilterBitmap[CAN_STANDARD_ID_COUNT / 32];
+    AcceptanceFilterRange extendedFilterRanges[2][MAX_ACCEPTANCE_FILTERS];
+    uint8_t extendedFilterRangeCounts[2];
+    volatile uint8_t activeExtendedFilterRanges;
+    uint8_t acceptanceFilterUpdateDepth;
+    bool acceptanceFiltersDirty;
+    SavedAcceptanceFilter savedAcceptanceFilters[MAX_ACCEPTANCE_FILTERS];
+    uint8_t savedAcceptanceFilterCount;
     CanMessageDefinitionList dynamicMessages;
     CanMessageDefinitionList freeMessageDefinitions;
     CanMessageDefinitionListEntry definitionEntries[MAX_DYNAMIC_MESSAGE_COUNT];
+    CanMessageIndexEntry* messageIndex;
+    uint16_t messageIndexSize;
+    bool messageIndexComplete;
+    CanMessageDefinition* indexedMessages;
+    CanSignal* indexedSignals;
     bool (*writeHandler)(const CanBus*, const CanMessage*);
     unsigned long lastMessageReceived;
     unsigned int messagesReceived;
     unsigned int messagesDropped;
+    unsigned int acceptanceFilterRebuilds;
 
     // TODO These are unnecessary if you aren't calculating metrics, and they do
     // take up a bit of memory.
@@ -280,6 +534,10 @@ struct CanBus {
     openxc::util::statistics::DeltaStatistic receivedDataStats;
     openxc::util::statistics::Statistic sendQueueStats;
     openxc::util::statistics::Statistic receiveQueueStats;
+    openxc::util::statistics::Statistic acceptanceFilterRebuildTimeStats;
+    openxc::util::statistics::Statistic receiveBatchStats;
+    openxc::util::statistics::Statistic receiveTimeStats;
+    openxc::util::statistics::Histogram receiveLatency;
 
     QUEUE_TYPE(CanMessage) sendQueue;
     QUEUE_TYPE(CanMessage) receiveQueue;
@@ -378,8 +636,15 @@ void destroy(CanBus* bus);
 void deinitialize(CanBus* bus);
 
 /* Public: Perform platform-agnostic CAN initialization.
+ *
+ * The bus's send and receive queues get the storage of its controller, so its
+ * address must be 1 or 2, and only one bus can use each controller. A bus with
+ * any other address is logged, and its queues can't hold any messages.
+ *
+ * Returns false if the bus's address is unsupported, in which case the
+ * platform must not initialize the bus's controller.
  */
-void initializeCommon(CanBus* bus);
+bool initializeCommon(CanBus* bus);
 
 /* Public: Check if the device is connected to an active CAN bus, i.e. it's
  * received a message in the recent past.
@@ -389,6 +654,29 @@ void initializeCommon(CanBus* bus);
  */
 bool busActive(CanBus* bus);
 
+/* Public: Build the hash tables used to look up signals, commands and signal
+ * states by name.
+ *
+ * This should be called any time the active message set changes. Afterwards,
+ * lookupSignal(...), lookupCommand(...) and lookupSignalState(const char*, ...)
+ * for the same signals and commands arrays only compare the name to the few
+ * names that share its slots in the table, instead of to every name.
+ * Lookups with any other array still work, with a linear search.
+ *
+ * If a name appears more than once, the first definition in the array is
+ * indexed, to match the linear search.
+ *
+ * signals - The list of all signals.
+ * signalCount - The length of the signals array.
+ * commands - The list of all commands.
+ * commandCount - The length of the commands array.
+ *
+ * Returns true if every name fit in the tables. If false, lookups in the
+ * tables that overflowed will fall back to a linear search.
+ */
+bool buildNameIndex(CanSignal* signals, int signalCount, CanCommand* commands,
+        int commandCount);
+
 /* Public: Look up the CanSignal representation of a signal based on its generic
  * name. The signal may or may not be writable - the first result will be
  * returned.
@@ -449,6 +737,35 @@ const CanSignalState* lookupSignalState(const char* name, const CanSignal* signa
  */
 const CanSignalState* lookupSignalState(int value, const CanSignal* signal);
 
+/* Public: Pack a decoded value of a signal into a type and a float, so it can
+ * be held without the whole openxc_DynamicField. This is the inverse of
+ * unpackSignalValue(...).
+ *
+ * signal - The signal the value is from.
+ * value - The decoded value, as returned by the signal's decoder.
+ * type - Set to the openxc_DynamicField_Type of the value.
+ * packed - Set to the numerical value, 0 or 1 for a boolean, or the index of
+ *      the state in the signal's states for a string.
+ *
+ * Returns true if the value was packed. Only values that unpack to exactly the
+ * same field can be packed, so e.g. strings that aren't one of the signal's
+ * states or numbers that need the precision of a double are not.
+ */
+bool packSignalValue(const CanSignal* signal, const openxc_DynamicField* value,
+        uint8_t* type, float* packed);
+
+/* Public: Rebuild a value of a signal that was packed with
+ * packSignalValue(...).
+ *
+ * signal - The signal the value is from.
+ * type - The openxc_DynamicField_Type of the value.
+ * packed - The packed value.
+ *
+ * Returns the value, exactly as the signal's decoder returned it.
+ */
+openxc_DynamicField unpackSignalValue(const CanSignal* signal, uint8_t type,
+        float packed);
+
 /* Public: Search all predefined and dynamically configured CAN messages for one
  * matching the given ID.
  *
@@ -465,6 +782,46 @@ CanMessageDefinition* lookupMessageDefinition(CanBus* bus, uint32_t id,
         CanMessageDefinition* predefinedMessages,
         int predefinedMessageCount);
 
+/* Public: Build the sorted message ID index for all CAN buses.
+ *
+ * This should be called any time the active message set changes - after the
+ * buses are initialized with initializeCommon(...), which clears any previous
+ * index. Lookups with lookupMessageDefinition(...) for the same predefined
+ * messages array then use a binary search instead of a linear scan, and
+ * lookupMessageIndexEntry(...) returns the span of signals for a message and
+ * the plan for extracting them (see openxc::can::read::translateMessage(...)).
+ *
+ * All buses share a single static table of MAX_MESSAGE_INDEX_SIZE entries, so
+ * they must be indexed together.
+ *
+ * buses - An array of all active CanBus instances.
+ * busCount - The length of the buses array.
+ * messages - The list of predefined CAN messages.
+ * messageCount - The length of the messages array.
+ * signals - The list of all signals.
+ * signalCount - The length of the signals array.
+ *
+ * Returns true if every message was indexed. If false, the index for at least
+ * one bus is incomplete and lookups on that bus will fall back to a linear
+ * search.
+ */
+bool buildMessageIndex(CanBus* buses, const int busCount,
+        CanMessageDefinition* messages, int messageCount,
+        CanSignal* signals, int signalCount);
+
+/* Public: Find the index entry for a predefined CAN message with the given ID.
+ *
+ * bus - The CanBus to search for the message.
+ * id - The ID of the CAN message.
+ * format - The format of the ID of the message.
+ *
+ * Returns a pointer to the index entry if found, otherwise NULL. If the index
+ * for the bus was not built or is incomplete, NULL may be returned for a
+ * message that is predefined.
+ */
+const CanMessageIndexEntry* lookupMessageIndexEntry(CanBus* bus, uint32_t id,
+        CanMessageFormat format);
+
 /* Public: Search all active CAN buses for one using the given controller
  * address.
  *
@@ -516,7 +873,10 @@ bool unregisterMessageDefinition(CanBus* bus, uint32_t id,
  * CAN acceptance filters to receive all messages.
  *
  * This will find messages in the messages array configured on the given bus and
- * add an acceptance filter for the message ID.
+ * add an acceptance filter for the message ID. Consecutive standard IDs share a
+ * single range filter. If there still aren't enough free filter slots, nearby
+ * standard IDs are grouped into ranges that also accept the IDs between them,
+ * leaving a few slots free for filters added later.
  *
  * This function is *not* platform specific - it uses the
  * addAcceptanceFilter(...) function.
@@ -532,6 +892,41 @@ bool unregisterMessageDefinition(CanBus* bus, uint32_t id,
 bool configureDefaultFilters(CanBus* bus, const CanMessageDefinition* messages,
         const int messageCount, CanBus* buses, const int busCount);
 
+/* Public: Start a batch of changes to the acceptance filters for a bus.
+ *
+ * Adding or removing a filter normally rebuilds the CAN controller's entire
+ * acceptance filter table, which is slow and may drop messages while the
+ * controller is reconfigured. Between this call and the matching
+ * commitAcceptanceFilterUpdate(...), changes to the bus's filters are only
+ * made in software, and the table is rebuilt once when the batch is committed.
+ *
+ * Batches may be nested - only the outermost commit rebuilds the table.
+ *
+ * bus - The CanBus whose filters will be changed.
+ */
+void beginAcceptanceFilterUpdate(CanBus* bus);
+
+/* Public: Finish a batch of changes to the acceptance filters for a bus
+ * started with beginAcceptanceFilterUpdate(...), and apply them to the CAN
+ * controller if anything changed.
+ *
+ * During a batch, addAcceptanceFilter(...) can't tell if the hardware
+ * will accept a new filter, so a failure is only reported here. If the batch
+ * fails, every filter is put back the way it was when the batch started -
+ * filters that were added are removed, removed filters come back and user
+ * counts are restored - so the software filters match what the CAN controller
+ * had before.
+ *
+ * bus - The CanBus whose filters were changed.
+ * buses - An array of all active CanBus instances.
+ * busCount - The length of the buses array.
+ *
+ * Returns true if the acceptance filter table was updated successfully, or
+ * didn't need to be.
+ */
+bool commitAcceptanceFilterUpdate(CanBus* bus, CanBus* buses,
+        const int busCount);
+
 /* Public: Configure a new CAN message acceptance filter on the given bus.
  *
  * bus - The CanBus to initialize the filter on.
@@ -562,6 +957,72 @@ bool addAcceptanceFilter(CanBus* bus, uint32_t id, CanMessageFormat format,
 void removeAcceptanceFilter(CanBus* bus, uint32_t id, CanMessageFormat format,
         CanBus* buses, const int busCount);
 
+/* Public: Configure a CAN message acceptance filter for a range of IDs on the
+ * given bus. The range only takes up one of the bus's filter slots.
+ *
+ * bus - The CanBus to initialize the filter on.
+ * firstId - The first ID accepted by the new filter.
+ * lastId - The last ID accepted by the new filter (inclusive).
+ * format - the format of the IDs for the new filter.
+ * buses - An array of all active CanBus instances.
+ * busCount - The length of the buses array.
+ *
+ * Returns true if the filter was added or already existed. Returns false if the
+ * range is invalid, or the filter could not be added because of a CAN
+ * controller error or because all available filter slots are taken.
+ */
+bool addAcceptanceFilterRange(CanBus* bus, uint32_t firstId, uint32_t lastId,
+        CanMessageFormat format, CanBus* buses, const int busCount);
+
+/* Public: Remove a CAN message acceptance filter for a range of IDs, added with
+ * addAcceptanceFilterRange(...), from the given bus.
+ *
+ * bus - The CanBus to remove the filter from.
+ * firstId - The first ID accepted by the filter.
+ * lastId - The last ID accepted by the filter (inclusive).
+ * format - the format of the IDs for the filter.
+ * buses - An array of all active CanBus instances.
+ * busCount - The length of the buses array.
+ */
+void removeAcceptanceFilterRange(CanBus* bus, uint32_t firstId,
+        uint32_t lastId, CanMessageFormat format, CanBus* buses,
+        const int busCount);
+
+/* Public: Sort an array of ID ranges and merge it into the fewest ranges that
+ * accept every ID in the original ranges.
+ *
+ * Overlapping and adjacent ranges are always merged. If there are still more
+ * than maxRanges, the two ranges with the smallest gap between them are
+ * merged until there are few enough - the result then also accepts the IDs in
+ * those gaps, so a widened range must be paired with software filtering (see
+ * shouldAcceptMessage(...)) to drop the extra messages.
+ *
+ * ranges - The ranges to merge, in place.
+ * rangeCount - The length of the ranges array.
+ * maxRanges - The maximum number of ranges to return, at least 1.
+ *
+ * Returns the number of ranges at the start of the array after merging.
+ */
+int mergeAcceptanceFilterRanges(AcceptanceFilterRange* ranges, int rangeCount,
+        int maxRanges);
+
+/* Public: Pack the active acceptance filters of one format on a bus into the
+ * fewest ID ranges, for loading into a CAN controller's hardware filters.
+ *
+ * This is used by each platform's updateAcceptanceFilterTable(...). IDs that
+ * can't be filtered exactly with maxRanges ranges are accepted by the
+ * hardware and left to the software filter.
+ *
+ * bus - The CanBus with the active filters.
+ * format - The format of the filters to pack.
+ * ranges - An output array of at least MAX_ACCEPTANCE_FILTERS ranges.
+ * maxRanges - The maximum number of hardware entries available.
+ *
+ * Returns the number of ranges written, at most maxRanges.
+ */
+int optimizeAcceptanceFilters(CanBus* bus, CanMessageFormat format,
+        AcceptanceFilterRange* ranges, int maxRanges);
+
 /* Private: Apply the CAN acceptance filter configuration from software (on the
  * CanBus struct) to the actual hardware CAN controllers.
  *
@@ -622,12 +1083,21 @@ void logBusStatistics(CanBus* buses, const int busCount);
  * bus has the AF off but we still want to filter on the other, we use this to
  * do software filtering based on the registered CAN messages.
  *
+ * This is safe to call from an ISR - it takes constant time for standard IDs
+ * and a binary search over at most MAX_ACCEPTANCE_FILTERS ranges for extended
+ * IDs, regardless of the number of active filters.
+ *
+ * When the hardware filters can't hold every filter exactly, they are
+ * configured to accept a superset of the IDs, and this drops the rest.
+ *
  * bus - The bus the message was received on.
  * messageId - the ID of the message.
+ * format - the format of the message's ID.
  *
  * Returns true if the message should be accepted.
  */
-bool shouldAcceptMessage(CanBus* bus, uint32_t messageId);
+bool shouldAcceptMessage(CanBus* bus, uint32_t messageId,
+        CanMessageFormat format);
 
 } // can
 } // openxc
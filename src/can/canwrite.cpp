@@ -7,8 +7,6 @@ namespace can = openxc::can;
 
 using openxc::util::log::debug;
 
-QUEUE_DEFINE(CanMessage);
-
 void openxc::can::write::buildMessage(const CanSignal* signal, int value,
         uint8_t data[], size_t length) {
     bitfield_encode_float(value, signal->bitPosition, signal->bitSize,
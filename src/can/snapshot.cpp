@@ -0,0 +1,106 @@
+#include "can/snapshot.h"
+#include "can/canread.h"
+#include "config.h"
+#include "util/timer.h"
+
+namespace time = openxc::util::time;
+
+using openxc::can::snapshot::SignalSnapshot;
+using openxc::config::getConfiguration;
+using openxc::pipeline::Pipeline;
+
+#if MAX_SNAPSHOT_SIGNALS > 0
+static SignalSnapshot SNAPSHOTS[MAX_SNAPSHOT_SIGNALS];
+#endif
+static time::FrequencyClock SNAPSHOT_CLOCK;
+
+/* Private: Return the slot in the snapshot for a signal, or NULL if it doesn't
+ * have one.
+ */
+static SignalSnapshot* slot(const CanSignal* signal,
+        const CanSignal* signals) {
+#if MAX_SNAPSHOT_SIGNALS > 0
+    int index = signal - signals;
+    return index >= 0 && index < MAX_SNAPSHOT_SIGNALS ? &SNAPSHOTS[index] :
+            NULL;
+#else
+    return NULL;
+#endif
+}
+
+void openxc::can::snapshot::initialize() {
+#if MAX_SNAPSHOT_SIGNALS > 0
+    for(int i = 0; i < MAX_SNAPSHOT_SIGNALS; i++) {
+        SNAPSHOTS[i].valid = false;
+        SNAPSHOTS[i].dirty = false;
+    }
+#endif
+    time::initializeClock(&SNAPSHOT_CLOCK);
+}
+
+bool openxc::can::snapshot::enabled() {
+    return MAX_SNAPSHOT_SIGNALS > 0 && getConfiguration()->snapshotMode;
+}
+
+bool openxc::can::snapshot::update(const CanSignal* signal,
+        const CanSignal* signals, const openxc_DynamicField* value,
+        bool dirty) {
+    SignalSnapshot* snapshot = slot(signal, signals);
+    if(snapshot == NULL) {
+        return false;
+    }
+
+    float storedValue;
+    uint8_t type;
+    if(!packSignalValue(signal, value, &type, &storedValue)) {
+        return false;
+    }
+
+    snapshot->value = storedValue;
+    snapshot->type = type;
+    snapshot->timestamp = time::systemTimeMs();
+    snapshot->dirty = snapshot->dirty || dirty || !snapshot->valid;
+    snapshot->valid = true;
+    return true;
+}
+
+const SignalSnapshot* openxc::can::snapshot::lookup(const CanSignal* signal,
+        const CanSignal* signals) {
+    return slot(signal, signals);
+}
+
+int openxc::can::snapshot::publish(const CanSignal* signals, int signalCount,
+        Pipeline* pipeline) {
+    int published = 0;
+    for(int i = 0; i < signalCount && i < MAX_SNAPSHOT_SIGNALS; i++) {
+        SignalSnapshot* snapshot = slot(&signals[i], signals);
+        if(!snapshot->valid || !snapshot->dirty) {
+            continue;
+        }
+
+        snapshot->dirty = false;
+        if(!pipeline::signalSubscribed(pipeline, i)) {
+            continue;
+        }
+
+        openxc_DynamicField value = unpackSignalValue(&signals[i],
+                snapshot->type, snapshot->value);
+        read::publishSignal(&signals[i], signals, &value, pipeline);
+        ++published;
+    }
+    return published;
+}
+
+void openxc::can::snapshot::loop(const CanSignal* signals, int signalCount,
+        Pipeline* pipeline) {
+    if(!enabled()) {
+        return;
+    }
+
+    // A frequency of 0 would tick every time, but it means the snapshot is only
+    // sent when the host asks for it.
+    SNAPSHOT_CLOCK.frequency = getConfiguration()->snapshotFrequency;
+    if(SNAPSHOT_CLOCK.frequency > 0 && time::conditionalTick(&SNAPSHOT_CLOCK)) {
+        publish(signals, signalCount, pipeline);
+    }
+}
@@ -0,0 +1,101 @@
+#ifndef _SNAPSHOT_H_
+#define _SNAPSHOT_H_
+
+#include "can/canutil.h"
+#include "pipeline.h"
+#include "openxc.pb.h"
+
+// The number of signals, from the start of getSignals(), that have a slot in
+// the snapshot. Signals after that are always published right away. If 0, the
+// snapshot isn't built in and snapshot mode can't be enabled.
+#ifndef MAX_SNAPSHOT_SIGNALS
+#define MAX_SNAPSHOT_SIGNALS 0
+#endif
+
+namespace openxc {
+namespace can {
+namespace snapshot {
+
+/* Public: The latest value of a signal, waiting to be published with the next
+ * snapshot.
+ *
+ * value - The numerical value, 0 or 1 for a boolean, or the index of the
+ *      state in the signal's states for a string.
+ * timestamp - The time in milliseconds when the value was last received. The
+ *      simple vehicle message format doesn't have a field for it, so it isn't
+ *      sent with the snapshot - use lookup(...) to tell how stale a held value
+ *      is.
+ * type - The openxc_DynamicField_Type of the value.
+ * valid - True if the signal has a value in the snapshot.
+ * dirty - True if the value should go out with the next snapshot.
+ */
+typedef struct {
+    float value;
+    unsigned long timestamp;
+    uint8_t type;
+    bool valid;
+    bool dirty;
+} SignalSnapshot;
+
+/* Public: Drop every value from the snapshot and restart its clock.
+ */
+void initialize();
+
+/* Public: Check if values should be held in the snapshot, i.e. snapshot mode
+ * is enabled in the configuration and the firmware was built with room for a
+ * snapshot.
+ */
+bool enabled();
+
+/* Public: Store the latest decoded value of a signal in the snapshot, instead
+ * of publishing it.
+ *
+ * signal - The signal the value is from.
+ * signals - An array of all active signals.
+ * value - The value returned by the signal's decoder.
+ * dirty - True if the value should be published with the next snapshot, e.g.
+ *      because it changed. A value that's still waiting stays dirty.
+ *
+ * Returns true if the value was stored. Values that can't be stored, i.e. from
+ * signals after the first MAX_SNAPSHOT_SIGNALS or that can't be packed with
+ * packSignalValue(...), should be published right away instead.
+ */
+bool update(const CanSignal* signal, const CanSignal* signals,
+        const openxc_DynamicField* value, bool dirty);
+
+/* Public: Look up the latest value of a signal in the snapshot.
+ *
+ * Returns the signal's slot in the snapshot, or NULL if it doesn't have one.
+ * Check the slot's valid field before using the value.
+ */
+const SignalSnapshot* lookup(const CanSignal* signal,
+        const CanSignal* signals);
+
+/* Public: Publish every dirty value in the snapshot that an endpoint is
+ * subscribed to, and mark them all as clean.
+ *
+ * signals - An array of all active signals.
+ * signalCount - The length of the signals array.
+ * pipeline - The pipeline to publish the values on.
+ *
+ * Returns the number of values published.
+ */
+int publish(const CanSignal* signals, int signalCount,
+        openxc::pipeline::Pipeline* pipeline);
+
+/* Public: Publish the snapshot if it's enabled and due,
+ * according to the configuration's snapshotFrequency. This is intended to be
+ * called each time through the main loop.
+ *
+ * signals - An array of all active signals.
+ * signalCount - The length of the signals array.
+ * pipeline - The pipeline to publish the values on.
+ */
+void loop(const CanSignal* signals, int signalCount,
+        openxc::pipeline::Pipeline* pipeline);
+
+} // namespace snapshot
+} // namespace can
+} // namespace openxc
+
+#endif // _SNAPSHOT_H_
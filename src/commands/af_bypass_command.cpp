@@ -44,9 +44,20 @@ bool openxc::commands::handleFilterBypassCommand(openxc_ControlCommand* command)
             }
 
             if(bus != NULL) {
+                // Any other filter changes queued up for this bus are applied
+                // in the same rebuild of the filter table
+                bool bypassed = bus->bypassFilters;
+                openxc::can::beginAcceptanceFilterUpdate(bus);
                 openxc::can::setAcceptanceFilterStatus(bus,
                         !bypassCommand->bypass, getCanBuses(), getCanBusCount());
-                status = true;
+                status = openxc::can::commitAcceptanceFilterUpdate(bus,
+                        getCanBuses(), getCanBusCount());
+                if(!status) {
+                    debug("Unable to update AF table, bus %d stays %s",
+                            bus->address, bypassed ? "bypassed" : "filtered");
+                    openxc::can::setAcceptanceFilterStatus(bus, !bypassed,
+                            getCanBuses(), getCanBusCount());
+                }
             }
         }
     }
@@ -0,0 +1,86 @@
+#include "can_receive_command.h"
+
+#include <limits.h>
+
+#include "config.h"
+#include "pipeline.h"
+#include "payload/json.h"
+#include "util/log.h"
+#include "commands/commands.h"
+
+namespace json = openxc::payload::json;
+namespace jsontokenizer = openxc::util::jsontokenizer;
+
+using openxc::util::log::debug;
+using openxc::config::getConfiguration;
+using openxc::payload::json::JsonWriter;
+using openxc::util::jsontokenizer::JsonDocument;
+using openxc::util::jsontokenizer::JsonToken;
+using openxc::commands::parseExtensionCommand;
+using openxc::commands::beginExtensionCommandResponse;
+using openxc::commands::sendExtensionCommandResponse;
+
+/* Private: Read an optional number field from the command.
+ *
+ * value - An output parameter, set to the value of the field if it's a number
+ *      from minimum to maximum. It's left alone if the field is missing.
+ *
+ * Returns false if the field is there, but isn't a number in that range.
+ */
+static bool readLimit(const JsonDocument* document, const char* name,
+        double minimum, double maximum, double* value) {
+    int field = jsontokenizer::findField(document->text, document->tokens,
+            document->tokenCount, 0, name);
+    if(field == NO_JSON_TOKEN) {
+        return true;
+    }
+
+    const JsonToken* token = &document->tokens[field];
+    if(!jsontokenizer::isNumber(document->text, token)) {
+        debug("CAN receive %s must be a number", name);
+        return false;
+    }
+
+    double number = jsontokenizer::toDouble(document->text, token);
+    if(number < minimum || number > maximum) {
+        debug("CAN receive %s must be from %f to %f", name, minimum, maximum);
+        return false;
+    }
+    *value = number;
+    return true;
+}
+
+size_t openxc::commands::handleCanReceiveCommand(uint8_t payload[],
+        size_t length) {
+    size_t bytesRead = 0;
+    JsonDocument document;
+    if(!parseExtensionCommand(payload, length, json::CAN_RECEIVE_COMMAND_NAME,
+                &document, &bytesRead)) {
+        return bytesRead;
+    }
+
+    double batchSize = getConfiguration()->canReceiveBatchSize;
+    double budget = getConfiguration()->canReceiveBudgetUs;
+    bool status = readLimit(&document, json::CAN_RECEIVE_BATCH_SIZE_FIELD_NAME,
+                1, UINT8_MAX, &batchSize) &&
+            readLimit(&document, json::CAN_RECEIVE_BUDGET_FIELD_NAME, 0,
+                UINT_MAX, &budget);
+    if(status) {
+        getConfiguration()->canReceiveBatchSize = (uint8_t) batchSize;
+        getConfiguration()->canReceiveBudgetUs = (unsigned int) budget;
+        debug("Processing up to %d CAN messages in %dus per bus",
+                getConfiguration()->canReceiveBatchSize,
+                getConfiguration()->canReceiveBudgetUs);
+    }
+
+    uint8_t response[MAX_OUTGOING_PAYLOAD_SIZE];
+    JsonWriter writer;
+    beginExtensionCommandResponse(&writer, response, sizeof(response),
+            json::CAN_RECEIVE_COMMAND_NAME, status);
+    json::writeNumberField(&writer, json::CAN_RECEIVE_BATCH_SIZE_FIELD_NAME,
+            getConfiguration()->canReceiveBatchSize);
+    json::writeNumberField(&writer, json::CAN_RECEIVE_BUDGET_FIELD_NAME,
+            getConfiguration()->canReceiveBudgetUs);
+    sendExtensionCommandResponse(&writer);
+    return bytesRead;
+}
@@ -0,0 +1,40 @@
+#ifndef __CAN_RECEIVE_COMMAND_H__
+#define __CAN_RECEIVE_COMMAND_H__
+
+#include <stdint.h>
+#include <stdlib.h>
+
+namespace openxc {
+namespace commands {
+
+/* Public: Handle a can_receive command if it's the next message in the
+ * payload, changing how many received CAN messages are processed from each bus
+ * on each pass through the main loop.
+ *
+ * Like subscriptions, this is a JSON-only extension to the OpenXC message
+ * format:
+ *
+ *      {"command": "can_receive", "batch_size": 16, "budget_us": 1000}
+ *
+ * The batch_size (1 to 255) and budget_us (0 for no limit) set the
+ * configuration's canReceiveBatchSize and canReceiveBudgetUs. Either can be
+ * left out to keep its current value. The response has the limits in effect
+ * after the command, and a status of false if either value was invalid, in
+ * which case neither is changed:
+ *
+ *      {"command_response": "can_receive", "status": true, "batch_size": 16,
+ *          "budget_us": 1000}
+ *
+ * payload - The bytestream payload to parse the command from.
+ * length - The length of the payload.
+ *
+ * Returns the number of bytes read from the payload if it held a complete
+ * can_receive command, otherwise 0 and the payload should be handled like any
+ * other message.
+ */
+size_t handleCanReceiveCommand(uint8_t payload[], size_t length);
+
+} // namespace commands
+} // namespace openxc
+
+#endif // __CAN_RECEIVE_COMMAND_H__
@@ -1,10 +1,14 @@
 #include "commands/commands.h"
 
+#include <strings.h>
+
 #include "config.h"
 #include "util/log.h"
 #include "interface/interface.h"
 #include "config.h"
 #include "pb_decode.h"
+#include "payload/json.h"
+#include "util/strutil.h"
 
 #include "commands/passthrough_command.h"
 #include "commands/diagnostic_request_command.h"
@@ -15,11 +19,26 @@
 #include "commands/af_bypass_command.h"
 #include "commands/payload_format_command.h"
 #include "commands/predefined_obd2_command.h"
+#include "commands/subscription_command.h"
+#include "commands/snapshot_command.h"
+#include "commands/metrics_command.h"
+#include "commands/can_receive_command.h"
+
+// Room for the longest name of a command that isn't in the OpenXC message
+// format, e.g. "subscribe", and the NULL character.
+#define MAX_EXTENSION_COMMAND_NAME_LENGTH 16
 
 using openxc::util::log::debug;
 using openxc::config::getConfiguration;
 using openxc::payload::PayloadFormat;
 using openxc::interface::InterfaceType;
+using openxc::pipeline::MessageClass;
+using openxc::payload::json::JsonWriter;
+using openxc::util::jsontokenizer::JsonDocument;
+using openxc::util::jsontokenizer::JsonToken;
+
+namespace json = openxc::payload::json;
+namespace jsontokenizer = openxc::util::jsontokenizer;
 
 static bool handleComplexCommand(openxc_VehicleMessage* message) {
     bool status = true;
@@ -70,6 +89,18 @@ size_t openxc::commands::handleIncomingMessage(uint8_t payload[], size_t length,
     // Ignore anything less than 2 bytes, we know it's an incomplete payload -
     // wait for more to come in before trying to parse it
     if(length > 2) {
+        // Subscriptions and snapshots aren't in the OpenXC message format
+        // yet, so they're only accepted as JSON and handled before the normal
+        // deserializer. Commands are JSON in the RAW_CAN format, too.
+        if(getConfiguration()->payloadFormat != PayloadFormat::PROTOBUF &&
+                ((bytesRead = handleSubscriptionCommand(payload, length,
+                    sourceInterfaceDescriptor)) > 0 ||
+                (bytesRead = handleSnapshotCommand(payload, length)) > 0 ||
+                (bytesRead = handleMetricsCommand(payload, length)) > 0 ||
+                (bytesRead = handleCanReceiveCommand(payload, length)) > 0)) {
+            return bytesRead;
+        }
+
         if((bytesRead = openxc::payload::deserialize(payload, length,
                 getConfiguration()->payloadFormat, &message)) > 0) {
             if(validate(&message)) {
@@ -181,3 +212,108 @@ void openxc::commands::sendCommandResponse(openxc_ControlCommand_Type commandTyp
         bool status) {
     sendCommandResponse(commandType, status, NULL, 0);
 }
+
+/* Private: Check if the first tokens of a command, which had too many tokens
+ * to tokenize completely, include a "command" field with this name. The
+ * tokens that fit are still in order, and the name is normally the first
+ * field.
+ */
+static bool truncatedCommandIs(const char* json, const JsonToken* tokens,
+        int tokenCount, const char* commandName) {
+    char text[MAX_EXTENSION_COMMAND_NAME_LENGTH];
+    for(int i = 1; i + 1 < tokenCount; i++) {
+        if(jsontokenizer::isString(&tokens[i]) &&
+                jsontokenizer::isString(&tokens[i + 1]) &&
+                jsontokenizer::copyString(json, &tokens[i], text,
+                    sizeof(text)) && !strcasecmp(text, "command") &&
+                jsontokenizer::copyString(json, &tokens[i + 1], text,
+                    sizeof(text)) && !strcmp(text, commandName)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool openxc::commands::parseExtensionCommand(uint8_t payload[],
+        size_t length, const char* commandName, JsonDocument* document,
+        size_t* bytesRead) {
+    if(length < 2) {
+        return false;
+    }
+
+    const char* delimiter = strnchr((const char*)payload, length - 1, '\0');
+    // Most messages aren't this command - check for its name before spending
+    // the time to parse the whole thing.
+    if(delimiter == NULL || strstr((const char*)payload, commandName) == NULL) {
+        return false;
+    }
+
+    const char* jsonStart = strchr((const char*)payload, '{');
+    if(jsonStart == NULL) {
+        return false;
+    }
+
+    document->text = jsonStart;
+    document->tokenCount = jsontokenizer::tokenize(jsonStart,
+            delimiter - jsonStart, document->tokens, MAX_JSON_TOKENS);
+    if(document->tokenCount == JSON_ERROR_TOO_MANY_TOKENS &&
+            truncatedCommandIs(document->text, document->tokens,
+                MAX_JSON_TOKENS, commandName)) {
+        debug("%s command has more than %d JSON tokens", commandName,
+                MAX_JSON_TOKENS);
+        sendExtensionCommandResponse(commandName, false);
+        *bytesRead = (size_t)(delimiter - (const char*)payload) + 1;
+        return false;
+    }
+
+    if(document->tokenCount < 0) {
+        return false;
+    }
+
+    // A name that doesn't fit isn't any of the extension commands
+    char name[MAX_EXTENSION_COMMAND_NAME_LENGTH];
+    int command = jsontokenizer::findField(document->text, document->tokens,
+            document->tokenCount, 0, "command");
+    if(command == NO_JSON_TOKEN || !jsontokenizer::copyString(document->text,
+                &document->tokens[command], name, sizeof(name)) ||
+            strcmp(name, commandName)) {
+        return false;
+    }
+
+    *bytesRead = (size_t)(delimiter - (const char*)payload) + 1;
+    return true;
+}
+
+void openxc::commands::beginExtensionCommandResponse(JsonWriter* writer,
+        uint8_t buffer[], size_t size, const char* commandName, bool status) {
+    json::initializeWriter(writer, buffer, size);
+    json::writeCharacter(writer, '{');
+    json::writeStringField(writer, json::COMMAND_RESPONSE_FIELD_NAME,
+            commandName);
+    json::writeBoolField(writer, json::COMMAND_RESPONSE_STATUS_FIELD_NAME,
+            status);
+}
+
+void openxc::commands::sendExtensionCommandResponse(JsonWriter* writer) {
+    json::writeCharacter(writer, '}');
+    // Include the NULL character as a delimiter, like any other JSON payload
+    json::writeCharacter(writer, '\0');
+    if(writer->length > writer->size) {
+        debug("Command response is %d bytes, only room for %d",
+                writer->length, writer->size);
+        return;
+    }
+
+    pipeline::sendMessage(&getConfiguration()->pipeline,
+            (uint8_t*)writer->buffer, writer->length,
+            MessageClass::COMMAND_RESPONSE);
+}
+
+void openxc::commands::sendExtensionCommandResponse(const char* commandName,
+        bool status) {
+    uint8_t buffer[MAX_OUTGOING_PAYLOAD_SIZE];
+    JsonWriter writer;
+    beginExtensionCommandResponse(&writer, buffer, sizeof(buffer), commandName,
+            status);
+    sendExtensionCommandResponse(&writer);
+}
@@ -6,6 +6,8 @@
 
 #include "openxc.pb.h"
 #include "interface/interface.h"
+#include "payload/json.h"
+#include "util/jsontokenizer.h"
 
 namespace openxc {
 namespace commands {
@@ -53,6 +55,59 @@ void sendCommandResponse(openxc_ControlCommand_Type commandType,
  */
 void sendCommandResponse(openxc_ControlCommand_Type commandType, bool status);
 
+/* Public: Parse a JSON command that isn't in the OpenXC message format yet
+ * (e.g. "subscribe"), if it's the next message in the payload.
+ *
+ * The command is tokenized in place without any heap allocations, so a
+ * command can't have more than MAX_JSON_TOKENS tokens. A longer command with
+ * this name is answered here with a failed response, and bytesRead is set so
+ * the caller can skip it, but this still returns false.
+ *
+ * payload - The bytestream payload to parse the command from.
+ * length - The length of the payload.
+ * commandName - The name of the command to look for in the "command" field.
+ * document - An output parameter, set to the tokens of the command if it was
+ *      found. They point into the payload.
+ * bytesRead - An output parameter, set to the number of bytes in the payload
+ *      for the command if it was found.
+ *
+ * Returns true if the payload starts with a complete command with that name.
+ */
+bool parseExtensionCommand(uint8_t payload[], size_t length,
+        const char* commandName,
+        openxc::util::jsontokenizer::JsonDocument* document,
+        size_t* bytesRead);
+
+/* Public: Send a JSON command response ACK for a command that isn't in the
+ * OpenXC message format, and so doesn't have an openxc_ControlCommand_Type to
+ * use with sendCommandResponse(...).
+ *
+ * commandName - The name of the command to ACK, sent as the command_response.
+ * status - the status of the command, true if it was successful.
+ */
+void sendExtensionCommandResponse(const char* commandName, bool status);
+
+/* Public: Start a JSON command response for a command that isn't in the
+ * OpenXC message format, for when it needs more fields than the status. Add
+ * the fields with the writer and send it with
+ * sendExtensionCommandResponse(JsonWriter*).
+ *
+ * writer - The writer to write the response with.
+ * buffer - The buffer to write the response to, e.g. one of
+ *      MAX_OUTGOING_PAYLOAD_SIZE bytes on the stack.
+ * size - The size of the buffer.
+ * commandName - The name of the command, sent as the command_response.
+ * status - the status of the command, true if it was successful.
+ */
+void beginExtensionCommandResponse(openxc::payload::json::JsonWriter* writer,
+        uint8_t buffer[], size_t size, const char* commandName, bool status);
+
+/* Public: Finish a JSON command response started with
+ * beginExtensionCommandResponse(...) and send it. Nothing is sent if the
+ * response didn't fit in its buffer.
+ */
+void sendExtensionCommandResponse(openxc::payload::json::JsonWriter* writer);
+
 } // namespace commands
 } // namespace openxc
 
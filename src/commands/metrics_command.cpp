@@ -0,0 +1,127 @@
+#include "metrics_command.h"
+
+#include "pipeline.h"
+#include "payload/json.h"
+#include "util/log.h"
+#include "util/metrics.h"
+#include "commands/commands.h"
+
+// Room for the next offset field, which is only added once the response is
+// otherwise complete
+#define NEXT_FIELD_RESERVE sizeof(",\"next\":65535")
+
+namespace json = openxc::payload::json;
+namespace metrics = openxc::util::metrics;
+namespace statistics = openxc::util::statistics;
+namespace jsontokenizer = openxc::util::jsontokenizer;
+
+using openxc::util::log::debug;
+using openxc::util::metrics::Metric;
+using openxc::util::metrics::MetricType;
+using openxc::payload::json::JsonWriter;
+using openxc::util::jsontokenizer::JsonDocument;
+using openxc::commands::parseExtensionCommand;
+using openxc::commands::beginExtensionCommandResponse;
+using openxc::commands::sendExtensionCommandResponse;
+
+/* Private: Write the JSON value of a metric - a number, or an array for a
+ * histogram.
+ */
+static void writeMetricValue(JsonWriter* writer, const Metric* metric) {
+    if(metric->type == MetricType::HISTOGRAM) {
+        json::writeCharacter(writer, '[');
+        json::writeNumber(writer, metric->histogram->count);
+        json::writeCharacter(writer, ',');
+        json::writeNumber(writer,
+                statistics::percentile(metric->histogram, 50));
+        json::writeCharacter(writer, ',');
+        json::writeNumber(writer,
+                statistics::percentile(metric->histogram, 99));
+        json::writeCharacter(writer, ',');
+        json::writeNumber(writer, statistics::maximum(metric->histogram));
+        json::writeCharacter(writer, ']');
+    } else {
+        json::writeNumber(writer, metrics::read(metric));
+    }
+}
+
+/* Private: Add as many metrics as fit in one payload to the response, starting
+ * from offset.
+ *
+ * Each metric is written once, and dropped again if the response no longer
+ * fits, so the cost is linear in the number of metrics.
+ *
+ * Returns the index of the first metric that didn't fit, or the metric count
+ * if they all did.
+ */
+static int addMetrics(JsonWriter* writer, int offset) {
+    json::writeFieldName(writer, json::METRICS_FIELD_NAME);
+    json::writeCharacter(writer, '{');
+    int responseFieldCount = writer->fieldCount;
+    writer->fieldCount = 0;
+
+    int index = offset;
+    for(; index < metrics::getMetricCount(); index++) {
+        const Metric* metric = metrics::getMetric(index);
+        char name[48];
+        if(metrics::formatName(metric, name, sizeof(name)) < 0) {
+            debug("Metric name %s.%s is too long", metric->group,
+                    metric->name);
+            continue;
+        }
+
+        size_t length = writer->length;
+        int fieldCount = writer->fieldCount;
+        json::writeFieldName(writer, name);
+        writeMetricValue(writer, metric);
+        // Leave room to close both objects and for the NULL delimiter
+        if(writer->length + 3 + NEXT_FIELD_RESERVE > writer->size) {
+            writer->length = length;
+            writer->fieldCount = fieldCount;
+            break;
+        }
+    }
+
+    json::writeCharacter(writer, '}');
+    writer->fieldCount = responseFieldCount;
+    return index;
+}
+
+size_t openxc::commands::handleMetricsCommand(uint8_t payload[],
+        size_t length) {
+    size_t bytesRead = 0;
+    JsonDocument document;
+    if(!parseExtensionCommand(payload, length, json::METRICS_COMMAND_NAME,
+                &document, &bytesRead)) {
+        return bytesRead;
+    }
+
+    int offset = 0;
+    int offsetField = jsontokenizer::findField(document.text, document.tokens,
+            document.tokenCount, 0, json::METRICS_OFFSET_FIELD_NAME);
+    if(offsetField != NO_JSON_TOKEN && jsontokenizer::isNumber(document.text,
+                &document.tokens[offsetField])) {
+        offset = jsontokenizer::toInt(document.text,
+                &document.tokens[offsetField]);
+    }
+
+    bool status = offset >= 0 && offset <= metrics::getMetricCount();
+    uint8_t response[MAX_OUTGOING_PAYLOAD_SIZE];
+    JsonWriter writer;
+    beginExtensionCommandResponse(&writer, response, sizeof(response),
+            json::METRICS_COMMAND_NAME, status);
+    if(status) {
+        json::writeNumberField(&writer, json::METRICS_TOTAL_FIELD_NAME,
+                metrics::getMetricCount());
+        int next = addMetrics(&writer, offset);
+        if(next < metrics::getMetricCount()) {
+            json::writeNumberField(&writer, json::METRICS_NEXT_FIELD_NAME,
+                    next);
+        }
+    } else {
+        debug("No metrics from offset %d, there are only %d", offset,
+                metrics::getMetricCount());
+    }
+    sendExtensionCommandResponse(&writer);
+    return bytesRead;
+}
@@ -0,0 +1,42 @@
+#ifndef __METRICS_COMMAND_H__
+#define __METRICS_COMMAND_H__
+
+#include <stdint.h>
+#include <stdlib.h>
+
+namespace openxc {
+namespace commands {
+
+/* Public: Handle a metrics command if it's the next message in the payload,
+ * responding with the current values of the metrics in the registry.
+ *
+ * Like subscriptions, this is a JSON-only extension to the OpenXC message
+ * format:
+ *
+ *      {"command": "metrics", "offset": 0}
+ *
+ * Every metric doesn't fit in one response, so the response has as many as
+ * fit starting from the optional offset, the total number of metrics, and the
+ * offset to ask for next if there are more:
+ *
+ *      {"command_response": "metrics", "status": true, "total": 40,
+ *          "metrics": {"can1.messages_received": 1234,
+ *              "USB.flush_latency_us": [100, 63, 255, 300]}, "next": 8}
+ *
+ * Counters and gauges are a number, and histograms are an array of the number
+ * of values observed, the estimated p50 and p99 and the maximum. The status is
+ * false if the offset is past the end of the metrics.
+ *
+ * payload - The bytestream payload to parse the command from.
+ * length - The length of the payload.
+ *
+ * Returns the number of bytes read from the payload if it held a complete
+ * metrics command, otherwise 0 and the payload should be handled like any
+ * other message.
+ */
+size_t handleMetricsCommand(uint8_t payload[], size_t length);
+
+} // namespace commands
+} // namespace openxc
+
+#endif // __METRICS_COMMAND_H__
@@ -29,21 +29,28 @@ bool openxc::commands::validatePayloadFormatCommand(openxc_VehicleMessage* messa
 
 bool openxc::commands::handlePayloadFormatCommand(openxc_ControlCommand* command) {
     bool status = false;
-    PayloadFormat format;
+    PayloadFormat format = PayloadFormat::JSON;
     if(command->has_payload_format_command) {
         openxc_PayloadFormatCommand* messageFormatCommand =
                 &command->payload_format_command;
         if(messageFormatCommand->has_format) {
-            switch(messageFormatCommand->format) {
-                case openxc_PayloadFormatCommand_PayloadFormat_JSON:
-                    format = PayloadFormat::JSON;
-                    break;
-                case openxc_PayloadFormatCommand_PayloadFormat_PROTOBUF:
-                    format = PayloadFormat::PROTOBUF;
-                    break;
-            }
-
             status = true;
+            // RAW_CAN isn't in the message format's enum yet, so this can't
+            // be a switch
+            if(messageFormatCommand->format ==
+                    openxc_PayloadFormatCommand_PayloadFormat_JSON) {
+                format = PayloadFormat::JSON;
+            } else if(messageFormatCommand->format ==
+                    openxc_PayloadFormatCommand_PayloadFormat_PROTOBUF) {
+                format = PayloadFormat::PROTOBUF;
+            } else if(messageFormatCommand->format ==
+                    PAYLOAD_FORMAT_COMMAND_RAW_CAN) {
+                format = PayloadFormat::RAW_CAN;
+            } else {
+                debug("Unrecognized payload format: %d",
+                        messageFormatCommand->format);
+                status = false;
+            }
         }
     }
 
@@ -53,7 +60,8 @@ bool openxc::commands::handlePayloadFormatCommand(openxc_ControlCommand* command
         // Don't change format until we've sent the response
         getConfiguration()->payloadFormat = format;
         debug("Set message format to %s",
-                format == PayloadFormat::JSON ? "JSON" : "binary" );
+                format == PayloadFormat::JSON ? "JSON" :
+                    format == PayloadFormat::PROTOBUF ? "protobuf" : "raw CAN");
     }
 
     return status;
@@ -0,0 +1,42 @@
+#include "snapshot_command.h"
+
+#include "config.h"
+#include "signals.h"
+#include "payload/json.h"
+#include "util/log.h"
+#include "can/snapshot.h"
+#include "commands/commands.h"
+
+namespace json = openxc::payload::json;
+namespace snapshot = openxc::can::snapshot;
+
+using openxc::util::log::debug;
+using openxc::config::getConfiguration;
+using openxc::signals::getSignals;
+using openxc::signals::getSignalCount;
+using openxc::util::jsontokenizer::JsonDocument;
+using openxc::commands::parseExtensionCommand;
+using openxc::commands::sendExtensionCommandResponse;
+
+size_t openxc::commands::handleSnapshotCommand(uint8_t payload[],
+        size_t length) {
+    size_t bytesRead = 0;
+    JsonDocument document;
+    if(!parseExtensionCommand(payload, length, json::SNAPSHOT_COMMAND_NAME,
+                &document, &bytesRead)) {
+        return bytesRead;
+    }
+
+    bool status = snapshot::enabled();
+    // Respond first, so the host knows the values that follow are the
+    // snapshot it asked for
+    sendExtensionCommandResponse(json::SNAPSHOT_COMMAND_NAME, status);
+    if(status) {
+        int published = snapshot::publish(getSignals(), getSignalCount(),
+                &getConfiguration()->pipeline);
+        debug("Published %d signals in a snapshot on request", published);
+    } else {
+        debug("Snapshot requested, but snapshot mode isn't enabled");
+    }
+    return bytesRead;
+}
@@ -0,0 +1,33 @@
+#ifndef __SNAPSHOT_COMMAND_H__
+#define __SNAPSHOT_COMMAND_H__
+
+#include <stdint.h>
+#include <stdlib.h>
+
+namespace openxc {
+namespace commands {
+
+/* Public: Handle a snapshot command if it's the next message in the payload,
+ * publishing the signals that changed since the last snapshot right away.
+ *
+ * Like subscriptions, this is a JSON-only extension to the OpenXC message
+ * format:
+ *
+ *      {"command": "snapshot"}
+ *
+ * The response has "snapshot" as its command_response, and a status of false
+ * if snapshot mode isn't enabled.
+ *
+ * payload - The bytestream payload to parse the command from.
+ * length - The length of the payload.
+ *
+ * Returns the number of bytes read from the payload if it held a complete
+ * snapshot command, otherwise 0 and the payload should be handled like any
+ * other message.
+ */
+size_t handleSnapshotCommand(uint8_t payload[], size_t length);
+
+} // namespace commands
+} // namespace openxc
+
+#endif // __SNAPSHOT_COMMAND_H__
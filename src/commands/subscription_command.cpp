@@ -0,0 +1,198 @@
+#include "subscription_command.h"
+
+#include <string.h>
+
+#include "config.h"
+#include "signals.h"
+#include "pipeline.h"
+#include "payload/json.h"
+#include "util/log.h"
+#include "can/canutil.h"
+#include "commands/commands.h"
+
+// Room for the longest name of a message class or subscription mode.
+#define MAX_MESSAGE_CLASS_NAME_LENGTH 16
+#define MAX_MODE_NAME_LENGTH 16
+
+// Room for the name of a signal, the same as in a simple message.
+#define MAX_SIGNAL_NAME_LENGTH sizeof(((openxc_SimpleMessage*)0)->name)
+
+namespace pipeline = openxc::pipeline;
+namespace json = openxc::payload::json;
+namespace jsontokenizer = openxc::util::jsontokenizer;
+
+using openxc::util::log::debug;
+using openxc::config::getConfiguration;
+using openxc::signals::getSignals;
+using openxc::signals::getSignalCount;
+using openxc::can::lookupSignal;
+using openxc::commands::parseExtensionCommand;
+using openxc::commands::sendExtensionCommandResponse;
+using openxc::pipeline::MessageClass;
+using openxc::pipeline::SubscriptionMode;
+using openxc::interface::InterfaceDescriptor;
+using openxc::util::jsontokenizer::JsonDocument;
+using openxc::util::jsontokenizer::JsonTokenType;
+
+// Only the classes a host can ask for - command responses are always sent.
+static const struct {
+    const char* name;
+    MessageClass messageClass;
+} MESSAGE_CLASS_NAMES[] = {
+    {"simple", MessageClass::SIMPLE},
+    {"can", MessageClass::CAN},
+    {"diagnostic", MessageClass::DIAGNOSTIC},
+    {"log", MessageClass::LOG},
+};
+
+/* Private: Copy a string token to a buffer, like jsontokenizer::copyString.
+ */
+static bool copyString(const JsonDocument* document, int token, char* buffer,
+        size_t bufferSize) {
+    return jsontokenizer::copyString(document->text,
+            &document->tokens[token], buffer, bufferSize);
+}
+
+/* Private: Build a bitmask of the message classes named in a JSON array.
+ *
+ * Returns false if any of the names isn't a class.
+ */
+static bool parseMessageClasses(const JsonDocument* document, int classes,
+        unsigned int* messageClasses) {
+    *messageClasses = 0;
+    for(int element = classes + 1; element < document->tokenCount &&
+                document->tokens[element].start < document->tokens[classes].end;
+            element = jsontokenizer::nextSibling(document->tokens,
+                document->tokenCount, element)) {
+        char name[MAX_MESSAGE_CLASS_NAME_LENGTH];
+        bool found = false;
+        bool valid = copyString(document, element, name, sizeof(name));
+        for(size_t j = 0; valid && j <
+                sizeof(MESSAGE_CLASS_NAMES) / sizeof(MESSAGE_CLASS_NAMES[0]);
+                j++) {
+            if(!strcmp(name, MESSAGE_CLASS_NAMES[j].name)) {
+                *messageClasses |= MESSAGE_CLASS_MASK(
+                        MESSAGE_CLASS_NAMES[j].messageClass);
+                found = true;
+            }
+        }
+
+        if(!found) {
+            debug("Can't subscribe to unrecognized message class");
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Private: Look up the position in getSignals() of each of the signals named
+ * in a JSON array.
+ *
+ * Returns the number of signals stored in signalIndexes, or -1 if any of the
+ * names isn't a signal or there are too many.
+ */
+static int parseSignals(const JsonDocument* document, int signalNames,
+        int signalIndexes[], int maxSignals) {
+    int count = 0;
+    for(int element = signalNames + 1; element < document->tokenCount &&
+                document->tokens[element].start <
+                    document->tokens[signalNames].end;
+            element = jsontokenizer::nextSibling(document->tokens,
+                document->tokenCount, element)) {
+        char name[MAX_SIGNAL_NAME_LENGTH];
+        if(!jsontokenizer::isString(&document->tokens[element])) {
+            debug("Signal names in a subscription must be strings");
+            return -1;
+        }
+
+        const CanSignal* signal = NULL;
+        if(copyString(document, element, name, sizeof(name))) {
+            signal = lookupSignal(name, getSignals(), getSignalCount());
+        }
+        if(signal == NULL) {
+            debug("Can't subscribe to unrecognized signal %s", name);
+            return -1;
+        }
+
+        if(count >= maxSignals) {
+            debug("Too many signals in subscription, max is %d", maxSignals);
+            return -1;
+        }
+        signalIndexes[count++] = signal - getSignals();
+    }
+    return count;
+}
+
+/* Private: Apply the subscription in a parsed command to an endpoint.
+ *
+ * Returns true if the subscription was valid and changed.
+ */
+static bool applySubscription(const JsonDocument* document,
+        int endpointIndex) {
+    SubscriptionMode mode = SubscriptionMode::INCLUDE_SIGNALS;
+    int element = jsontokenizer::findField(document->text, document->tokens,
+            document->tokenCount, 0, json::SUBSCRIPTION_MODE_FIELD_NAME);
+    if(element != NO_JSON_TOKEN) {
+        char name[MAX_MODE_NAME_LENGTH];
+        if(!copyString(document, element, name, sizeof(name))) {
+            debug("Unrecognized subscription mode");
+            return false;
+        } else if(!strcmp(name, json::SUBSCRIPTION_MODE_ALL_NAME)) {
+            pipeline::unsubscribe(&getConfiguration()->pipeline,
+                    endpointIndex);
+            return true;
+        } else if(!strcmp(name, json::SUBSCRIPTION_MODE_EXCLUDE_NAME)) {
+            mode = SubscriptionMode::EXCLUDE_SIGNALS;
+        } else if(strcmp(name, json::SUBSCRIPTION_MODE_INCLUDE_NAME)) {
+            debug("Unrecognized subscription mode: %s", name);
+            return false;
+        }
+    }
+
+    unsigned int messageClasses = ALL_MESSAGE_CLASSES;
+    element = jsontokenizer::findField(document->text, document->tokens,
+            document->tokenCount, 0, json::SUBSCRIPTION_CLASSES_FIELD_NAME);
+    if(element != NO_JSON_TOKEN) {
+        unsigned int listedClasses;
+        if(document->tokens[element].type != JsonTokenType::ARRAY ||
+                !parseMessageClasses(document, element, &listedClasses)) {
+            return false;
+        }
+        messageClasses = mode == SubscriptionMode::INCLUDE_SIGNALS ?
+                listedClasses : ALL_MESSAGE_CLASSES & ~listedClasses;
+    }
+
+    static int signalIndexes[MAX_SUBSCRIBED_SIGNALS];
+    int signalCount = 0;
+    element = jsontokenizer::findField(document->text, document->tokens,
+            document->tokenCount, 0, json::SUBSCRIPTION_SIGNALS_FIELD_NAME);
+    if(element == NO_JSON_TOKEN) {
+        mode = SubscriptionMode::ALL_SIGNALS;
+    } else if(document->tokens[element].type != JsonTokenType::ARRAY ||
+            (signalCount = parseSignals(document, element, signalIndexes,
+                    MAX_SUBSCRIBED_SIGNALS)) < 0) {
+        return false;
+    }
+
+    return pipeline::subscribe(&getConfiguration()->pipeline, endpointIndex,
+            mode, signalIndexes, signalCount, messageClasses);
+}
+
+size_t openxc::commands::handleSubscriptionCommand(uint8_t payload[],
+        size_t length, InterfaceDescriptor* sourceInterfaceDescriptor) {
+    size_t bytesRead = 0;
+    JsonDocument document;
+    if(!parseExtensionCommand(payload, length,
+                json::SUBSCRIPTION_COMMAND_NAME, &document, &bytesRead)) {
+        return bytesRead;
+    }
+
+    // The built-in endpoints are registered in InterfaceType order
+    bool status = applySubscription(&document,
+            sourceInterfaceDescriptor->type);
+    debug("%s subscription from %s",
+            status ? "Updated" : "Rejected invalid",
+            openxc::interface::descriptorToString(sourceInterfaceDescriptor));
+    sendExtensionCommandResponse(json::SUBSCRIPTION_COMMAND_NAME, status);
+    return bytesRead;
+}
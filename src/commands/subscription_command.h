@@ -0,0 +1,41 @@
+#ifndef __SUBSCRIPTION_COMMAND_H__
+#define __SUBSCRIPTION_COMMAND_H__
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "interface/interface.h"
+
+namespace openxc {
+namespace commands {
+
+/* Public: Handle a subscription command if it's the next message in the
+ * payload.
+ *
+ * The OpenXC message format doesn't have a subscription command yet, so this
+ * is a JSON-only extension, e.g.:
+ *
+ *      {"command": "subscribe", "mode": "include",
+ *          "signals": ["vehicle_speed"], "classes": ["simple", "can"]}
+ *
+ * The mode is "include" (the default) to only send the listed signals and
+ * message classes to the interface the command came from, "exclude" to send
+ * everything but them, or "all" to go back to sending everything. Either list
+ * may be left out. Command responses are always sent, and the response to this
+ * command has "subscribe" as its command_response.
+ *
+ * payload - The bytestream payload to parse the command from.
+ * length - The length of the payload.
+ * sourceInterfaceDescriptor - The interface the payload was received on.
+ *
+ * Returns the number of bytes read from the payload if it held a complete
+ * subscription command, otherwise 0 and the payload should be handled like any
+ * other message.
+ */
+size_t handleSubscriptionCommand(uint8_t payload[], size_t length,
+        openxc::interface::InterfaceDescriptor* sourceInterfaceDescriptor);
+
+} // namespace commands
+} // namespace openxc
+
+#endif // __SUBSCRIPTION_COMMAND_H__
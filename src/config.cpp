@@ -17,6 +17,7 @@ static void initialize(openxc::config::Configuration* config) {
         &config->network,
 #endif // __USE_NETWORK__
     };
+    openxc::pipeline::initialize(&config->pipeline);
     config->initialized = true;
 }
 
@@ -33,6 +34,19 @@ openxc::config::Configuration* openxc::config::getConfiguration() {
         loggingOutput: DEFAULT_LOGGING_OUTPUT,
         calculateMetrics: DEFAULT_METRICS_STATUS,
         desiredRunLevel: RunLevel::CAN_ONLY,
+        canReceiveBatchSize: DEFAULT_CAN_RECEIVE_BATCH_SIZE,
+        canReceiveBudgetUs: DEFAULT_CAN_RECEIVE_BUDGET_US,
+        fixedPointDecode: DEFAULT_FIXED_POINT_DECODE_STATUS,
+        indexedDecode: DEFAULT_INDEXED_DECODE_STATUS,
+        dropPolicy: openxc::pipeline::DropPolicy::DEFAULT_DROP_POLICY,
+        pipelineFlushBudgetUs: DEFAULT_PIPELINE_FLUSH_BUDGET_US,
+        batchSize: DEFAULT_BATCH_SIZE,
+        batchTimeoutMs: DEFAULT_BATCH_TIMEOUT_MS,
+        snapshotMode: DEFAULT_SNAPSHOT_MODE_STATUS,
+        snapshotFrequency: DEFAULT_SNAPSHOT_FREQUENCY,
+        deferSerialization: DEFAULT_DEFERRED_SERIALIZATION_STATUS,
+        jsonDecimalPlaces: DEFAULT_JSON_DECIMAL_PLACES,
+        rawCanTimestamps: DEFAULT_RAW_CAN_TIMESTAMPS_STATUS,
         initialized: false,
         runLevel: RunLevel::NOT_RUNNING,
         uart: {
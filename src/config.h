@@ -94,6 +94,53 @@ typedef enum {
  *      moment.
  * desiredRunLevel - The desired run level. If this is different from the
  *      current run level, the main loop will make the changes necessary.
+ * canReceiveBatchSize - The maximum number of received CAN messages to process
+ *      from each bus on each pass through the main loop.
+ * canReceiveBudgetUs - The maximum time in microseconds to spend processing
+ *      received CAN messages from each bus on each pass through the main loop,
+ *      or 0 for no limit. At least 1 message is processed if any are waiting.
+ * fixedPointDecode - If true, signal values are calculated with integer math
+ *      when that gives the exact same result as floating point, and for those
+ *      signals unchanged values are detected by comparing the raw integers
+ *      from the CAN message.
+ *      This avoids most of the floating point math when translating signals,
+ *      which is slow on MCUs without an FPU (e.g. the LPC1768).
+ * indexedDecode - If true, the signals in received CAN messages are translated
+ *      with the extraction plan from the bus's message index (see
+ *      openxc::can::read::translateMessage(...)) instead of by the generated
+ *      decodeCanMessage(...). This only applies to messages in the index that
+ *      set their indexedDecode flag; all others are still passed to
+ *      decodeCanMessage(...).
+ * dropPolicy - Which simple vehicle or raw CAN message to drop when an output
+ *      interface is backed up, from openxc::pipeline::DropPolicy.
+ * pipelineFlushBudgetUs - The maximum time in microseconds to spend flushing
+ *      the output interfaces on each pass through the main loop. The flush is
+ *      repeated within the budget while messages are still waiting in the
+ *      pipeline and the interfaces are making progress, or it's done once if
+ *      this is 0.
+ * batchSize - If not 0, published simple vehicle and raw CAN messages are
+ *      packed together for each output interface and sent as a batch once
+ *      the batch is at least this many bytes, e.g. a multiple of the 64 byte
+ *      USB packet size. Batches are never more than MAX_OUTGOING_PAYLOAD_SIZE.
+ *      Messages aren't batched in the PROTOBUF payload format.
+ * batchTimeoutMs - The longest time in milliseconds a message waits in a batch
+ *      before the batch is sent, even if it's not full yet.
+ * snapshotMode - If true, translated signals update a snapshot of the latest
+ *      value of each signal instead of being published right away, and only
+ *      the values that changed are published, at snapshotFrequency or when
+ *      the host asks for a snapshot.
+ * snapshotFrequency - How often to publish the snapshot in Hz, or 0 to only
+ *      publish it when the host asks.
+ * deferSerialization - If true, translated signal values are queued in the
+ *      pipeline as compact records, and only built into messages and
+ *      serialized in each output interface's payload format when the pipeline
+ *      is processed.
+ * jsonDecimalPlaces - The number of decimal places for numbers that aren't
+ *      whole in JSON output, unless a signal has its own, or
+ *      SHORTEST_DECIMAL_PLACES for the shortest text that parses back to the
+ *      exact value. Whole numbers never have decimal places.
+ * rawCanTimestamps - If true, raw CAN records in the RAW_CAN payload format
+ *      include a timestamp.
  *
  * Private:
  * initialized - True of the configuration struct has been initialized.
@@ -116,6 +163,19 @@ typedef struct {
     LoggingOutputInterface loggingOutput;
     bool calculateMetrics;
     RunLevel desiredRunLevel;
+    uint8_t canReceiveBatchSize;
+    unsigned int canReceiveBudgetUs;
+    bool fixedPointDecode;
+    bool indexedDecode;
+    openxc::pipeline::DropPolicy dropPolicy;
+    unsigned int pipelineFlushBudgetUs;
+    unsigned int batchSize;
+    unsigned int batchTimeoutMs;
+    bool snapshotMode;
+    float snapshotFrequency;
+    bool deferSerialization;
+    int8_t jsonDecimalPlaces;
+    bool rawCanTimestamps;
     bool initialized;
     RunLevel runLevel;
     openxc::interface::uart::UartDevice uart;
@@ -4,6 +4,7 @@
 #include "can/canread.h"
 #include "util/log.h"
 #include "util/timer.h"
+#include "util/metrics.h"
 #include "obd2.h"
 #include <bitfield/bitfield.h>
 #include <limits.h>
@@ -20,12 +21,15 @@ using openxc::util::log::debug;
 using openxc::can::lookupBus;
 using openxc::can::addAcceptanceFilter;
 using openxc::can::removeAcceptanceFilter;
+using openxc::can::addAcceptanceFilterRange;
+using openxc::can::removeAcceptanceFilterRange;
 using openxc::can::read::publishNumericalMessage;
 using openxc::pipeline::Pipeline;
 using openxc::signals::getCanBuses;
 using openxc::signals::getCanBusCount;
 
 namespace time = openxc::util::time;
+namespace metrics = openxc::util::metrics;
 namespace pipeline = openxc::pipeline;
 namespace obd2 = openxc::diagnostics::obd2;
 
@@ -61,14 +65,10 @@ static void cancelRequest(DiagnosticsManager* manager,
         ActiveDiagnosticRequest* entry) {
     LIST_INSERT_HEAD(&manager->freeRequestEntries, entry, listEntries);
     if(entry->arbitration_id == OBD2_FUNCTIONAL_BROADCAST_ID) {
-        for(uint32_t filter = OBD2_FUNCTIONAL_RESPONSE_START;
-                filter < OBD2_FUNCTIONAL_RESPONSE_START +
-                    OBD2_FUNCTIONAL_RESPONSE_COUNT;
-                filter++) {
-            removeAcceptanceFilter(entry->bus, filter,
-                    CanMessageFormat::STANDARD, getCanBuses(),
-                    getCanBusCount());
-        }
+        removeAcceptanceFilterRange(entry->bus, OBD2_FUNCTIONAL_RESPONSE_START,
+                OBD2_FUNCTIONAL_RESPONSE_START +
+                    OBD2_FUNCTIONAL_RESPONSE_COUNT - 1,
+                CanMessageFormat::STANDARD, getCanBuses(), getCanBusCount());
     } else {
         removeAcceptanceFilter(entry->bus,
                 entry->arbitration_id +
@@ -80,6 +80,9 @@ static void cancelRequest(DiagnosticsManager* manager,
 static void cleanupRequest(DiagnosticsManager* manager,
         ActiveDiagnosticRequest* entry, bool force) {
     if(force || (entry->inFlight && requestCompleted(entry))) {
+        if(!force && !entry->handle.completed) {
+            ++manager->requestsTimedOut;
+        }
         entry->inFlight = false;
 
         char request_string[128] = {0};
@@ -162,6 +165,16 @@ void openxc::diagnostics::reset(DiagnosticsManager* manager) {
     debug("Reset diagnostics requests");
 }
 
+static int activeRequestCount(void* manager) {
+    int freeEntries = 0;
+    ActiveDiagnosticRequest* entry;
+    LIST_FOREACH(entry, &((DiagnosticsManager*) manager)->freeRequestEntries,
+            listEntries) {
+        ++freeEntries;
+    }
+    return MAX_SIMULTANEOUS_DIAG_REQUESTS - freeEntries;
+}
+
 void openxc::diagnostics::initialize(DiagnosticsManager* manager, CanBus* buses,
         int busCount, uint8_t obd2BusAddress) {
     if(busCount > 0) {
@@ -175,6 +188,18 @@ void openxc::diagnostics::initialize(DiagnosticsManager* manager, CanBus* buses,
 
     reset(manager);
     manager->initialized = true;
+    manager->requestsSent = 0;
+    manager->responsesReceived = 0;
+    manager->requestsTimedOut = 0;
+
+    metrics::registerCounter("diagnostics", NO_METRIC_INSTANCE,
+            "requests_sent", &manager->requestsSent);
+    metrics::registerCounter("diagnostics", NO_METRIC_INSTANCE,
+            "responses_received", &manager->responsesReceived);
+    metrics::registerCounter("diagnostics", NO_METRIC_INSTANCE,
+            "requests_timed_out", &manager->requestsTimedOut);
+    metrics::registerGauge("diagnostics", NO_METRIC_INSTANCE,
+            "active_requests", activeRequestCount, manager);
 
     manager->obd2Bus = lookupBus(obd2BusAddress, buses, busCount);
     obd2::initialize(manager);
@@ -230,6 +255,7 @@ static void sendRequest(DiagnosticsManager* manager, CanBus* bus,
             request->timeoutClock.frequency = 10;
             time::tick(&request->timeoutClock);
             request->inFlight = true;
+            ++manager->requestsSent;
         }
     }
 }
@@ -336,6 +362,7 @@ static void receiveCanMessage(DiagnosticsManager* manager,
                 &entry->handle, message->id, message->data, message->length);
         if(response.completed && entry->handle.completed) {
             if(entry->handle.success) {
+                ++manager->responsesReceived;
                 relayDiagnosticResponse(manager, entry, &response,
                         pipeline);
             } else {
@@ -401,14 +428,12 @@ static bool updateRequiredAcceptanceFilters(CanBus* bus,
         DiagnosticRequest* request) {
     bool filterStatus = true;
     if(request->arbitration_id == OBD2_FUNCTIONAL_BROADCAST_ID) {
-        for(uint32_t filter = OBD2_FUNCTIONAL_RESPONSE_START;
-                filter < OBD2_FUNCTIONAL_RESPONSE_START +
-                OBD2_FUNCTIONAL_RESPONSE_COUNT;
-                filter++) {
-            filterStatus = filterStatus && addAcceptanceFilter(bus, filter,
-                    CanMessageFormat::STANDARD, getCanBuses(),
-                    getCanBusCount());
-        }
+        // All of the possible responses fit in a single range filter
+        filterStatus = addAcceptanceFilterRange(bus,
+                OBD2_FUNCTIONAL_RESPONSE_START,
+                OBD2_FUNCTIONAL_RESPONSE_START +
+                    OBD2_FUNCTIONAL_RESPONSE_COUNT - 1,
+                CanMessageFormat::STANDARD, getCanBuses(), getCanBusCount());
     } else {
         filterStatus = addAcceptanceFilter(bus,
                 request->arbitration_id +
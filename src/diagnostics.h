@@ -137,6 +137,9 @@ TAILQ_HEAD(DiagnosticRequestQueue, ActiveDiagnosticRequest);
  *      the requestListEntries attribute.
  * requestListEntries - Static allocation for all active diagnostic requests.
  * initialized - True if the DiagnosticsManager has been initialized.
+ * requestsSent - The number of requests sent on the bus.
+ * responsesReceived - The number of complete responses received.
+ * requestsTimedOut - The number of requests that got no response in time.
  */
 struct DiagnosticsManager {
     DiagnosticShims shims[MAX_SHIM_COUNT];
@@ -146,6 +149,9 @@ struct DiagnosticsManager {
     DiagnosticRequestList freeRequestEntries;
     ActiveDiagnosticRequest requestListEntries[MAX_SIMULTANEOUS_DIAG_REQUESTS];
     bool initialized;
+    unsigned int requestsSent;
+    unsigned int responsesReceived;
+    unsigned int requestsTimedOut;
 };
 typedef struct DiagnosticsManager DiagnosticsManager;
 
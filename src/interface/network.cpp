@@ -11,6 +11,7 @@ void openxc::interface::network::initializeCommon(NetworkDevice* device) {
     if(device != NULL) {
         debug("Initializing Network...");
         QUEUE_INIT(uint8_t, &device->receiveQueue);
+        openxc::util::bytebuffer::initializeFramer(&device->receiveFramer);
         QUEUE_INIT(uint8_t, &device->sendQueue);
         device->descriptor.type = InterfaceType::NETWORK;
     }
@@ -29,6 +29,8 @@ namespace network {
  * sendQueue - A queue of bytes that need to be sent out over an IP network.
  * receiveQueue - A queue of bytes that have been received via an IP network but
  *      not yet processed.
+ * receiveFramer - The state of the search for the end of the next message in
+ *      the receiveQueue.
  * server - An instance of Server which will allow connections from network
  *      clients.
  */
@@ -42,6 +44,7 @@ typedef struct {
     QUEUE_TYPE(uint8_t) sendQueue;
     // host to device
     QUEUE_TYPE(uint8_t) receiveQueue;
+    openxc::util::bytebuffer::MessageFramer receiveFramer;
 #if defined(__PIC32__) && defined(__USE_NETWORK__)
     Server* server;
 #endif // __USE_NETWORK__
@@ -13,6 +13,7 @@ void openxc::interface::uart::initializeCommon(UartDevice* device) {
     if(device != NULL) {
         debug("Initializing UART.....");
         QUEUE_INIT(uint8_t, &device->receiveQueue);
+        openxc::util::bytebuffer::initializeFramer(&device->receiveFramer);
         QUEUE_INIT(uint8_t, &device->sendQueue);
 
         device->descriptor.type = InterfaceType::UART;
@@ -24,6 +24,8 @@ extern const int BAUD_RATE;
  * sendQueue - A queue of bytes that need to be sent out over UART.
  * receiveQueue - A queue of bytes that have been received via UART but not yet
  *      processed.
+ * receiveFramer - The state of the search for the end of the next message in
+ *      the receiveQueue.
  * controller - A pointer to the hardware UART device to use for OpenXC messages.
  * deviceId - If applicable, a unique device ID for an attached UART receiver
  *      (e.g. the MAC of a Bluetooth module)
@@ -36,6 +38,7 @@ typedef struct {
     QUEUE_TYPE(uint8_t) sendQueue;
     // host to device
     QUEUE_TYPE(uint8_t) receiveQueue;
+    openxc::util::bytebuffer::MessageFramer receiveFramer;
     void* controller;
     char deviceId[MAX_DEVICE_ID_LENGTH];
 } UartDevice;
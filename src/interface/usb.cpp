@@ -10,6 +10,8 @@ void openxc::interface::usb::initializeCommon(UsbDevice* usbDevice) {
     debug("Initializing USB.....");
     for(int i = 0; i < ENDPOINT_COUNT; i++) {
         QUEUE_INIT(uint8_t, &usbDevice->endpoints[i].queue);
+        openxc::util::bytebuffer::initializeFramer(
+                &usbDevice->endpoints[i].framer);
     }
     usbDevice->configured = false;
     usbDevice->descriptor.type = InterfaceType::USB;
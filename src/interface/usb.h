@@ -32,12 +32,15 @@ typedef enum {
  * direction - the direction of the endpoint, IN or OUT.
  * queue - A queue of bytes from or for IN or OUT requests, depending on the
  *      direction.
+ * framer - The state of the search for the end of the next message in the
+ *      queue, for an OUT endpoint.
  */
 typedef struct {
     uint8_t address;
     uint8_t size;
     UsbEndpointDirection direction;
     QUEUE_TYPE(uint8_t) queue;
+    openxc::util::bytebuffer::MessageFramer framer;
     // This buffer MUST be non-local, so it doesn't get invalidated when it
     // falls off the stack
     uint8_t sendBuffer[USB_SEND_BUFFER_SIZE];
@@ -1,18 +1,49 @@
 #include "payload.h"
 
-#include <cJSON.h>
 #include <stdlib.h>
 #include <sys/param.h>
 #include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <limits.h>
 
 #include "json.h"
 #include "util/strutil.h"
 #include "util/log.h"
+#include "util/numberformat.h"
+#include "util/jsontokenizer.h"
 #include "config.h"
 
+// The number of decimal places cJSON prints numbers that aren't whole with.
+#define CJSON_DECIMAL_PLACES 6
+
+// Room for the longest command name, which are matched by prefix.
+#define MAX_COMMAND_NAME_LENGTH 32
+
+// Room for the longest name of an enum value, e.g. a frame format.
+#define MAX_ENUM_NAME_LENGTH 16
+
+// Room for a '0x' prefix and 2 hex characters for each byte of the largest
+// bytes field in a message.
+#define MAX_HEX_FIELD_LENGTH 20
+
 namespace payload = openxc::payload;
+namespace numberformat = openxc::util::numberformat;
+namespace jsontokenizer = openxc::util::jsontokenizer;
 
 using openxc::util::log::debug;
+using openxc::config::getConfiguration;
+using openxc::util::jsontokenizer::JsonToken;
+using openxc::util::jsontokenizer::JsonDocument;
+using openxc::payload::json::JsonWriter;
+using openxc::payload::json::writeCharacter;
+using openxc::payload::json::writeString;
+using openxc::payload::json::writeNumber;
+using openxc::payload::json::writeFieldName;
+using openxc::payload::json::writeNumberField;
+using openxc::payload::json::writeStringField;
+using openxc::payload::json::writeBoolField;
 
 const char openxc::payload::json::VERSION_COMMAND_NAME[] = "version";
 const char openxc::payload::json::DEVICE_ID_COMMAND_NAME[] = "device_id";
@@ -21,9 +52,30 @@ const char openxc::payload::json::PASSTHROUGH_COMMAND_NAME[] = "passthrough";
 const char openxc::payload::json::ACCEPTANCE_FILTER_BYPASS_COMMAND_NAME[] = "af_bypass";
 const char openxc::payload::json::PAYLOAD_FORMAT_COMMAND_NAME[] = "payload_format";
 const char openxc::payload::json::PREDEFINED_OBD2_REQUESTS_COMMAND_NAME[] = "predefined_obd2";
+const char openxc::payload::json::SUBSCRIPTION_COMMAND_NAME[] = "subscribe";
+const char openxc::payload::json::SNAPSHOT_COMMAND_NAME[] = "snapshot";
+const char openxc::payload::json::METRICS_COMMAND_NAME[] = "metrics";
+const char openxc::payload::json::CAN_RECEIVE_COMMAND_NAME[] = "can_receive";
 
 const char openxc::payload::json::PAYLOAD_FORMAT_JSON_NAME[] = "json";
 const char openxc::payload::json::PAYLOAD_FORMAT_PROTOBUF_NAME[] = "protobuf";
+const char openxc::payload::json::PAYLOAD_FORMAT_RAW_CAN_NAME[] = "raw_can";
+
+const char openxc::payload::json::SUBSCRIPTION_MODE_FIELD_NAME[] = "mode";
+const char openxc::payload::json::SUBSCRIPTION_SIGNALS_FIELD_NAME[] = "signals";
+const char openxc::payload::json::SUBSCRIPTION_CLASSES_FIELD_NAME[] = "classes";
+const char openxc::payload::json::SUBSCRIPTION_MODE_INCLUDE_NAME[] = "include";
+const char openxc::payload::json::SUBSCRIPTION_MODE_EXCLUDE_NAME[] = "exclude";
+const char openxc::payload::json::SUBSCRIPTION_MODE_ALL_NAME[] = "all";
+
+const char openxc::payload::json::METRICS_OFFSET_FIELD_NAME[] = "offset";
+const char openxc::payload::json::METRICS_TOTAL_FIELD_NAME[] = "total";
+const char openxc::payload::json::METRICS_NEXT_FIELD_NAME[] = "next";
+const char openxc::payload::json::METRICS_FIELD_NAME[] = "metrics";
+
+const char openxc::payload::json::CAN_RECEIVE_BATCH_SIZE_FIELD_NAME[] =
+        "batch_size";
+const char openxc::payload::json::CAN_RECEIVE_BUDGET_FIELD_NAME[] = "budget_us";
 
 const char openxc::payload::json::COMMAND_RESPONSE_FIELD_NAME[] = "command_response";
 const char openxc::payload::json::COMMAND_RESPONSE_MESSAGE_FIELD_NAME[] = "message";
@@ -47,49 +99,167 @@ const char openxc::payload::json::DIAGNOSTIC_NRC_FIELD_NAME[] = "negative_respon
 const char openxc::payload::json::DIAGNOSTIC_PAYLOAD_FIELD_NAME[] = "payload";
 const char openxc::payload::json::DIAGNOSTIC_VALUE_FIELD_NAME[] = "value";
 
-static bool serializeDiagnostic(openxc_VehicleMessage* message, cJSON* root) {
-    cJSON_AddNumberToObject(root, payload::json::BUS_FIELD_NAME,
+static void writeBytes(JsonWriter* writer, const char* bytes, size_t length) {
+    if(writer->length < writer->size) {
+        memcpy(writer->buffer + writer->length, bytes,
+                MIN(length, writer->size - writer->length));
+    }
+    writer->length += length;
+}
+
+void openxc::payload::json::initializeWriter(JsonWriter* writer,
+        uint8_t buffer[], size_t size) {
+    writer->buffer = (char*) buffer;
+    writer->size = size;
+    writer->length = 0;
+    writer->fieldCount = 0;
+    writer->decimalPlaces = getConfiguration()->jsonDecimalPlaces;
+}
+
+void openxc::payload::json::writeCharacter(JsonWriter* writer,
+        char character) {
+    writeBytes(writer, &character, 1);
+}
+
+void openxc::payload::json::writeString(JsonWriter* writer,
+        const char* value) {
+    writeCharacter(writer, '\"');
+    const char* unescaped = value;
+    for(const char* next = value; *next != '\0'; next++) {
+        unsigned char character = *next;
+        if(character > 31 && character != '\"' && character != '\\') {
+            continue;
+        }
+
+        writeBytes(writer, unescaped, next - unescaped);
+        unescaped = next + 1;
+
+        char escaped[7];
+        switch(character) {
+            case '\"': strcpy(escaped, "\\\""); break;
+            case '\\': strcpy(escaped, "\\\\"); break;
+            case '\b': strcpy(escaped, "\\b"); break;
+            case '\f': strcpy(escaped, "\\f"); break;
+            case '\n': strcpy(escaped, "\\n"); break;
+            case '\r': strcpy(escaped, "\\r"); break;
+            case '\t': strcpy(escaped, "\\t"); break;
+            default:
+                snprintf(escaped, sizeof(escaped), "\\u%04x", character);
+                break;
+        }
+        writeBytes(writer, escaped, strlen(escaped));
+    }
+    writeBytes(writer, unescaped, strlen(unescaped));
+    writeCharacter(writer, '\"');
+}
+
+void openxc::payload::json::writeNumber(JsonWriter* writer, double value) {
+    char number[MAX_FORMATTED_NUMBER_LENGTH];
+    int length;
+    int integer = (int) value;
+    if(fabs(((double)integer) - value) <= DBL_EPSILON && value <= INT_MAX &&
+            value >= INT_MIN) {
+        length = numberformat::formatInteger(integer, number, sizeof(number));
+    } else if(fabs(floor(value) - value) <= DBL_EPSILON &&
+            fabs(value) < 1.0e60) {
+        length = snprintf(number, sizeof(number), "%.0f", value);
+    } else if(writer->decimalPlaces == SHORTEST_DECIMAL_PLACES) {
+        length = numberformat::formatShortest(value, number, sizeof(number));
+    } else if(fabs(value) < 1.0e-6 || fabs(value) > 1.0e9) {
+        length = snprintf(number, sizeof(number), "%e", value);
+    } else {
+        length = numberformat::formatDecimal(value, writer->decimalPlaces,
+                number, sizeof(number));
+    }
+
+    if(length > 0) {
+        writeBytes(writer, number, length);
+    }
+}
+
+static void writeBool(JsonWriter* writer, bool value) {
+    if(value) {
+        writeBytes(writer, "true", 4);
+    } else {
+        writeBytes(writer, "false", 5);
+    }
+}
+
+/* Private: Write a hex string like "0x1234" for a byte array.
+ */
+static void writeHexString(JsonWriter* writer, const uint8_t* bytes,
+        size_t size) {
+    static const char HEX_DIGITS[] = "0123456789abcdef";
+    writeBytes(writer, "\"0x", 3);
+    for(size_t i = 0; i < size; i++) {
+        writeCharacter(writer, HEX_DIGITS[bytes[i] >> 4]);
+        writeCharacter(writer, HEX_DIGITS[bytes[i] & 0xf]);
+    }
+    writeCharacter(writer, '\"');
+}
+
+void openxc::payload::json::writeFieldName(JsonWriter* writer,
+        const char* name) {
+    if(writer->fieldCount++ > 0) {
+        writeCharacter(writer, ',');
+    }
+    writeString(writer, name);
+    writeCharacter(writer, ':');
+}
+
+void openxc::payload::json::writeNumberField(JsonWriter* writer,
+        const char* name, double value) {
+    writeFieldName(writer, name);
+    writeNumber(writer, value);
+}
+
+void openxc::payload::json::writeStringField(JsonWriter* writer,
+        const char* name, const char* value) {
+    writeFieldName(writer, name);
+    writeString(writer, value);
+}
+
+void openxc::payload::json::writeBoolField(JsonWriter* writer,
+        const char* name, bool value) {
+    writeFieldName(writer, name);
+    writeBool(writer, value);
+}
+
+static bool serializeDiagnostic(openxc_VehicleMessage* message,
+        JsonWriter* writer) {
+    writeNumberField(writer, payload::json::BUS_FIELD_NAME,
             message->diagnostic_response.bus);
-    cJSON_AddNumberToObject(root, payload::json::ID_FIELD_NAME,
+    writeNumberField(writer, payload::json::ID_FIELD_NAME,
             message->diagnostic_response.message_id);
-    cJSON_AddNumberToObject(root, payload::json::DIAGNOSTIC_MODE_FIELD_NAME,
+    writeNumberField(writer, payload::json::DIAGNOSTIC_MODE_FIELD_NAME,
             message->diagnostic_response.mode);
-    cJSON_AddBoolToObject(root, payload::json::DIAGNOSTIC_SUCCESS_FIELD_NAME,
+    writeBoolField(writer, payload::json::DIAGNOSTIC_SUCCESS_FIELD_NAME,
             message->diagnostic_response.success);
 
     if(message->diagnostic_response.has_pid) {
-        cJSON_AddNumberToObject(root, payload::json::DIAGNOSTIC_PID_FIELD_NAME,
+        writeNumberField(writer, payload::json::DIAGNOSTIC_PID_FIELD_NAME,
                 message->diagnostic_response.pid);
     }
 
     if(message->diagnostic_response.has_negative_response_code) {
-        cJSON_AddNumberToObject(root, payload::json::DIAGNOSTIC_NRC_FIELD_NAME,
+        writeNumberField(writer, payload::json::DIAGNOSTIC_NRC_FIELD_NAME,
                 message->diagnostic_response.negative_response_code);
     }
 
     if(message->diagnostic_response.has_value) {
-        cJSON_AddNumberToObject(root, payload::json::DIAGNOSTIC_VALUE_FIELD_NAME,
+        writeNumberField(writer, payload::json::DIAGNOSTIC_VALUE_FIELD_NAME,
                 message->diagnostic_response.value);
     } else if(message->diagnostic_response.has_payload) {
-        char encodedData[67];
-        const char* maxAddress = encodedData + sizeof(encodedData);
-        char* encodedDataIndex = encodedData;
-        encodedDataIndex += sprintf(encodedDataIndex, "0x");
-        for(uint8_t i = 0; i < message->diagnostic_response.payload.size &&
-                encodedDataIndex < maxAddress; i++) {
-            encodedDataIndex += snprintf(encodedDataIndex,
-                    maxAddress - encodedDataIndex,
-                    "%02x",
-                    message->diagnostic_response.payload.bytes[i]);
-        }
-        cJSON_AddStringToObject(root, payload::json::DIAGNOSTIC_PAYLOAD_FIELD_NAME,
-                encodedData);
+        writeFieldName(writer, payload::json::DIAGNOSTIC_PAYLOAD_FIELD_NAME);
+        writeHexString(writer, message->diagnostic_response.payload.bytes,
+                MIN(message->diagnostic_response.payload.size,
+                    sizeof(message->diagnostic_response.payload.bytes)));
     }
     return true;
 }
 
 static bool serializeCommandResponse(openxc_VehicleMessage* message,
-        cJSON* root) {
+        JsonWriter* writer) {
     const char* typeString = NULL;
     if(message->command_response.type == openxc_ControlCommand_Type_VERSION) {
         typeString = payload::json::VERSION_COMMAND_NAME;
@@ -109,43 +279,35 @@ static bool serializeCommandResponse(openxc_VehicleMessage* message,
         return false;
     }
 
-    cJSON_AddStringToObject(root, payload::json::COMMAND_RESPONSE_FIELD_NAME,
+    writeStringField(writer, payload::json::COMMAND_RESPONSE_FIELD_NAME,
             typeString);
     if(message->command_response.has_message) {
-        cJSON_AddStringToObject(root,
+        writeStringField(writer,
                 payload::json::COMMAND_RESPONSE_MESSAGE_FIELD_NAME,
                 message->command_response.message);
     }
 
     if(message->command_response.has_status) {
-        cJSON_AddBoolToObject(root,
+        writeBoolField(writer,
                 payload::json::COMMAND_RESPONSE_STATUS_FIELD_NAME,
                 message->command_response.status);
     }
     return true;
 }
 
-static bool serializeCan(openxc_VehicleMessage* message, cJSON* root) {
-    cJSON_AddNumberToObject(root, payload::json::BUS_FIELD_NAME,
+static bool serializeCan(openxc_VehicleMessage* message, JsonWriter* writer) {
+    writeNumberField(writer, payload::json::BUS_FIELD_NAME,
             message->can_message.bus);
-    cJSON_AddNumberToObject(root, payload::json::ID_FIELD_NAME,
+    writeNumberField(writer, payload::json::ID_FIELD_NAME,
             message->can_message.id);
 
-    char encodedData[67];
-    const char* maxAddress = encodedData + sizeof(encodedData);
-    char* encodedDataIndex = encodedData;
-    encodedDataIndex += sprintf(encodedDataIndex, "0x");
-    for(uint8_t i = 0; i < message->can_message.data.size &&
-            encodedDataIndex < maxAddress; i++) {
-        encodedDataIndex += snprintf(encodedDataIndex,
-                maxAddress - encodedDataIndex,
-                "%02x", message->can_message.data.bytes[i]);
-    }
-    cJSON_AddStringToObject(root, payload::json::DATA_FIELD_NAME,
-            encodedData);
+    writeFieldName(writer, payload::json::DATA_FIELD_NAME);
+    writeHexString(writer, message->can_message.data.bytes,
+            MIN(message->can_message.data.size,
+                sizeof(message->can_message.data.bytes)));
 
     if(message->can_message.has_frame_format) {
-        cJSON_AddStringToObject(root, payload::json::FRAME_FORMAT_FIELD_NAME,
+        writeStringField(writer, payload::json::FRAME_FORMAT_FIELD_NAME,
                 message->can_message.frame_format == openxc_CanMessage_FrameFormat_STANDARD ?
                     payload::json::FRAME_FORMAT_STANDARD_NAME :
                         payload::json::FRAME_FORMAT_EXTENDED_NAME);
@@ -153,36 +315,33 @@ static bool serializeCan(openxc_VehicleMessage* message, cJSON* root) {
     return true;
 }
 
-static cJSON* serializeDynamicField(openxc_DynamicField* field) {
-    cJSON* value = NULL;
+/* Private: Write a field for a dynamic field's value, or nothing if it doesn't
+ * have one.
+ */
+static void serializeDynamicField(JsonWriter* writer, const char* name,
+        openxc_DynamicField* field) {
     if(field->has_numeric_value) {
-        value = cJSON_CreateNumber(field->numeric_value);
+        writeNumberField(writer, name, field->numeric_value);
     } else if(field->has_boolean_value) {
-        value = cJSON_CreateBool(field->boolean_value);
+        writeBoolField(writer, name, field->boolean_value);
     } else if(field->has_string_value) {
-        value = cJSON_CreateString(field->string_value);
+        writeStringField(writer, name, field->string_value);
     }
-    return value;
 }
 
-static bool serializeSimple(openxc_VehicleMessage* message, cJSON* root) {
-    const char* name = message->simple_message.name;
-    cJSON_AddStringToObject(root, payload::json::NAME_FIELD_NAME, name);
+static bool serializeSimple(openxc_VehicleMessage* message,
+        JsonWriter* writer) {
+    writeStringField(writer, payload::json::NAME_FIELD_NAME,
+            message->simple_message.name);
 
-    cJSON* value = NULL;
     if(message->simple_message.has_value) {
-        value = serializeDynamicField(&message->simple_message.value);
-        if(value != NULL) {
-            cJSON_AddItemToObject(root, payload::json::VALUE_FIELD_NAME, value);
-        }
+        serializeDynamicField(writer, payload::json::VALUE_FIELD_NAME,
+                &message->simple_message.value);
     }
 
-    cJSON* event = NULL;
     if(message->simple_message.has_event) {
-        event = serializeDynamicField(&message->simple_message.event);
-        if(event != NULL) {
-            cJSON_AddItemToObject(root, payload::json::EVENT_FIELD_NAME, event);
-        }
+        serializeDynamicField(writer, payload::json::EVENT_FIELD_NAME,
+                &message->simple_message.event);
     }
     return true;
 }
@@ -216,90 +375,144 @@ static size_t dehexlify(const char source[], uint8_t* destination,
     return byteIndex;
 }
 
-static void deserializePassthrough(cJSON* root, openxc_ControlCommand* command) {
+/* Private: Find the value of a field in an object, case-insensitive like
+ * cJSON_GetObjectItem.
+ *
+ * Returns the value's token, or NULL if the object doesn't have the field.
+ */
+static const JsonToken* getField(const JsonDocument* document,
+        const JsonToken* object, const char* name) {
+    int index = jsontokenizer::findField(document->text, document->tokens,
+            document->tokenCount, object - document->tokens, name);
+    return index == NO_JSON_TOKEN ? NULL : &document->tokens[index];
+}
+
+static int getInt(const JsonDocument* document, const JsonToken* token) {
+    return jsontokenizer::toInt(document->text, token);
+}
+
+/* Private: Return true if the token is a string equal to the value.
+ */
+static bool stringEquals(const JsonDocument* document, const JsonToken* token,
+        const char* value) {
+    char text[MAX_ENUM_NAME_LENGTH];
+    return jsontokenizer::copyString(document->text, token, text,
+            sizeof(text)) && !strcmp(text, value);
+}
+
+/* Private: Parse a hex string token as a byte array, with dehexlify(...).
+ *
+ * Returns the size of the byte array stored in dest, or 0 if the token isn't a
+ * string.
+ */
+static size_t dehexlifyField(const JsonDocument* document,
+        const JsonToken* token, uint8_t* destination,
+        size_t destinationLength) {
+    // Anything past the bytes that fit in the destination is ignored anyway, so
+    // it's fine if the copy is truncated
+    char hex[MAX_HEX_FIELD_LENGTH];
+    jsontokenizer::copyString(document->text, token, hex, sizeof(hex));
+    return dehexlify(hex, destination, destinationLength);
+}
+
+static void deserializePassthrough(const JsonDocument* document,
+        openxc_ControlCommand* command) {
     command->has_type = true;
     command->type = openxc_ControlCommand_Type_PASSTHROUGH;
     command->has_passthrough_mode_request = true;
 
-    cJSON* element = cJSON_GetObjectItem(root, "bus");
+    const JsonToken* root = document->tokens;
+    const JsonToken* element = getField(document, root, "bus");
     if(element != NULL) {
         command->passthrough_mode_request.has_bus = true;
-        command->passthrough_mode_request.bus = element->valueint;
+        command->passthrough_mode_request.bus = getInt(document, element);
     }
 
-    element = cJSON_GetObjectItem(root, "enabled");
+    element = getField(document, root, "enabled");
     if(element != NULL) {
         command->passthrough_mode_request.has_enabled = true;
-        command->passthrough_mode_request.enabled = bool(element->valueint);
+        command->passthrough_mode_request.enabled = bool(getInt(document,
+                    element));
     }
 }
 
-static void deserializePayloadFormat(cJSON* root,
+static void deserializePayloadFormat(const JsonDocument* document,
         openxc_ControlCommand* command) {
     command->has_type = true;
     command->type = openxc_ControlCommand_Type_PAYLOAD_FORMAT;
     command->has_payload_format_command = true;
 
-    cJSON* element = cJSON_GetObjectItem(root, "format");
+    const JsonToken* element = getField(document, document->tokens, "format");
     if(element != NULL) {
-        if(!strcmp(element->valuestring,
+        if(stringEquals(document, element,
                     openxc::payload::json::PAYLOAD_FORMAT_JSON_NAME)) {
             command->payload_format_command.has_format = true;
             command->payload_format_command.format =
                     openxc_PayloadFormatCommand_PayloadFormat_JSON;
-        } else if(!strcmp(element->valuestring,
+        } else if(stringEquals(document, element,
                     openxc::payload::json::PAYLOAD_FORMAT_PROTOBUF_NAME)) {
             command->payload_format_command.has_format = true;
             command->payload_format_command.format =
                     openxc_PayloadFormatCommand_PayloadFormat_PROTOBUF;
+        } else if(stringEquals(document, element,
+                    openxc::payload::json::PAYLOAD_FORMAT_RAW_CAN_NAME)) {
+            command->payload_format_command.has_format = true;
+            command->payload_format_command.format =
+                    PAYLOAD_FORMAT_COMMAND_RAW_CAN;
         }
     }
 }
 
-static void deserializePredefinedObd2RequestsCommand(cJSON* root,
-        openxc_ControlCommand* command) {
+static void deserializePredefinedObd2RequestsCommand(
+        const JsonDocument* document, openxc_ControlCommand* command) {
     command->has_type = true;
     command->type = openxc_ControlCommand_Type_PREDEFINED_OBD2_REQUESTS;
     command->has_predefined_obd2_requests_command = true;
 
-    cJSON* element = cJSON_GetObjectItem(root, "enabled");
+    const JsonToken* element = getField(document, document->tokens,
+            "enabled");
     if(element != NULL) {
         command->predefined_obd2_requests_command.has_enabled = true;
-        command->predefined_obd2_requests_command.enabled = bool(element->valueint);
+        command->predefined_obd2_requests_command.enabled = bool(getInt(
+                    document, element));
     }
 }
 
-static void deserializeAfBypass(cJSON* root, openxc_ControlCommand* command) {
+static void deserializeAfBypass(const JsonDocument* document,
+        openxc_ControlCommand* command) {
     command->has_type = true;
     command->type = openxc_ControlCommand_Type_ACCEPTANCE_FILTER_BYPASS;
     command->has_acceptance_filter_bypass_command = true;
 
-    cJSON* element = cJSON_GetObjectItem(root, "bus");
+    const JsonToken* root = document->tokens;
+    const JsonToken* element = getField(document, root, "bus");
     if(element != NULL) {
         command->acceptance_filter_bypass_command.has_bus = true;
-        command->acceptance_filter_bypass_command.bus = element->valueint;
+        command->acceptance_filter_bypass_command.bus = getInt(document,
+                element);
     }
 
-    element = cJSON_GetObjectItem(root, "bypass");
+    element = getField(document, root, "bypass");
     if(element != NULL) {
         command->acceptance_filter_bypass_command.has_bypass = true;
         command->acceptance_filter_bypass_command.bypass =
-            bool(element->valueint);
+            bool(getInt(document, element));
     }
 }
 
-static void deserializeDiagnostic(cJSON* root, openxc_ControlCommand* command) {
+static void deserializeDiagnostic(const JsonDocument* document,
+        openxc_ControlCommand* command) {
     command->has_type = true;
     command->type = openxc_ControlCommand_Type_DIAGNOSTIC;
     command->has_diagnostic_request = true;
 
-    cJSON* action = cJSON_GetObjectItem(root, "action");
-    if(action != NULL && action->type == cJSON_String) {
+    const JsonToken* action = getField(document, document->tokens, "action");
+    if(action != NULL && jsontokenizer::isString(action)) {
         command->diagnostic_request.has_action = true;
-        if(!strcmp(action->valuestring, "add")) {
+        if(stringEquals(document, action, "add")) {
             command->diagnostic_request.action =
                     openxc_DiagnosticControlCommand_Action_ADD;
-        } else if(!strcmp(action->valuestring, "cancel")) {
+        } else if(stringEquals(document, action, "cancel")) {
             command->diagnostic_request.action =
                     openxc_DiagnosticControlCommand_Action_CANCEL;
         } else {
@@ -307,167 +520,173 @@ static void deserializeDiagnostic(cJSON* root, openxc_ControlCommand* command) {
         }
     }
 
-    cJSON* request = cJSON_GetObjectItem(root, "request");
+    const JsonToken* request = getField(document, document->tokens,
+            "request");
     if(request != NULL) {
-        cJSON* element = cJSON_GetObjectItem(request, "bus");
+        const JsonToken* element = getField(document, request, "bus");
         if(element != NULL) {
             command->diagnostic_request.request.has_bus = true;
-            command->diagnostic_request.request.bus = element->valueint;
+            command->diagnostic_request.request.bus = getInt(document,
+                    element);
         }
 
-        element = cJSON_GetObjectItem(request, "mode");
+        element = getField(document, request, "mode");
         if(element != NULL) {
             command->diagnostic_request.request.has_mode = true;
-            command->diagnostic_request.request.mode = element->valueint;
+            command->diagnostic_request.request.mode = getInt(document,
+                    element);
         }
 
-        element = cJSON_GetObjectItem(request, "id");
+        element = getField(document, request, "id");
         if(element != NULL) {
             command->diagnostic_request.request.has_message_id = true;
-            command->diagnostic_request.request.message_id = element->valueint;
+            command->diagnostic_request.request.message_id = getInt(document,
+                    element);
         }
 
-        element = cJSON_GetObjectItem(request, "pid");
+        element = getField(document, request, "pid");
         if(element != NULL) {
             command->diagnostic_request.request.has_pid = true;
-            command->diagnostic_request.request.pid = element->valueint;
+            command->diagnostic_request.request.pid = getInt(document,
+                    element);
         }
 
-        element = cJSON_GetObjectItem(request, "payload");
+        element = getField(document, request, "payload");
         if(element != NULL) {
             command->diagnostic_request.request.has_payload = true;
-            command->diagnostic_request.request.payload.size = dehexlify(
-                    element->valuestring,
+            command->diagnostic_request.request.payload.size = dehexlifyField(
+                    document, element,
                     command->diagnostic_request.request.payload.bytes,
                     sizeof(((openxc_DiagnosticRequest*)0)->payload.bytes));
         }
 
-        element = cJSON_GetObjectItem(request, "multiple_responses");
+        element = getField(document, request, "multiple_responses");
         if(element != NULL) {
             command->diagnostic_request.request.has_multiple_responses = true;
             command->diagnostic_request.request.multiple_responses =
-                bool(element->valueint);
+                bool(getInt(document, element));
         }
 
-        element = cJSON_GetObjectItem(request, "frequency");
+        element = getField(document, request, "frequency");
         if(element != NULL) {
             command->diagnostic_request.request.has_frequency = true;
             command->diagnostic_request.request.frequency =
-                element->valuedouble;
+                jsontokenizer::toDouble(document->text, element);
         }
 
-        element = cJSON_GetObjectItem(request, "decoded_type");
+        element = getField(document, request, "decoded_type");
         if(element != NULL) {
-            if(!strcmp(element->valuestring, "obd2")) {
+            if(stringEquals(document, element, "obd2")) {
                 command->diagnostic_request.request.has_decoded_type = true;
                 command->diagnostic_request.request.decoded_type =
                         openxc_DiagnosticRequest_DecodedType_OBD2;
-            } else if(!strcmp(element->valuestring, "none")) {
+            } else if(stringEquals(document, element, "none")) {
                 command->diagnostic_request.request.has_decoded_type = true;
                 command->diagnostic_request.request.decoded_type =
                         openxc_DiagnosticRequest_DecodedType_NONE;
             }
         }
 
-        element = cJSON_GetObjectItem(request, "name");
-        if(element != NULL && element->type == cJSON_String) {
+        element = getField(document, request, "name");
+        if(element != NULL && jsontokenizer::isString(element)) {
             command->diagnostic_request.request.has_name = true;
-            strcpy(command->diagnostic_request.request.name,
-                    element->valuestring);
+            jsontokenizer::copyString(document->text, element,
+                    command->diagnostic_request.request.name,
+                    sizeof(command->diagnostic_request.request.name));
         }
     }
 }
 
-static bool deserializeDynamicField(cJSON* element,
-        openxc_DynamicField* field) {
+static bool deserializeDynamicField(const JsonDocument* document,
+        const JsonToken* element, openxc_DynamicField* field) {
     bool status = true;
     field->has_type = true;
-    switch(element->type) {
-        case cJSON_String:
-            field->type = openxc_DynamicField_Type_STRING;
-            field->has_string_value = true;
-            strcpy(field->string_value, element->valuestring);
-            break;
-        case cJSON_False:
-        case cJSON_True:
-            field->type = openxc_DynamicField_Type_BOOL;
-            field->has_boolean_value = true;
-            field->boolean_value = bool(element->valueint);
-            break;
-        case cJSON_Number:
-            field->type = openxc_DynamicField_Type_NUM;
-            field->has_numeric_value = true;
-            field->numeric_value = element->valuedouble;
-            break;
-        default:
-            debug("Unsupported type in value field: %d", element->type);
-            field->has_type = false;
-            status = false;
-            break;
+    if(jsontokenizer::isString(element)) {
+        field->type = openxc_DynamicField_Type_STRING;
+        field->has_string_value = true;
+        jsontokenizer::copyString(document->text, element, field->string_value,
+                sizeof(field->string_value));
+    } else if(jsontokenizer::isBoolean(document->text, element)) {
+        field->type = openxc_DynamicField_Type_BOOL;
+        field->has_boolean_value = true;
+        field->boolean_value = bool(getInt(document, element));
+    } else if(jsontokenizer::isNumber(document->text, element)) {
+        field->type = openxc_DynamicField_Type_NUM;
+        field->has_numeric_value = true;
+        field->numeric_value = jsontokenizer::toDouble(document->text, element);
+    } else {
+        debug("Unsupported type in value field: %d", element->type);
+        field->has_type = false;
+        status = false;
     }
     return status;
 }
 
-static void deserializeSimple(cJSON* root, openxc_VehicleMessage* message) {
+static void deserializeSimple(const JsonDocument* document,
+        openxc_VehicleMessage* message) {
     message->has_type = true;
     message->type = openxc_VehicleMessage_Type_SIMPLE;
     message->has_simple_message = true;
     openxc_SimpleMessage* simpleMessage = &message->simple_message;
 
-    cJSON* element = cJSON_GetObjectItem(root, "name");
-    if(element != NULL && element->type == cJSON_String) {
+    const JsonToken* root = document->tokens;
+    const JsonToken* element = getField(document, root, "name");
+    if(element != NULL && jsontokenizer::isString(element)) {
         simpleMessage->has_name = true;
-        strcpy(simpleMessage->name, element->valuestring);
+        jsontokenizer::copyString(document->text, element, simpleMessage->name,
+                sizeof(simpleMessage->name));
     }
 
-    element = cJSON_GetObjectItem(root, "value");
+    element = getField(document, root, "value");
     if(element != NULL) {
-        if(deserializeDynamicField(element, &simpleMessage->value)) {
+        if(deserializeDynamicField(document, element, &simpleMessage->value)) {
             simpleMessage->has_value = true;
         }
     }
 
-    element = cJSON_GetObjectItem(root, "event");
+    element = getField(document, root, "event");
     if(element != NULL) {
-        if(deserializeDynamicField(element, &simpleMessage->event)) {
+        if(deserializeDynamicField(document, element, &simpleMessage->event)) {
             simpleMessage->has_event = true;
         }
     }
 }
 
-static void deserializeCan(cJSON* root, openxc_VehicleMessage* message) {
+static void deserializeCan(const JsonDocument* document,
+        openxc_VehicleMessage* message) {
     message->has_type = true;
     message->type = openxc_VehicleMessage_Type_CAN;
     message->has_can_message = true;
     openxc_CanMessage* canMessage = &message->can_message;
 
-    cJSON* element = cJSON_GetObjectItem(root, "id");
+    const JsonToken* root = document->tokens;
+    const JsonToken* element = getField(document, root, "id");
     if(element != NULL) {
         canMessage->has_id = true;
-        canMessage->id = element->valueint;
+        canMessage->id = getInt(document, element);
 
-        element = cJSON_GetObjectItem(root, "data");
+        element = getField(document, root, "data");
         if(element != NULL) {
             canMessage->has_data = true;
-            canMessage->data.size = dehexlify(
-                    element->valuestring,
+            canMessage->data.size = dehexlifyField(document, element,
                     canMessage->data.bytes,
                     sizeof(((openxc_CanMessage*)0)->data.bytes));
         }
 
-        element = cJSON_GetObjectItem(root, "bus");
+        element = getField(document, root, "bus");
         if(element != NULL) {
             canMessage->has_bus = true;
-            canMessage->bus = element->valueint;
+            canMessage->bus = getInt(document, element);
         }
 
-        element = cJSON_GetObjectItem(root, payload::json::FRAME_FORMAT_FIELD_NAME);
+        element = getField(document, root,
+                payload::json::FRAME_FORMAT_FIELD_NAME);
         if(element != NULL) {
             canMessage->has_frame_format = true;
-            if(!strcmp(element->valuestring,
+            if(stringEquals(document, element,
                         payload::json::FRAME_FORMAT_STANDARD_NAME)) {
                 canMessage->frame_format = openxc_CanMessage_FrameFormat_STANDARD;
-            } else if(!strcmp(element->valuestring,
+            } else if(stringEquals(document, element,
                         payload::json::FRAME_FORMAT_EXTENDED_NAME)) {
                 canMessage->frame_format = openxc_CanMessage_FrameFormat_EXTENDED;
             } else {
@@ -485,21 +704,26 @@ size_t openxc::payload::json::deserialize(uint8_t payload[], size_t length,
     size_t messageLength = 0;
     if(delimiter != NULL) {
         messageLength = (size_t)(delimiter - (const char*)payload) + 1;
-        uint8_t messageBuffer[messageLength];
-        if(messageLength > 0) {
-            memcpy(messageBuffer, payload, messageLength);
-        }
         // There may be junk data at the start of the payload - seek ahead to the
         // start of the message.
-        char* jsonStart = strchr((char*)messageBuffer, '{');
+        const char* jsonStart = strchr((const char*)payload, '{');
         if(jsonStart == NULL) {
             debug("%s", "No JSON object start found");
             // Return message length so this bogus front matter is erased
             return messageLength;
         }
 
-        cJSON *root = cJSON_Parse(jsonStart);
-        if(root == NULL) {
+        // The tokens point into the payload, so nothing is copied or allocated
+        // until the fields are stored in the message
+        JsonDocument document;
+        document.text = jsonStart;
+        document.tokenCount = jsontokenizer::tokenize(jsonStart,
+                delimiter - jsonStart, document.tokens, MAX_JSON_TOKENS);
+        if(document.tokenCount == JSON_ERROR_TOO_MANY_TOKENS) {
+            debug("JSON message has more than %d tokens", MAX_JSON_TOKENS);
+            // It's complete, just not anything we could handle, so drop it
+            return messageLength;
+        } else if(document.tokenCount < 0) {
             debug("No JSON found in %u byte payload", length);
             // TODO should this return messageLength to eat up corrupt data, or
             // does it need to be 0 so we preserve partial messages?
@@ -507,52 +731,59 @@ size_t openxc::payload::json::deserialize(uint8_t payload[], size_t length,
         }
 
         message->has_type = true;
-        cJSON* commandNameObject = cJSON_GetObjectItem(root, "command");
+        const JsonToken* commandNameObject = getField(&document,
+                document.tokens, "command");
         if(commandNameObject != NULL) {
             message->has_type = true;
             message->type = openxc_VehicleMessage_Type_CONTROL_COMMAND;
             message->has_control_command = true;
             openxc_ControlCommand* command = &message->control_command;
 
-            if(!strncmp(commandNameObject->valuestring, VERSION_COMMAND_NAME,
+            // Command names are matched by prefix, so it's fine if a long one
+            // is truncated
+            char commandName[MAX_COMMAND_NAME_LENGTH];
+            jsontokenizer::copyString(document.text, commandNameObject,
+                    commandName, sizeof(commandName));
+            if(!jsontokenizer::isString(commandNameObject)) {
+                debug("Command name isn't a string");
+                message->has_control_command = false;
+            } else if(!strncmp(commandName, VERSION_COMMAND_NAME,
                         strlen(VERSION_COMMAND_NAME))) {
                 command->has_type = true;
                 command->type = openxc_ControlCommand_Type_VERSION;
-            } else if(!strncmp(commandNameObject->valuestring,
+            } else if(!strncmp(commandName,
                         DEVICE_ID_COMMAND_NAME, strlen(DEVICE_ID_COMMAND_NAME))) {
                 command->has_type = true;
                 command->type = openxc_ControlCommand_Type_DEVICE_ID;
-            } else if(!strncmp(commandNameObject->valuestring,
+            } else if(!strncmp(commandName,
                         DIAGNOSTIC_COMMAND_NAME, strlen(DIAGNOSTIC_COMMAND_NAME))) {
-                deserializeDiagnostic(root, command);
-            } else if(!strncmp(commandNameObject->valuestring,
+                deserializeDiagnostic(&document, command);
+            } else if(!strncmp(commandName,
                         PASSTHROUGH_COMMAND_NAME, strlen(PASSTHROUGH_COMMAND_NAME))) {
-                deserializePassthrough(root, command);
-            } else if(!strncmp(commandNameObject->valuestring,
+                deserializePassthrough(&document, command);
+            } else if(!strncmp(commandName,
                         PREDEFINED_OBD2_REQUESTS_COMMAND_NAME,
                             strlen(PREDEFINED_OBD2_REQUESTS_COMMAND_NAME))) {
-                deserializePredefinedObd2RequestsCommand(root, command);
-            } else if(!strncmp(commandNameObject->valuestring,
+                deserializePredefinedObd2RequestsCommand(&document, command);
+            } else if(!strncmp(commandName,
                         ACCEPTANCE_FILTER_BYPASS_COMMAND_NAME,
                         strlen(ACCEPTANCE_FILTER_BYPASS_COMMAND_NAME))) {
-                deserializeAfBypass(root, command);
-            } else if(!strncmp(commandNameObject->valuestring,
+                deserializeAfBypass(&document, command);
+            } else if(!strncmp(commandName,
                         PAYLOAD_FORMAT_COMMAND_NAME,
                         strlen(PAYLOAD_FORMAT_COMMAND_NAME))) {
-                deserializePayloadFormat(root, command);
+                deserializePayloadFormat(&document, command);
             } else {
-                debug("Unrecognized command: %s", commandNameObject->valuestring);
+                debug("Unrecognized command: %s", commandName);
                 message->has_control_command = false;
             }
         } else {
-            cJSON* nameObject = cJSON_GetObjectItem(root, "name");
-            if(nameObject == NULL) {
-                deserializeCan(root, message);
+            if(getField(&document, document.tokens, "name") == NULL) {
+                deserializeCan(&document, message);
             } else {
-                deserializeSimple(root, message);
+                deserializeSimple(&document, message);
             }
         }
-        cJSON_Delete(root);
     }
 
     return messageLength;
@@ -560,37 +791,44 @@ size_t openxc::payload::json::deserialize(uint8_t payload[], size_t length,
 
 int openxc::payload::json::serialize(openxc_VehicleMessage* message,
         uint8_t payload[], size_t length) {
-    cJSON* root = cJSON_CreateObject();
-    size_t finalLength = 0;
-    if(root != NULL) {
-        bool status = true;
-        if(message->type == openxc_VehicleMessage_Type_SIMPLE) {
-            status = serializeSimple(message, root);
-        } else if(message->type == openxc_VehicleMessage_Type_CAN) {
-            status = serializeCan(message, root);
-        } else if(message->type == openxc_VehicleMessage_Type_DIAGNOSTIC) {
-            status = serializeDiagnostic(message, root);
-        } else if(message->type == openxc_VehicleMessage_Type_COMMAND_RESPONSE) {
-            status = serializeCommandResponse(message, root);
-        } else {
-            debug("Unrecognized message type -- not sending");
-        }
+    return serialize(message, payload, length,
+            getConfiguration()->jsonDecimalPlaces);
+}
 
-        char* serialized = cJSON_PrintUnformatted(root);
-        if(status && serialized != NULL) {
-            // set the length to the strlen + 1, so we include the NULL
-            // character as a delimiter
-            finalLength = MIN(length, strlen(serialized) + 1);
-            memcpy(payload, serialized, finalLength);
+int openxc::payload::json::serialize(openxc_VehicleMessage* message,
+        uint8_t payload[], size_t length, int decimalPlaces) {
+    if(decimalPlaces != SHORTEST_DECIMAL_PLACES && (decimalPlaces < 0 ||
+                decimalPlaces > MAX_DECIMAL_PLACES)) {
+        debug("Invalid number of decimal places %d, using %d", decimalPlaces,
+                CJSON_DECIMAL_PLACES);
+        decimalPlaces = CJSON_DECIMAL_PLACES;
+    }
 
-            free(serialized);
-        } else {
-            debug("Converting JSON to string failed -- possibly OOM");
-        }
+    JsonWriter writer;
+    initializeWriter(&writer, payload, length);
+    writer.decimalPlaces = decimalPlaces;
 
-        cJSON_Delete(root);
+    writeCharacter(&writer, '{');
+    bool status = true;
+    if(message->type == openxc_VehicleMessage_Type_SIMPLE) {
+        status = serializeSimple(message, &writer);
+    } else if(message->type == openxc_VehicleMessage_Type_CAN) {
+        status = serializeCan(message, &writer);
+    } else if(message->type == openxc_VehicleMessage_Type_DIAGNOSTIC) {
+        status = serializeDiagnostic(message, &writer);
+    } else if(message->type == openxc_VehicleMessage_Type_COMMAND_RESPONSE) {
+        status = serializeCommandResponse(message, &writer);
     } else {
-        debug("JSON object is NULL -- probably OOM");
+        debug("Unrecognized message type -- not sending");
     }
-    return finalLength;
+    writeCharacter(&writer, '}');
+
+    if(!status) {
+        debug("Unable to serialize message as JSON");
+        return 0;
+    }
+
+    // include the NULL character as a delimiter
+    writeCharacter(&writer, '\0');
+    return MIN(length, writer.length);
 }
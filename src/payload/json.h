@@ -14,9 +14,29 @@ extern const char PASSTHROUGH_COMMAND_NAME[];
 extern const char ACCEPTANCE_FILTER_BYPASS_COMMAND_NAME[];
 extern const char PAYLOAD_FORMAT_COMMAND_NAME[];
 extern const char PREDEFINED_OBD2_REQUESTS_COMMAND_NAME[];
+extern const char SUBSCRIPTION_COMMAND_NAME[];
+extern const char SNAPSHOT_COMMAND_NAME[];
+extern const char METRICS_COMMAND_NAME[];
+extern const char CAN_RECEIVE_COMMAND_NAME[];
 
 extern const char PAYLOAD_FORMAT_JSON_NAME[];
 extern const char PAYLOAD_FORMAT_PROTOBUF_NAME[];
+extern const char PAYLOAD_FORMAT_RAW_CAN_NAME[];
+
+extern const char SUBSCRIPTION_MODE_FIELD_NAME[];
+extern const char SUBSCRIPTION_SIGNALS_FIELD_NAME[];
+extern const char SUBSCRIPTION_CLASSES_FIELD_NAME[];
+extern const char SUBSCRIPTION_MODE_INCLUDE_NAME[];
+extern const char SUBSCRIPTION_MODE_EXCLUDE_NAME[];
+extern const char SUBSCRIPTION_MODE_ALL_NAME[];
+
+extern const char METRICS_OFFSET_FIELD_NAME[];
+extern const char METRICS_TOTAL_FIELD_NAME[];
+extern const char METRICS_NEXT_FIELD_NAME[];
+extern const char METRICS_FIELD_NAME[];
+
+extern const char CAN_RECEIVE_BATCH_SIZE_FIELD_NAME[];
+extern const char CAN_RECEIVE_BUDGET_FIELD_NAME[];
 
 extern const char COMMAND_RESPONSE_FIELD_NAME[];
 extern const char COMMAND_RESPONSE_MESSAGE_FIELD_NAME[];
@@ -41,6 +61,9 @@ extern const char DIAGNOSTIC_PAYLOAD_FIELD_NAME[];
 extern const char DIAGNOSTIC_VALUE_FIELD_NAME[];
 
 /* Public: Deserialize an OpenXC message from a payload containing JSON.
+ *
+ * The JSON is tokenized in place without any heap allocations, so a message
+ * with more than MAX_JSON_TOKENS tokens is dropped.
  *
  * payload - The bytestream payload to parse a message from.
  * length -  The length of the payload.
@@ -52,6 +75,11 @@ extern const char DIAGNOSTIC_VALUE_FIELD_NAME[];
 size_t deserialize(uint8_t payload[], size_t length, openxc_VehicleMessage* message);
 
 /* Public: Serialize an OpenXC message as JSON and store in the payload.
+ *
+ * The JSON is written straight into the payload without any heap
+ * allocations, and is the same as cJSON_PrintUnformatted would produce for the
+ * equivalent cJSON object. Numbers that aren't whole are written with the
+ * configuration's jsonDecimalPlaces.
  *
  * message - The message to serialize.
  * payload - The buffer to store the payload - must be allocated by the caller.
@@ -62,6 +90,73 @@ size_t deserialize(uint8_t payload[], size_t length, openxc_VehicleMessage* mess
  */
 int serialize(openxc_VehicleMessage* message, uint8_t payload[], size_t length);
 
+/* Public: Serialize an OpenXC message as JSON like serialize(...), with a
+ * specific number of decimal places for numbers that aren't whole, e.g. the
+ * ones configured for the message's signal.
+ *
+ * decimalPlaces - From 0 to MAX_DECIMAL_PLACES, or SHORTEST_DECIMAL_PLACES
+ *      for the shortest text that parses back to exactly the same number.
+ */
+int serialize(openxc_VehicleMessage* message, uint8_t payload[], size_t length,
+        int decimalPlaces);
+
+/* Public: A JSON object being written straight into a payload buffer, so
+ * outgoing messages don't need a cJSON tree (and all of its allocations) to be
+ * built and printed first. The output matches cJSON_PrintUnformatted byte for
+ * byte.
+ *
+ * Nothing is written past the end of the buffer, but the length keeps
+ * counting, so the caller can tell if the JSON was truncated. A caller can set
+ * the length and field count back to what they were earlier to drop
+ * everything written since then, or reset the field count to start a nested
+ * object.
+ *
+ * buffer - The payload buffer to write to.
+ * size - The size of the buffer.
+ * length - The length of the JSON so far.
+ * fieldCount - The number of fields written to the object so far.
+ * decimalPlaces - The number of decimal places for numbers that aren't whole,
+ *      or SHORTEST_DECIMAL_PLACES.
+ */
+typedef struct {
+    char* buffer;
+    size_t size;
+    size_t length;
+    int fieldCount;
+    int decimalPlaces;
+} JsonWriter;
+
+/* Public: Start writing JSON to the start of a buffer, with the
+ * configuration's jsonDecimalPlaces.
+ */
+void initializeWriter(JsonWriter* writer, uint8_t buffer[], size_t size);
+
+/* Public: Write a single character, e.g. the braces of an object.
+ */
+void writeCharacter(JsonWriter* writer, char character);
+
+/* Public: Write a quoted string, escaped the same way as cJSON.
+ */
+void writeString(JsonWriter* writer, const char* value);
+
+/* Public: Write a number, formatted the same way as cJSON - as an integer if
+ * it is one, otherwise with the writer's decimal places (6 for cJSON), or an
+ * exponent if it's very large or very small.
+ */
+void writeNumber(JsonWriter* writer, double value);
+
+/* Public: Write the name of the next field in the object, and the separator
+ * from the previous field if there is one. The caller must write the value
+ * next.
+ */
+void writeFieldName(JsonWriter* writer, const char* name);
+
+void writeNumberField(JsonWriter* writer, const char* name, double value);
+
+void writeStringField(JsonWriter* writer, const char* name, const char* value);
+
+void writeBoolField(JsonWriter* writer, const char* name, bool value);
+
 } // namespace json
 } // namespace payload
 } // namespace openxc
@@ -1,7 +1,9 @@
 #include "payload.h"
 #include "payload/json.h"
 #include "payload/protobuf.h"
+#include "payload/rawcan.h"
 #include "util/log.h"
+#include "config.h"
 
 namespace payload = openxc::payload;
 
@@ -37,7 +39,7 @@ openxc_DynamicField openxc::payload::wrapBoolean(bool value) {
 size_t openxc::payload::deserialize(uint8_t payload[], size_t length,
         PayloadFormat format, openxc_VehicleMessage* message) {
     size_t bytesRead = 0;
-    if(format == PayloadFormat::JSON) {
+    if(format == PayloadFormat::JSON || format == PayloadFormat::RAW_CAN) {
         bytesRead = payload::json::deserialize(payload, length, message);
     } else if(format == PayloadFormat::PROTOBUF) {
         bytesRead = payload::protobuf::deserialize(payload, length, message);
@@ -49,11 +51,33 @@ size_t openxc::payload::deserialize(uint8_t payload[], size_t length,
 
 int openxc::payload::serialize(openxc_VehicleMessage* message,
         uint8_t payload[], size_t length, PayloadFormat format) {
+    return serialize(message, payload, length, format,
+            openxc::config::getConfiguration()->jsonDecimalPlaces);
+}
+
+int openxc::payload::serialize(openxc_VehicleMessage* message,
+        uint8_t payload[], size_t length, PayloadFormat format,
+        int decimalPlaces) {
+    return serialize(message, payload, length, format, decimalPlaces, 0);
+}
+
+int openxc::payload::serialize(openxc_VehicleMessage* message,
+        uint8_t payload[], size_t length, PayloadFormat format,
+        int decimalPlaces, unsigned long receiveTimestamp) {
     int serializedLength = 0;
     if(format == PayloadFormat::JSON) {
-        serializedLength = payload::json::serialize(message, payload, length);
+        serializedLength = payload::json::serialize(message, payload, length,
+                decimalPlaces);
     } else if(format == PayloadFormat::PROTOBUF) {
         serializedLength = payload::protobuf::serialize(message, payload, length);
+    } else if(format == PayloadFormat::RAW_CAN) {
+        if(message->type == openxc_VehicleMessage_Type_CAN) {
+            serializedLength = payload::rawcan::serialize(message, payload,
+                    length, receiveTimestamp);
+        } else {
+            serializedLength = payload::json::serialize(message, payload,
+                    length, decimalPlaces);
+        }
     } else {
         debug("Invalid payload format: %d", format);
     }
@@ -7,11 +7,22 @@
 namespace openxc {
 namespace payload {
 
+// The payload format command's value for RAW_CAN. The OpenXC message format
+// doesn't define it yet, so it's only accepted from JSON commands.
+#define PAYLOAD_FORMAT_COMMAND_RAW_CAN \
+        ((openxc_PayloadFormatCommand_PayloadFormat) 3)
+
 /* Public: The available encoding formats for OpenXC payloads.
+ *
+ * JSON - Every message as a NULL delimited JSON object.
+ * PROTOBUF - Every message as a protobuf, prefixed with its length.
+ * RAW_CAN - Raw CAN messages as fixed width binary records (see the rawcan
+ *      module), and every other message as JSON. Incoming commands are JSON.
  */
 typedef enum {
     JSON,
     PROTOBUF,
+    RAW_CAN,
 } PayloadFormat;
 
 /* Public: Deserialize an OpenXC message from the given payload, using the given
@@ -48,6 +59,26 @@ size_t deserialize(uint8_t payload[], size_t length, PayloadFormat format,
 int serialize(openxc_VehicleMessage* message, uint8_t payload[], size_t length,
         PayloadFormat format);
 
+/* Public: Serialize an OpenXC message into a payload like serialize(...), with
+ * a specific number of decimal places for numbers in formats that write them as
+ * text, i.e. JSON.
+ *
+ * decimalPlaces - From 0 to MAX_DECIMAL_PLACES, or SHORTEST_DECIMAL_PLACES.
+ */
+int serialize(openxc_VehicleMessage* message, uint8_t payload[], size_t length,
+        PayloadFormat format, int decimalPlaces);
+
+/* Public: Serialize an OpenXC message into a payload like serialize(...), with
+ * the time a CAN message was received for formats that record it, i.e.
+ * RAW_CAN.
+ *
+ * receiveTimestamp - When the CAN interrupt handler received the message, in
+ *      microseconds from systemTimeUs(), or 0 if it's not known.
+ */
+int serialize(openxc_VehicleMessage* message, uint8_t payload[], size_t length,
+        PayloadFormat format, int decimalPlaces,
+        unsigned long receiveTimestamp);
+
 /* Public: Helper functions to wrap values in an openxc_DynamicField
  */
 openxc_DynamicField wrapNumber(float value);
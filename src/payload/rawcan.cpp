@@ -0,0 +1,79 @@
+#include "rawcan.h"
+
+#include <string.h>
+#include "config.h"
+#include "util/log.h"
+#include "util/timer.h"
+
+#define CAN_MESSAGE_MAX_DATA_LENGTH 8
+
+namespace time = openxc::util::time;
+
+using openxc::util::log::debug;
+using openxc::config::getConfiguration;
+
+/* Private: Store a 32 bit value in little endian, regardless of the platform's
+ * byte order.
+ */
+static void writeUint32(uint8_t* destination, uint32_t value) {
+    destination[0] = value & 0xff;
+    destination[1] = (value >> 8) & 0xff;
+    destination[2] = (value >> 16) & 0xff;
+    destination[3] = (value >> 24) & 0xff;
+}
+
+int openxc::payload::rawcan::serialize(openxc_VehicleMessage* message,
+        uint8_t payload[], size_t length) {
+    return serialize(message, payload, length, (unsigned long) 0);
+}
+
+int openxc::payload::rawcan::serialize(openxc_VehicleMessage* message,
+        uint8_t payload[], size_t length, unsigned long receiveTimestamp) {
+    bool includeTimestamp = getConfiguration()->rawCanTimestamps;
+    if(includeTimestamp && receiveTimestamp == 0) {
+        receiveTimestamp = time::systemTimeUs();
+    }
+    return serialize(message, payload, length, includeTimestamp,
+            receiveTimestamp);
+}
+
+int openxc::payload::rawcan::serialize(openxc_VehicleMessage* message,
+        uint8_t payload[], size_t length, bool includeTimestamp,
+        uint32_t timestamp) {
+    if(message == NULL || message->type != openxc_VehicleMessage_Type_CAN) {
+        debug("Only CAN messages can be serialized as raw CAN records");
+        return 0;
+    }
+
+    size_t recordSize = includeTimestamp ? RAW_CAN_TIMESTAMPED_RECORD_SIZE :
+            RAW_CAN_RECORD_SIZE;
+    if(length < recordSize) {
+        debug("Raw CAN record doesn't fit in payload buffer of %d bytes",
+                length);
+        return 0;
+    }
+
+    openxc_CanMessage* canMessage = &message->can_message;
+    uint8_t dataLength = MIN(canMessage->data.size,
+            CAN_MESSAGE_MAX_DATA_LENGTH);
+
+    uint8_t flags = dataLength;
+    if(canMessage->has_frame_format && canMessage->frame_format ==
+            openxc_CanMessage_FrameFormat_EXTENDED) {
+        flags |= RAW_CAN_FLAG_EXTENDED;
+    }
+    if(includeTimestamp) {
+        flags |= RAW_CAN_FLAG_TIMESTAMP;
+    }
+
+    payload[0] = RAW_CAN_SYNC_BYTE;
+    payload[1] = flags;
+    payload[2] = canMessage->bus;
+    writeUint32(&payload[3], canMessage->id);
+    memset(&payload[7], 0, CAN_MESSAGE_MAX_DATA_LENGTH);
+    memcpy(&payload[7], canMessage->data.bytes, dataLength);
+    if(includeTimestamp) {
+        writeUint32(&payload[15], timestamp);
+    }
+    return recordSize;
+}
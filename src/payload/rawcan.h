@@ -0,0 +1,74 @@
+#ifndef __RAWCAN_H__
+#define __RAWCAN_H__
+
+#include "openxc.pb.h"
+
+// Every raw CAN record starts with this byte, so a host can find the start of
+// the next record if it joins the stream part way through. A JSON message
+// sent in the same stream starts with '{' instead.
+#define RAW_CAN_SYNC_BYTE 0xa5
+
+// The bits of a record's flags byte.
+#define RAW_CAN_FLAG_EXTENDED 0x80
+#define RAW_CAN_FLAG_TIMESTAMP 0x40
+#define RAW_CAN_LENGTH_MASK 0xf
+
+// The size of a record without and with a timestamp.
+#define RAW_CAN_RECORD_SIZE 15
+#define RAW_CAN_TIMESTAMPED_RECORD_SIZE 19
+
+namespace openxc {
+namespace payload {
+namespace rawcan {
+
+/* Public: Serialize a raw CAN message as a fixed width binary record and store
+ * it in the payload.
+ *
+ * Every record has the same layout, with multi-byte fields in little endian:
+ *
+ *  0     RAW_CAN_SYNC_BYTE
+ *  1     Flags - RAW_CAN_FLAG_EXTENDED, RAW_CAN_FLAG_TIMESTAMP and the number
+ *        of data bytes (0 to 8) in the low bits.
+ *  2     The bus, 1 or 2.
+ *  3-6   The message ID.
+ *  7-14  The data, padded with zeros to 8 bytes.
+ *  15-18 Only if RAW_CAN_FLAG_TIMESTAMP is set, the time the message was
+ *        received in microseconds, which wraps around about every 71 minutes.
+ *
+ * A timestamp is included if the configuration's rawCanTimestamps is true. The
+ * time the message was received isn't part of the message, so this stamps it
+ * with the current time - use the receiveTimestamp version when it's known.
+ *
+ * message - The message to serialize, which must be a CAN message.
+ * payload - The buffer to store the payload - must be allocated by the caller.
+ * length -  The length of the payload buffer.
+ *
+ * Returns the number of bytes written to the payload, or 0 if the message
+ * isn't a CAN message or the buffer is too small.
+ */
+int serialize(openxc_VehicleMessage* message, uint8_t payload[], size_t length);
+
+/* Public: Serialize a raw CAN message like serialize(...), stamped with the
+ * time it was received.
+ *
+ * receiveTimestamp - When the CAN interrupt handler received the message, in
+ *      microseconds from systemTimeUs(), or 0 if it's not known and the
+ *      current time should be used instead.
+ */
+int serialize(openxc_VehicleMessage* message, uint8_t payload[], size_t length,
+        unsigned long receiveTimestamp);
+
+/* Public: Serialize a raw CAN message like serialize(...), with or without a
+ * specific timestamp.
+ *
+ * includeTimestamp - True if the record should have a timestamp.
+ * timestamp - The timestamp in microseconds.
+ */
+int serialize(openxc_VehicleMessage* message, uint8_t payload[], size_t length,
+        bool includeTimestamp, uint32_t timestamp);
+
+} // namespace rawcan
+} // namespace payload
+} // namespace openxc
+
+#endif // __RAWCAN_H__
@@ -1,15 +1,17 @@
+#include <string.h>
 #include "emqueue.h"
 #include "pipeline.h"
 #include "util/log.h"
 #include "util/timer.h"
 #include "util/statistics.h"
 #include "util/bytebuffer.h"
+#include "util/metrics.h"
 #include "config.h"
 #include "lights.h"
+#include "signals.h"
+#include "can/canutil.h"
 
-#define PIPELINE_ENDPOINT_COUNT 3
 #define PIPELINE_STATS_LOG_FREQUENCY_S 15
-#define QUEUE_FLUSH_MAX_TRIES 100
 
 namespace uart = openxc::interface::uart;
 namespace usb = openxc::interface::usb;
@@ -17,6 +19,7 @@ namespace network = openxc::interface::network;
 namespace time = openxc::util::time;
 namespace statistics = openxc::util::statistics;
 namespace config = openxc::config;
+namespace metrics = openxc::util::metrics;
 
 using openxc::util::bytebuffer::conditionalEnqueue;
 using openxc::util::bytebuffer::messageFits;
@@ -24,87 +27,970 @@ using openxc::util::statistics::DeltaStatistic;
 using openxc::util::log::debug;
 using openxc::pipeline::Pipeline;
 using openxc::pipeline::MessageClass;
-using openxc::interface::InterfaceDescriptor;
-using openxc::interface::InterfaceType;
+using openxc::pipeline::PayloadHeader;
+using openxc::pipeline::PayloadPool;
+using openxc::pipeline::PipelineEndpoint;
+using openxc::pipeline::Subscription;
+using openxc::pipeline::SubscriptionMode;
+using openxc::pipeline::PipelineLane;
+using openxc::pipeline::DropPolicy;
+using openxc::pipeline::PayloadBatch;
+using openxc::signals::getSignals;
+using openxc::signals::getSignalCount;
+using openxc::payload::PayloadFormat;
 using openxc::config::LoggingOutputInterface;
 
-unsigned int droppedMessages[PIPELINE_ENDPOINT_COUNT];
-unsigned int sentMessages[PIPELINE_ENDPOINT_COUNT];
-unsigned int dataSent[PIPELINE_ENDPOINT_COUNT];
-unsigned int sendQueueLength[PIPELINE_ENDPOINT_COUNT];
-unsigned int receiveQueueLength[PIPELINE_ENDPOINT_COUNT];
+unsigned int droppedMessages[MAX_PIPELINE_ENDPOINTS];
+unsigned int sentMessages[MAX_PIPELINE_ENDPOINTS];
+unsigned int dataSent[MAX_PIPELINE_ENDPOINTS];
+unsigned int sendQueueLength[MAX_PIPELINE_ENDPOINTS];
+unsigned int receiveQueueLength[MAX_PIPELINE_ENDPOINTS];
+unsigned int droppedMessagesByClass[MAX_PIPELINE_ENDPOINTS][
+        MESSAGE_CLASS_COUNT];
 
-void conditionalFlush(Pipeline* pipeline,
-        QUEUE_TYPE(uint8_t)* sendQueue, uint8_t* message, int messageSize) {
-    int timeout = QUEUE_FLUSH_MAX_TRIES;
-    while(timeout > 0 && !messageFits(sendQueue, message, messageSize)) {
-        process(pipeline);
-        --timeout;
+static const PayloadFormat PAYLOAD_FORMATS[] = {
+    PayloadFormat::JSON,
+    PayloadFormat::PROTOBUF,
+    PayloadFormat::RAW_CAN,
+};
+
+static bool usbConnected(PipelineEndpoint* endpoint) {
+    UsbDevice* device = ((Pipeline*)endpoint->context)->usb;
+    return device != NULL && device->configured;
+}
+
+/* Private: Return the USB endpoint queue for the class of message, or NULL for
+ * log messages if logging to USB is disabled.
+ */
+static QUEUE_TYPE(uint8_t)* usbSendQueue(PipelineEndpoint* endpoint,
+        MessageClass messageClass) {
+    UsbDevice* device = ((Pipeline*)endpoint->context)->usb;
+    if(messageClass == MessageClass::LOG) {
+        if(config::getConfiguration()->loggingOutput !=
+                    LoggingOutputInterface::BOTH &&
+                config::getConfiguration()->loggingOutput !=
+                    LoggingOutputInterface::USB) {
+            return NULL;
+        }
+        return &device->endpoints[LOG_ENDPOINT_INDEX].queue;
     }
+    return &device->endpoints[IN_ENDPOINT_INDEX].queue;
 }
 
-void sendToEndpoint(openxc::interface::InterfaceType endpointType,
-        QUEUE_TYPE(uint8_t)* sendQueue, QUEUE_TYPE(uint8_t)* receiveQueue,
+static bool usbFits(PipelineEndpoint* endpoint, MessageClass messageClass,
         uint8_t* message, int messageSize) {
-    if(!conditionalEnqueue(sendQueue, message, messageSize)) {
-        ++droppedMessages[endpointType];
-    } else {
-        ++sentMessages[endpointType];
-        dataSent[endpointType] += messageSize;
+    QUEUE_TYPE(uint8_t)* sendQueue = usbSendQueue(endpoint, messageClass);
+    return sendQueue == NULL || messageFits(sendQueue, message, messageSize);
+}
+
+static bool usbEnqueue(PipelineEndpoint* endpoint, MessageClass messageClass,
+        uint8_t* message, int messageSize) {
+    // Log messages are discarded if they aren't supposed to go out over USB
+    QUEUE_TYPE(uint8_t)* sendQueue = usbSendQueue(endpoint, messageClass);
+    return sendQueue == NULL ||
+            conditionalEnqueue(sendQueue, message, messageSize);
+}
+
+static void usbFlush(PipelineEndpoint* endpoint) {
+    // Must always process USB, because this function usually runs the MCU's USB
+    // task that handles SETUP and enumeration.
+    usb::processSendQueue(((Pipeline*)endpoint->context)->usb);
+}
+
+static int usbQueuedBytes(PipelineEndpoint* endpoint) {
+    UsbDevice* device = ((Pipeline*)endpoint->context)->usb;
+    if(device == NULL) {
+        return 0;
     }
-    sendQueueLength[endpointType] = QUEUE_LENGTH(uint8_t, sendQueue);
-    // TODO This may not belong here after USB refactoring
-    receiveQueueLength[endpointType] = QUEUE_LENGTH(uint8_t, receiveQueue);
+    return QUEUE_LENGTH(uint8_t, &device->endpoints[IN_ENDPOINT_INDEX].queue) +
+        QUEUE_LENGTH(uint8_t, &device->endpoints[LOG_ENDPOINT_INDEX].queue);
 }
 
-void sendToUsb(Pipeline* pipeline, uint8_t* message, int messageSize,
+static int usbFreeBytes(PipelineEndpoint* endpoint,
         MessageClass messageClass) {
-    if(pipeline->usb->configured) {
-        QUEUE_TYPE(uint8_t)* sendQueue;
-        if(messageClass == MessageClass::LOG) {
-            sendQueue = &pipeline->usb->endpoints[LOG_ENDPOINT_INDEX].queue;
-            if(config::getConfiguration()->loggingOutput !=
-                        LoggingOutputInterface::BOTH &&
-                    config::getConfiguration()->loggingOutput !=
-                        LoggingOutputInterface::USB) {
+    QUEUE_TYPE(uint8_t)* sendQueue = usbSendQueue(endpoint, messageClass);
+    return sendQueue == NULL ? QUEUE_MAX_LENGTH(uint8_t) :
+            QUEUE_AVAILABLE(uint8_t, sendQueue);
+}
+
+static int usbReceivedBytes(PipelineEndpoint* endpoint) {
+    UsbDevice* device = ((Pipeline*)endpoint->context)->usb;
+    return device == NULL ? 0 : QUEUE_LENGTH(uint8_t,
+            &device->endpoints[OUT_ENDPOINT_INDEX].queue);
+}
+
+static bool uartConnected(PipelineEndpoint* endpoint) {
+    return uart::connected(((Pipeline*)endpoint->context)->uart);
+}
+
+static bool uartFits(PipelineEndpoint* endpoint, MessageClass messageClass,
+        uint8_t* message, int messageSize) {
+    return messageFits(&((Pipeline*)endpoint->context)->uart->sendQueue,
+            message, messageSize);
+}
+
+static bool uartEnqueue(PipelineEndpoint* endpoint, MessageClass messageClass,
+        uint8_t* message, int messageSize) {
+    return conditionalEnqueue(&((Pipeline*)endpoint->context)->uart->sendQueue,
+            message, messageSize);
+}
+
+static void uartFlush(PipelineEndpoint* endpoint) {
+    if(uartConnected(endpoint)) {
+        uart::processSendQueue(((Pipeline*)endpoint->context)->uart);
+    }
+}
+
+static int uartQueuedBytes(PipelineEndpoint* endpoint) {
+    return uartConnected(endpoint) ? QUEUE_LENGTH(uint8_t,
+            &((Pipeline*)endpoint->context)->uart->sendQueue) : 0;
+}
+
+static int uartFreeBytes(PipelineEndpoint* endpoint,
+        MessageClass messageClass) {
+    return QUEUE_AVAILABLE(uint8_t,
+            &((Pipeline*)endpoint->context)->uart->sendQueue);
+}
+
+static int uartReceivedBytes(PipelineEndpoint* endpoint) {
+    return uartConnected(endpoint) ? QUEUE_LENGTH(uint8_t,
+            &((Pipeline*)endpoint->context)->uart->receiveQueue) : 0;
+}
+
+static bool networkConnected(PipelineEndpoint* endpoint) {
+    return ((Pipeline*)endpoint->context)->network != NULL;
+}
+
+static bool networkFits(PipelineEndpoint* endpoint, MessageClass messageClass,
+        uint8_t* message, int messageSize) {
+    return messageFits(&((Pipeline*)endpoint->context)->network->sendQueue,
+            message, messageSize);
+}
+
+static bool networkEnqueue(PipelineEndpoint* endpoint,
+        MessageClass messageClass, uint8_t* message, int messageSize) {
+    return conditionalEnqueue(
+            &((Pipeline*)endpoint->context)->network->sendQueue, message,
+            messageSize);
+}
+
+static void networkFlush(PipelineEndpoint* endpoint) {
+    if(networkConnected(endpoint)) {
+       network::processSendQueue(((Pipeline*)endpoint->context)->network);
+    }
+}
+
+static int networkQueuedBytes(PipelineEndpoint* endpoint) {
+    return networkConnected(endpoint) ? QUEUE_LENGTH(uint8_t,
+            &((Pipeline*)endpoint->context)->network->sendQueue) : 0;
+}
+
+static int networkFreeBytes(PipelineEndpoint* endpoint,
+        MessageClass messageClass) {
+    return QUEUE_AVAILABLE(uint8_t,
+            &((Pipeline*)endpoint->context)->network->sendQueue);
+}
+
+static int networkReceivedBytes(PipelineEndpoint* endpoint) {
+    return networkConnected(endpoint) ? QUEUE_LENGTH(uint8_t,
+            &((Pipeline*)endpoint->context)->network->receiveQueue) : 0;
+}
+
+// Registered in InterfaceType order, and given the pipeline as their context
+// by initialize(...).
+static const PipelineEndpoint BUILTIN_ENDPOINTS[
+        PIPELINE_BUILTIN_ENDPOINT_COUNT] = {
+    {
+        name: "USB",
+        messageClasses: ALL_MESSAGE_CLASSES,
+        overridePayloadFormat: false,
+        payloadFormat: PayloadFormat::JSON,
+        connected: usbConnected,
+        fits: usbFits,
+        enqueue: usbEnqueue,
+        flush: usbFlush,
+        queuedBytes: usbQueuedBytes,
+        freeBytes: usbFreeBytes,
+        receivedBytes: usbReceivedBytes,
+        context: NULL,
+    },
+    {
+        name: "UART",
+        messageClasses: ALL_MESSAGE_CLASSES &
+                ~MESSAGE_CLASS_MASK(MessageClass::LOG),
+        overridePayloadFormat: false,
+        payloadFormat: PayloadFormat::JSON,
+        connected: uartConnected,
+        fits: uartFits,
+        enqueue: uartEnqueue,
+        flush: uartFlush,
+        queuedBytes: uartQueuedBytes,
+        freeBytes: uartFreeBytes,
+        receivedBytes: uartReceivedBytes,
+        context: NULL,
+    },
+    {
+        name: "NET",
+        messageClasses: ALL_MESSAGE_CLASSES &
+                ~MESSAGE_CLASS_MASK(MessageClass::LOG),
+        overridePayloadFormat: false,
+        payloadFormat: PayloadFormat::JSON,
+        connected: networkConnected,
+        fits: networkFits,
+        enqueue: networkEnqueue,
+        flush: networkFlush,
+        queuedBytes: networkQueuedBytes,
+        freeBytes: networkFreeBytes,
+        receivedBytes: networkReceivedBytes,
+        context: NULL,
+    },
+};
+
+/* Private: Return true if the endpoint's subscription includes the signal.
+ */
+static bool subscribedToSignal(Subscription* subscription, int signalIndex) {
+    if(subscription->mode == SubscriptionMode::ALL_SIGNALS) {
+        return true;
+    }
+
+    bool listed = signalIndex >= 0 && signalIndex < MAX_SUBSCRIBED_SIGNALS &&
+            (subscription->signals[signalIndex / 8] & (1 << (signalIndex % 8)));
+    return subscription->mode == SubscriptionMode::INCLUDE_SIGNALS ?
+            listed : !listed;
+}
+
+/* Private: Return true if the endpoint is connected and wants messages of
+ * this class, and it's subscribed to the signal if it's a simple vehicle
+ * message.
+ *
+ * signalIndex - The position of the message's signal in getSignals(), or
+ *      NO_SIGNAL.
+ */
+static bool wantsMessage(PipelineEndpoint* endpoint,
+        MessageClass messageClass, int signalIndex) {
+    return (endpoint->messageClasses &
+                endpoint->subscription.messageClasses &
+                MESSAGE_CLASS_MASK(messageClass)) &&
+        (messageClass != MessageClass::SIMPLE ||
+            subscribedToSignal(&endpoint->subscription, signalIndex)) &&
+        endpoint->connected(endpoint);
+}
+
+static PayloadFormat endpointPayloadFormat(PipelineEndpoint* endpoint) {
+    return endpoint->overridePayloadFormat ? endpoint->payloadFormat :
+            config::getConfiguration()->payloadFormat;
+}
+
+static int queuedBytes(PipelineEndpoint* endpoint) {
+    return endpoint->queuedBytes != NULL ? endpoint->queuedBytes(endpoint) : 0;
+}
+
+static PipelineLane lane(MessageClass messageClass) {
+    return messageClass == MessageClass::COMMAND_RESPONSE ||
+            messageClass == MessageClass::DIAGNOSTIC ?
+        PipelineLane::PRIORITY_LANE : PipelineLane::NORMAL_LANE;
+}
+
+/* Private: Return true if messages of this class can be dropped or held back
+ * to make room for responses.
+ */
+static bool expendable(MessageClass messageClass) {
+    return messageClass == MessageClass::SIMPLE ||
+            messageClass == MessageClass::CAN;
+}
+
+/* Private: Return true if queueing the message would leave enough room in the
+ * endpoint's send queue for responses. Only expendable messages have to leave
+ * room.
+ */
+static bool hasHeadroom(PipelineEndpoint* endpoint, MessageClass messageClass,
+        int messageSize) {
+    return !expendable(messageClass) || endpoint->freeBytes == NULL ||
+        endpoint->freeBytes(endpoint, messageClass) - messageSize >=
+            PRIORITY_HEADROOM_BYTES;
+}
+
+static void recordDrop(int endpointIndex, MessageClass messageClass) {
+    ++droppedMessages[endpointIndex];
+    ++droppedMessagesByClass[endpointIndex][messageClass];
+}
+
+QUEUE_DEFINE(PayloadReference)
+QUEUE_DEFINE(SignalRecord)
+
+static unsigned int deferredPayloads;
+static unsigned int deferredReferences;
+static unsigned int sharedPayloadBytes;
+static int peakPayloadBytesUsed;
+static unsigned int batchesSent;
+static unsigned int recordsSerialized;
+static unsigned int batchedMessages;
+
+/* Private: Add the message to an endpoint's outgoing data if it fits (leaving
+ * room for responses, if it's expendable), and update the endpoint's
+ * statistics.
+ *
+ * Returns true if the message was queued.
+ */
+static bool enqueue(Pipeline* pipeline, int endpointIndex,
+        MessageClass messageClass, uint8_t* message, int messageSize) {
+    PipelineEndpoint* endpoint = &pipeline->endpoints[endpointIndex];
+    if(!hasHeadroom(endpoint, messageClass, messageSize) ||
+            !endpoint->enqueue(endpoint, messageClass, message, messageSize)) {
+        return false;
+    }
+
+    ++sentMessages[endpointIndex];
+    dataSent[endpointIndex] += messageSize;
+
+    if(config::getConfiguration()->calculateMetrics) {
+        pipeline->newestQueuedTime[endpointIndex] = time::systemTimeUs();
+        if(pipeline->oldestQueuedTime[endpointIndex] == 0) {
+            pipeline->oldestQueuedTime[endpointIndex] =
+                    pipeline->newestQueuedTime[endpointIndex];
+        }
+    }
+    sendQueueLength[endpointIndex] = queuedBytes(endpoint);
+    return true;
+}
+
+static PayloadHeader* payloadHeader(Pipeline* pipeline, int offset) {
+    return (PayloadHeader*) &pipeline->payloadPool.data[offset];
+}
+
+/* Private: Return the number of bytes a payload of this length takes up in
+ * the pool, including its header. Rounding up to a whole header keeps every
+ * header aligned.
+ */
+static int payloadSpace(int length) {
+    const int headerSize = sizeof(PayloadHeader);
+    return headerSize + (length + headerSize - 1) / headerSize * headerSize;
+}
+
+/* Private: Store a copy of the message at the head of the shared payload pool,
+ * skipping the end of the pool if it doesn't fit there. The payload starts
+ * with a single reference held by the caller, which must be released with
+ * releasePayload(...) once it's done handing the payload out to the endpoints.
+ *
+ * Returns the offset of the payload in the pool, or -1 if the pool is full.
+ */
+static int storePayload(Pipeline* pipeline, uint8_t* message,
+        int messageSize) {
+    if(messageSize > MAX_OUTGOING_PAYLOAD_SIZE) {
+        return -1;
+    }
+
+    PayloadPool* pool = &pipeline->payloadPool;
+    if(pool->used == 0) {
+        pool->head = 0;
+        pool->tail = 0;
+    }
+
+    int space = payloadSpace(messageSize);
+    int offset = -1;
+    if(pool->used == 0 || pool->head > pool->tail) {
+        int padding = PAYLOAD_POOL_BYTES - pool->head;
+        if(padding >= space) {
+            offset = pool->head;
+        } else if(pool->tail >= space) {
+            // The padding is reused along with the payload in front of it
+            PayloadHeader* header = payloadHeader(pipeline, pool->head);
+            header->length = padding - sizeof(PayloadHeader);
+            header->references = 0;
+            pool->used += padding;
+            offset = 0;
+        }
+    } else if(pool->tail - pool->head >= space) {
+        offset = pool->head;
+    }
+
+    if(offset != -1) {
+        PayloadHeader* header = payloadHeader(pipeline, offset);
+        header->length = messageSize;
+        header->references = 1;
+        header->referencesTaken = 0;
+        memcpy(&pool->data[offset + sizeof(PayloadHeader)], message,
+                messageSize);
+        pool->head = (offset + space) % PAYLOAD_POOL_BYTES;
+        pool->used += space;
+        ++pool->count;
+        ++deferredPayloads;
+        if(pool->used > peakPayloadBytesUsed) {
+            peakPayloadBytesUsed = pool->used;
+        }
+    }
+    return offset;
+}
+
+/* Private: Drop a reference to a payload in the pool. Once no endpoint is
+ * waiting for the oldest payloads anymore, their space can be reused.
+ */
+static void releasePayload(Pipeline* pipeline, int offset) {
+    PayloadHeader* header = payloadHeader(pipeline, offset);
+    if(header->references == 0 || --header->references > 0) {
+        return;
+    }
+
+    if(header->referencesTaken > 1) {
+        sharedPayloadBytes += (header->referencesTaken - 1) * header->length;
+    }
+
+    PayloadPool* pool = &pipeline->payloadPool;
+    --pool->count;
+    while(pool->used > 0) {
+        header = payloadHeader(pipeline, pool->tail);
+        if(header->references > 0) {
+            break;
+        }
+
+        int space = payloadSpace(header->length);
+        pool->tail = (pool->tail + space) % PAYLOAD_POOL_BYTES;
+        pool->used -= space;
+    }
+}
+
+/* Private: Drop any payload from the same signal or CAN message that's still
+ * waiting for an endpoint, because a newer value is about to be added.
+ */
+static void replacePayload(Pipeline* pipeline, int endpointIndex,
+        MessageClass messageClass, uint32_t key) {
+    QUEUE_TYPE(PayloadReference)* pending =
+            &pipeline->pendingPayloads[endpointIndex][lane(messageClass)];
+    for(int i = 0; i < QUEUE_LENGTH(PayloadReference, pending); i++) {
+        PayloadReference* reference = &pending->elements[(pending->tail + i) %
+                (QUEUE_MAX_LENGTH(PayloadReference) + 1)];
+        if(!reference->replaced && reference->key == key &&
+                reference->messageClass == messageClass) {
+            // The reference keeps its place in the queue, but is skipped
+            releasePayload(pipeline, reference->offset);
+            reference->replaced = true;
+            recordDrop(endpointIndex, messageClass);
+        }
+    }
+}
+
+/* Private: Drop the oldest payload waiting in an endpoint's normal lane, to
+ * make room in the lane and, once no other endpoint is waiting for it or any
+ * older payload, the pool.
+ *
+ * Returns false if there was nothing to drop.
+ */
+static bool dropOldestPayload(Pipeline* pipeline, int endpointIndex) {
+    QUEUE_TYPE(PayloadReference)* pending =
+            &pipeline->pendingPayloads[endpointIndex][
+                PipelineLane::NORMAL_LANE];
+    if(QUEUE_EMPTY(PayloadReference, pending)) {
+        return false;
+    }
+
+    PayloadReference reference = QUEUE_POP(PayloadReference, pending);
+    if(!reference.replaced) {
+        releasePayload(pipeline, reference.offset);
+        recordDrop(endpointIndex, (MessageClass) reference.messageClass);
+    }
+    return true;
+}
+
+/* Private: Add a reference to the message to the end of an endpoint's queue of
+ * pending payloads for its lane, storing the message in the pool first if this
+ * is the first endpoint that has to wait for it.
+ *
+ * Returns true if the endpoint now has a reference to the message.
+ */
+static bool deferPayload(Pipeline* pipeline, int endpointIndex,
+        MessageClass messageClass, uint32_t key, uint8_t* message,
+        int messageSize, int* poolOffset) {
+    QUEUE_TYPE(PayloadReference)* pending =
+            &pipeline->pendingPayloads[endpointIndex][lane(messageClass)];
+    if(QUEUE_FULL(PayloadReference, pending)) {
+        return false;
+    }
+
+    if(*poolOffset == -1) {
+        *poolOffset = storePayload(pipeline, message, messageSize);
+        if(*poolOffset == -1) {
+            return false;
+        }
+    }
+
+    PayloadReference reference = {(uint16_t) *poolOffset,
+            (uint8_t) messageClass, false, key};
+    QUEUE_PUSH(PayloadReference, pending, reference);
+    PayloadHeader* header = payloadHeader(pipeline, *poolOffset);
+    ++header->references;
+    ++header->referencesTaken;
+    ++deferredReferences;
+    return true;
+}
+
+/* Private: Return true if dropping the oldest payload in an endpoint's normal
+ * lane would make room for a message - in the lane, if that's what is full, and
+ * otherwise in the pool. The pool only reclaims space from its oldest payload,
+ * so dropping any other payload, or one another endpoint is still waiting for,
+ * would lose it without making room.
+ */
+static bool dropMakesRoom(Pipeline* pipeline, int endpointIndex,
+        MessageClass messageClass) {
+    QUEUE_TYPE(PayloadReference)* pending =
+            &pipeline->pendingPayloads[endpointIndex][
+                PipelineLane::NORMAL_LANE];
+    if(QUEUE_EMPTY(PayloadReference, pending)) {
+        return false;
+    }
+
+    if(lane(messageClass) == PipelineLane::NORMAL_LANE &&
+            QUEUE_FULL(PayloadReference, pending)) {
+        return true;
+    }
+
+    PayloadReference oldest = QUEUE_PEEK(PayloadReference, pending);
+    return oldest.replaced || (oldest.offset == pipeline->payloadPool.tail &&
+            payloadHeader(pipeline, oldest.offset)->references == 1);
+}
+
+/* Private: Hold the message in the pool for an endpoint, making room if the
+ * endpoint's lane or the pool is full by dropping the oldest message in its
+ * normal lane - always for responses, and for other messages if the drop
+ * policy allows it. Messages are only dropped while that actually makes room
+ * (see dropMakesRoom(...)). With the LATEST_VALUE policy, any older value of
+ * the same signal or CAN message waiting for the endpoint is dropped, too.
+ *
+ * Returns true if the endpoint now has a reference to the message.
+ */
+static bool deferPayloadWithPolicy(Pipeline* pipeline, int endpointIndex,
+        MessageClass messageClass, uint32_t key, uint8_t* message,
+        int messageSize, int* poolOffset) {
+    DropPolicy policy = config::getConfiguration()->dropPolicy;
+    if(expendable(messageClass) && policy == DropPolicy::LATEST_VALUE &&
+            key != NO_MESSAGE_KEY) {
+        replacePayload(pipeline, endpointIndex, messageClass, key);
+    }
+
+    bool makeRoom = !expendable(messageClass) ||
+            policy != DropPolicy::DROP_NEWEST;
+    while(!deferPayload(pipeline, endpointIndex, messageClass, key, message,
+                messageSize, poolOffset)) {
+        // Dropping from the normal lane doesn't help if it's the response's
+        // own lane that's full
+        if(!makeRoom || (lane(messageClass) == PipelineLane::PRIORITY_LANE &&
+                    QUEUE_FULL(PayloadReference,
+                        &pipeline->pendingPayloads[endpointIndex][
+                            PipelineLane::PRIORITY_LANE])) ||
+                !dropMakesRoom(pipeline, endpointIndex, messageClass) ||
+                !dropOldestPayload(pipeline, endpointIndex)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Private: Copy as many of the payloads waiting for an endpoint into its send
+ * queue as will fit, oldest first and priority lane first, releasing each from
+ * the pool. If the endpoint isn't connected anymore, the payloads are dropped.
+ */
+static void sendPendingPayloads(Pipeline* pipeline, int endpointIndex) {
+    PipelineEndpoint* endpoint = &pipeline->endpoints[endpointIndex];
+    bool connected = endpoint->connected(endpoint);
+    for(int i = 0; i < PIPELINE_LANE_COUNT; i++) {
+        QUEUE_TYPE(PayloadReference)* pending =
+                &pipeline->pendingPayloads[endpointIndex][i];
+        while(!QUEUE_EMPTY(PayloadReference, pending)) {
+            PayloadReference reference = QUEUE_PEEK(PayloadReference, pending);
+            if(reference.replaced) {
+                // Replaced by a newer value, and already released
+                QUEUE_POP(PayloadReference, pending);
+                continue;
+            }
+
+            if(!connected) {
+                recordDrop(endpointIndex,
+                        (MessageClass) reference.messageClass);
+            } else if(!enqueue(pipeline, endpointIndex,
+                        (MessageClass) reference.messageClass,
+                        &pipeline->payloadPool.data[reference.offset +
+                            sizeof(PayloadHeader)],
+                        payloadHeader(pipeline, reference.offset)->length)) {
+                // Keep lower priority payloads behind this one
                 return;
             }
-        } else {
-            sendQueue = &pipeline->usb->endpoints[IN_ENDPOINT_INDEX].queue;
+            QUEUE_POP(PayloadReference, pending);
+            releasePayload(pipeline, reference.offset);
+        }
+    }
+}
+
+/* Private: Queue the message to send on an endpoint, without waiting for it to
+ * make room - this can be called from deep inside signal decoders and
+ * diagnostic callbacks, so it must never stall the main loop. The endpoint's
+ * queues are only flushed by process(...).
+ *
+ * If the endpoint is full, or it already has payloads waiting in the
+ * pool that should go first, the message is added to the pool (once for all of
+ * the endpoints - poolOffset is shared between the calls for each endpoint) and
+ * the endpoint keeps a reference to it instead of dropping it. Responses only
+ * wait behind other responses. If the pool is full too, a message is dropped
+ * according to the drop policy.
+ *
+ * key - Identifies the signal or CAN message the message is from, or
+ *      NO_MESSAGE_KEY.
+ * poolOffset - The offset in the pool where the message is already stored, or
+ *      -1 if it's not. If NULL, the message can't be held in the pool (e.g.
+ *      log messages, which have their own send queue).
+ */
+static void sendToEndpoint(Pipeline* pipeline, int endpointIndex,
+        MessageClass messageClass, uint32_t key, uint8_t* message,
+        int messageSize, int* poolOffset) {
+    PipelineEndpoint* endpoint = &pipeline->endpoints[endpointIndex];
+    bool waiting = !QUEUE_EMPTY(PayloadReference,
+            &pipeline->pendingPayloads[endpointIndex][
+                PipelineLane::PRIORITY_LANE]);
+    if(lane(messageClass) == PipelineLane::NORMAL_LANE) {
+        waiting = waiting || !QUEUE_EMPTY(PayloadReference,
+                &pipeline->pendingPayloads[endpointIndex][
+                    PipelineLane::NORMAL_LANE]);
+    }
+
+    bool queued = false;
+    if(poolOffset == NULL || !waiting) {
+        queued = enqueue(pipeline, endpointIndex, messageClass, message,
+                messageSize);
+    }
+
+    if(!queued && poolOffset != NULL) {
+        queued = deferPayloadWithPolicy(pipeline, endpointIndex, messageClass,
+                key, message, messageSize, poolOffset);
+    }
+
+    if(!queued) {
+        recordDrop(endpointIndex, messageClass);
+    }
+    sendQueueLength[endpointIndex] = queuedBytes(endpoint);
+    // TODO This may not belong here after USB refactoring
+    if(endpoint->receivedBytes != NULL) {
+        receiveQueueLength[endpointIndex] = endpoint->receivedBytes(endpoint);
+    }
+}
+
+/* Private: Return the number of bytes a batch with this many bytes of messages
+ * takes up once it's framed for sending.
+ */
+static int batchFrameLength(PayloadFormat format, int dataLength) {
+    if(format == PayloadFormat::JSON) {
+        // Brackets around the array, and the NULL delimiter
+        return dataLength + 3;
+    }
+    // Every raw CAN record and JSON message already marks its own start and end
+    return dataLength;
+}
+
+/* Private: Frame the messages in the batch for sending.
+ *
+ * Returns the number of bytes written to payload, which must be at least
+ * MAX_OUTGOING_PAYLOAD_SIZE long.
+ */
+static int encodeBatch(PayloadBatch* batch, uint8_t* payload) {
+    int length = 0;
+    if(batch->format == PayloadFormat::JSON) {
+        payload[length++] = '[';
+        memcpy(&payload[length], batch->data, batch->length);
+        length += batch->length;
+        payload[length++] = ']';
+        payload[length++] = '\0';
+    } else {
+        memcpy(payload, batch->data, batch->length);
+        length = batch->length;
+    }
+    return length;
+}
+
+/* Private: Queue an endpoint's batch of messages as a single payload, and
+ * start a new batch. If the endpoint isn't connected anymore, the batch is
+ * dropped.
+ */
+static void sendBatch(Pipeline* pipeline, int endpointIndex) {
+    PayloadBatch* batch = &pipeline->batches[endpointIndex];
+    if(batch->count == 0) {
+        return;
+    }
+
+    PipelineEndpoint* endpoint = &pipeline->endpoints[endpointIndex];
+    if(endpoint->connected(endpoint)) {
+        uint8_t payload[MAX_OUTGOING_PAYLOAD_SIZE];
+        int length = encodeBatch(batch, payload);
+        int poolOffset = -1;
+        sendToEndpoint(pipeline, endpointIndex,
+                (MessageClass) batch->messageClass, NO_MESSAGE_KEY, payload,
+                length, &poolOffset);
+        if(poolOffset != -1) {
+            releasePayload(pipeline, poolOffset);
+        }
+        ++batchesSent;
+        batchedMessages += batch->count;
+    } else {
+        recordDrop(endpointIndex, (MessageClass) batch->messageClass);
+    }
+
+    batch->count = 0;
+    batch->length = 0;
+}
+
+/* Private: Add the message to an endpoint's batch, sending the batch first if
+ * the message won't fit in it or has a different payload format, and right
+ * after if it's reached the configured batch size. A message that's too big
+ * for a batch is sent on its own.
+ */
+static void addToBatch(Pipeline* pipeline, int endpointIndex,
+        MessageClass messageClass, uint32_t key, uint8_t* message,
+        int messageSize, PayloadFormat format) {
+    PayloadBatch* batch = &pipeline->batches[endpointIndex];
+    // A JSON message loses its NULL delimiter but may need a comma in front,
+    // and a raw CAN record or NULL delimited JSON message is added as it is
+    int elementSize = messageSize;
+    if(batch->count > 0 && (batch->format != format ||
+                batchFrameLength(format, batch->length + elementSize) >
+                    MAX_OUTGOING_PAYLOAD_SIZE)) {
+        sendBatch(pipeline, endpointIndex);
+    }
+
+    if(messageSize < 1 || batchFrameLength(format, elementSize) >
+            MAX_OUTGOING_PAYLOAD_SIZE) {
+        int poolOffset = -1;
+        sendToEndpoint(pipeline, endpointIndex, messageClass, key, message,
+                messageSize, &poolOffset);
+        if(poolOffset != -1) {
+            releasePayload(pipeline, poolOffset);
+        }
+        return;
+    }
+
+    if(batch->count == 0) {
+        batch->format = format;
+        batch->messageClass = messageClass;
+        batch->startTime = time::systemTimeMs();
+    }
+
+    if(format == PayloadFormat::JSON) {
+        if(batch->count > 0) {
+            batch->data[batch->length++] = ',';
+        }
+        memcpy(&batch->data[batch->length], message, messageSize - 1);
+        batch->length += messageSize - 1;
+    } else {
+        memcpy(&batch->data[batch->length], message, messageSize);
+        batch->length += messageSize;
+    }
+    ++batch->count;
+
+    if(batchFrameLength(format, batch->length) >=
+            (int) config::getConfiguration()->batchSize) {
+        sendBatch(pipeline, endpointIndex);
+    }
+}
+
+/* Private: Send the batch of every endpoint that has been waiting longer than
+ * the configured batch timeout.
+ */
+static void sendExpiredBatches(Pipeline* pipeline) {
+    for(int i = 0; i < pipeline->endpointCount; i++) {
+        if(pipeline->batches[i].count > 0 && time::systemTimeMs() -
+                pipeline->batches[i].startTime >=
+                    config::getConfiguration()->batchTimeoutMs) {
+            sendBatch(pipeline, i);
+        }
+    }
+}
+
+/* Private: Queue the message on every connected endpoint that accepts its
+ * class and is subscribed to its signal.
+ *
+ * Simple vehicle and raw CAN messages that were published (i.e. format is
+ * set) are added to each endpoint's batch instead, if batching is enabled.
+ *
+ * signalIndex - The position of the message's signal in getSignals(), or
+ *      NO_SIGNAL.
+ * key - Identifies the signal or CAN message the message is from, or
+ *      NO_MESSAGE_KEY.
+ * format - If not NULL, only send to the endpoints using this payload format.
+ */
+static void sendToEndpoints(Pipeline* pipeline, uint8_t* message,
+        int messageSize, MessageClass messageClass, int signalIndex,
+        uint32_t key, const PayloadFormat* format) {
+    // The message is only copied into the payload pool if an endpoint can't
+    // take it right away, and then only once for all of the endpoints.
+    int poolOffset = -1;
+    int* pooled = messageClass == MessageClass::LOG ? NULL : &poolOffset;
+    // The message format doesn't have a container for a batch of protobuf
+    // messages yet, and one would look just like a single message in the
+    // length delimited stream, so those are never batched.
+    bool batched = format != NULL && *format != PayloadFormat::PROTOBUF &&
+            expendable(messageClass) &&
+            config::getConfiguration()->batchSize > 0;
+    for(int i = 0; i < pipeline->endpointCount; i++) {
+        PipelineEndpoint* endpoint = &pipeline->endpoints[i];
+        if(wantsMessage(endpoint, messageClass, signalIndex) &&
+                (format == NULL ||
+                    endpointPayloadFormat(endpoint) == *format)) {
+            if(batched) {
+                addToBatch(pipeline, i, messageClass, key, message,
+                        messageSize, *format);
+            } else {
+                sendToEndpoint(pipeline, i, messageClass, key, message,
+                        messageSize, pooled);
+            }
         }
+    }
 
-        conditionalFlush(pipeline, sendQueue, message, messageSize);
-        sendToEndpoint(pipeline->usb->descriptor.type, sendQueue,
-                &pipeline->usb->endpoints[OUT_ENDPOINT_INDEX].queue,
-                message, messageSize);
+    if(poolOffset != -1) {
+        releasePayload(pipeline, poolOffset);
     }
 }
 
-void sendToUart(Pipeline* pipeline, uint8_t* message, int messageSize,
-        MessageClass messageClass) {
-    if(uart::connected(pipeline->uart) && messageClass != MessageClass::LOG) {
-        QUEUE_TYPE(uint8_t)* sendQueue = &pipeline->uart->sendQueue;
-        conditionalFlush(pipeline, sendQueue, message, messageSize);
-        sendToEndpoint(pipeline->uart->descriptor.type, sendQueue,
-                &pipeline->uart->receiveQueue, message, messageSize);
+/* Private: Return true if any endpoint's subscription filters signals.
+ */
+static bool signalsFiltered(Pipeline* pipeline) {
+    for(int i = 0; i < pipeline->endpointCount; i++) {
+        if(pipeline->endpoints[i].subscription.mode !=
+                SubscriptionMode::ALL_SIGNALS) {
+            return true;
+        }
     }
+    return false;
 }
 
-void sendToNetwork(Pipeline* pipeline, uint8_t* message, int messageSize,
-        MessageClass messageClass) {
-    if(pipeline->network != NULL && messageClass != MessageClass::LOG) {
-        QUEUE_TYPE(uint8_t)* sendQueue = &pipeline->network->sendQueue;
-        conditionalFlush(pipeline, sendQueue, message, messageSize);
-        sendToEndpoint(pipeline->network->descriptor.type, sendQueue,
-                &pipeline->network->receiveQueue, message, messageSize);
+/* Private: Return the position in getSignals() of the signal a simple vehicle
+ * message is from, or NO_SIGNAL if it isn't from a known signal.
+ */
+static int signalIndex(openxc_VehicleMessage* message) {
+    if(!message->has_simple_message || !message->simple_message.has_name) {
+        return NO_SIGNAL;
+    }
+
+    const CanSignal* signal = openxc::can::lookupSignal(
+            message->simple_message.name, getSignals(), getSignalCount());
+    return signal == NULL ? NO_SIGNAL : signal - getSignals();
+}
+
+/* Private: Return the key identifying which signal or CAN message a message
+ * is from, so a newer value can replace it while it's waiting to be sent.
+ *
+ * signal - The position of a simple vehicle message's signal in getSignals(),
+ *      or NO_SIGNAL.
+ */
+static uint32_t messageKey(openxc_VehicleMessage* message, int signal) {
+    if(message->type == openxc_VehicleMessage_Type_SIMPLE &&
+            signal != NO_SIGNAL) {
+        return signal;
+    } else if(message->type == openxc_VehicleMessage_Type_CAN &&
+            message->has_can_message) {
+        return (message->can_message.bus << 29) | message->can_message.id;
+    }
+    return NO_MESSAGE_KEY;
+}
+
+/* Private: Serialize the message once for each payload format in use by an
+ * endpoint that wants it - usually just one, and none at all if nothing is
+ * connected or subscribed - and queue it for those endpoints.
+ *
+ * signal - The position of a simple vehicle message's signal in getSignals(),
+ *      or NO_SIGNAL. If the signal has its own decimal places, they're used for
+ *      its value in JSON instead of the configured default.
+ */
+static void serializeForEndpoints(Pipeline* pipeline,
+        openxc_VehicleMessage* message, MessageClass messageClass,
+        int signal) {
+    uint32_t key = messageKey(message, signal);
+    int decimalPlaces = config::getConfiguration()->jsonDecimalPlaces;
+    if(signal != NO_SIGNAL && getSignals()[signal].hasDecimalPlaces) {
+        decimalPlaces = getSignals()[signal].decimalPlaces;
+    }
+    for(size_t i = 0; i < sizeof(PAYLOAD_FORMATS) /
+            sizeof(PAYLOAD_FORMATS[0]); i++) {
+        bool wanted = false;
+        for(int j = 0; j < pipeline->endpointCount && !wanted; j++) {
+            PipelineEndpoint* endpoint = &pipeline->endpoints[j];
+            wanted = endpointPayloadFormat(endpoint) == PAYLOAD_FORMATS[i] &&
+                wantsMessage(endpoint, messageClass, signal);
+        }
+
+        if(wanted) {
+            uint8_t payload[MAX_OUTGOING_PAYLOAD_SIZE] = {0};
+            size_t length = openxc::payload::serialize(message, payload,
+                    sizeof(payload), PAYLOAD_FORMATS[i], decimalPlaces,
+                    pipeline->receiveTimestamp);
+            sendToEndpoints(pipeline, payload, length, messageClass, signal,
+                    key, &PAYLOAD_FORMATS[i]);
+        }
+    }
+
+    if(pipeline->sourceTimestamp != 0 &&
+            config::getConfiguration()->calculateMetrics) {
+        statistics::update(&pipeline->publishLatency,
+                time::elapsedUs(pipeline->sourceTimestamp));
+    }
+}
+
+/* Private: Build a simple vehicle message from each signal record waiting in
+ * the pipeline, oldest first, and serialize it for the endpoints.
+ */
+static void serializeRecords(Pipeline* pipeline) {
+    unsigned long sourceTimestamp = pipeline->sourceTimestamp;
+    while(!QUEUE_EMPTY(SignalRecord, &pipeline->records)) {
+        SignalRecord record = QUEUE_POP(SignalRecord, &pipeline->records);
+        const CanSignal* signal = &getSignals()[record.signal];
+
+        openxc_VehicleMessage message = {0};
+        message.has_type = true;
+        message.type = openxc_VehicleMessage_Type_SIMPLE;
+        message.has_simple_message = true;
+        message.simple_message.has_name = true;
+        strcpy(message.simple_message.name, signal->genericName);
+        message.simple_message.has_value = true;
+        message.simple_message.value = openxc::can::unpackSignalValue(signal,
+                record.valueType, record.value);
+        if(record.eventType != NO_EVENT) {
+            message.simple_message.has_event = true;
+            message.simple_message.event = openxc::can::unpackSignalValue(
+                    signal, record.eventType, record.event);
+        }
+
+        // Measure the latency from when the value's CAN message was received,
+        // not from whatever is being translated now
+        pipeline->sourceTimestamp = record.timestamp;
+        serializeForEndpoints(pipeline, &message, MessageClass::SIMPLE,
+                record.signal);
+        ++recordsSerialized;
     }
+    pipeline->sourceTimestamp = sourceTimestamp;
+}
+
+bool openxc::pipeline::publishSignal(Pipeline* pipeline, int signalIndex,
+        const openxc_DynamicField* value, const openxc_DynamicField* event) {
+    if(!config::getConfiguration()->deferSerialization || value == NULL ||
+            signalIndex < 0 || signalIndex >= getSignalCount()) {
+        return false;
+    }
+
+    const CanSignal* signal = &getSignals()[signalIndex];
+    SignalRecord record;
+    record.signal = signalIndex;
+    record.eventType = NO_EVENT;
+    record.timestamp = pipeline->sourceTimestamp;
+    if(!openxc::can::packSignalValue(signal, value, &record.valueType,
+                &record.value) || (event != NULL &&
+                !openxc::can::packSignalValue(signal, event, &record.eventType,
+                    &record.event))) {
+        return false;
+    }
+
+    if(QUEUE_FULL(SignalRecord, &pipeline->records)) {
+        serializeRecords(pipeline);
+    }
+    QUEUE_PUSH(SignalRecord, &pipeline->records, record);
+    return true;
 }
 
 void openxc::pipeline::publish(openxc_VehicleMessage* message,
         Pipeline* pipeline) {
-    uint8_t payload[MAX_OUTGOING_PAYLOAD_SIZE] = {0};
-    size_t length = payload::serialize(message, payload, sizeof(payload),
-            config::getConfiguration()->payloadFormat);
     MessageClass messageClass;
     bool matched = false;
     switch(message->type) {
@@ -128,7 +1014,21 @@ void openxc::pipeline::publish(openxc_VehicleMessage* message,
             break;
     }
     if(matched) {
-        sendMessage(pipeline, payload, length, messageClass);
+        // Keep vehicle messages in the order they were published. Responses
+        // go ahead of them in the priority lane anyway.
+        if(expendable(messageClass)) {
+            serializeRecords(pipeline);
+        }
+
+        // Only look up which signal a simple message is from when someone has
+        // a subscription or a drop policy that depends on it.
+        int signal = NO_SIGNAL;
+        if(messageClass == MessageClass::SIMPLE && (signalsFiltered(pipeline) ||
+                    config::getConfiguration()->dropPolicy ==
+                        DropPolicy::LATEST_VALUE)) {
+            signal = signalIndex(message);
+        }
+        serializeForEndpoints(pipeline, message, messageClass, signal);
     } else {
         debug("Trying to serialize unrecognized type: %d", message->type);
     }
@@ -136,9 +1036,8 @@ void openxc::pipeline::publish(openxc_VehicleMessage* message,
 
 void openxc::pipeline::sendMessage(Pipeline* pipeline, uint8_t* message,
         int messageSize, MessageClass messageClass) {
-    sendToUsb(pipeline, message, messageSize, messageClass);
-    sendToUart(pipeline, message, messageSize, messageClass);
-    sendToNetwork(pipeline, message, messageSize, messageClass);
+    sendToEndpoints(pipeline, message, messageSize, messageClass, NO_SIGNAL,
+            NO_MESSAGE_KEY, NULL);
 
     if((config::getConfiguration()->loggingOutput == LoggingOutputInterface::BOTH ||
         config::getConfiguration()->loggingOutput == LoggingOutputInterface::UART)
@@ -148,16 +1047,221 @@ void openxc::pipeline::sendMessage(Pipeline* pipeline, uint8_t* message,
     }
 }
 
-void openxc::pipeline::process(Pipeline* pipeline) {
-    // Must always process USB, because this function usually runs the MCU's USB
-    // task that handles SETUP and enumeration.
-    usb::processSendQueue(pipeline->usb);
-    if(uart::connected(pipeline->uart)) {
-        uart::processSendQueue(pipeline->uart);
+/* Private: If any data was flushed from an endpoint's send queues, record how
+ * long the oldest of it had been waiting.
+ */
+static void recordFlush(Pipeline* pipeline, int endpointIndex,
+        int queuedBefore) {
+    if(pipeline->oldestQueuedTime[endpointIndex] == 0) {
+        return;
+    }
+
+    int queuedAfter = queuedBytes(&pipeline->endpoints[endpointIndex]);
+    if(queuedAfter < queuedBefore) {
+        statistics::update(&pipeline->flushLatency[endpointIndex],
+                time::elapsedUs(pipeline->oldestQueuedTime[endpointIndex]));
+        // The queue doesn't keep track of when each message was added - if
+        // some data is left over, the best guess we have for its age is the
+        // last time anything was queued, so this may under-report its wait.
+        pipeline->oldestQueuedTime[endpointIndex] = queuedAfter == 0 ? 0 :
+                pipeline->newestQueuedTime[endpointIndex];
+    } else if(queuedAfter == 0) {
+        pipeline->oldestQueuedTime[endpointIndex] = 0;
+    }
+}
+
+void openxc::pipeline::initialize(Pipeline* pipeline) {
+    pipeline->endpointCount = 0;
+    for(int i = 0; i < PIPELINE_BUILTIN_ENDPOINT_COUNT; i++) {
+        int index = registerEndpoint(pipeline, &BUILTIN_ENDPOINTS[i]);
+        pipeline->endpoints[index].context = pipeline;
+    }
+
+    pipeline->payloadPool.head = 0;
+    pipeline->payloadPool.tail = 0;
+    pipeline->payloadPool.used = 0;
+    pipeline->payloadPool.count = 0;
+    QUEUE_INIT(SignalRecord, &pipeline->records);
+
+    metrics::registerHistogram("pipeline", NO_METRIC_INSTANCE,
+            "publish_latency_us", &pipeline->publishLatency);
+    metrics::registerHistogram("pipeline", NO_METRIC_INSTANCE, "flush_time_us",
+            &pipeline->flushTime);
+    metrics::registerCounter("pipeline", NO_METRIC_INSTANCE,
+            "deferred_payloads", &deferredPayloads);
+    metrics::registerCounter("pipeline", NO_METRIC_INSTANCE, "batches_sent",
+            &batchesSent);
+    metrics::registerCounter("pipeline", NO_METRIC_INSTANCE,
+            "records_serialized", &recordsSerialized);
+}
+
+static int endpointQueuedBytes(void* endpoint) {
+    return queuedBytes((PipelineEndpoint*) endpoint);
+}
+
+/* Private: Add the counters and histograms of an endpoint to the metrics
+ * registry, named after the endpoint.
+ */
+static void registerEndpointMetrics(Pipeline* pipeline, int endpointIndex) {
+    PipelineEndpoint* endpoint = &pipeline->endpoints[endpointIndex];
+    metrics::registerCounter(endpoint->name, NO_METRIC_INSTANCE,
+            "messages_sent", &sentMessages[endpointIndex]);
+    metrics::registerCounter(endpoint->name, NO_METRIC_INSTANCE,
+            "messages_dropped", &droppedMessages[endpointIndex]);
+    metrics::registerCounter(endpoint->name, NO_METRIC_INSTANCE, "bytes_sent",
+            &dataSent[endpointIndex]);
+    metrics::registerGauge(endpoint->name, NO_METRIC_INSTANCE, "queued_bytes",
+            endpointQueuedBytes, endpoint);
+    metrics::registerHistogram(endpoint->name, NO_METRIC_INSTANCE,
+            "flush_latency_us", &pipeline->flushLatency[endpointIndex]);
+}
+
+int openxc::pipeline::registerEndpoint(Pipeline* pipeline,
+        const PipelineEndpoint* endpoint) {
+    if(endpoint->connected == NULL || endpoint->fits == NULL ||
+            endpoint->enqueue == NULL || endpoint->flush == NULL) {
+        debug("Pipeline endpoint %s is missing a required operation",
+                endpoint->name);
+        return -1;
+    }
+
+    if(pipeline->endpointCount >= MAX_PIPELINE_ENDPOINTS) {
+        debug("No room to add pipeline endpoint %s", endpoint->name);
+        return -1;
+    }
+
+    int index = pipeline->endpointCount++;
+    pipeline->endpoints[index] = *endpoint;
+    unsubscribe(pipeline, index);
+    for(int i = 0; i < PIPELINE_LANE_COUNT; i++) {
+        QUEUE_INIT(PayloadReference, &pipeline->pendingPayloads[index][i]);
+    }
+    pipeline->oldestQueuedTime[index] = 0;
+    pipeline->batches[index].count = 0;
+    pipeline->batches[index].length = 0;
+    registerEndpointMetrics(pipeline, index);
+    return index;
+}
+
+bool openxc::pipeline::subscribe(Pipeline* pipeline, int endpointIndex,
+        SubscriptionMode mode, const int signalIndexes[], int signalCount,
+        unsigned int messageClasses) {
+    if(endpointIndex < 0 || endpointIndex >= pipeline->endpointCount) {
+        debug("No pipeline endpoint %d to subscribe", endpointIndex);
+        return false;
+    }
+
+    // The signals past the end of the bitmap couldn't be filtered correctly
+    if(mode != SubscriptionMode::ALL_SIGNALS &&
+            getSignalCount() > MAX_SUBSCRIBED_SIGNALS) {
+        debug("Can't filter by signal with %d signals, the max is %d",
+                getSignalCount(), MAX_SUBSCRIBED_SIGNALS);
+        return false;
+    }
+
+    for(int i = 0; i < signalCount; i++) {
+        if(signalIndexes[i] < 0 ||
+                signalIndexes[i] >= MAX_SUBSCRIBED_SIGNALS) {
+            debug("Signal %d can't be subscribed to, only the first %d can",
+                    signalIndexes[i], MAX_SUBSCRIBED_SIGNALS);
+            return false;
+        }
     }
 
-    if(pipeline->network != NULL) {
-       network::processSendQueue(pipeline->network);
+    Subscription* subscription =
+            &pipeline->endpoints[endpointIndex].subscription;
+    subscription->mode = mode;
+    subscription->messageClasses = messageClasses |
+            MESSAGE_CLASS_MASK(MessageClass::COMMAND_RESPONSE);
+    memset(subscription->signals, 0, sizeof(subscription->signals));
+    for(int i = 0; i < signalCount; i++) {
+        subscription->signals[signalIndexes[i] / 8] |=
+                1 << (signalIndexes[i] % 8);
+    }
+    return true;
+}
+
+void openxc::pipeline::unsubscribe(Pipeline* pipeline, int endpointIndex) {
+    if(endpointIndex >= 0 && endpointIndex < pipeline->endpointCount) {
+        Subscription* subscription =
+                &pipeline->endpoints[endpointIndex].subscription;
+        subscription->mode = SubscriptionMode::ALL_SIGNALS;
+        subscription->messageClasses = ALL_MESSAGE_CLASSES;
+        memset(subscription->signals, 0, sizeof(subscription->signals));
+    }
+}
+
+bool openxc::pipeline::signalSubscribed(Pipeline* pipeline, int signalIndex) {
+    for(int i = 0; i < pipeline->endpointCount; i++) {
+        if(wantsMessage(&pipeline->endpoints[i], MessageClass::SIMPLE,
+                    signalIndex)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Private: Return the number of payloads waiting in the pool for all of the
+ * endpoints.
+ */
+static int pendingPayloadCount(Pipeline* pipeline) {
+    int count = 0;
+    for(int i = 0; i < pipeline->endpointCount; i++) {
+        for(int j = 0; j < PIPELINE_LANE_COUNT; j++) {
+            count += QUEUE_LENGTH(PayloadReference,
+                    &pipeline->pendingPayloads[i][j]);
+        }
+    }
+    return count;
+}
+
+/* Private: Move waiting payloads into the endpoints' send queues, flush them
+ * all once and then refill them from the pool.
+ */
+static void flushEndpoints(Pipeline* pipeline) {
+    bool measureLatency = config::getConfiguration()->calculateMetrics;
+    int queued[MAX_PIPELINE_ENDPOINTS];
+    for(int i = 0; i < pipeline->endpointCount; i++) {
+        sendPendingPayloads(pipeline, i);
+        if(measureLatency) {
+            queued[i] = queuedBytes(&pipeline->endpoints[i]);
+        }
+    }
+
+    for(int i = 0; i < pipeline->endpointCount; i++) {
+        pipeline->endpoints[i].flush(&pipeline->endpoints[i]);
+    }
+
+    for(int i = 0; i < pipeline->endpointCount; i++) {
+        if(measureLatency) {
+            recordFlush(pipeline, i, queued[i]);
+        }
+        sendPendingPayloads(pipeline, i);
+    }
+}
+
+void openxc::pipeline::process(Pipeline* pipeline) {
+    const unsigned int budget = config::getConfiguration()->pipelineFlushBudgetUs;
+    unsigned long startTime = time::systemTimeUs();
+    unsigned long elapsedTime = 0;
+    int pendingBefore;
+    serializeRecords(pipeline);
+    sendExpiredBatches(pipeline);
+
+    int pendingAfter = pendingPayloadCount(pipeline);
+    // Always flush at least once, even if the budget is 0. After that, only
+    // keep going while the pool is draining - an interface that isn't taking
+    // any data can't make us wait.
+    do {
+        pendingBefore = pendingAfter;
+        flushEndpoints(pipeline);
+        pendingAfter = pendingPayloadCount(pipeline);
+        elapsedTime = time::elapsedUs(startTime);
+    } while(budget > 0 && pendingAfter > 0 && pendingAfter < pendingBefore &&
+            elapsedTime < budget);
+
+    if(config::getConfiguration()->calculateMetrics) {
+        statistics::update(&pipeline->flushTime, elapsedTime);
     }
 }
 
@@ -167,15 +1271,15 @@ void openxc::pipeline::logStatistics(Pipeline* pipeline) {
     }
 
     static unsigned long lastTimeLogged;
-    static DeltaStatistic droppedMessageStats[PIPELINE_ENDPOINT_COUNT];
-    static DeltaStatistic sentMessageStats[PIPELINE_ENDPOINT_COUNT];
-    static DeltaStatistic totalMessageStats[PIPELINE_ENDPOINT_COUNT];
-    static DeltaStatistic dataSentStats[PIPELINE_ENDPOINT_COUNT];
-    static DeltaStatistic sendQueueStats[PIPELINE_ENDPOINT_COUNT];
-    static DeltaStatistic receiveQueueStats[PIPELINE_ENDPOINT_COUNT];
+    static DeltaStatistic droppedMessageStats[MAX_PIPELINE_ENDPOINTS];
+    static DeltaStatistic sentMessageStats[MAX_PIPELINE_ENDPOINTS];
+    static DeltaStatistic totalMessageStats[MAX_PIPELINE_ENDPOINTS];
+    static DeltaStatistic dataSentStats[MAX_PIPELINE_ENDPOINTS];
+    static DeltaStatistic sendQueueStats[MAX_PIPELINE_ENDPOINTS];
+    static DeltaStatistic receiveQueueStats[MAX_PIPELINE_ENDPOINTS];
     static bool initializedStats = false;
     if(!initializedStats) {
-        for(int i = 0; i < PIPELINE_ENDPOINT_COUNT; i++) {
+        for(int i = 0; i < MAX_PIPELINE_ENDPOINTS; i++) {
             statistics::initialize(&droppedMessageStats[i]);
             statistics::initialize(&sentMessageStats[i]);
             statistics::initialize(&totalMessageStats[i]);
@@ -188,7 +1292,7 @@ void openxc::pipeline::logStatistics(Pipeline* pipeline) {
 
     if(time::systemTimeMs() - lastTimeLogged >
             PIPELINE_STATS_LOG_FREQUENCY_S * 1000) {
-        for(int i = 0; i < PIPELINE_ENDPOINT_COUNT; i++) {
+        for(int i = 0; i < pipeline->endpointCount; i++) {
             statistics::update(&sentMessageStats[i], sentMessages[i]);
             statistics::update(&droppedMessageStats[i], droppedMessages[i]);
             statistics::update(&totalMessageStats[i],
@@ -200,28 +1304,83 @@ void openxc::pipeline::logStatistics(Pipeline* pipeline) {
             statistics::update(&receiveQueueStats[i], receiveQueueLength[i]);
 
             if(totalMessageStats[i].total > 0) {
-                InterfaceDescriptor descriptor;
-                descriptor.type = (InterfaceType) i;
+                const char* name = pipeline->endpoints[i].name;
                 debug("%s avg queue fill percents, Rx: %f, Tx: %f",
-                        descriptorToString(&descriptor),
+                        name,
                         statistics::exponentialMovingAverage(&receiveQueueStats[i])
                             / QUEUE_MAX_LENGTH(uint8_t) * 100,
                         statistics::exponentialMovingAverage(&sendQueueStats[i])
                             / QUEUE_MAX_LENGTH(uint8_t) * 100);
                 debug("%s msgs sent: %d, dropped: %d (avg %f percent)",
-                        descriptorToString(&descriptor),
+                        name,
                         sentMessageStats[i].total,
                         droppedMessageStats[i].total,
                         statistics::exponentialMovingAverage(&droppedMessageStats[i]) /
                             statistics::exponentialMovingAverage(&totalMessageStats[i]) * 100);
                 debug("%s avg throughput: %fKB / s, %d msgs / s",
-                        descriptorToString(&descriptor),
+                        name,
                         statistics::exponentialMovingAverage(&dataSentStats[i])
                             / 1024.0 / PIPELINE_STATS_LOG_FREQUENCY_S,
                         (int)(statistics::exponentialMovingAverage(&sentMessageStats[i])
                             / PIPELINE_STATS_LOG_FREQUENCY_S));
+                if(droppedMessages[i] > 0) {
+                    debug("%s msgs dropped by class, simple: %d, can: %d, "
+                            "diagnostic: %d, log: %d, command response: %d",
+                            name,
+                            droppedMessagesByClass[i][MessageClass::SIMPLE],
+                            droppedMessagesByClass[i][MessageClass::CAN],
+                            droppedMessagesByClass[i][MessageClass::DIAGNOSTIC],
+                            droppedMessagesByClass[i][MessageClass::LOG],
+                            droppedMessagesByClass[i][
+                                MessageClass::COMMAND_RESPONSE]);
+                }
+                if(pipeline->flushLatency[i].count > 0) {
+                    debug("%s flush latency p50: %luus, p99: %luus, max: %luus",
+                            name,
+                            statistics::percentile(&pipeline->flushLatency[i],
+                                50),
+                            statistics::percentile(&pipeline->flushLatency[i],
+                                99),
+                            statistics::maximum(&pipeline->flushLatency[i]));
+                }
             }
             lastTimeLogged = time::systemTimeMs();
         }
+
+        if(pipeline->flushTime.count > 0) {
+            debug("Pipeline flush time p50: %luus, p99: %luus, max: %luus "
+                    "(budget %dus)",
+                    statistics::percentile(&pipeline->flushTime, 50),
+                    statistics::percentile(&pipeline->flushTime, 99),
+                    statistics::maximum(&pipeline->flushTime),
+                    config::getConfiguration()->pipelineFlushBudgetUs);
+        }
+
+        if(pipeline->publishLatency.count > 0) {
+            debug("CAN dequeue to publish latency p50: %luus, p99: %luus, "
+                    "max: %luus",
+                    statistics::percentile(&pipeline->publishLatency, 50),
+                    statistics::percentile(&pipeline->publishLatency, 99),
+                    statistics::maximum(&pipeline->publishLatency));
+        }
+
+        if(deferredPayloads > 0) {
+            debug("Payload pool held %d msgs for %d endpoint sends, "
+                    "avoided %fKB of duplicate copies, peak use %d / %d bytes",
+                    deferredPayloads, deferredReferences,
+                    sharedPayloadBytes / 1024.0, peakPayloadBytesUsed,
+                    PAYLOAD_POOL_BYTES);
+        }
+
+        if(batchesSent > 0) {
+            debug("Sent %d msgs in %d batches, avg %f msgs per batch",
+                    batchedMessages, batchesSent,
+                    (float) batchedMessages / batchesSent);
+        }
+
+        if(recordsSerialized > 0) {
+            debug("Serialized %d signal records at flush time",
+                    recordsSerialized);
+        }
     }
 }
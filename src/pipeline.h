@@ -4,6 +4,9 @@
 #include "interface/usb.h"
 #include "interface/uart.h"
 #include "interface/network.h"
+#include "util/statistics.h"
+#include "payload/payload.h"
+#include "emqueue.h"
 
 using openxc::interface::uart::UartDevice;
 using openxc::interface::usb::UsbDevice;
@@ -11,6 +14,97 @@ using openxc::interface::network::NetworkDevice;
 
 #define MAX_OUTGOING_PAYLOAD_SIZE 256
 
+// The USB, UART and network endpoints are always registered first, in
+// InterfaceType order, so their indexes in the pipeline match their type.
+#define PIPELINE_BUILTIN_ENDPOINT_COUNT 3
+
+#ifndef MAX_PIPELINE_ENDPOINTS
+#define MAX_PIPELINE_ENDPOINTS 5
+#endif
+
+// The number of bytes in the pipeline's shared pool for payloads waiting for
+// an endpoint. Each payload only takes up its own length plus a 4 byte
+// header, and this must be a multiple of 4 with room for the largest payload.
+#ifndef PAYLOAD_POOL_BYTES
+#define PAYLOAD_POOL_BYTES 768
+#endif
+
+#ifndef PAYLOAD_REFERENCE_QUEUE_SIZE
+#define PAYLOAD_REFERENCE_QUEUE_SIZE 8
+#endif
+
+// The number of signals, from the start of getSignals(), that an endpoint can
+// subscribe to by name.
+#ifndef MAX_SUBSCRIBED_SIGNALS
+#define MAX_SUBSCRIBED_SIGNALS 256
+#endif
+
+#define SIGNAL_SUBSCRIPTION_BITMAP_SIZE ((MAX_SUBSCRIBED_SIGNALS + 7) / 8)
+
+// The signal index for messages that aren't from a signal in getSignals().
+#define NO_SIGNAL -1
+
+// The number of bytes in an endpoint's send queue that simple vehicle and raw
+// CAN messages leave free, so command and diagnostic responses still fit when
+// the queue is flooded.
+#ifndef PRIORITY_HEADROOM_BYTES
+#define PRIORITY_HEADROOM_BYTES 96
+#endif
+
+// The key for payloads that aren't replaced by newer values.
+#define NO_MESSAGE_KEY 0xffffffff
+
+/* Public: A reference to a payload in the pipeline's shared pool that is
+ * waiting to be copied into an endpoint's send queue.
+ *
+ * offset - The offset of the payload's header in the pipeline's payloadPool.
+ * messageClass - The MessageClass of the payload.
+ * replaced - True if the payload was replaced by a newer value and should be
+ *      skipped. The reference to it has already been released.
+ * key - Identifies the value in the payload (e.g. the signal or CAN message it's
+ *      from) so it can be replaced by a newer one with the LATEST_VALUE drop
+ *      policy, or NO_MESSAGE_KEY.
+ */
+typedef struct {
+    uint16_t offset;
+    uint8_t messageClass;
+    bool replaced;
+    uint32_t key;
+} PayloadReference;
+
+QUEUE_DECLARE(PayloadReference, PAYLOAD_REFERENCE_QUEUE_SIZE)
+
+#ifndef SIGNAL_RECORD_QUEUE_SIZE
+#define SIGNAL_RECORD_QUEUE_SIZE 32
+#endif
+
+// The event type of a SignalRecord without an event.
+#define NO_EVENT 0
+
+/* Public: A decoded value of a signal, waiting in the pipeline to be built
+ * into a simple vehicle message and serialized for the endpoints.
+ *
+ * The values are packed with openxc::can::packSignalValue(...), so a record
+ * is a few bytes instead of a whole openxc_VehicleMessage.
+ *
+ * signal - The position of the signal in getSignals().
+ * valueType - The openxc_DynamicField_Type of the value.
+ * eventType - The openxc_DynamicField_Type of the event, or NO_EVENT.
+ * value - The packed value.
+ * event - The packed event, if there is one.
+ * timestamp - The pipeline's sourceTimestamp when the value was published.
+ */
+typedef struct {
+    uint16_t signal;
+    uint8_t valueType;
+    uint8_t eventType;
+    float value;
+    float event;
+    unsigned long timestamp;
+} SignalRecord;
+
+QUEUE_DECLARE(SignalRecord, SIGNAL_RECORD_QUEUE_SIZE)
+
 namespace openxc {
 namespace pipeline {
 
@@ -22,29 +116,285 @@ typedef enum {
     COMMAND_RESPONSE,
 } MessageClass;
 
+#define MESSAGE_CLASS_COUNT 5
+
+/* Public: The lanes of payloads waiting in the pipeline for each endpoint.
+ * Payloads in the priority lane are always sent first.
+ *
+ * PRIORITY_LANE - Command and diagnostic responses.
+ * NORMAL_LANE - Everything else.
+ */
+typedef enum {
+    PRIORITY_LANE,
+    NORMAL_LANE,
+} PipelineLane;
+
+#define PIPELINE_LANE_COUNT 2
+
+/* Public: What to do with simple vehicle and raw CAN messages when an
+ * endpoint's send queue and its lane in the payload pool are both full.
+ *
+ * DROP_NEWEST - Drop the new message.
+ * DROP_OLDEST - Drop the oldest message waiting in the lane to make room for
+ *      the new one.
+ * LATEST_VALUE - Like DROP_OLDEST, but also replace any message from the same
+ *      signal or CAN message that's still waiting, so a backed up endpoint
+ *      sends the latest value once instead of every stale one.
+ */
+typedef enum {
+    DROP_NEWEST,
+    DROP_OLDEST,
+    LATEST_VALUE,
+} DropPolicy;
+
+#define MESSAGE_CLASS_MASK(messageClass) (1 << (messageClass))
+#define ALL_MESSAGE_CLASSES 0xff
+
+/* Public: How an endpoint's subscription filters simple vehicle messages.
+ *
+ * ALL_SIGNALS - Send every signal.
+ * INCLUDE_SIGNALS - Only send the signals in the subscription's bitmap.
+ * EXCLUDE_SIGNALS - Send every signal except those in the bitmap.
+ */
+typedef enum {
+    ALL_SIGNALS,
+    INCLUDE_SIGNALS,
+    EXCLUDE_SIGNALS,
+} SubscriptionMode;
+
+/* Public: The messages the host on the other side of an endpoint asked for,
+ * e.g. with a subscription command.
+ *
+ * mode - How the signals bitmap filters simple vehicle messages. Messages that
+ *      aren't from one of the first MAX_SUBSCRIBED_SIGNALS signals in
+ *      getSignals() can't be in the bitmap, so they are only filtered out by
+ *      INCLUDE_SIGNALS.
+ * messageClasses - A bitmask of the MessageClasses the host wants, built with
+ *      MESSAGE_CLASS_MASK(...). This narrows the classes the endpoint itself
+ *      accepts, it never adds to them.
+ * signals - A bitmap of signals, indexed by their position in getSignals().
+ */
+typedef struct {
+    SubscriptionMode mode;
+    unsigned int messageClasses;
+    uint8_t signals[SIGNAL_SUBSCRIPTION_BITMAP_SIZE];
+} Subscription;
+
+/* Public: An output for messages from the pipeline, e.g. a USB endpoint or a
+ * log file.
+ *
+ * The pipeline only talks to endpoints through these operations, so new kinds
+ * of outputs can be added with registerEndpoint(...) without changing the
+ * pipeline itself. Each operation is passed the endpoint, and can find its
+ * device or other state in the endpoint's context.
+ *
+ * name - A short name for the endpoint, used when logging its statistics.
+ * messageClasses - A bitmask of the MessageClasses this endpoint accepts,
+ *      built with MESSAGE_CLASS_MASK(...).
+ * overridePayloadFormat - If true, messages published to this endpoint are
+ *      serialized with payloadFormat instead of the configuration's active
+ *      payload format.
+ * payloadFormat - The format for this endpoint if overridePayloadFormat is set.
+ * connected - Return true if the endpoint can accept messages right now. The
+ *      pipeline skips endpoints that aren't connected, without serializing or
+ *      copying anything for them.
+ * fits - Return true if there is room to enqueue the message right now.
+ * enqueue - Add the message to the endpoint's outgoing data, and return true
+ *      if there was room.
+ * flush - Send as much of the endpoint's outgoing data as possible to the
+ *      physical interface. This is called every time the pipeline is
+ *      processed, even if the endpoint isn't connected.
+ * queuedBytes - Optional, return the number of bytes waiting to be sent. Used
+ *      for statistics and to measure latency.
+ * freeBytes - Optional, return the number of bytes free in the send queue for
+ *      messages of the class. Simple vehicle and raw CAN messages are only
+ *      queued if they leave PRIORITY_HEADROOM_BYTES free, so there is room
+ *      for responses.
+ * receivedBytes - Optional, return the number of bytes received from the
+ *      endpoint and waiting to be processed. Used for statistics.
+ * context - Any data the operations need, e.g. the device for the endpoint.
+ * subscription - The messages the host wants from this endpoint, checked
+ *      before serializing anything for it. This is reset to everything the
+ *      endpoint accepts when it's registered.
+ */
+typedef struct PipelineEndpoint {
+    const char* name;
+    unsigned int messageClasses;
+    bool overridePayloadFormat;
+    openxc::payload::PayloadFormat payloadFormat;
+    bool (*connected)(struct PipelineEndpoint* endpoint);
+    bool (*fits)(struct PipelineEndpoint* endpoint, MessageClass messageClass,
+            uint8_t* message, int messageSize);
+    bool (*enqueue)(struct PipelineEndpoint* endpoint,
+            MessageClass messageClass, uint8_t* message, int messageSize);
+    void (*flush)(struct PipelineEndpoint* endpoint);
+    int (*queuedBytes)(struct PipelineEndpoint* endpoint);
+    int (*freeBytes)(struct PipelineEndpoint* endpoint,
+            MessageClass messageClass);
+    int (*receivedBytes)(struct PipelineEndpoint* endpoint);
+    void* context;
+    Subscription subscription;
+} PipelineEndpoint;
+
+/* Public: The header in front of each payload in the pipeline's shared pool.
+ *
+ * length - The length of the payload in bytes. For the padding that skips the
+ *      end of the pool when a payload doesn't fit there, the number of bytes
+ *      skipped after the header.
+ * references - The number of references to this payload that are still
+ *      waiting, or 0 if its space can be reused.
+ * referencesTaken - The total number of references taken since the payload
+ *      was stored, used to count how many duplicate copies were avoided.
+ */
+typedef struct {
+    uint16_t length;
+    uint8_t references;
+    uint8_t referencesTaken;
+} PayloadHeader;
+
+/* Public: The pipeline's shared pool of serialized payloads waiting for one or
+ * more endpoints.
+ *
+ * Each endpoint's send queue is drained by its interface (the UART's from an
+ * interrupt), so every endpoint needs its own copy of a payload in the end.
+ * The pool only holds the payloads that an endpoint can't take yet: one is
+ * stored here once, however many endpoints are waiting for it, and each of
+ * them holds a PayloadReference to it until it's copied into their send queue.
+ *
+ * The payloads are stored one after another in a ring, each after a
+ * PayloadHeader and taking up only its own length, rounded up to a multiple
+ * of 4. The space of the oldest payload is reused once no endpoint is waiting
+ * for it anymore, along with any newer ones that were already released.
+ *
+ * head - The offset where the next payload is stored.
+ * tail - The offset of the oldest payload in the pool.
+ * used - The number of bytes in use, from tail to head.
+ * count - The number of payloads in the pool that are still referenced.
+ * data - The payloads, each after its PayloadHeader.
+ */
+typedef struct {
+    uint16_t head;
+    uint16_t tail;
+    uint16_t used;
+    uint16_t count;
+    uint8_t data[PAYLOAD_POOL_BYTES];
+} PayloadPool;
+
+/* Public: Vehicle messages being packed together for an endpoint, to be sent as
+ * a single payload.
+ *
+ * A JSON batch is sent as an array of the messages, followed by the usual
+ * NULL delimiter. A RAW_CAN batch is just the messages one after another.
+ * Protocol buffer messages are never batched, because the message format has
+ * no container for them that a host could tell apart from a single message.
+ *
+ * data - The messages in the batch so far, without the framing around them.
+ * length - The number of bytes used in data.
+ * count - The number of messages in the batch, or 0 if it's empty.
+ * messageClass - The MessageClass of the first message in the batch.
+ * format - The payload format of the messages in the batch.
+ * startTime - The time in milliseconds when the first message was added.
+ */
+typedef struct {
+    uint8_t data[MAX_OUTGOING_PAYLOAD_SIZE];
+    uint16_t length;
+    uint8_t count;
+    uint8_t messageClass;
+    openxc::payload::PayloadFormat format;
+    unsigned long startTime;
+} PayloadBatch;
+
 /* Public: A container for all output devices that want to be notified of new
  *      messages from the CAN bus.
  *
  * This structure sets up a standard interface for all output devices to receive
- * updates from CAN. Right now, this means USB and UART, but it can be extended
- * to output over another UART, Network, WiFi, etc.
+ * updates from CAN. Each output is a PipelineEndpoint in the endpoints list -
+ * USB, UART and network are always registered, and more can be added with
+ * registerEndpoint(...).
+ *
+ * usb - The USB device for the built-in USB endpoint.
+ * uart - The UART device for the built-in UART endpoint, or NULL.
+ * network - The network device for the built-in network endpoint, or NULL.
+ * endpoints - The registered endpoints.
+ * endpointCount - The number of registered endpoints.
+ *
+ * The rest of the fields are used to measure how long it takes messages to get
+ * through the pipeline when metrics are enabled. The times are all in
+ * microseconds, from systemTimeUs(), and are indexed by the endpoint's index
+ * in endpoints where there's one per endpoint.
+ *
+ * sourceTimestamp - the time the CAN message currently being translated was
+ *      taken from its bus's receive queue, or 0 if messages being published
+ *      aren't from CAN.
+ * receiveTimestamp - the time the interrupt handler received the CAN message
+ *      currently being handled, whether or not metrics are enabled, or 0 if
+ *      it's not known. Raw CAN records are stamped with it.
+ * oldestQueuedTime - the time when the oldest data waiting in each endpoint's
+ *      send queue was queued, or 0 if the queue was empty.
+ * newestQueuedTime - the time when data was last queued for each endpoint.
+ * publishLatency - A histogram of the time from taking a CAN message from the
+ *      receive queue to queueing the messages translated from it for the
+ *      endpoints.
+ * flushLatency - A histogram for each endpoint of how long the oldest data in
+ *      the send queue had been waiting each time data was flushed out to the
+ *      physical interface.
+ * flushTime - A histogram of the time spent in each call to process(...).
+ *
+ * Publishing never flushes the endpoints itself. When an endpoint's send queue
+ * is full (or it already has messages waiting), the serialized message is
+ * stored once in the shared payload pool and the endpoint keeps a reference to
+ * it, in order, until process(...) can copy it into the send queue. Messages
+ * sent to several backed up endpoints at once are only buffered once. Command
+ * and diagnostic responses wait in their own lane, and go ahead of any other
+ * messages waiting for the endpoint.
+ *
+ * payloadPool - The shared pool of payloads waiting for one or more endpoints.
+ * pendingPayloads - A queue for each endpoint and PipelineLane of references
+ *      to the payloads in payloadPool that it's still waiting to send, oldest
+ *      first.
  *
- * TODO This file could most likely be refactored and improved. Ideally these
- * output interfaces would all have the same type, so this could just be a list
- * of "receiver" functions. maybe instead of the devices, this is a list of the
- * sendQueues?
+ * When batching is enabled in the configuration, published simple vehicle and
+ * raw CAN messages are packed into a batch for each endpoint first, and only
+ * the complete batch is queued.
+ *
+ * batches - The batch being filled for each endpoint.
+ *
+ * When the configuration defers serialization, decoded signal values are
+ * only recorded when they're published. The records are serialized in each
+ * endpoint's payload format the next time the pipeline is processed, or
+ * before any other vehicle message is published so the order is kept.
+ *
+ * records - The signal values waiting to be serialized, oldest first.
  */
 typedef struct {
     UsbDevice* usb;
     UartDevice* uart;
     NetworkDevice* network;
+    PipelineEndpoint endpoints[MAX_PIPELINE_ENDPOINTS];
+    int endpointCount;
+
+    // Private
+    unsigned long sourceTimestamp;
+    unsigned long receiveTimestamp;
+    unsigned long oldestQueuedTime[MAX_PIPELINE_ENDPOINTS];
+    unsigned long newestQueuedTime[MAX_PIPELINE_ENDPOINTS];
+    openxc::util::statistics::Histogram publishLatency;
+    openxc::util::statistics::Histogram flushLatency[MAX_PIPELINE_ENDPOINTS];
+    openxc::util::statistics::Histogram flushTime;
+    PayloadPool payloadPool;
+    QUEUE_TYPE(PayloadReference) pendingPayloads[MAX_PIPELINE_ENDPOINTS][
+            PIPELINE_LANE_COUNT];
+    PayloadBatch batches[MAX_PIPELINE_ENDPOINTS];
+    QUEUE_TYPE(SignalRecord) records;
 } Pipeline;
 
 /* Public: Serialize the message to a bytestream (conforming to the OpenXC
- * standard and the currently selected payload format) and send it out to the
- * pipeline.
+ * standard and the currently selected payload format, or the payload format of
+ * each endpoint that overrides it) and send it out to the pipeline.
  *
- * This will accept both raw and translated typed messages.
+ * This will accept both raw and translated typed messages. If batching is
+ * enabled, simple vehicle and raw CAN messages are added to each endpoint's
+ * batch instead of being queued on their own.
  *
  * message - A message structure containing the type and data for the message.
  * pipeline - The pipeline to send on.
@@ -52,11 +402,31 @@ typedef struct {
 void publish(openxc_VehicleMessage* message,
         openxc::pipeline::Pipeline* pipeline);
 
-/* Public: Queue the message to send on all of the interfaces registered with
- *      the pipeline. If the any of the queues does not have sufficient capacity
- *      to store the message, it will be dropped for that interface only (i.e.
- *      UART can be overloaded and dropping messages but USB will continue
- *      with a 100% translation rate).
+/* Public: Record a decoded value of a signal, to be built into a simple
+ * vehicle message and serialized for the endpoints that want it when the
+ * pipeline is processed. If the record queue is full, the waiting records are
+ * serialized first to make room.
+ *
+ * pipeline - The pipeline to publish on.
+ * signalIndex - The position of the signal in getSignals().
+ * value - The value returned by the signal's decoder.
+ * event - An optional event for the message, or NULL.
+ *
+ * Returns true if the value was recorded. If the configuration doesn't defer
+ * serialization, or the value or event can't be packed into a record, it
+ * returns false and the caller should publish the message itself.
+ */
+bool publishSignal(Pipeline* pipeline, int signalIndex,
+        const openxc_DynamicField* value, const openxc_DynamicField* event);
+
+/* Public: Queue the message to send on all of the connected endpoints that
+ *      accept its class. This never waits for an endpoint to flush its queues -
+ *      if any of the queues does not have sufficient capacity to store the
+ *      message, it's held in the pipeline's shared payload pool until
+ *      process(...) makes room. If the pool is also full, a
+ *      message will be dropped for that interface only (i.e. UART can be
+ *      overloaded and dropping messages but USB will continue with a 100%
+ *      translation rate) - which one depends on the configured DropPolicy.
  *
  * pipeline - Container of all pipelines to send the message on.
  * message - The message data as an array of uint8_t.
@@ -67,16 +437,91 @@ void publish(openxc_VehicleMessage* message,
 void sendMessage(Pipeline* pipeline, uint8_t* message, int messageSize,
         MessageClass messageClass);
 
-/* Public: Perform interface-specific functions to flush all message queues out
- *      to their respective physical interfaces.
+/* Public: Register the built-in USB, UART and network endpoints, replacing any
+ * other endpoints, drop any payloads waiting in the pipeline's shared pool and
+ * mark all of its slots as free, and drop any waiting signal records.
+ *
+ * pipeline - The pipeline to reset.
+ */
+void initialize(Pipeline* pipeline);
+
+/* Public: Add an endpoint to the pipeline. The endpoint is copied, so it
+ * doesn't need to outlive this call, but its context does.
+ *
+ * pipeline - The pipeline to add the endpoint to.
+ * endpoint - The endpoint to add. The connected, fits, enqueue and flush
+ *      operations are required.
+ *
+ * Returns the endpoint's index in the pipeline, or -1 if it's invalid or
+ * there's no room for another endpoint.
+ */
+int registerEndpoint(Pipeline* pipeline, const PipelineEndpoint* endpoint);
+
+/* Public: Replace an endpoint's subscription, so it only receives the message
+ * classes and signals the host on the other side wants.
  *
- * TODO This is the tricky part with making the pipeline more generic - this
- * needs to call an interface-specific method for each queue.
+ * pipeline - The pipeline with the endpoint.
+ * endpointIndex - The index of the endpoint in the pipeline.
+ * mode - How the listed signals filter simple vehicle messages.
+ * signalIndexes - The positions in getSignals() of the signals to include or
+ *      exclude. May be NULL if signalCount is 0.
+ * signalCount - The length of the signalIndexes array.
+ * messageClasses - A bitmask of the MessageClasses the endpoint should
+ *      receive. Command responses are always sent, so the host can tell if its
+ *      commands worked.
+ *
+ * Returns true if the subscription was changed. If the endpoint doesn't exist,
+ * any of the signals can't be stored in the bitmap, or the mode filters by
+ * signal and there are more than MAX_SUBSCRIBED_SIGNALS signals, the
+ * subscription is left alone.
+ */
+bool subscribe(Pipeline* pipeline, int endpointIndex, SubscriptionMode mode,
+        const int signalIndexes[], int signalCount,
+        unsigned int messageClasses);
+
+/* Public: Reset an endpoint's subscription so it receives every message it
+ * accepts again.
  *
- * pipeline - Pipeline instance with the interface queues to flush.
+ * pipeline - The pipeline with the endpoint.
+ * endpointIndex - The index of the endpoint in the pipeline.
+ */
+void unsubscribe(Pipeline* pipeline, int endpointIndex);
+
+/* Public: Check if any connected endpoint wants simple vehicle messages for a
+ * signal, so callers can skip building and publishing values nobody
+ * subscribed to.
+ *
+ * pipeline - The pipeline to check.
+ * signalIndex - The position of the signal in getSignals(), or NO_SIGNAL.
+ *
+ * Returns true if at least one connected endpoint wants the signal.
+ */
+bool signalSubscribed(Pipeline* pipeline, int signalIndex);
+
+/* Public: Flush the outgoing data of every registered endpoint out to their
+ *      respective physical interfaces. This is the only place the pipeline
+ *      flushes, and is intended to be called once each time through the main
+ *      loop.
+ *
+ * Any waiting signal records are serialized first, and then any batch of
+ * messages that has been waiting longer than the configuration's
+ * batchTimeoutMs is queued.
+ *
+ * Payloads waiting in the shared pool are moved into each endpoint's send
+ * queue as room becomes available, before and after flushing. While payloads
+ * are still waiting and the pool is draining, the flush is repeated until the
+ * configuration's pipelineFlushBudgetUs runs out.
+ *
+ * pipeline - Pipeline instance with the endpoints to flush.
  */
 void process(Pipeline* pipeline);
 
+/* Public: Log the message counts, throughput and latencies of each endpoint in
+ * the pipeline, if metrics are enabled. This is rate limited and is intended to
+ * be called each time through the main loop.
+ *
+ * pipeline - The pipeline to log statistics for.
+ */
 void logStatistics(Pipeline* pipeline);
 
 } // namespace interface
@@ -2,6 +2,9 @@
 #include "canutil_lpc17xx.h"
 #include "signals.h"
 #include "util/log.h"
+#include "util/timer.h"
+
+namespace time = openxc::util::time;
 
 using openxc::util::log::debug;
 using openxc::signals::getCanBusCount;
@@ -32,7 +35,8 @@ void CAN_IRQHandler() {
         CanBus* bus = &getCanBuses()[i];
         if((CAN_IntGetStatus(CAN_CONTROLLER(bus)) & 0x01) == 1) {
             CanMessage message = receiveCanMessage(bus);
-            if(shouldAcceptMessage(bus, message.id) &&
+            message.timestamp = time::systemTimeUs();
+            if(shouldAcceptMessage(bus, message.id, message.format) &&
                     !QUEUE_PUSH(CanMessage, &bus->receiveQueue, message)) {
                 // An exception to the "don't leave commented out code" rule,
                 // this log statement is useful for debugging performance issues
@@ -61,29 +61,91 @@ bool openxc::can::resetAcceptanceFilterStatus(CanBus* bus, bool enabled) {
     return true;
 }
 
+/* Private: Load a range of IDs into the AF table, as an explicit entry for a
+ * single ID or a group entry for a range.
+ */
+static CAN_ERROR loadRangeEntry(CanBus* bus, AcceptanceFilterRange* range,
+        CanMessageFormat format) {
+    CAN_ID_FORMAT_Type idFormat = format == CanMessageFormat::STANDARD ?
+            STD_ID_FORMAT : EXT_ID_FORMAT;
+    if(range->first == range->last) {
+        return CAN_LoadExplicitEntry(CAN_CONTROLLER(bus), range->first,
+                idFormat);
+    }
+    return CAN_LoadGroupEntry(CAN_CONTROLLER(bus), range->first, range->last,
+            idFormat);
+}
+
 bool openxc::can::updateAcceptanceFilterTable(CanBus* buses, const int busCount) {
     clearAcceptanceFilterTable();
 
+    static const CanMessageFormat FORMATS[] = {CanMessageFormat::STANDARD,
+            CanMessageFormat::EXTENDED};
+    const int formatCount = sizeof(FORMATS) / sizeof(FORMATS[0]);
+
+    // Find how many AF entries each bus and format needs to filter exactly.
+    // If they need more than we have in total, split the available entries
+    // between them proportionally.
+    AcceptanceFilterRange ranges[MAX_ACCEPTANCE_FILTERS];
+    int totalExactCount = 0;
+    for(int i = 0; i < busCount; i++) {
+        for(int j = 0; j < formatCount; j++) {
+            totalExactCount += optimizeAcceptanceFilters(&buses[i], FORMATS[j],
+                    ranges, MAX_ACCEPTANCE_FILTERS);
+        }
+    }
+
     uint16_t filterCount = 0;
     CAN_ERROR result = CAN_OK;
     bool bypassFilters = false;
-    for(int i = 0; i < busCount; i++) {
+    for(int i = 0; i < busCount && result == CAN_OK; i++) {
         CanBus* bus = &buses[i];
         bypassFilters |= bus->bypassFilters;
-        AcceptanceFilterListEntry* entry;
-        LIST_FOREACH(entry, &bus->acceptanceFilters, entries) {
-            if(filterCount >= MAX_ACCEPTANCE_FILTERS) {
-                break;
+        for(int j = 0; j < formatCount && result == CAN_OK; j++) {
+            int exactCount = optimizeAcceptanceFilters(bus, FORMATS[j],
+                    ranges, MAX_ACCEPTANCE_FILTERS);
+            if(exactCount == 0) {
+                continue;
             }
-            result = CAN_LoadExplicitEntry(CAN_CONTROLLER(bus), entry->filter,
-                   entry->format == CanMessageFormat::STANDARD ?
-                       STD_ID_FORMAT : EXT_ID_FORMAT);
-           if(result != CAN_OK) {
-                debug("Couldn't add filter 0x%x to bus %d", entry->filter,
+
+            int maxRanges = exactCount;
+            if(totalExactCount > MAX_ACCEPTANCE_FILTERS) {
+                maxRanges = maxRanges * MAX_ACCEPTANCE_FILTERS /
+                        totalExactCount;
+                if(maxRanges < 1) {
+                    maxRanges = 1;
+                }
+            }
+            if(maxRanges > MAX_ACCEPTANCE_FILTERS - filterCount) {
+                maxRanges = MAX_ACCEPTANCE_FILTERS - filterCount;
+            }
+
+            if(maxRanges < 1) {
+                // The software filter will still drop anything that we
+                // shouldn't receive.
+                debug("No AF entries left for bus %d, disabling AF",
                         bus->address);
-                break;
-           }
-           ++filterCount;
+                bypassFilters = true;
+                continue;
+            }
+
+            int rangeCount = exactCount;
+            if(maxRanges < exactCount) {
+                rangeCount = optimizeAcceptanceFilters(bus, FORMATS[j],
+                        ranges, maxRanges);
+                debug("Packed AF for bus %d into %d entries, the rest will be "
+                        "filtered in software", bus->address, rangeCount);
+            }
+
+            for(int k = 0; k < rangeCount; k++) {
+                result = loadRangeEntry(bus, &ranges[k], FORMATS[j]);
+                if(result != CAN_OK) {
+                    debug("Couldn't add filter 0x%x - 0x%x to bus %d",
+                            ranges[k].first, ranges[k].last, bus->address);
+                    break;
+                }
+                ++filterCount;
+            }
         }
     }
 
@@ -103,7 +165,9 @@ void openxc::can::deinitialize(CanBus* bus) { }
 
 void openxc::can::initialize(CanBus* bus, bool writable, CanBus* buses,
         const int busCount) {
-    can::initializeCommon(bus);
+    if(!can::initializeCommon(bus)) {
+        return;
+    }
     configureCanControllerPins(CAN_CONTROLLER(bus));
     configureTransceiver();
 
@@ -35,6 +35,29 @@ unsigned long openxc::util::time::systemTimeMs() {
     return SYSTEM_TICK_COUNT;
 }
 
+unsigned long openxc::util::time::systemTimeUs() {
+    // SysTick counts down from LOAD to 0 each millisecond - read it again if
+    // the tick count rolled over while reading the current value.
+    unsigned int ticks;
+    unsigned int pendingTicks;
+    uint32_t remaining;
+    do {
+        ticks = *(volatile unsigned int*)&SYSTEM_TICK_COUNT;
+        remaining = SysTick->VAL;
+        // In a handler with a higher priority than SysTick (e.g. the CAN
+        // ISR), the counter can reload without SysTick_Handler running, so
+        // the tick count is one behind - count the pending tick, and read the
+        // value again in case it reloaded after the first read.
+        pendingTicks = 0;
+        if(SCB->ICSR & SCB_ICSR_PENDSTSET_Msk) {
+            pendingTicks = 1;
+            remaining = SysTick->VAL;
+        }
+    } while(ticks != *(volatile unsigned int*)&SYSTEM_TICK_COUNT);
+    return (ticks + pendingTicks) * 1000 + (SysTick->LOAD - remaining) /
+        (SystemCoreClock / 1000000);
+}
+
 void openxc::util::time::initialize() {
     // Configure for 1ms tick
     SysTick_Config(SystemCoreClock / 1000);
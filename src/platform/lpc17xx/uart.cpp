@@ -45,6 +45,9 @@ using openxc::config::getConfiguration;
 using openxc::util::log::debug;
 using openxc::pipeline::Pipeline;
 using openxc::util::bytebuffer::processQueue;
+using openxc::util::bytebuffer::peek;
+using openxc::util::bytebuffer::consume;
+using openxc::util::bytebuffer::ByteSpan;
 using openxc::gpio::GpioValue;
 using openxc::gpio::GpioDirection;
 
@@ -100,17 +103,21 @@ void handleTransmitInterrupt() {
 
     while(UART_CheckBusy(UART1_DEVICE) == SET);
 
-    while(!QUEUE_EMPTY(uint8_t, &getConfiguration()->uart.sendQueue)) {
-        uint8_t byte = QUEUE_PEEK(uint8_t, &getConfiguration()->uart.sendQueue);
+    // Send the queued data straight from the queue's storage, a contiguous
+    // region at a time, instead of popping it off byte by byte.
+    ByteSpan spans[BYTE_QUEUE_MAX_SPANS];
+    int spanCount = peek(&getConfiguration()->uart.sendQueue, spans);
+    for(int i = 0; i < spanCount; i++) {
         // We used to use non-blocking here, but then we got into a race
         // condition - if the transmit interrupt occurred while adding more data
         // to the queue, you could lose data. We should be able to switch back
         // to non-blocking if we disabled interrupts while modifying the queue
         // (good practice anyway) but for now switching this to block sends
         // seems to work OK without any significant impacts.
-        if(UART_Send(UART1_DEVICE, &byte, 1, BLOCKING)) {
-            QUEUE_POP(uint8_t, &getConfiguration()->uart.sendQueue);
-        } else {
+        uint32_t sent = UART_Send(UART1_DEVICE, spans[i].data,
+                spans[i].length, BLOCKING);
+        consume(&getConfiguration()->uart.sendQueue, sent);
+        if((int)sent < spans[i].length) {
             break;
         }
     }
@@ -162,7 +169,8 @@ void openxc::interface::uart::read(UartDevice* device,
         openxc::util::bytebuffer::IncomingMessageCallback callback) {
     if(device != NULL) {
         if(!QUEUE_EMPTY(uint8_t, &device->receiveQueue)) {
-            processQueue(&device->receiveQueue, callback);
+            processQueue(&device->receiveQueue, &device->receiveFramer,
+                    getConfiguration()->payloadFormat, callback);
             if(!QUEUE_FULL(uint8_t, &device->receiveQueue)) {
                 resumeReceive();
             }
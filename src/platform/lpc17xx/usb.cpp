@@ -34,6 +34,7 @@ extern "C" {
 namespace gpio = openxc::gpio;
 namespace commands = openxc::commands;
 namespace usb = openxc::interface::usb;
+namespace bytebuffer = openxc::util::bytebuffer;
 
 using openxc::config::getConfiguration;
 using openxc::util::log::debug;
@@ -41,6 +42,7 @@ using openxc::interface::usb::UsbDevice;
 using openxc::interface::usb::UsbEndpoint;
 using openxc::interface::usb::UsbEndpointDirection;
 using openxc::util::bytebuffer::processQueue;
+using openxc::util::bytebuffer::ByteSpan;
 using openxc::gpio::GPIO_VALUE_HIGH;
 using openxc::gpio::GPIO_VALUE_LOW;
 
@@ -119,16 +121,24 @@ static void flushQueueToHost(UsbDevice* usbDevice, UsbEndpoint* endpoint) {
     uint8_t previousEndpoint = Endpoint_GetCurrentEndpoint();
     Endpoint_SelectEndpoint(endpoint->address);
     if(Endpoint_IsINReady()) {
-        // get bytes from transmit FIFO into intermediate buffer
+        // write straight from the transmit FIFO's storage - the stream write
+        // copies the data into the endpoint, so no intermediate buffer is
+        // needed
+        ByteSpan spans[BYTE_QUEUE_MAX_SPANS];
+        int spanCount = bytebuffer::peek(&endpoint->queue, spans);
         int byteCount = 0;
-        while(!QUEUE_EMPTY(uint8_t, &endpoint->queue)
-                && byteCount < USB_SEND_BUFFER_SIZE) {
-            endpoint->sendBuffer[byteCount++] = QUEUE_POP(uint8_t,
-                    &endpoint->queue);
+        for(int i = 0; i < spanCount && byteCount < USB_SEND_BUFFER_SIZE;
+                i++) {
+            int length = spans[i].length;
+            if(byteCount + length > USB_SEND_BUFFER_SIZE) {
+                length = USB_SEND_BUFFER_SIZE - byteCount;
+            }
+            Endpoint_Write_Stream_LE(spans[i].data, length, NULL);
+            byteCount += length;
         }
 
         if(byteCount > 0) {
-            Endpoint_Write_Stream_LE(endpoint->sendBuffer, byteCount, NULL);
+            bytebuffer::consume(&endpoint->queue, byteCount);
             Endpoint_ClearIN();
         }
     }
@@ -260,7 +270,8 @@ void openxc::interface::usb::read(UsbDevice* device, UsbEndpoint* endpoint,
     }
 
     if(receivedData) {
-        while(processQueue(&endpoint->queue, callback)) {
+        while(processQueue(&endpoint->queue, &endpoint->framer,
+                    getConfiguration()->payloadFormat, callback)) {
             continue;
         }
     }
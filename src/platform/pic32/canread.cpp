@@ -3,8 +3,10 @@
 #include "signals.h"
 #include "util/log.h"
 #include "power.h"
+#include "util/timer.h"
 
 namespace power = openxc::power;
+namespace time = openxc::util::time;
 
 using openxc::util::log::debug;
 using openxc::signals::getCanBuses;
@@ -46,8 +48,15 @@ void openxc::can::pic32::handleCanInterrupt(CanBus* bus) {
         CAN_CONTROLLER(bus)->enableChannelEvent(CAN::CHANNEL1,
                 CAN::RX_CHANNEL_NOT_EMPTY, false);
 
+        // When the filters on a bus don't fit in the hardware exactly, they
+        // are widened to accept some extra IDs, so check again in software.
+        // With no filters at all the AF is off and everything is accepted.
         CanMessage message = receiveCanMessage(bus);
-        if(!QUEUE_PUSH(CanMessage, &bus->receiveQueue, message)) {
+        message.timestamp = time::systemTimeUs();
+        if((LIST_EMPTY(&bus->acceptanceFilters) ||
+                    openxc::can::shouldAcceptMessage(bus, message.id,
+                        message.format)) &&
+                !QUEUE_PUSH(CanMessage, &bus->receiveQueue, message)) {
             // An exception to the "don't leave commented out code" rule,
             // this log statement is useful for debugging performance issues
             // but if left enabled all of the time, it can can slown down
@@ -12,6 +12,11 @@
 
 #define CAN_RX_CHANNEL 1
 #define BUS_MEMORY_BUFFER_SIZE 2 * 8 * 16
+// The number of hardware acceptance filters on each CAN module.
+#define CAN_FILTER_COUNT 32
+// Filter masks 2 and 3 ignore the lowest bits of an ID, so one filter can
+// accept an aligned block of this many IDs.
+#define CAN_FILTER_BLOCK_SIZE 8
 
 namespace gpio = openxc::gpio;
 
@@ -53,6 +58,12 @@ bool openxc::can::resetAcceptanceFilterStatus(CanBus* bus, bool enabled) {
                 CAN::SID, CAN::FILTER_MASK_IDE_TYPE);
         CAN_CONTROLLER(bus)->configureFilterMask(CAN::FILTER_MASK1, 0x1FFFFFFF,
                 CAN::EID, CAN::FILTER_MASK_IDE_TYPE);
+        CAN_CONTROLLER(bus)->configureFilterMask(CAN::FILTER_MASK2,
+                0xFFF & ~(CAN_FILTER_BLOCK_SIZE - 1), CAN::SID,
+                CAN::FILTER_MASK_IDE_TYPE);
+        CAN_CONTROLLER(bus)->configureFilterMask(CAN::FILTER_MASK3,
+                0x1FFFFFFF & ~(CAN_FILTER_BLOCK_SIZE - 1), CAN::EID,
+                CAN::FILTER_MASK_IDE_TYPE);
     } else {
         debug("Disabling primary AF filter mask for bus %d to allow "
                 "all messages through", bus->address);
@@ -73,60 +84,191 @@ bool openxc::can::resetAcceptanceFilterStatus(CanBus* bus, bool enabled) {
     return true;
 }
 
+/* Private: Count or configure the hardware filters needed to accept a range
+ * of IDs. Aligned blocks of CAN_FILTER_BLOCK_SIZE IDs use one filter with a
+ * block mask, and any other IDs use one filter each with an exact mask. Only
+ * those two fixed masks are used - a wide range is not covered by a single
+ * filter with a wider mask, so it usually needs more filters than the module
+ * has and the bus falls back to filtering in software.
+ *
+ * bus - The bus to configure, or NULL to only count the filters.
+ * range - The range of IDs to accept.
+ * format - The format of the IDs.
+ * firstFilter - The index of the first hardware filter to configure.
+ * limit - Stop after this many filters, so counting a wide range (e.g. a
+ *      block of extended IDs) doesn't walk every ID in it.
+ *
+ * Returns the number of hardware filters required for the range, or limit + 1
+ * if it needs more than limit.
+ */
+static int configureRangeFilters(CanBus* bus, AcceptanceFilterRange* range,
+        CanMessageFormat format, int firstFilter, int limit) {
+    int filterCount = 0;
+    uint32_t id = range->first;
+    while(id <= range->last) {
+        if(filterCount >= limit) {
+            return limit + 1;
+        }
+
+        bool block = id % CAN_FILTER_BLOCK_SIZE == 0 &&
+                range->last - id >= CAN_FILTER_BLOCK_SIZE - 1;
+        if(bus != NULL) {
+            CAN::FILTER filter = CAN::FILTER(firstFilter + filterCount);
+            CAN::FILTER_MASK mask;
+            if(format == CanMessageFormat::STANDARD) {
+                mask = block ? CAN::FILTER_MASK2 : CAN::FILTER_MASK0;
+            } else {
+                mask = block ? CAN::FILTER_MASK3 : CAN::FILTER_MASK1;
+            }
+
+            // Must disable before changing or else the filters do not work!
+            CAN_CONTROLLER(bus)->enableFilter(filter, false);
+            CAN_CONTROLLER(bus)->configureFilter(filter, id,
+                    format == CanMessageFormat::STANDARD ? CAN::SID : CAN::EID);
+            CAN_CONTROLLER(bus)->linkFilterToChannel(filter, mask,
+                    CAN::CHANNEL(CAN_RX_CHANNEL));
+            CAN_CONTROLLER(bus)->enableFilter(filter, true);
+        }
+
+        ++filterCount;
+        if(block) {
+            if(range->last - id < CAN_FILTER_BLOCK_SIZE) {
+                break;
+            }
+            id += CAN_FILTER_BLOCK_SIZE;
+        } else {
+            if(id == range->last) {
+                break;
+            }
+            ++id;
+        }
+    }
+    return filterCount;
+}
+
+/* Private: Count the hardware filters needed for a set of ranges, stopping as
+ * soon as the count passes limit.
+ *
+ * Returns the number of hardware filters required, or limit + 1 if the ranges
+ * need more than limit.
+ */
+static int countRangeFilters(AcceptanceFilterRange ranges[], int rangeCount,
+        CanMessageFormat format, int limit) {
+    int filterCount = 0;
+    for(int i = 0; i < rangeCount && filterCount <= limit; i++) {
+        filterCount += configureRangeFilters(NULL, &ranges[i], format, 0,
+                limit - filterCount);
+    }
+    return filterCount;
+}
+
+/* Private: Pack the bus's filters of one format into ranges that need as few
+ * hardware filters as possible.
+ *
+ * Merging ranges only helps while the gaps it swallows are small - past that
+ * the merged ranges need more filters, not fewer - so every packing from no
+ * merging down to a single range is counted and the one needing the fewest
+ * filters wins, preferring the least merging on a tie.
+ *
+ * bus - The bus with the filters to pack.
+ * format - The format of the IDs to pack.
+ * ranges - An array of at least MAX_ACCEPTANCE_FILTERS ranges to fill.
+ * limit - The number of hardware filters still available.
+ * filterCount - Set to the number of hardware filters the ranges need, or
+ *      limit + 1 if no packing fits in limit.
+ *
+ * Returns the number of ranges stored in ranges.
+ */
+static int packRangeFilters(CanBus* bus, CanMessageFormat format,
+        AcceptanceFilterRange ranges[], int limit, int* filterCount) {
+    int bestMaxRanges = MAX_ACCEPTANCE_FILTERS;
+    *filterCount = limit + 1;
+    for(int maxRanges = MAX_ACCEPTANCE_FILTERS; maxRanges > 0; --maxRanges) {
+        int rangeCount = optimizeAcceptanceFilters(bus, format, ranges,
+                maxRanges);
+        int count = countRangeFilters(ranges, rangeCount, format, limit);
+        if(count < *filterCount) {
+            *filterCount = count;
+            bestMaxRanges = maxRanges;
+        }
+    }
+    return optimizeAcceptanceFilters(bus, format, ranges, bestMaxRanges);
+}
+
 bool openxc::can::updateAcceptanceFilterTable(CanBus* buses, const int busCount) {
     // For the PIC32 we *could* only change the filters for one bus, but to
     // simplify things we'll reset everything like we have to with the LPC1768
-    uint16_t totalFilterCount = 0;
     for(int i = 0; i < busCount; i++) {
         CanBus* bus = &buses[i];
-        uint16_t busFilterCount = 0;
         CAN::OP_MODE previousMode = switchControllerMode(bus, CAN::CONFIGURATION);
 
+        // Pack the extended IDs first and separately from the standard ones -
+        // a sparse set of 29-bit IDs gains little from merging and a
+        // shared merge count would widen both formats together, pushing the
+        // bus into bypass when the standard IDs alone could have been
+        // packed. The standard IDs then get whatever filters are left. If
+        // they don't all fit, the bus falls back to bypass, and anything the
+        // wider ranges let through is dropped by the software filter in the
+        // ISR.
+        AcceptanceFilterRange standardRanges[MAX_ACCEPTANCE_FILTERS];
+        AcceptanceFilterRange extendedRanges[MAX_ACCEPTANCE_FILTERS];
+        int extendedFilterCount;
+        int extendedCount = packRangeFilters(bus, CanMessageFormat::EXTENDED,
+                extendedRanges, CAN_FILTER_COUNT, &extendedFilterCount);
+        int standardCount = 0;
+        int busFilterCount = extendedFilterCount;
+        if(extendedFilterCount <= CAN_FILTER_COUNT) {
+            int standardLimit = CAN_FILTER_COUNT - extendedFilterCount;
+            int standardFilterCount = standardLimit + 1;
+            for(int maxRanges = MAX_ACCEPTANCE_FILTERS;
+                    maxRanges > 0 && standardFilterCount > standardLimit;
+                    --maxRanges) {
+                standardCount = optimizeAcceptanceFilters(bus,
+                        CanMessageFormat::STANDARD, standardRanges, maxRanges);
+                standardFilterCount = countRangeFilters(standardRanges,
+                        standardCount, CanMessageFormat::STANDARD,
+                        standardLimit);
+            }
+            busFilterCount += standardFilterCount;
+        }
+
         if(LIST_EMPTY(&bus->acceptanceFilters) || bus->bypassFilters) {
             debug("Bus %d has no filters configured or manually set to bypass, "
                     "turning off acceptance filter", bus->address);
             resetAcceptanceFilterStatus(bus, false);
+        } else if(busFilterCount > CAN_FILTER_COUNT) {
+            debug("Bus %d needs more than %d filters, turning off acceptance "
+                    "filter and filtering in software", bus->address,
+                    CAN_FILTER_COUNT);
+            resetAcceptanceFilterStatus(bus, false);
         } else {
             // Must set the controller's AF filter status first and only once,
             // before configuring, because it wipes anything you've configured
             // when you set it.
             resetAcceptanceFilterStatus(bus, true);
 
-            AcceptanceFilterListEntry* entry;
-            LIST_FOREACH(entry, &bus->acceptanceFilters, entries) {
-                if(busFilterCount >= MAX_ACCEPTANCE_FILTERS) {
-                    break;
-                }
-
-                // Must disable before changing or else the filters do not work!
-                CAN_CONTROLLER(bus)->enableFilter(CAN::FILTER(totalFilterCount), false);
-                if(entry->format == CanMessageFormat::STANDARD) {
-                    // Standard format message IDs match filter mask 0
-                    debug("Added acceptance filter for STD 0x%x on bus %d to AF",
-                            entry->filter, bus->address);
-                    CAN_CONTROLLER(bus)->configureFilter(
-                            CAN::FILTER(totalFilterCount), entry->filter, CAN::SID);
-                    CAN_CONTROLLER(bus)->linkFilterToChannel(CAN::FILTER(totalFilterCount),
-                            CAN::FILTER_MASK0, CAN::CHANNEL(CAN_RX_CHANNEL));
-                } else {
-                    // Extended format message IDs match filter mask 1
-                    debug("Added acceptance filter for EXT 0x%x on bus %d to AF",
-                            entry->filter, bus->address);
-                    CAN_CONTROLLER(bus)->configureFilter(
-                            CAN::FILTER(totalFilterCount), entry->filter, CAN::EID);
-                    CAN_CONTROLLER(bus)->linkFilterToChannel(CAN::FILTER(totalFilterCount),
-                            CAN::FILTER_MASK1, CAN::CHANNEL(CAN_RX_CHANNEL));
-                }
-                CAN_CONTROLLER(bus)->enableFilter(CAN::FILTER(totalFilterCount), true);
-
-                ++totalFilterCount;
-                ++busFilterCount;
+            busFilterCount = 0;
+            for(int j = 0; j < standardCount; j++) {
+                debug("Added acceptance filter for STD 0x%x - 0x%x on bus %d "
+                        "to AF", standardRanges[j].first,
+                        standardRanges[j].last, bus->address);
+                busFilterCount += configureRangeFilters(bus,
+                        &standardRanges[j], CanMessageFormat::STANDARD,
+                        busFilterCount, CAN_FILTER_COUNT - busFilterCount);
+            }
+            for(int j = 0; j < extendedCount; j++) {
+                debug("Added acceptance filter for EXT 0x%x - 0x%x on bus %d "
+                        "to AF", extendedRanges[j].first,
+                        extendedRanges[j].last, bus->address);
+                busFilterCount += configureRangeFilters(bus,
+                        &extendedRanges[j], CanMessageFormat::EXTENDED,
+                        busFilterCount, CAN_FILTER_COUNT - busFilterCount);
             }
 
             // Disable the remaining unused filters. When AF is "off" we are
             // actually using filter 0, so we don't want to disable that.
             for(int disabledFilters = busFilterCount;
-                    disabledFilters < MAX_ACCEPTANCE_FILTERS; ++disabledFilters) {
+                    disabledFilters < CAN_FILTER_COUNT; ++disabledFilters) {
                 CAN_CONTROLLER(bus)->enableFilter(CAN::FILTER(disabledFilters), false);
             }
         }
@@ -170,7 +312,9 @@ static void handleCan2Interrupt() {
 
 void openxc::can::initialize(CanBus* bus, bool writable, CanBus* buses,
         const int busCount) {
-    can::initializeCommon(bus);
+    if(!can::initializeCommon(bus)) {
+        return;
+    }
     // Switch the CAN module ON and switch it to Configuration mode. Wait till
     // the switch is complete
     CAN_CONTROLLER(bus)->enableModule(true);
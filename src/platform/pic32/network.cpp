@@ -1,6 +1,7 @@
 #include "interface/network.h"
 #include "util/log.h"
 #include "util/bytebuffer.h"
+#include "config.h"
 #include <stddef.h>
 
 #ifdef __USE_NETWORK__
@@ -15,6 +16,7 @@
 
 using openxc::util::log::debug;
 using openxc::util::bytebuffer::processQueue;
+using openxc::config::getConfiguration;
 
 Server server = Server(DEFAULT_NETWORK_PORT);
 
@@ -65,7 +67,8 @@ void openxc::interface::network::read(NetworkDevice* device,
                 !QUEUE_FULL(uint8_t, &device->receiveQueue)) {
             QUEUE_PUSH(uint8_t, &device->receiveQueue, byte);
         }
-        processQueue(&device->receiveQueue, callback);
+        processQueue(&device->receiveQueue, &device->receiveFramer,
+                getConfiguration()->payloadFormat, callback);
     }
 }
 
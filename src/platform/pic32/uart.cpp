@@ -22,6 +22,7 @@
  */
 #include "interface/uart.h"
 #include "util/bytebuffer.h"
+#include "config.h"
 #include "util/log.h"
 #include "atcommander.h"
 #include "WProgram.h"
@@ -50,6 +51,7 @@ namespace gpio = openxc::gpio;
 
 using openxc::util::log::debug;
 using openxc::util::bytebuffer::processQueue;
+using openxc::config::getConfiguration;
 
 extern const AtCommanderPlatform AT_PLATFORM_RN42;
 extern HardwareSerial Serial;
@@ -66,7 +68,8 @@ void openxc::interface::uart::read(UartDevice* device,
                 char byte = ((HardwareSerial*)device->controller)->read();
                 QUEUE_PUSH(uint8_t, &device->receiveQueue, (uint8_t) byte);
             }
-            processQueue(&device->receiveQueue, callback);
+            processQueue(&device->receiveQueue, &device->receiveFramer,
+                    getConfiguration()->payloadFormat, callback);
         }
     }
 }
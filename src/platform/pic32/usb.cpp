@@ -196,7 +196,8 @@ void openxc::interface::usb::read(UsbDevice* device, UsbEndpoint* endpoint,
         }
 
         if(length > 0) {
-            while(processQueue(&endpoint->queue, callback)) {
+            while(processQueue(&endpoint->queue, &endpoint->framer,
+                        getConfiguration()->payloadFormat, callback)) {
                 continue;
             }
         }
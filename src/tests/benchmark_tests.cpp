@@ -0,0 +1,797 @@
+#include <check.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/param.h>
+
+#include "can/canutil.h"
+#include "can/canread.h"
+#include "config.h"
+#include "pipeline.h"
+#include "payload/json.h"
+#include "util/bytebuffer.h"
+#include "util/numberformat.h"
+#include <cJSON.h>
+
+namespace can = openxc::can;
+namespace usb = openxc::interface::usb;
+namespace bytebuffer = openxc::util::bytebuffer;
+
+using openxc::can::lookupMessageDefinition;
+using openxc::can::buildMessageIndex;
+using openxc::can::buildNameIndex;
+using openxc::can::lookupSignal;
+using openxc::can::addAcceptanceFilter;
+using openxc::can::shouldAcceptMessage;
+using openxc::can::read::translateSignal;
+using openxc::can::read::translateMessage;
+using openxc::can::read::ignoreDecoder;
+using openxc::config::getConfiguration;
+using openxc::pipeline::Pipeline;
+using openxc::pipeline::MessageClass;
+using openxc::payload::PayloadFormat;
+using openxc::util::bytebuffer::ByteSpan;
+
+/* These aren't pass/fail performance tests - they check that the fast path
+ * returns the same results as the original implementation and print the
+ * measured throughput of both, so regressions are visible in the test output.
+ */
+
+#define BENCHMARK_MESSAGE_COUNT 160
+#define BENCHMARK_SIGNAL_COUNT 300
+#define BENCHMARK_ITERATIONS 2000
+#define BENCHMARK_FRAME_SIGNAL_COUNT 16
+#define BENCHMARK_PAYLOAD_SIZE 61
+#define BENCHMARK_SERIALIZED_MESSAGE_COUNT 4
+#define BENCHMARK_NUMBER_COUNT 256
+// The low end of what the VI gets out of full speed USB
+#define BENCHMARK_USB_BYTES_PER_SECOND 125000.0
+
+CanBus BENCHMARK_BUSES[1];
+CanMessageDefinition BENCHMARK_MESSAGES[BENCHMARK_MESSAGE_COUNT];
+CanSignal BENCHMARK_SIGNALS[BENCHMARK_SIGNAL_COUNT];
+char BENCHMARK_SIGNAL_NAMES[BENCHMARK_SIGNAL_COUNT][32];
+CanSignal BENCHMARK_FRAME_SIGNALS[BENCHMARK_FRAME_SIGNAL_COUNT];
+
+static double elapsedSeconds(struct timespec* start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) +
+        (end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void report(const char* name, unsigned long operations,
+        double seconds) {
+    printf("%-40s %12.0f ops / s\n", name,
+            seconds > 0 ? operations / seconds : 0);
+}
+
+static void reportThroughput(const char* name, unsigned long bytes,
+        double seconds) {
+    printf("%-40s %12.0f bytes / s\n", name, seconds > 0 ? bytes / seconds : 0);
+}
+
+void setup() {
+    can::initializeCommon(&BENCHMARK_BUSES[0]);
+    for(int i = 0; i < BENCHMARK_MESSAGE_COUNT; i++) {
+        // spread the IDs out and define them in descending order, so the
+        // linear search is not helped by the order of the array
+        BENCHMARK_MESSAGES[i].bus = &BENCHMARK_BUSES[0];
+        BENCHMARK_MESSAGES[i].id = 0x100 + (BENCHMARK_MESSAGE_COUNT - i) * 7;
+        BENCHMARK_MESSAGES[i].format = CanMessageFormat::STANDARD;
+    }
+
+    for(int i = 0; i < BENCHMARK_SIGNAL_COUNT; i++) {
+        snprintf(BENCHMARK_SIGNAL_NAMES[i], sizeof(BENCHMARK_SIGNAL_NAMES[i]),
+                "vehicle_signal_number_%d", i);
+        BENCHMARK_SIGNALS[i].message =
+                &BENCHMARK_MESSAGES[i % BENCHMARK_MESSAGE_COUNT];
+        BENCHMARK_SIGNALS[i].genericName = BENCHMARK_SIGNAL_NAMES[i];
+        BENCHMARK_SIGNALS[i].writable = i % 10 == 0;
+    }
+    buildNameIndex(NULL, 0, NULL, 0);
+}
+
+static unsigned long benchmarkMessageLookups(unsigned long* found) {
+    unsigned long lookups = 0;
+    for(int i = 0; i < BENCHMARK_ITERATIONS; i++) {
+        // every other lookup is for an ID that isn't defined
+        for(uint32_t id = 0x100; id < 0x100 + BENCHMARK_MESSAGE_COUNT * 7;
+                id += 3) {
+            if(lookupMessageDefinition(&BENCHMARK_BUSES[0], id,
+                    CanMessageFormat::STANDARD, BENCHMARK_MESSAGES,
+                    BENCHMARK_MESSAGE_COUNT) != NULL) {
+                ++*found;
+            }
+            ++lookups;
+        }
+    }
+    return lookups;
+}
+
+START_TEST (test_benchmark_message_lookup)
+{
+    struct timespec start;
+    unsigned long linearFound = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    unsigned long lookups = benchmarkMessageLookups(&linearFound);
+    report("message lookup, linear search", lookups, elapsedSeconds(&start));
+
+    ck_assert(buildMessageIndex(BENCHMARK_BUSES, 1, BENCHMARK_MESSAGES,
+            BENCHMARK_MESSAGE_COUNT, NULL, 0));
+
+    unsigned long indexedFound = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    lookups = benchmarkMessageLookups(&indexedFound);
+    report("message lookup, index", lookups, elapsedSeconds(&start));
+
+    ck_assert(linearFound > 0);
+    ck_assert_int_eq(linearFound, indexedFound);
+}
+END_TEST
+
+static unsigned long benchmarkSignalLookups(unsigned long* found) {
+    unsigned long lookups = 0;
+    for(int i = 0; i < BENCHMARK_ITERATIONS / 10; i++) {
+        for(int j = 0; j < BENCHMARK_SIGNAL_COUNT; j++) {
+            if(lookupSignal(BENCHMARK_SIGNAL_NAMES[j], BENCHMARK_SIGNALS,
+                    BENCHMARK_SIGNAL_COUNT, j % 2 == 0) != NULL) {
+                ++*found;
+            }
+            ++lookups;
+        }
+    }
+    return lookups;
+}
+
+START_TEST (test_benchmark_signal_lookup)
+{
+    struct timespec start;
+    unsigned long linearFound = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    unsigned long lookups = benchmarkSignalLookups(&linearFound);
+    report("signal lookup by name, linear search", lookups,
+            elapsedSeconds(&start));
+
+    ck_assert(buildNameIndex(BENCHMARK_SIGNALS, BENCHMARK_SIGNAL_COUNT, NULL,
+            0));
+
+    unsigned long indexedFound = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    lookups = benchmarkSignalLookups(&indexedFound);
+    report("signal lookup by name, index", lookups, elapsedSeconds(&start));
+
+    ck_assert(linearFound > 0);
+    ck_assert_int_eq(linearFound, indexedFound);
+}
+END_TEST
+
+/* Private: The original acceptance check, a walk of the filter list, for
+ * comparison.
+ */
+static bool shouldAcceptMessageListSearch(CanBus* bus, uint32_t messageId,
+        CanMessageFormat format) {
+    bool acceptMessage = bus->bypassFilters;
+    if(!acceptMessage) {
+        AcceptanceFilterListEntry* entry;
+        LIST_FOREACH(entry, &bus->acceptanceFilters, entries) {
+            if(entry->filter <= messageId && messageId <= entry->lastFilter &&
+                    entry->format == format) {
+                acceptMessage = true;
+                break;
+            }
+        }
+    }
+    return acceptMessage;
+}
+
+static unsigned long benchmarkAcceptanceCheck(
+        bool (*check)(CanBus*, uint32_t, CanMessageFormat),
+        unsigned long* accepted) {
+    unsigned long checks = 0;
+    for(int i = 0; i < BENCHMARK_ITERATIONS; i++) {
+        for(uint32_t id = 0x100; id < 0x300; id += 2) {
+            if(check(&BENCHMARK_BUSES[0], id, CanMessageFormat::STANDARD)) {
+                ++*accepted;
+            }
+            ++checks;
+        }
+    }
+    return checks;
+}
+
+START_TEST (test_benchmark_acceptance_check)
+{
+    // fill every filter slot, so the list search is at its worst case
+    for(int i = 0; i < MAX_ACCEPTANCE_FILTERS; i++) {
+        ck_assert(addAcceptanceFilter(&BENCHMARK_BUSES[0], 0x100 + i * 16,
+                CanMessageFormat::STANDARD, BENCHMARK_BUSES, 1));
+    }
+
+    struct timespec start;
+    unsigned long listAccepted = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    unsigned long checks = benchmarkAcceptanceCheck(
+            shouldAcceptMessageListSearch, &listAccepted);
+    report("acceptance check, filter list", checks, elapsedSeconds(&start));
+
+    unsigned long bitmapAccepted = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    checks = benchmarkAcceptanceCheck(shouldAcceptMessage, &bitmapAccepted);
+    report("acceptance check, bitmap", checks, elapsedSeconds(&start));
+
+    ck_assert(listAccepted > 0);
+    ck_assert_int_eq(listAccepted, bitmapAccepted);
+}
+END_TEST
+
+static unsigned long benchmarkSignalTranslation(bool useExtractionPlan,
+        float* lastValues) {
+    unsigned long signalsTranslated = 0;
+    CanMessage message = {
+        id: BENCHMARK_MESSAGES[0].id,
+        format: CanMessageFormat::STANDARD,
+    };
+    for(int i = 0; i < BENCHMARK_ITERATIONS * 10; i++) {
+        for(int j = 0; j < CAN_MESSAGE_SIZE; j++) {
+            message.data[j] = i * 31 + j * 7;
+        }
+
+        if(useExtractionPlan) {
+            translateMessage(&BENCHMARK_BUSES[0], &message,
+                    BENCHMARK_FRAME_SIGNALS, BENCHMARK_FRAME_SIGNAL_COUNT,
+                    &getConfiguration()->pipeline);
+        } else {
+            for(int j = 0; j < BENCHMARK_FRAME_SIGNAL_COUNT; j++) {
+                translateSignal(&BENCHMARK_FRAME_SIGNALS[j], &message,
+                        BENCHMARK_FRAME_SIGNALS, BENCHMARK_FRAME_SIGNAL_COUNT,
+                        &getConfiguration()->pipeline);
+            }
+        }
+        signalsTranslated += BENCHMARK_FRAME_SIGNAL_COUNT;
+    }
+
+    for(int i = 0; i < BENCHMARK_FRAME_SIGNAL_COUNT; i++) {
+        lastValues[i] = BENCHMARK_FRAME_SIGNALS[i].lastValue;
+    }
+    return signalsTranslated;
+}
+
+START_TEST (test_benchmark_signal_extraction)
+{
+    // 16 signals of assorted sizes packed into one message, like the busiest
+    // messages in a real vehicle
+    int bitPosition = 0;
+    for(int i = 0; i < BENCHMARK_FRAME_SIGNAL_COUNT; i++) {
+        CanSignal* signal = &BENCHMARK_FRAME_SIGNALS[i];
+        signal->message = &BENCHMARK_MESSAGES[0];
+        signal->genericName = BENCHMARK_SIGNAL_NAMES[i];
+        signal->bitSize = 1 + i % 6;
+        signal->bitPosition = bitPosition;
+        bitPosition += signal->bitSize;
+        signal->factor = 0.5;
+        signal->offset = -10;
+        // measure the decoding, not the publishing
+        signal->decoder = ignoreDecoder;
+    }
+    ck_assert(buildMessageIndex(BENCHMARK_BUSES, 1, BENCHMARK_MESSAGES,
+            BENCHMARK_MESSAGE_COUNT, BENCHMARK_FRAME_SIGNALS,
+            BENCHMARK_FRAME_SIGNAL_COUNT));
+
+    struct timespec start;
+    float signalValues[BENCHMARK_FRAME_SIGNAL_COUNT];
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    unsigned long translated = benchmarkSignalTranslation(false, signalValues);
+    report("signal translation, per signal", translated,
+            elapsedSeconds(&start));
+
+    float plannedSignalValues[BENCHMARK_FRAME_SIGNAL_COUNT];
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    translated = benchmarkSignalTranslation(true, plannedSignalValues);
+    report("signal translation, extraction plan", translated,
+            elapsedSeconds(&start));
+
+    for(int i = 0; i < BENCHMARK_FRAME_SIGNAL_COUNT; i++) {
+        ck_assert(signalValues[i] == plannedSignalValues[i]);
+    }
+}
+END_TEST
+
+/* Private: The original byte queue operations, a byte at a time, for
+ * comparison.
+ */
+static bool conditionalEnqueueByteByByte(QUEUE_TYPE(uint8_t)* queue,
+        uint8_t* message, int messageSize) {
+    if(bytebuffer::messageFits(queue, message, messageSize)) {
+        for(int i = 0; i < messageSize; i++) {
+            QUEUE_PUSH(uint8_t, queue, (uint8_t)message[i]);
+        }
+        return true;
+    }
+    return false;
+}
+
+static int flushByteByByte(QUEUE_TYPE(uint8_t)* queue, uint8_t* sendBuffer) {
+    int byteCount = 0;
+    while(!QUEUE_EMPTY(uint8_t, queue) && byteCount < USB_SEND_BUFFER_SIZE) {
+        sendBuffer[byteCount++] = QUEUE_POP(uint8_t, queue);
+    }
+    return byteCount;
+}
+
+/* Private: Flush the queue the way the USB and UART drivers do now, reading
+ * straight from the queue's storage.
+ */
+static int flushSpans(QUEUE_TYPE(uint8_t)* queue, uint8_t* sendBuffer) {
+    ByteSpan spans[BYTE_QUEUE_MAX_SPANS];
+    int spanCount = bytebuffer::peek(queue, spans);
+    int byteCount = 0;
+    for(int i = 0; i < spanCount; i++) {
+        memcpy(&sendBuffer[byteCount], spans[i].data, spans[i].length);
+        byteCount += spans[i].length;
+    }
+    bytebuffer::consume(queue, byteCount);
+    return byteCount;
+}
+
+/* Private: Send payloads to the USB IN endpoint's queue, flushing it to a
+ * buffer like the USB driver whenever it's full.
+ *
+ * throughPipeline - if true, send with sendMessage(...) and flush with spans,
+ *      otherwise queue and flush a byte at a time.
+ * checksum - a running sum of the flushed bytes, to compare the two methods.
+ */
+static unsigned long benchmarkUsbSend(bool throughPipeline,
+        unsigned long* checksum) {
+    Pipeline* pipeline = &getConfiguration()->pipeline;
+    QUEUE_TYPE(uint8_t)* queue = &pipeline->usb->endpoints[
+            IN_ENDPOINT_INDEX].queue;
+    uint8_t payload[BENCHMARK_PAYLOAD_SIZE];
+    uint8_t sendBuffer[USB_SEND_BUFFER_SIZE];
+    unsigned long bytesSent = 0;
+
+    for(int i = 0; i < BENCHMARK_ITERATIONS * 50; i++) {
+        for(int j = 0; j < BENCHMARK_PAYLOAD_SIZE; j++) {
+            payload[j] = i + j;
+        }
+
+        // Flush at the same point for both methods - the pipeline keeps
+        // PRIORITY_HEADROOM_BYTES free for responses, and would otherwise
+        // flush the queue itself.
+        if(QUEUE_AVAILABLE(uint8_t, queue) - BENCHMARK_PAYLOAD_SIZE <
+                PRIORITY_HEADROOM_BYTES) {
+            int flushed = throughPipeline ? flushSpans(queue, sendBuffer) :
+                    flushByteByByte(queue, sendBuffer);
+            for(int j = 0; j < flushed; j++) {
+                *checksum += sendBuffer[j];
+            }
+        }
+
+        if(throughPipeline) {
+            openxc::pipeline::sendMessage(pipeline, payload,
+                    BENCHMARK_PAYLOAD_SIZE, MessageClass::SIMPLE);
+        } else {
+            conditionalEnqueueByteByByte(queue, payload,
+                    BENCHMARK_PAYLOAD_SIZE);
+        }
+        bytesSent += BENCHMARK_PAYLOAD_SIZE;
+    }
+    QUEUE_INIT(uint8_t, queue);
+    return bytesSent;
+}
+
+START_TEST (test_benchmark_usb_send)
+{
+    Pipeline* pipeline = &getConfiguration()->pipeline;
+    pipeline->usb = &getConfiguration()->usb;
+    pipeline->uart = NULL;
+    pipeline->network = NULL;
+    usb::initialize(pipeline->usb);
+    pipeline->usb->configured = true;
+
+    struct timespec start;
+    unsigned long byteChecksum = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    unsigned long bytes = benchmarkUsbSend(false, &byteChecksum);
+    reportThroughput("USB send, a byte at a time", bytes,
+            elapsedSeconds(&start));
+
+    unsigned long spanChecksum = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    bytes = benchmarkUsbSend(true, &spanChecksum);
+    reportThroughput("USB send, pipeline with spans", bytes,
+            elapsedSeconds(&start));
+
+    ck_assert(byteChecksum > 0);
+    ck_assert_int_eq(byteChecksum, spanChecksum);
+}
+END_TEST
+
+/* Private: Publish raw CAN messages through the pipeline in a payload format,
+ * flushing the USB IN endpoint's queue like the USB driver whenever it's
+ * nearly full.
+ *
+ * bytes - An output parameter, the number of bytes flushed.
+ *
+ * Returns the number of CAN messages published.
+ */
+static unsigned long benchmarkCanPublish(PayloadFormat format,
+        unsigned long* bytes) {
+    Pipeline* pipeline = &getConfiguration()->pipeline;
+    QUEUE_TYPE(uint8_t)* queue = &pipeline->usb->endpoints[
+            IN_ENDPOINT_INDEX].queue;
+    uint8_t sendBuffer[USB_SEND_BUFFER_SIZE];
+    getConfiguration()->payloadFormat = format;
+
+    openxc_VehicleMessage message = {0};
+    message.has_type = true;
+    message.type = openxc_VehicleMessage_Type_CAN;
+    message.has_can_message = true;
+    message.can_message.has_bus = true;
+    message.can_message.bus = 1;
+    message.can_message.has_id = true;
+    message.can_message.has_data = true;
+    message.can_message.data.size = 8;
+
+    unsigned long published = 0;
+    for(int i = 0; i < BENCHMARK_ITERATIONS * 50; i++) {
+        message.can_message.id = 0x100 + i % 0x600;
+        for(int j = 0; j < 8; j++) {
+            message.can_message.data.bytes[j] = i + j * 0x21;
+        }
+
+        if(QUEUE_AVAILABLE(uint8_t, queue) - BENCHMARK_PAYLOAD_SIZE <
+                PRIORITY_HEADROOM_BYTES) {
+            *bytes += flushSpans(queue, sendBuffer);
+        }
+        openxc::pipeline::publish(&message, pipeline);
+        ++published;
+    }
+    *bytes += flushSpans(queue, sendBuffer);
+    getConfiguration()->payloadFormat = PayloadFormat::JSON;
+    return published;
+}
+
+START_TEST (test_benchmark_raw_can_usb_send)
+{
+    Pipeline* pipeline = &getConfiguration()->pipeline;
+    pipeline->usb = &getConfiguration()->usb;
+    pipeline->uart = NULL;
+    pipeline->network = NULL;
+    usb::initialize(pipeline->usb);
+    pipeline->usb->configured = true;
+
+    struct timespec start;
+    unsigned long jsonBytes = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    unsigned long jsonFrames = benchmarkCanPublish(PayloadFormat::JSON,
+            &jsonBytes);
+    report("CAN frames to USB, JSON", jsonFrames, elapsedSeconds(&start));
+
+    unsigned long rawBytes = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    unsigned long rawFrames = benchmarkCanPublish(PayloadFormat::RAW_CAN,
+            &rawBytes);
+    report("CAN frames to USB, raw CAN", rawFrames, elapsedSeconds(&start));
+
+    ck_assert_int_eq(jsonFrames, rawFrames);
+    double jsonFrameSize = (double) jsonBytes / jsonFrames;
+    double rawFrameSize = (double) rawBytes / rawFrames;
+    // The USB link, not the CPU, limits how many frames the VI can send
+    printf("%-40s %12.1f bytes, %8.0f frames / s on USB\n",
+            "CAN frame size, JSON", jsonFrameSize,
+            BENCHMARK_USB_BYTES_PER_SECOND / jsonFrameSize);
+    printf("%-40s %12.1f bytes, %8.0f frames / s on USB\n",
+            "CAN frame size, raw CAN", rawFrameSize,
+            BENCHMARK_USB_BYTES_PER_SECOND / rawFrameSize);
+    ck_assert(rawFrameSize * 2 <= jsonFrameSize);
+}
+END_TEST
+
+/* Private: Serialize a simple or CAN message by building a cJSON tree and
+ * printing it, the way the JSON payload did before it wrote straight to the
+ * buffer, for comparison.
+ */
+static int serializeWithCJSON(openxc_VehicleMessage* message,
+        uint8_t payload[], size_t length) {
+    namespace json = openxc::payload::json;
+    cJSON* root = cJSON_CreateObject();
+    if(message->type == openxc_VehicleMessage_Type_SIMPLE) {
+        cJSON_AddStringToObject(root, json::NAME_FIELD_NAME,
+                message->simple_message.name);
+        openxc_DynamicField* value = &message->simple_message.value;
+        if(value->has_numeric_value) {
+            cJSON_AddNumberToObject(root, json::VALUE_FIELD_NAME,
+                    value->numeric_value);
+        } else if(value->has_string_value) {
+            cJSON_AddStringToObject(root, json::VALUE_FIELD_NAME,
+                    value->string_value);
+        }
+        if(message->simple_message.has_event) {
+            cJSON_AddBoolToObject(root, json::EVENT_FIELD_NAME,
+                    message->simple_message.event.boolean_value);
+        }
+    } else {
+        cJSON_AddNumberToObject(root, json::BUS_FIELD_NAME,
+                message->can_message.bus);
+        cJSON_AddNumberToObject(root, json::ID_FIELD_NAME,
+                message->can_message.id);
+        char encodedData[67] = "0x";
+        for(uint8_t i = 0; i < message->can_message.data.size; i++) {
+            sprintf(&encodedData[2 + i * 2], "%02x",
+                    message->can_message.data.bytes[i]);
+        }
+        cJSON_AddStringToObject(root, json::DATA_FIELD_NAME, encodedData);
+    }
+
+    char* serialized = cJSON_PrintUnformatted(root);
+    size_t finalLength = MIN(length, strlen(serialized) + 1);
+    memcpy(payload, serialized, finalLength);
+    free(serialized);
+    cJSON_Delete(root);
+    return finalLength;
+}
+
+/* Private: A mix of the messages the VI sends the most - numeric and state
+ * simple messages, one with an event, and raw CAN.
+ */
+static void buildSerializedMessages(openxc_VehicleMessage* messages) {
+    memset(messages, 0, sizeof(openxc_VehicleMessage) *
+            BENCHMARK_SERIALIZED_MESSAGE_COUNT);
+    for(int i = 0; i < BENCHMARK_SERIALIZED_MESSAGE_COUNT - 1; i++) {
+        messages[i].has_type = true;
+        messages[i].type = openxc_VehicleMessage_Type_SIMPLE;
+        messages[i].has_simple_message = true;
+        strcpy(messages[i].simple_message.name, BENCHMARK_SIGNAL_NAMES[i]);
+        messages[i].simple_message.has_value = true;
+    }
+    messages[0].simple_message.value.has_numeric_value = true;
+    messages[0].simple_message.value.numeric_value = 1234.5;
+    messages[1].simple_message.value.has_string_value = true;
+    strcpy(messages[1].simple_message.value.string_value, "driver");
+    messages[1].simple_message.has_event = true;
+    messages[1].simple_message.event.has_boolean_value = true;
+    messages[1].simple_message.event.boolean_value = true;
+    messages[2].simple_message.value.has_numeric_value = true;
+    messages[2].simple_message.value.numeric_value = 42;
+
+    openxc_VehicleMessage* canMessage =
+            &messages[BENCHMARK_SERIALIZED_MESSAGE_COUNT - 1];
+    canMessage->has_type = true;
+    canMessage->type = openxc_VehicleMessage_Type_CAN;
+    canMessage->has_can_message = true;
+    canMessage->can_message.bus = 1;
+    canMessage->can_message.id = 0x7e8;
+    canMessage->can_message.data.size = 8;
+    for(int i = 0; i < 8; i++) {
+        canMessage->can_message.data.bytes[i] = i * 0x21;
+    }
+}
+
+static unsigned long benchmarkSerialize(bool withCJSON,
+        openxc_VehicleMessage* messages, unsigned long* bytes) {
+    uint8_t payload[MAX_OUTGOING_PAYLOAD_SIZE];
+    unsigned long serialized = 0;
+    for(int i = 0; i < BENCHMARK_ITERATIONS * 10; i++) {
+        for(int j = 0; j < BENCHMARK_SERIALIZED_MESSAGE_COUNT; j++) {
+            if(withCJSON) {
+                *bytes += serializeWithCJSON(&messages[j], payload,
+                        sizeof(payload));
+            } else {
+                *bytes += openxc::payload::json::serialize(&messages[j],
+                        payload, sizeof(payload));
+            }
+            ++serialized;
+        }
+    }
+    return serialized;
+}
+
+START_TEST (test_benchmark_json_serialize)
+{
+    openxc_VehicleMessage messages[BENCHMARK_SERIALIZED_MESSAGE_COUNT];
+    buildSerializedMessages(messages);
+
+    for(int i = 0; i < BENCHMARK_SERIALIZED_MESSAGE_COUNT; i++) {
+        uint8_t expected[MAX_OUTGOING_PAYLOAD_SIZE];
+        uint8_t actual[MAX_OUTGOING_PAYLOAD_SIZE];
+        int expectedLength = serializeWithCJSON(&messages[i], expected,
+                sizeof(expected));
+        ck_assert_int_eq(openxc::payload::json::serialize(&messages[i],
+                    actual, sizeof(actual)), expectedLength);
+        ck_assert(!memcmp(expected, actual, expectedLength));
+    }
+
+    struct timespec start;
+    unsigned long cJSONBytes = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    unsigned long serialized = benchmarkSerialize(true, messages, &cJSONBytes);
+    report("JSON serialize, cJSON tree", serialized, elapsedSeconds(&start));
+
+    unsigned long writerBytes = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    serialized = benchmarkSerialize(false, messages, &writerBytes);
+    report("JSON serialize, direct writer", serialized,
+            elapsedSeconds(&start));
+
+    ck_assert(cJSONBytes > 0);
+    ck_assert_int_eq(cJSONBytes, writerBytes);
+}
+END_TEST
+
+/* Private: Format signal-like values with 6 decimal places, the way the JSON
+ * payload always has, either with printf like cJSON or with the number
+ * formatter.
+ *
+ * checksum - a running sum of the formatted characters, to compare the two
+ *      methods.
+ */
+static unsigned long benchmarkNumberFormat(bool withPrintf, float* values,
+        unsigned long* checksum) {
+    char text[MAX_FORMATTED_NUMBER_LENGTH];
+    unsigned long formatted = 0;
+    for(int i = 0; i < BENCHMARK_ITERATIONS * 10; i++) {
+        for(int j = 0; j < BENCHMARK_NUMBER_COUNT; j++) {
+            int length;
+            if(withPrintf) {
+                length = snprintf(text, sizeof(text), "%f", values[j]);
+            } else {
+                length = openxc::util::numberformat::formatDecimal(values[j], 6,
+                        text, sizeof(text));
+            }
+            for(int k = 0; k < length; k++) {
+                *checksum += text[k] * (k + 1);
+            }
+            ++formatted;
+        }
+    }
+    return formatted;
+}
+
+START_TEST (test_benchmark_number_format)
+{
+    // Values like a signal's, scaled by a factor that's a fraction
+    float values[BENCHMARK_NUMBER_COUNT];
+    for(int i = 0; i < BENCHMARK_NUMBER_COUNT; i++) {
+        values[i] = (i * 7919 % 65536) * 0.0625f - 1000;
+    }
+
+    struct timespec start;
+    unsigned long printfChecksum = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    unsigned long formatted = benchmarkNumberFormat(true, values,
+            &printfChecksum);
+    report("number format, printf", formatted, elapsedSeconds(&start));
+
+    unsigned long formatterChecksum = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    formatted = benchmarkNumberFormat(false, values, &formatterChecksum);
+    report("number format, formatter", formatted, elapsedSeconds(&start));
+
+    ck_assert(printfChecksum > 0);
+    ck_assert_int_eq(printfChecksum, formatterChecksum);
+}
+END_TEST
+
+/* Private: One of each JSON command the VI accepts, to measure how long each
+ * takes to parse.
+ */
+static const char* BENCHMARK_COMMANDS[][2] = {
+    {"version", "{\"command\": \"version\"}"},
+    {"device_id", "{\"command\": \"device_id\"}"},
+    {"diagnostic_request", "{\"command\": \"diagnostic_request\", "
+        "\"action\": \"add\", \"request\": {\"bus\": 1, \"id\": 2015, "
+        "\"mode\": 1, \"pid\": 12, \"payload\": \"0x1234\", "
+        "\"multiple_responses\": false, \"frequency\": 1.5, "
+        "\"decoded_type\": \"obd2\", \"name\": \"rpm\"}}"},
+    {"passthrough", "{\"command\": \"passthrough\", \"bus\": 1, "
+        "\"enabled\": true}"},
+    {"af_bypass", "{\"command\": \"af_bypass\", \"bus\": 1, \"bypass\": true}"},
+    {"payload_format", "{\"command\": \"payload_format\", "
+        "\"format\": \"json\"}"},
+    {"predefined_obd2", "{\"command\": \"predefined_obd2\", "
+        "\"enabled\": true}"},
+    {"CAN write", "{\"bus\": 1, \"id\": 42, \"data\": \"0x1234567890abcdef\"}"},
+    {"simple write", "{\"name\": \"turn_signal_status\", \"value\": \"left\"}"},
+};
+
+/* Private: Parse a JSON command over and over, either into a cJSON tree like
+ * the JSON payload did before it tokenized in place, or all the way to an
+ * OpenXC message with the payload's deserializer.
+ *
+ * Returns the number of commands that parsed.
+ */
+static unsigned long benchmarkDeserialize(bool withCJSON, const char* command) {
+    uint8_t payload[256];
+    size_t length = strlen(command) + 1;
+    memcpy(payload, command, length);
+
+    unsigned long parsed = 0;
+    for(int i = 0; i < BENCHMARK_ITERATIONS * 10; i++) {
+        if(withCJSON) {
+            cJSON* root = cJSON_Parse((const char*)payload);
+            if(root != NULL) {
+                ++parsed;
+                cJSON_Delete(root);
+            }
+        } else {
+            openxc_VehicleMessage message = {0};
+            if(openxc::payload::json::deserialize(payload, length,
+                        &message) == length && message.has_type) {
+                ++parsed;
+            }
+        }
+    }
+    return parsed;
+}
+
+START_TEST (test_benchmark_json_deserialize)
+{
+    char name[64];
+    struct timespec start;
+    for(size_t i = 0; i < sizeof(BENCHMARK_COMMANDS) /
+            sizeof(BENCHMARK_COMMANDS[0]); i++) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        unsigned long parsed = benchmarkDeserialize(true,
+                BENCHMARK_COMMANDS[i][1]);
+        snprintf(name, sizeof(name), "%s, cJSON parse",
+                BENCHMARK_COMMANDS[i][0]);
+        report(name, parsed, elapsedSeconds(&start));
+        ck_assert_int_eq(parsed, BENCHMARK_ITERATIONS * 10);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        parsed = benchmarkDeserialize(false, BENCHMARK_COMMANDS[i][1]);
+        snprintf(name, sizeof(name), "%s, deserialize",
+                BENCHMARK_COMMANDS[i][0]);
+        report(name, parsed, elapsedSeconds(&start));
+        ck_assert_int_eq(parsed, BENCHMARK_ITERATIONS * 10);
+    }
+}
+END_TEST
+
+Suite* benchmarkSuite(void) {
+    Suite* s = suite_create("benchmark");
+    TCase *tc_lookup = tcase_create("lookup");
+    tcase_add_checked_fixture(tc_lookup, setup, NULL);
+    tcase_add_test(tc_lookup, test_benchmark_message_lookup);
+    tcase_add_test(tc_lookup, test_benchmark_signal_lookup);
+    suite_add_tcase(s, tc_lookup);
+
+    TCase *tc_filters = tcase_create("filters");
+    tcase_add_checked_fixture(tc_filters, setup, NULL);
+    tcase_add_test(tc_filters, test_benchmark_acceptance_check);
+    suite_add_tcase(s, tc_filters);
+
+    TCase *tc_translate = tcase_create("translate");
+    tcase_add_checked_fixture(tc_translate, setup, NULL);
+    tcase_add_test(tc_translate, test_benchmark_signal_extraction);
+    suite_add_tcase(s, tc_translate);
+
+    TCase *tc_send = tcase_create("send");
+    tcase_add_checked_fixture(tc_send, setup, NULL);
+    tcase_add_test(tc_send, test_benchmark_usb_send);
+    tcase_add_test(tc_send, test_benchmark_raw_can_usb_send);
+    tcase_add_test(tc_send, test_benchmark_json_serialize);
+    tcase_add_test(tc_send, test_benchmark_number_format);
+    suite_add_tcase(s, tc_send);
+
+    TCase *tc_receive = tcase_create("receive");
+    tcase_add_checked_fixture(tc_receive, setup, NULL);
+    tcase_add_test(tc_receive, test_benchmark_json_deserialize);
+    suite_add_tcase(s, tc_receive);
+
+    return s;
+}
+
+int main(void) {
+    int numberFailed;
+    Suite* s = benchmarkSuite();
+    SRunner *sr = srunner_create(s);
+    // Don't fork so we can actually use gdb
+    srunner_set_fork_status(sr, CK_NOFORK);
+    srunner_run_all(sr, CK_NORMAL);
+    numberFailed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (numberFailed == 0) ? 0 : 1;
+}
@@ -4,14 +4,24 @@
 
 using openxc::util::bytebuffer::conditionalEnqueue;
 using openxc::util::bytebuffer::processQueue;
+using openxc::util::bytebuffer::reserve;
+using openxc::util::bytebuffer::commit;
+using openxc::util::bytebuffer::peek;
+using openxc::util::bytebuffer::consume;
+using openxc::util::bytebuffer::ByteSpan;
+using openxc::util::bytebuffer::MessageFramer;
+using openxc::util::bytebuffer::initializeFramer;
+using openxc::payload::PayloadFormat;
 
 QUEUE_TYPE(uint8_t) queue;
+MessageFramer framer;
 bool called;
 size_t callbackDataRead;
 int calledTimes;
 
 void setup() {
     QUEUE_INIT(uint8_t, &queue);
+    initializeFramer(&framer);
     called = false;
     callbackDataRead = 0;
     calledTimes = 0;
@@ -20,17 +30,25 @@ void setup() {
 void teardown() {
 }
 
-uint8_t received_message[8];
+uint8_t received_message[QUEUE_MAX_LENGTH(uint8_t)];
+size_t receivedLength;
 size_t callback(uint8_t* message, size_t length) {
     called = true;
     calledTimes++;
     memcpy(received_message, message, length);
+    receivedLength = length;
     return callbackDataRead;
 }
 
+static void pushBytes(const char* bytes, int length) {
+    for(int i = 0; i < length; i++) {
+        QUEUE_PUSH(uint8_t, &queue, bytes[i]);
+    }
+}
+
 START_TEST (test_empty_doesnt_call)
 {
-    processQueue(&queue, callback);
+    processQueue(&queue, &framer, PayloadFormat::JSON, callback);
     fail_if(called);
 }
 END_TEST
@@ -38,7 +56,7 @@ END_TEST
 START_TEST (test_missing_callback)
 {
     QUEUE_PUSH(uint8_t, &queue, 128);
-    processQueue(&queue, NULL);
+    processQueue(&queue, &framer, PayloadFormat::JSON, NULL);
     fail_if(called);
     fail_if(QUEUE_EMPTY(uint8_t, &queue));
 }
@@ -52,8 +70,8 @@ START_TEST (test_parse_multiple)
     QUEUE_PUSH(uint8_t, &queue, 64);
     QUEUE_PUSH(uint8_t, &queue, 0);
 
-    processQueue(&queue, callback);
-    processQueue(&queue, callback);
+    processQueue(&queue, &framer, PayloadFormat::JSON, callback);
+    processQueue(&queue, &framer, PayloadFormat::JSON, callback);
     ck_assert_int_eq(calledTimes, 2);
     fail_unless(QUEUE_EMPTY(uint8_t, &queue));
 }
@@ -64,7 +82,7 @@ START_TEST (test_data_sent_to_callback)
     callbackDataRead = 2;
     QUEUE_PUSH(uint8_t, &queue, 128);
     QUEUE_PUSH(uint8_t, &queue, 0);
-    processQueue(&queue, callback);
+    processQueue(&queue, &framer, PayloadFormat::JSON, callback);
     ck_assert_int_eq(received_message[0], 128);
     ck_assert_int_eq(received_message[1], 0);
 }
@@ -75,7 +93,7 @@ START_TEST (test_success_clears)
     callbackDataRead = 2;
     QUEUE_PUSH(uint8_t, &queue, 128);
     QUEUE_PUSH(uint8_t, &queue, 0);
-    processQueue(&queue, callback);
+    processQueue(&queue, &framer, PayloadFormat::JSON, callback);
     fail_unless(called);
     fail_unless(QUEUE_EMPTY(uint8_t, &queue));
 }
@@ -86,7 +104,7 @@ START_TEST (test_failure_clears_too)
     callbackDataRead = 2;
     QUEUE_PUSH(uint8_t, &queue, 128);
     QUEUE_PUSH(uint8_t, &queue, 0);
-    processQueue(&queue, callback);
+    processQueue(&queue, &framer, PayloadFormat::JSON, callback);
     fail_unless(called);
     fail_unless(QUEUE_EMPTY(uint8_t, &queue));
 }
@@ -100,7 +118,7 @@ START_TEST (test_full_clears)
     fail_unless(QUEUE_FULL(uint8_t, &queue));
 
     callbackDataRead = 0;
-    processQueue(&queue, callback);
+    processQueue(&queue, &framer, PayloadFormat::JSON, callback);
     fail_unless(QUEUE_EMPTY(uint8_t, &queue));
 }
 END_TEST
@@ -158,6 +176,218 @@ START_TEST (test_enqueue_no_room_for_crlf)
 }
 END_TEST
 
+/* Private: Move the queue's head and tail to just before the end of its
+ * storage, so the next bytes pushed wrap around to the beginning.
+ */
+static void moveToEndOfStorage(int bytesBeforeEnd) {
+    for(int i = 0; i < QUEUE_MAX_LENGTH(uint8_t) + 1 - bytesBeforeEnd; i++) {
+        QUEUE_PUSH(uint8_t, &queue, 0);
+        QUEUE_POP(uint8_t, &queue);
+    }
+}
+
+START_TEST (test_reserve_empty)
+{
+    ByteSpan spans[BYTE_QUEUE_MAX_SPANS];
+    ck_assert_int_eq(reserve(&queue, 5, spans), 1);
+    ck_assert_int_eq(spans[0].length, 5);
+    memcpy(spans[0].data, "abcde", 5);
+    fail_unless(QUEUE_EMPTY(uint8_t, &queue));
+
+    commit(&queue, 5);
+    ck_assert_int_eq(QUEUE_LENGTH(uint8_t, &queue), 5);
+    ck_assert_int_eq(QUEUE_POP(uint8_t, &queue), 'a');
+    ck_assert_int_eq(QUEUE_POP(uint8_t, &queue), 'b');
+}
+END_TEST
+
+START_TEST (test_reserve_wraps)
+{
+    moveToEndOfStorage(3);
+
+    ByteSpan spans[BYTE_QUEUE_MAX_SPANS];
+    ck_assert_int_eq(reserve(&queue, 5, spans), 2);
+    ck_assert_int_eq(spans[0].length, 3);
+    ck_assert_int_eq(spans[1].length, 2);
+    memcpy(spans[0].data, "abc", 3);
+    memcpy(spans[1].data, "de", 2);
+    commit(&queue, 5);
+
+    uint8_t snapshot[5];
+    QUEUE_SNAPSHOT(uint8_t, &queue, snapshot, sizeof(snapshot));
+    fail_unless(!memcmp(snapshot, "abcde", 5));
+}
+END_TEST
+
+START_TEST (test_reserve_no_room)
+{
+    for(int i = 0; i < QUEUE_MAX_LENGTH(uint8_t) - 4; i++) {
+        QUEUE_PUSH(uint8_t, &queue, 128);
+    }
+
+    ByteSpan spans[BYTE_QUEUE_MAX_SPANS];
+    ck_assert_int_eq(reserve(&queue, 5, spans), 0);
+    ck_assert_int_eq(reserve(&queue, 4, spans), 1);
+    ck_assert_int_eq(reserve(NULL, 4, spans), 0);
+}
+END_TEST
+
+START_TEST (test_peek_empty)
+{
+    ByteSpan spans[BYTE_QUEUE_MAX_SPANS];
+    ck_assert_int_eq(peek(&queue, spans), 0);
+    ck_assert_int_eq(peek(NULL, spans), 0);
+}
+END_TEST
+
+START_TEST (test_peek_and_consume)
+{
+    char* message = "a message";
+    conditionalEnqueue(&queue, (uint8_t*)message, 9);
+
+    ByteSpan spans[BYTE_QUEUE_MAX_SPANS];
+    ck_assert_int_eq(peek(&queue, spans), 1);
+    ck_assert_int_eq(spans[0].length, 9);
+    fail_unless(!memcmp(spans[0].data, message, 9));
+    ck_assert_int_eq(QUEUE_LENGTH(uint8_t, &queue), 9);
+
+    consume(&queue, 2);
+    ck_assert_int_eq(QUEUE_LENGTH(uint8_t, &queue), 7);
+    ck_assert_int_eq(QUEUE_PEEK(uint8_t, &queue), 'm');
+}
+END_TEST
+
+START_TEST (test_peek_wraps)
+{
+    moveToEndOfStorage(4);
+    char* message = "a message";
+    fail_unless(conditionalEnqueue(&queue, (uint8_t*)message, 9));
+
+    ByteSpan spans[BYTE_QUEUE_MAX_SPANS];
+    ck_assert_int_eq(peek(&queue, spans), 2);
+    ck_assert_int_eq(spans[0].length, 4);
+    ck_assert_int_eq(spans[1].length, 5);
+    fail_unless(!memcmp(spans[0].data, "a me", 4));
+    fail_unless(!memcmp(spans[1].data, "ssage", 5));
+
+    consume(&queue, 9);
+    fail_unless(QUEUE_EMPTY(uint8_t, &queue));
+}
+END_TEST
+
+START_TEST (test_partial_message_not_passed)
+{
+    pushBytes("{\"command\"", 10);
+    fail_if(processQueue(&queue, &framer, PayloadFormat::JSON, callback));
+    fail_if(called);
+    ck_assert_int_eq(QUEUE_LENGTH(uint8_t, &queue), 10);
+}
+END_TEST
+
+START_TEST (test_message_in_pieces_called_once)
+{
+    const char message[] = "{\"command\": \"version\"}";
+    for(size_t i = 0; i < sizeof(message); i += 5) {
+        pushBytes(&message[i], sizeof(message) - i < 5 ?
+                sizeof(message) - i : 5);
+        processQueue(&queue, &framer, PayloadFormat::JSON, callback);
+    }
+    ck_assert_int_eq(calledTimes, 1);
+    ck_assert_int_eq(receivedLength, sizeof(message));
+    ck_assert_str_eq((char*)received_message, message);
+    fail_unless(QUEUE_EMPTY(uint8_t, &queue));
+}
+END_TEST
+
+START_TEST (test_only_new_bytes_scanned)
+{
+    pushBytes("{\"a\":", 5);
+    processQueue(&queue, &framer, PayloadFormat::JSON, callback);
+    ck_assert_int_eq(framer.scannedLength, 5);
+    pushBytes(" 1}", 3);
+    processQueue(&queue, &framer, PayloadFormat::JSON, callback);
+    ck_assert_int_eq(framer.scannedLength, 8);
+    fail_if(called);
+
+    pushBytes("\0", 1);
+    fail_unless(processQueue(&queue, &framer, PayloadFormat::JSON, callback));
+    ck_assert_int_eq(receivedLength, 9);
+    ck_assert_int_eq(framer.scannedLength, 0);
+}
+END_TEST
+
+START_TEST (test_unparsed_message_removed)
+{
+    callbackDataRead = 0;
+    pushBytes("junk\0{}\0", 8);
+    fail_unless(processQueue(&queue, &framer, PayloadFormat::JSON, callback));
+    ck_assert_int_eq(receivedLength, 5);
+    fail_unless(processQueue(&queue, &framer, PayloadFormat::JSON, callback));
+    ck_assert_int_eq(receivedLength, 3);
+    ck_assert_int_eq(calledTimes, 2);
+    fail_unless(QUEUE_EMPTY(uint8_t, &queue));
+}
+END_TEST
+
+START_TEST (test_wrapped_message_in_one_piece)
+{
+    moveToEndOfStorage(4);
+    pushBytes("{\"a\": 1}", 9);
+
+    fail_unless(processQueue(&queue, &framer, PayloadFormat::JSON, callback));
+    ck_assert_int_eq(receivedLength, 9);
+    ck_assert_str_eq((char*)received_message, "{\"a\": 1}");
+    fail_unless(QUEUE_EMPTY(uint8_t, &queue));
+}
+END_TEST
+
+START_TEST (test_length_prefixed_message)
+{
+    // A 2 byte varint, 130 bytes of message and the start of another message
+    QUEUE_PUSH(uint8_t, &queue, 0x82);
+    processQueue(&queue, &framer, PayloadFormat::PROTOBUF, callback);
+    QUEUE_PUSH(uint8_t, &queue, 0x01);
+    for(int i = 0; i < 129; i++) {
+        QUEUE_PUSH(uint8_t, &queue, i);
+    }
+    processQueue(&queue, &framer, PayloadFormat::PROTOBUF, callback);
+    ck_assert_int_eq(framer.messageLength, 132);
+    fail_if(called);
+
+    QUEUE_PUSH(uint8_t, &queue, 0);
+    QUEUE_PUSH(uint8_t, &queue, 3);
+    fail_unless(processQueue(&queue, &framer, PayloadFormat::PROTOBUF,
+                callback));
+    ck_assert_int_eq(calledTimes, 1);
+    ck_assert_int_eq(receivedLength, 132);
+    ck_assert_int_eq(received_message[131], 0);
+    ck_assert_int_eq(QUEUE_LENGTH(uint8_t, &queue), 1);
+}
+END_TEST
+
+START_TEST (test_length_prefixed_message_too_long)
+{
+    QUEUE_PUSH(uint8_t, &queue, 0xff);
+    QUEUE_PUSH(uint8_t, &queue, 0x7f);
+    fail_if(processQueue(&queue, &framer, PayloadFormat::PROTOBUF, callback));
+    fail_if(called);
+    fail_unless(QUEUE_EMPTY(uint8_t, &queue));
+}
+END_TEST
+
+START_TEST (test_format_change_resets_framer)
+{
+    pushBytes("\x04{\"a\"", 5);
+    processQueue(&queue, &framer, PayloadFormat::JSON, callback);
+    ck_assert_int_eq(framer.scannedLength, 5);
+
+    fail_unless(processQueue(&queue, &framer, PayloadFormat::PROTOBUF,
+                callback));
+    ck_assert_int_eq(receivedLength, 5);
+    ck_assert_int_eq(framer.scannedLength, 0);
+}
+END_TEST
+
 Suite* buffersSuite(void) {
     Suite* s = suite_create("buffers");
     TCase *tc_core = tcase_create("core");
@@ -171,6 +401,18 @@ Suite* buffersSuite(void) {
     tcase_add_test(tc_core, test_parse_multiple);
     suite_add_tcase(s, tc_core);
 
+    TCase *tc_framing = tcase_create("framing");
+    tcase_add_checked_fixture (tc_framing, setup, teardown);
+    tcase_add_test(tc_framing, test_partial_message_not_passed);
+    tcase_add_test(tc_framing, test_message_in_pieces_called_once);
+    tcase_add_test(tc_framing, test_only_new_bytes_scanned);
+    tcase_add_test(tc_framing, test_unparsed_message_removed);
+    tcase_add_test(tc_framing, test_wrapped_message_in_one_piece);
+    tcase_add_test(tc_framing, test_length_prefixed_message);
+    tcase_add_test(tc_framing, test_length_prefixed_message_too_long);
+    tcase_add_test(tc_framing, test_format_change_resets_framer);
+    suite_add_tcase(s, tc_framing);
+
     TCase *tc_conditional = tcase_create("conditional");
     tcase_add_checked_fixture (tc_conditional, setup, teardown);
     tcase_add_test(tc_conditional, test_null_queue);
@@ -180,6 +422,16 @@ Suite* buffersSuite(void) {
     tcase_add_test(tc_conditional, test_enqueue_just_enough_room);
     suite_add_tcase(s, tc_conditional);
 
+    TCase *tc_spans = tcase_create("spans");
+    tcase_add_checked_fixture (tc_spans, setup, teardown);
+    tcase_add_test(tc_spans, test_reserve_empty);
+    tcase_add_test(tc_spans, test_reserve_wraps);
+    tcase_add_test(tc_spans, test_reserve_no_room);
+    tcase_add_test(tc_spans, test_peek_empty);
+    tcase_add_test(tc_spans, test_peek_and_consume);
+    tcase_add_test(tc_spans, test_peek_wraps);
+    suite_add_tcase(s, tc_spans);
+
     return s;
 }
 
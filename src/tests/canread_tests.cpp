@@ -5,11 +5,13 @@
 #include "can/canutil.h"
 #include "can/canread.h"
 #include "can/canwrite.h"
+#include "can/snapshot.h"
 #include "pipeline.h"
 #include "config.h"
 
 namespace usb = openxc::interface::usb;
 namespace can = openxc::can;
+namespace snapshot = openxc::can::snapshot;
 
 using openxc::can::read::booleanDecoder;
 using openxc::can::read::ignoreDecoder;
@@ -52,7 +54,12 @@ void setup() {
     USB_PROCESSED = false;
     SENT_BYTES = 0;
     initializeVehicleInterface();
+    openxc::pipeline::initialize(&getConfiguration()->pipeline);
     getConfiguration()->payloadFormat = openxc::payload::PayloadFormat::JSON;
+    getConfiguration()->snapshotMode = false;
+    getConfiguration()->snapshotFrequency = 10;
+    // Most tests check the output right after translating
+    getConfiguration()->deferSerialization = false;
     usb::initialize(&getConfiguration()->usb);
     getConfiguration()->usb.configured = true;
     for(int i = 0; i < getSignalCount(); i++) {
@@ -370,12 +377,72 @@ START_TEST (test_translate_many_signals)
                 &TEST_MESSAGE, getSignals(), getSignalCount(), &getConfiguration()->pipeline);
         fail_unless(getSignals()[i].received);
     }
+    // Translating never waits for the output to flush - the queue takes 7
+    // signals before another would cut into the room reserved for responses,
+    // the next 8 wait in the payload pool and the last one is dropped
+    fail_if(USB_PROCESSED);
+    ck_assert_int_eq(0, SENT_BYTES);
+    ck_assert_int_eq(7 * 29, QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE));
+    ck_assert_int_eq(8, QUEUE_LENGTH(PayloadReference,
+                &getConfiguration()->pipeline.pendingPayloads[
+                    openxc::interface::InterfaceType::USB][
+                    openxc::pipeline::PipelineLane::NORMAL_LANE]));
+
+    // The scheduled flush keeps going while the pool drains - 14 signals sent
+    // in 2 flushes, and the last one left in the output queue
+    openxc::pipeline::process(&getConfiguration()->pipeline);
     fail_unless(USB_PROCESSED);
-    // 8 signals sent
-    ck_assert_int_eq(10 * 29 + 2, SENT_BYTES);
-    // 6 in the output queue
+    ck_assert_int_eq(14 * 29 + 2 * 2, SENT_BYTES);
+    ck_assert_int_eq(29, QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE));
+}
+END_TEST
+
+START_TEST (test_translate_message)
+{
+    CanMessage message = {
+        id: 2,
+        format: STANDARD,
+        data: {0x80},
+    };
+    fail_unless(can::read::translateMessage(&getCanBuses()[0], &message,
+            getSignals(), getSignalCount(), &getConfiguration()->pipeline));
     fail_if(queueEmpty());
-    ck_assert_int_eq(6 * 29, QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE));
+    const int messageSignals[] = {2, 4, 5};
+    for(int i = 0; i < 3; i++) {
+        CanSignal* signal = &getSignals()[messageSignals[i]];
+        fail_unless(signal->received);
+        ck_assert_int_eq(signal->lastValue, 1);
+    }
+    fail_if(getSignals()[3].received);
+}
+END_TEST
+
+START_TEST (test_translate_message_skips_other_messages)
+{
+    // the signals for message 0 are split up in the signals array
+    fail_unless(can::read::translateMessage(&getCanBuses()[0], &TEST_MESSAGE,
+            getSignals(), getSignalCount(), &getConfiguration()->pipeline));
+    fail_unless(getSignals()[0].received);
+    fail_unless(getSignals()[6].received);
+    ck_assert_int_eq(getSignals()[6].lastValue,
+            can::read::parseSignalBitfield(&getSignals()[6], &TEST_MESSAGE));
+    for(int i = 1; i < 6; i++) {
+        fail_if(getSignals()[i].received);
+    }
+}
+END_TEST
+
+START_TEST (test_translate_message_not_indexed)
+{
+    CanMessage message = {
+        id: 0x100,
+        format: STANDARD,
+    };
+    fail_if(can::read::translateMessage(&getCanBuses()[0], &message,
+            getSignals(), getSignalCount(), &getConfiguration()->pipeline));
+    fail_if(can::read::translateMessage(&getCanBuses()[0], &TEST_MESSAGE,
+            NULL, 0, &getConfiguration()->pipeline));
+    fail_unless(queueEmpty());
 }
 END_TEST
 
@@ -437,6 +504,21 @@ openxc_DynamicField stringDecoder(CanSignal* signal, CanSignal* signals,
     return decodedValue;
 }
 
+START_TEST (test_translate_unsubscribed_signal)
+{
+    int signals[] = {1};
+    ck_assert(openxc::pipeline::subscribe(&getConfiguration()->pipeline,
+                openxc::interface::InterfaceType::USB,
+                openxc::pipeline::SubscriptionMode::INCLUDE_SIGNALS, signals,
+                1, ALL_MESSAGE_CLASSES));
+    can::read::translateSignal(&getSignals()[0],
+            &TEST_MESSAGE, getSignals(), getSignalCount(), &getConfiguration()->pipeline);
+    fail_unless(queueEmpty());
+    // the signal's state is still updated, in case it's subscribed to later
+    fail_unless(getSignals()[0].received);
+}
+END_TEST
+
 START_TEST (test_translate_string)
 {
     getSignals()[0].decoder = stringDecoder;
@@ -554,6 +636,273 @@ START_TEST (test_dont_send_same)
 }
 END_TEST
 
+/* Private: Translate a signal from each of the frames in turn, appending
+ * everything published to the output buffer.
+ */
+static size_t translateFrames(CanSignal* signal, const CanMessage* frames,
+        int frameCount, uint8_t* output, size_t outputSize) {
+    size_t outputLength = 0;
+    for(int i = 0; i < frameCount; i++) {
+        QUEUE_INIT(uint8_t, OUTPUT_QUEUE);
+        can::read::translateSignal(signal, &frames[i], getSignals(),
+                getSignalCount(), &getConfiguration()->pipeline);
+        int length = QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE);
+        ck_assert(outputLength + length <= outputSize);
+        QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, &output[outputLength],
+                outputSize - outputLength);
+        outputLength += length;
+    }
+    return outputLength;
+}
+
+START_TEST (test_fixed_point_matches_float)
+{
+    const int frameCount = 48;
+    CanMessage frames[frameCount];
+    uint64_t data = 0x0123456789abcdef;
+    for(int i = 0; i < frameCount; i++) {
+        // repeat some frames, so unchanged values are skipped too
+        if(i % 3 != 2) {
+            data = data * 6364136223846793005ULL + 1442695040888963407ULL;
+        }
+        frames[i] = TEST_MESSAGE;
+        for(int j = 0; j < CAN_MESSAGE_SIZE; j++) {
+            frames[i].data[j] = data >> (j * 8);
+        }
+    }
+
+    uint8_t floatOutput[8192];
+    uint8_t fixedPointOutput[8192];
+    size_t totalLength = 0;
+    int originalMessageSet = getConfiguration()->messageSetIndex;
+    for(int set = 0; set < openxc::signals::getMessageSetCount(); set++) {
+        getConfiguration()->messageSetIndex = set;
+        can::read::initializeFixedPoint(getSignals(), getSignalCount());
+        for(int i = 0; i < getSignalCount(); i++) {
+            CanSignal* signal = &getSignals()[i];
+            CanSignal saved = *signal;
+            signal->decoder = signal->stateCount > 0 ? stateDecoder : NULL;
+            signal->frequencyClock = {0};
+            signal->received = false;
+            signal->lastValue = 0;
+            for(int sendSame = 0; sendSame < 2; sendSame++) {
+                signal->sendSame = sendSame;
+                CanSignal original = *signal;
+
+                getConfiguration()->fixedPointDecode = false;
+                size_t floatLength = translateFrames(signal, frames,
+                        frameCount, floatOutput, sizeof(floatOutput));
+                float floatLastValue = signal->lastValue;
+
+                *signal = original;
+                getConfiguration()->fixedPointDecode = true;
+                size_t fixedPointLength = translateFrames(signal, frames,
+                        frameCount, fixedPointOutput, sizeof(fixedPointOutput));
+
+                totalLength += floatLength;
+                ck_assert_int_eq(floatLength, fixedPointLength);
+                ck_assert(!memcmp(floatOutput, fixedPointOutput, floatLength));
+                ck_assert(floatLastValue == signal->lastValue);
+            }
+            *signal = saved;
+        }
+    }
+    ck_assert(totalLength > 0);
+    getConfiguration()->fixedPointDecode = false;
+    getConfiguration()->messageSetIndex = originalMessageSet;
+}
+END_TEST
+
+START_TEST (test_fixed_point_wide_signal)
+{
+    // Only the low 32 bits of the raw value are kept, so the bits above them
+    // mustn't make a value look changed or unchanged
+    CanSignal* signal = &getSignals()[0];
+    CanSignal saved = *signal;
+    signal->bitPosition = 0;
+    signal->bitSize = 40;
+    signal->factor = 1;
+    signal->offset = 0;
+    signal->sendSame = false;
+    signal->decoder = NULL;
+    can::read::initializeFixedPoint(getSignals(), getSignalCount());
+    getConfiguration()->fixedPointDecode = true;
+
+    CanMessage message = TEST_MESSAGE;
+    memset(message.data, 0, CAN_MESSAGE_SIZE);
+    message.data[0] = 0x01;
+    can::read::translateSignal(signal, &message, getSignals(),
+            getSignalCount(), &getConfiguration()->pipeline);
+    fail_if(queueEmpty());
+
+    QUEUE_INIT(uint8_t, OUTPUT_QUEUE);
+    can::read::translateSignal(signal, &message, getSignals(),
+            getSignalCount(), &getConfiguration()->pipeline);
+    bool sentSame = !queueEmpty();
+
+    QUEUE_INIT(uint8_t, OUTPUT_QUEUE);
+    message.data[0] = 0x02;
+    can::read::translateSignal(signal, &message, getSignals(),
+            getSignalCount(), &getConfiguration()->pipeline);
+    getConfiguration()->fixedPointDecode = false;
+    *signal = saved;
+    fail_if(sentSame);
+    fail_if(queueEmpty());
+}
+END_TEST
+
+START_TEST (test_fixed_point_inexact_signal)
+{
+    // With a factor this small, both raw values round to the same float, so
+    // the second one mustn't look like a change
+    CanSignal* signal = &getSignals()[0];
+    CanSignal saved = *signal;
+    signal->bitPosition = 0;
+    signal->bitSize = 8;
+    signal->factor = 0.00001;
+    signal->offset = 1000;
+    signal->sendSame = false;
+    signal->decoder = NULL;
+    can::read::initializeFixedPoint(getSignals(), getSignalCount());
+    getConfiguration()->fixedPointDecode = true;
+
+    CanMessage message = TEST_MESSAGE;
+    memset(message.data, 0, CAN_MESSAGE_SIZE);
+    message.data[0] = 0x01;
+    can::read::translateSignal(signal, &message, getSignals(),
+            getSignalCount(), &getConfiguration()->pipeline);
+    fail_if(queueEmpty());
+
+    QUEUE_INIT(uint8_t, OUTPUT_QUEUE);
+    message.data[0] = 0x02;
+    can::read::translateSignal(signal, &message, getSignals(),
+            getSignalCount(), &getConfiguration()->pipeline);
+    getConfiguration()->fixedPointDecode = false;
+    *signal = saved;
+    fail_unless(queueEmpty());
+}
+END_TEST
+
+START_TEST (test_fixed_point_exact_signals)
+{
+    can::read::initializeFixedPoint(getSignals(), getSignalCount());
+    // torque_at_transmission, factor 1001 and offset -30000
+    fail_unless(getSignals()[0].fixedPointExact);
+    ck_assert_int_eq(getSignals()[0].fixedPointFactor, 1001);
+    ck_assert_int_eq(getSignals()[0].fixedPointOffset, -30000);
+    // measurement, factor 0.001
+    fail_if(getSignals()[3].fixedPointExact);
+}
+END_TEST
+
+START_TEST (test_snapshot_holds_value)
+{
+    getConfiguration()->snapshotMode = true;
+    can::read::translateSignal(&getSignals()[0], &TEST_MESSAGE, getSignals(),
+            getSignalCount(), &getConfiguration()->pipeline);
+    fail_unless(queueEmpty());
+
+    const snapshot::SignalSnapshot* value = snapshot::lookup(&getSignals()[0],
+            getSignals());
+    fail_unless(value->valid);
+    fail_unless(value->dirty);
+    ck_assert_int_eq(value->value, -19990);
+    ck_assert_int_eq(value->timestamp, FAKE_TIME);
+
+    ck_assert_int_eq(snapshot::publish(getSignals(), getSignalCount(),
+                &getConfiguration()->pipeline), 1);
+    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE) + 1];
+    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    ck_assert_str_eq((char*)snapshot,
+            "{\"name\":\"torque_at_transmission\",\"value\":-19990}");
+    fail_if(value->dirty);
+    ck_assert_int_eq(snapshot::publish(getSignals(), getSignalCount(),
+                &getConfiguration()->pipeline), 0);
+}
+END_TEST
+
+START_TEST (test_snapshot_only_changes)
+{
+    getConfiguration()->snapshotMode = true;
+    getSignals()[0].sendSame = false;
+    can::read::translateSignal(&getSignals()[0], &TEST_MESSAGE, getSignals(),
+            getSignalCount(), &getConfiguration()->pipeline);
+    ck_assert_int_eq(snapshot::publish(getSignals(), getSignalCount(),
+                &getConfiguration()->pipeline), 1);
+
+    can::read::translateSignal(&getSignals()[0], &TEST_MESSAGE, getSignals(),
+            getSignalCount(), &getConfiguration()->pipeline);
+    ck_assert_int_eq(snapshot::publish(getSignals(), getSignalCount(),
+                &getConfiguration()->pipeline), 0);
+}
+END_TEST
+
+START_TEST (test_snapshot_state)
+{
+    bool send = true;
+    openxc_DynamicField value = stateDecoder(&getSignals()[1], getSignals(),
+            getSignalCount(), &getConfiguration()->pipeline,
+            getSignals()[1].states[1].value, &send);
+    fail_unless(snapshot::update(&getSignals()[1], getSignals(), &value,
+                true));
+    ck_assert_int_eq(snapshot::publish(getSignals(), getSignalCount(),
+                &getConfiguration()->pipeline), 1);
+
+    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE) + 1];
+    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    ck_assert(strstr((char*)snapshot, getSignals()[1].states[1].name) != NULL);
+
+    // Strings that aren't a state can't be rebuilt from the snapshot
+    strcpy(value.string_value, "foo");
+    fail_if(snapshot::update(&getSignals()[1], getSignals(), &value, true));
+}
+END_TEST
+
+START_TEST (test_snapshot_frequency)
+{
+    getConfiguration()->snapshotMode = true;
+    can::read::translateSignal(&getSignals()[0], &TEST_MESSAGE, getSignals(),
+            getSignalCount(), &getConfiguration()->pipeline);
+    snapshot::loop(getSignals(), getSignalCount(),
+            &getConfiguration()->pipeline);
+    fail_if(queueEmpty());
+
+    QUEUE_INIT(uint8_t, OUTPUT_QUEUE);
+    can::read::translateSignal(&getSignals()[0], &TEST_MESSAGE, getSignals(),
+            getSignalCount(), &getConfiguration()->pipeline);
+    snapshot::loop(getSignals(), getSignalCount(),
+            &getConfiguration()->pipeline);
+    fail_unless(queueEmpty());
+
+    FAKE_TIME += 100;
+    snapshot::loop(getSignals(), getSignalCount(),
+            &getConfiguration()->pipeline);
+    fail_if(queueEmpty());
+}
+END_TEST
+
+START_TEST (test_translate_deferred)
+{
+    getConfiguration()->deferSerialization = true;
+    Pipeline* pipeline = &getConfiguration()->pipeline;
+    can::read::translateSignal(&getSignals()[0], &TEST_MESSAGE, getSignals(),
+            getSignalCount(), pipeline);
+    fail_unless(queueEmpty());
+    ck_assert_int_eq(QUEUE_LENGTH(SignalRecord, &pipeline->records), 1);
+
+    // Publishing anything else serializes the record first, to keep the order
+    can::read::publishNumericalMessage("test", 42, pipeline);
+    fail_unless(QUEUE_EMPTY(SignalRecord, &pipeline->records));
+    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE) + 1];
+    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    snapshot[sizeof(snapshot) - 1] = NULL;
+    ck_assert_str_eq((char*)snapshot,
+            "{\"name\":\"torque_at_transmission\",\"value\":-19990}");
+    ck_assert_str_eq((char*)snapshot + strlen((char*)snapshot) + 1,
+            "{\"name\":\"test\",\"value\":42}");
+}
+END_TEST
+
 Suite* canreadSuite(void) {
     Suite* s = suite_create("canread");
     TCase *tc_core = tcase_create("core");
@@ -581,6 +930,7 @@ Suite* canreadSuite(void) {
     TCase *tc_translate = tcase_create("translate");
     tcase_add_checked_fixture(tc_translate, setup, NULL);
     tcase_add_test(tc_translate, test_translate_float);
+    tcase_add_test(tc_translate, test_translate_unsubscribed_signal);
     tcase_add_test(tc_translate, test_translate_string);
     tcase_add_test(tc_translate, test_limited_frequency);
     tcase_add_test(tc_translate, test_unlimited_frequency);
@@ -596,6 +946,18 @@ Suite* canreadSuite(void) {
             test_decoder_called_every_time_with_unlimited_frequency);
     tcase_add_test(tc_translate,
             test_translate_many_signals);
+    tcase_add_test(tc_translate, test_translate_message);
+    tcase_add_test(tc_translate, test_translate_message_skips_other_messages);
+    tcase_add_test(tc_translate, test_translate_message_not_indexed);
+    tcase_add_test(tc_translate, test_fixed_point_matches_float);
+    tcase_add_test(tc_translate, test_fixed_point_exact_signals);
+    tcase_add_test(tc_translate, test_fixed_point_wide_signal);
+    tcase_add_test(tc_translate, test_fixed_point_inexact_signal);
+    tcase_add_test(tc_translate, test_snapshot_holds_value);
+    tcase_add_test(tc_translate, test_snapshot_only_changes);
+    tcase_add_test(tc_translate, test_snapshot_state);
+    tcase_add_test(tc_translate, test_snapshot_frequency);
+    tcase_add_test(tc_translate, test_translate_deferred);
     suite_add_tcase(s, tc_translate);
 
     return s;
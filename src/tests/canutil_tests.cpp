@@ -11,10 +11,25 @@ namespace can = openxc::can;
 
 using openxc::can::lookupSignal;
 using openxc::can::lookupSignalState;
+using openxc::can::packSignalValue;
+using openxc::can::unpackSignalValue;
 using openxc::can::lookupMessageDefinition;
+using openxc::can::lookupMessageIndexEntry;
+using openxc::can::buildMessageIndex;
+using openxc::can::buildNameIndex;
 using openxc::can::registerMessageDefinition;
 using openxc::can::unregisterMessageDefinition;
 using openxc::can::setAcceptanceFilterStatus;
+using openxc::can::addAcceptanceFilter;
+using openxc::can::removeAcceptanceFilter;
+using openxc::can::shouldAcceptMessage;
+using openxc::can::beginAcceptanceFilterUpdate;
+using openxc::can::addAcceptanceFilterRange;
+using openxc::can::removeAcceptanceFilterRange;
+using openxc::can::mergeAcceptanceFilterRanges;
+using openxc::can::optimizeAcceptanceFilters;
+using openxc::can::configureDefaultFilters;
+using openxc::can::commitAcceptanceFilterUpdate;
 using openxc::signals::getCanBusCount;
 using openxc::signals::getCanBuses;
 using openxc::signals::getMessages;
@@ -24,6 +39,8 @@ using openxc::signals::getSignalCount;
 using openxc::signals::getCommands;
 using openxc::signals::getCommandCount;
 
+extern unsigned long FAKE_TIME;
+
 void setup() {
     for(int i = 0; i < getCanBusCount(); i++) {
         can::initializeCommon(&getCanBuses()[i]);
@@ -104,6 +121,49 @@ START_TEST (test_lookup_signal_state_by_value)
 }
 END_TEST
 
+START_TEST (test_pack_signal_value)
+{
+    uint8_t type;
+    float packed;
+    openxc_DynamicField value = openxc::payload::wrapNumber(42.5);
+    fail_unless(packSignalValue(&getSignals()[0], &value, &type, &packed));
+    openxc_DynamicField unpacked = unpackSignalValue(&getSignals()[0], type,
+            packed);
+    fail_unless(!memcmp(&value, &unpacked, sizeof(value)));
+
+    value = openxc::payload::wrapBoolean(true);
+    fail_unless(packSignalValue(&getSignals()[0], &value, &type, &packed));
+    unpacked = unpackSignalValue(&getSignals()[0], type, packed);
+    fail_unless(!memcmp(&value, &unpacked, sizeof(value)));
+
+    value = openxc_DynamicField();
+    value.has_type = true;
+    value.type = openxc_DynamicField_Type_STRING;
+    value.has_string_value = true;
+    strcpy(value.string_value, "third");
+    fail_unless(packSignalValue(&getSignals()[1], &value, &type, &packed));
+    ck_assert_int_eq(packed, 1);
+    unpacked = unpackSignalValue(&getSignals()[1], type, packed);
+    fail_unless(!memcmp(&value, &unpacked, sizeof(value)));
+}
+END_TEST
+
+START_TEST (test_pack_signal_value_inexact)
+{
+    uint8_t type;
+    float packed;
+    openxc_DynamicField value = openxc::payload::wrapString("does_not_exist");
+    fail_if(packSignalValue(&getSignals()[1], &value, &type, &packed));
+
+    value.type = openxc_DynamicField_Type_STRING;
+    fail_if(packSignalValue(&getSignals()[1], &value, &type, &packed));
+
+    value = openxc::payload::wrapNumber(0);
+    value.numeric_value = 0.1;
+    fail_if(packSignalValue(&getSignals()[0], &value, &type, &packed));
+}
+END_TEST
+
 START_TEST (test_lookup_command)
 {
     fail_unless(lookupCommand("does_not_exist", getCommands(), getCommandCount()
@@ -113,6 +173,71 @@ START_TEST (test_lookup_command)
 }
 END_TEST
 
+void buildDefaultNameIndex() {
+    ck_assert(buildNameIndex(getSignals(), getSignalCount(), getCommands(),
+            getCommandCount()));
+}
+
+START_TEST (test_indexed_lookup_signal)
+{
+    buildDefaultNameIndex();
+    fail_unless(lookupSignal("does_not_exist", getSignals(), getSignalCount()) == NULL);
+    for(int i = 0; i < getSignalCount(); i++) {
+        CanSignal* signal = lookupSignal(getSignals()[i].genericName,
+                getSignals(), getSignalCount());
+        ck_assert(signal != NULL);
+        ck_assert_str_eq(signal->genericName, getSignals()[i].genericName);
+    }
+    // duplicate names resolve to the first definition
+    fail_unless(lookupSignal("torque_at_transmission", getSignals(),
+            getSignalCount()) == &getSignals()[0]);
+}
+END_TEST
+
+START_TEST (test_indexed_lookup_writable_signal)
+{
+    buildDefaultNameIndex();
+    fail_unless(lookupSignal("does_not_exist", getSignals(), getSignalCount(), true
+                ) == NULL);
+    fail_unless(lookupSignal("command", getSignals(),
+            getSignalCount(), false) == &getSignals()[4]);
+    fail_unless(lookupSignal("command", getSignals(),
+            getSignalCount(), true) == &getSignals()[5]);
+}
+END_TEST
+
+START_TEST (test_indexed_lookup_signal_state_by_name)
+{
+    buildDefaultNameIndex();
+    fail_unless(lookupSignalState("does_not_exist", &getSignals()[1]) == NULL);
+    fail_unless(lookupSignalState("reverse", &getSignals()[1]) == &getSignals()[1].states[0]);
+    fail_unless(lookupSignalState("second", &getSignals()[1]) == &getSignals()[1].states[5]);
+    fail_unless(lookupSignalState("second", &getSignals()[3]) == &getSignals()[3].states[5]);
+    fail_unless(lookupSignalState("reverse", &getSignals()[0]) == NULL);
+}
+END_TEST
+
+START_TEST (test_indexed_lookup_command)
+{
+    buildDefaultNameIndex();
+    fail_unless(lookupCommand("does_not_exist", getCommands(), getCommandCount()
+                ) == NULL);
+    fail_unless(lookupCommand("turn_signal_status", getCommands(), getCommandCount())
+            == &getCommands()[0]);
+}
+END_TEST
+
+START_TEST (test_indexed_lookup_other_array)
+{
+    buildDefaultNameIndex();
+    // the index only covers the array it was built from
+    fail_unless(lookupSignal("transmission_gear_position", &getSignals()[1],
+            getSignalCount() - 1) == &getSignals()[1]);
+    fail_unless(lookupSignal("torque_at_transmission", &getSignals()[1],
+            getSignalCount() - 1) == &getSignals()[6]);
+}
+END_TEST
+
 START_TEST (test_initialize)
 {
     CanBus bus = {500, 0x101};
@@ -137,6 +262,95 @@ START_TEST (test_get_can_message_definition_undefined)
 }
 END_TEST
 
+START_TEST (test_get_can_message_definition_wrong_format)
+{
+    CanMessageDefinition* message = lookupMessageDefinition(&getCanBuses()[0], 1,
+            CanMessageFormat::EXTENDED, getMessages(), getMessageCount());
+    ck_assert(message == NULL);
+}
+END_TEST
+
+START_TEST (test_build_message_index)
+{
+    ck_assert(buildMessageIndex(getCanBuses(), getCanBusCount(), getMessages(),
+            getMessageCount(), getSignals(), getSignalCount()));
+    ck_assert_int_eq(getCanBuses()[0].messageIndexSize, getMessageCount());
+    ck_assert_int_eq(getCanBuses()[1].messageIndexSize, 0);
+    ck_assert(getCanBuses()[0].messageIndexComplete);
+}
+END_TEST
+
+START_TEST (test_lookup_message_index_entry)
+{
+    buildMessageIndex(getCanBuses(), getCanBusCount(), getMessages(),
+            getMessageCount(), getSignals(), getSignalCount());
+    const CanMessageIndexEntry* entry = lookupMessageIndexEntry(
+            &getCanBuses()[0], 1, CanMessageFormat::STANDARD);
+    ck_assert(entry != NULL);
+    ck_assert_int_eq(entry->messageIndex, 1);
+    ck_assert_int_eq(entry->signalStart, 1);
+    ck_assert_int_eq(entry->signalCount, 1);
+
+    ck_assert(lookupMessageIndexEntry(&getCanBuses()[0], 1,
+            CanMessageFormat::EXTENDED) == NULL);
+    ck_assert(lookupMessageIndexEntry(&getCanBuses()[1], 1,
+            CanMessageFormat::STANDARD) == NULL);
+    ck_assert(lookupMessageIndexEntry(&getCanBuses()[0], 999,
+            CanMessageFormat::STANDARD) == NULL);
+}
+END_TEST
+
+START_TEST (test_message_index_noncontiguous_signals)
+{
+    buildMessageIndex(getCanBuses(), getCanBusCount(), getMessages(),
+            getMessageCount(), getSignals(), getSignalCount());
+    const CanMessageIndexEntry* entry = lookupMessageIndexEntry(
+            &getCanBuses()[0], 2, CanMessageFormat::STANDARD);
+    ck_assert(entry != NULL);
+    // signals for message 2 are at 2, 4 and 5
+    ck_assert_int_eq(entry->signalStart, 2);
+    ck_assert_int_eq(entry->signalCount, 4);
+
+    // signals for message 0 are at 0 and 6
+    entry = lookupMessageIndexEntry(&getCanBuses()[0], 0,
+            CanMessageFormat::STANDARD);
+    ck_assert(entry != NULL);
+    ck_assert_int_eq(entry->signalStart, 0);
+    ck_assert_int_eq(entry->signalCount, 7);
+}
+END_TEST
+
+START_TEST (test_get_can_message_definition_indexed)
+{
+    buildMessageIndex(getCanBuses(), getCanBusCount(), getMessages(),
+            getMessageCount(), getSignals(), getSignalCount());
+    for(int i = 0; i < getMessageCount(); i++) {
+        CanMessageDefinition* message = lookupMessageDefinition(
+                &getCanBuses()[0], getMessages()[i].id,
+                CanMessageFormat::STANDARD, getMessages(), getMessageCount());
+        ck_assert(message == &getMessages()[i]);
+    }
+
+    ck_assert(lookupMessageDefinition(&getCanBuses()[0], 999,
+            CanMessageFormat::STANDARD, getMessages(),
+            getMessageCount()) == NULL);
+}
+END_TEST
+
+START_TEST (test_get_dynamic_message_definition_indexed)
+{
+    buildMessageIndex(getCanBuses(), getCanBusCount(), getMessages(),
+            getMessageCount(), getSignals(), getSignalCount());
+    ck_assert(registerMessageDefinition(&getCanBuses()[0], MESSAGE_ID,
+            CanMessageFormat::STANDARD, getMessages(), getMessageCount()));
+    CanMessageDefinition* message = lookupMessageDefinition(&getCanBuses()[0],
+            MESSAGE_ID, CanMessageFormat::STANDARD, getMessages(),
+            getMessageCount());
+    ck_assert(message != NULL);
+    ck_assert_int_eq(message->id, MESSAGE_ID);
+}
+END_TEST
+
 START_TEST (test_register_can_message)
 {
     ck_assert(registerMessageDefinition(&getCanBuses()[0], MESSAGE_ID, CanMessageFormat::STANDARD, getMessages(), getMessageCount()));
@@ -219,6 +433,473 @@ START_TEST (test_set_acceptance_filter_status)
 }
 END_TEST
 
+int extendedRangeCount(CanBus* bus) {
+    return bus->extendedFilterRangeCounts[bus->activeExtendedFilterRanges];
+}
+
+int countFilters(CanBus* bus) {
+    int filterCount = 0;
+    AcceptanceFilterListEntry* entry;
+    LIST_FOREACH(entry, &bus->acceptanceFilters, entries) {
+        ++filterCount;
+    }
+    return filterCount;
+}
+
+START_TEST (test_should_accept_no_filters)
+{
+    CanBus* bus = &getCanBuses()[0];
+    bus->bypassFilters = false;
+    ck_assert(!shouldAcceptMessage(bus, MESSAGE_ID, CanMessageFormat::STANDARD));
+    ck_assert(!shouldAcceptMessage(bus, MESSAGE_ID, CanMessageFormat::EXTENDED));
+}
+END_TEST
+
+START_TEST (test_should_accept_bypass)
+{
+    CanBus* bus = &getCanBuses()[0];
+    bus->bypassFilters = true;
+    ck_assert(shouldAcceptMessage(bus, MESSAGE_ID, CanMessageFormat::STANDARD));
+    ck_assert(shouldAcceptMessage(bus, 0x18daf110, CanMessageFormat::EXTENDED));
+}
+END_TEST
+
+START_TEST (test_should_accept_standard_filter)
+{
+    CanBus* bus = &getCanBuses()[0];
+    bus->bypassFilters = false;
+    ck_assert(addAcceptanceFilter(bus, 0x7ff, CanMessageFormat::STANDARD,
+                getCanBuses(), getCanBusCount()));
+    ck_assert(addAcceptanceFilter(bus, MESSAGE_ID, CanMessageFormat::STANDARD,
+                getCanBuses(), getCanBusCount()));
+    ck_assert(shouldAcceptMessage(bus, MESSAGE_ID, CanMessageFormat::STANDARD));
+    ck_assert(shouldAcceptMessage(bus, 0x7ff, CanMessageFormat::STANDARD));
+    ck_assert(!shouldAcceptMessage(bus, MESSAGE_ID + 1,
+                CanMessageFormat::STANDARD));
+    ck_assert(!shouldAcceptMessage(bus, MESSAGE_ID, CanMessageFormat::EXTENDED));
+    ck_assert(!shouldAcceptMessage(&getCanBuses()[1], MESSAGE_ID,
+                CanMessageFormat::STANDARD));
+}
+END_TEST
+
+START_TEST (test_should_accept_extended_filter)
+{
+    CanBus* bus = &getCanBuses()[0];
+    bus->bypassFilters = false;
+    uint32_t ids[] = {0x18daf110, 0x100, 0x1fffffff, 0x18daf100};
+    for(size_t i = 0; i < sizeof(ids) / sizeof(ids[0]); i++) {
+        ck_assert(addAcceptanceFilter(bus, ids[i], CanMessageFormat::EXTENDED,
+                    getCanBuses(), getCanBusCount()));
+    }
+
+    ck_assert_int_eq(extendedRangeCount(bus), 4);
+    for(size_t i = 0; i < sizeof(ids) / sizeof(ids[0]); i++) {
+        ck_assert(shouldAcceptMessage(bus, ids[i], CanMessageFormat::EXTENDED));
+    }
+    ck_assert(!shouldAcceptMessage(bus, 0x18daf111, CanMessageFormat::EXTENDED));
+    ck_assert(!shouldAcceptMessage(bus, 0x100, CanMessageFormat::STANDARD));
+}
+END_TEST
+
+START_TEST (test_should_accept_removed_filter)
+{
+    CanBus* bus = &getCanBuses()[0];
+    bus->bypassFilters = false;
+    addAcceptanceFilter(bus, MESSAGE_ID, CanMessageFormat::STANDARD,
+            getCanBuses(), getCanBusCount());
+    addAcceptanceFilter(bus, MESSAGE_ID, CanMessageFormat::STANDARD,
+            getCanBuses(), getCanBusCount());
+    addAcceptanceFilter(bus, 0x18daf110, CanMessageFormat::EXTENDED,
+            getCanBuses(), getCanBusCount());
+    addAcceptanceFilter(bus, 0x18daf111, CanMessageFormat::EXTENDED,
+            getCanBuses(), getCanBusCount());
+
+    // the filter has 2 users, so it's still active after 1 removal
+    removeAcceptanceFilter(bus, MESSAGE_ID, CanMessageFormat::STANDARD,
+            getCanBuses(), getCanBusCount());
+    ck_assert(shouldAcceptMessage(bus, MESSAGE_ID, CanMessageFormat::STANDARD));
+    removeAcceptanceFilter(bus, MESSAGE_ID, CanMessageFormat::STANDARD,
+            getCanBuses(), getCanBusCount());
+    ck_assert(!shouldAcceptMessage(bus, MESSAGE_ID, CanMessageFormat::STANDARD));
+
+    removeAcceptanceFilter(bus, 0x18daf110, CanMessageFormat::EXTENDED,
+            getCanBuses(), getCanBusCount());
+    ck_assert(!shouldAcceptMessage(bus, 0x18daf110, CanMessageFormat::EXTENDED));
+    ck_assert(shouldAcceptMessage(bus, 0x18daf111, CanMessageFormat::EXTENDED));
+    ck_assert_int_eq(extendedRangeCount(bus), 1);
+}
+END_TEST
+
+START_TEST (test_batched_filter_update)
+{
+    CanBus* bus = &getCanBuses()[0];
+    bus->bypassFilters = false;
+    beginAcceptanceFilterUpdate(bus);
+    for(uint32_t id = 0x7e8; id < 0x7f0; id++) {
+        ck_assert(addAcceptanceFilter(bus, id, CanMessageFormat::STANDARD,
+                getCanBuses(), getCanBusCount()));
+    }
+    // the software copy is updated right away, the controller isn't
+    ck_assert(shouldAcceptMessage(bus, 0x7e8, CanMessageFormat::STANDARD));
+    ck_assert_int_eq(bus->acceptanceFilterRebuilds, 0);
+
+    ck_assert(commitAcceptanceFilterUpdate(bus, getCanBuses(),
+            getCanBusCount()));
+    ck_assert_int_eq(bus->acceptanceFilterRebuilds, 1);
+    ck_assert(can::spy::acceptanceFiltersUpdated());
+}
+END_TEST
+
+START_TEST (test_failed_filter_update)
+{
+    CanBus* bus = &getCanBuses()[0];
+    bus->bypassFilters = false;
+    addAcceptanceFilter(bus, MESSAGE_ID, CanMessageFormat::STANDARD,
+            getCanBuses(), getCanBusCount());
+
+    beginAcceptanceFilterUpdate(bus);
+    ck_assert(addAcceptanceFilter(bus, MESSAGE_ID + 1,
+            CanMessageFormat::STANDARD, getCanBuses(), getCanBusCount()));
+    ck_assert(addAcceptanceFilter(bus, MESSAGE_ID, CanMessageFormat::STANDARD,
+            getCanBuses(), getCanBusCount()));
+    can::spy::setAcceptanceFilterTableFull(true);
+    bool status = commitAcceptanceFilterUpdate(bus, getCanBuses(),
+            getCanBusCount());
+    can::spy::setAcceptanceFilterTableFull(false);
+    ck_assert(!status);
+
+    // The filter added in the failed update is gone, the one from before isn't
+    ck_assert(!shouldAcceptMessage(bus, MESSAGE_ID + 1,
+            CanMessageFormat::STANDARD));
+    ck_assert(shouldAcceptMessage(bus, MESSAGE_ID, CanMessageFormat::STANDARD));
+    ck_assert_int_eq(LIST_FIRST(&bus->acceptanceFilters)->filter, MESSAGE_ID);
+    ck_assert(LIST_NEXT(LIST_FIRST(&bus->acceptanceFilters), entries) == NULL);
+}
+END_TEST
+
+START_TEST (test_failed_filter_update_restores_removed)
+{
+    CanBus* bus = &getCanBuses()[0];
+    bus->bypassFilters = false;
+    addAcceptanceFilter(bus, MESSAGE_ID, CanMessageFormat::STANDARD,
+            getCanBuses(), getCanBusCount());
+    addAcceptanceFilter(bus, MESSAGE_ID + 2, CanMessageFormat::STANDARD,
+            getCanBuses(), getCanBusCount());
+    addAcceptanceFilter(bus, MESSAGE_ID + 2, CanMessageFormat::STANDARD,
+            getCanBuses(), getCanBusCount());
+
+    beginAcceptanceFilterUpdate(bus);
+    removeAcceptanceFilter(bus, MESSAGE_ID, CanMessageFormat::STANDARD,
+            getCanBuses(), getCanBusCount());
+    removeAcceptanceFilter(bus, MESSAGE_ID + 2, CanMessageFormat::STANDARD,
+            getCanBuses(), getCanBusCount());
+    ck_assert(addAcceptanceFilter(bus, MESSAGE_ID + 1,
+            CanMessageFormat::STANDARD, getCanBuses(), getCanBusCount()));
+    can::spy::setAcceptanceFilterTableFull(true);
+    bool status = commitAcceptanceFilterUpdate(bus, getCanBuses(),
+            getCanBusCount());
+    can::spy::setAcceptanceFilterTableFull(false);
+    ck_assert(!status);
+
+    // Every filter is back the way it was before the update
+    ck_assert(shouldAcceptMessage(bus, MESSAGE_ID, CanMessageFormat::STANDARD));
+    ck_assert(!shouldAcceptMessage(bus, MESSAGE_ID + 1,
+            CanMessageFormat::STANDARD));
+    ck_assert(shouldAcceptMessage(bus, MESSAGE_ID + 2,
+            CanMessageFormat::STANDARD));
+    AcceptanceFilterListEntry* entry = LIST_FIRST(&bus->acceptanceFilters);
+    ck_assert_int_eq(entry->filter, MESSAGE_ID + 2);
+    ck_assert_int_eq(entry->activeUserCount, 2);
+    entry = LIST_NEXT(entry, entries);
+    ck_assert_int_eq(entry->filter, MESSAGE_ID);
+    ck_assert_int_eq(entry->activeUserCount, 1);
+    ck_assert(LIST_NEXT(entry, entries) == NULL);
+}
+END_TEST
+
+START_TEST (test_nested_filter_update)
+{
+    CanBus* bus = &getCanBuses()[0];
+    beginAcceptanceFilterUpdate(bus);
+    beginAcceptanceFilterUpdate(bus);
+    addAcceptanceFilter(bus, MESSAGE_ID, CanMessageFormat::STANDARD,
+            getCanBuses(), getCanBusCount());
+    ck_assert(commitAcceptanceFilterUpdate(bus, getCanBuses(),
+            getCanBusCount()));
+    ck_assert_int_eq(bus->acceptanceFilterRebuilds, 0);
+
+    removeAcceptanceFilter(bus, MESSAGE_ID, CanMessageFormat::STANDARD,
+            getCanBuses(), getCanBusCount());
+    ck_assert(commitAcceptanceFilterUpdate(bus, getCanBuses(),
+            getCanBusCount()));
+    ck_assert_int_eq(bus->acceptanceFilterRebuilds, 1);
+}
+END_TEST
+
+START_TEST (test_unchanged_filter_update)
+{
+    CanBus* bus = &getCanBuses()[0];
+    beginAcceptanceFilterUpdate(bus);
+    ck_assert(commitAcceptanceFilterUpdate(bus, getCanBuses(),
+            getCanBusCount()));
+    ck_assert_int_eq(bus->acceptanceFilterRebuilds, 0);
+
+    // a commit without a matching begin is an error
+    ck_assert(!commitAcceptanceFilterUpdate(bus, getCanBuses(),
+            getCanBusCount()));
+}
+END_TEST
+
+START_TEST (test_unbatched_filter_update)
+{
+    CanBus* bus = &getCanBuses()[0];
+    addAcceptanceFilter(bus, MESSAGE_ID, CanMessageFormat::STANDARD,
+            getCanBuses(), getCanBusCount());
+    addAcceptanceFilter(bus, MESSAGE_ID + 1, CanMessageFormat::STANDARD,
+            getCanBuses(), getCanBusCount());
+    ck_assert_int_eq(bus->acceptanceFilterRebuilds, 2);
+}
+END_TEST
+
+START_TEST (test_should_accept_range_filter)
+{
+    CanBus* bus = &getCanBuses()[0];
+    bus->bypassFilters = false;
+    ck_assert(addAcceptanceFilterRange(bus, 0x7e8, 0x7ef,
+                CanMessageFormat::STANDARD, getCanBuses(), getCanBusCount()));
+    ck_assert_int_eq(countFilters(bus), 1);
+    ck_assert(shouldAcceptMessage(bus, 0x7e8, CanMessageFormat::STANDARD));
+    ck_assert(shouldAcceptMessage(bus, 0x7eb, CanMessageFormat::STANDARD));
+    ck_assert(shouldAcceptMessage(bus, 0x7ef, CanMessageFormat::STANDARD));
+    ck_assert(!shouldAcceptMessage(bus, 0x7e7, CanMessageFormat::STANDARD));
+    ck_assert(!shouldAcceptMessage(bus, 0x7f0, CanMessageFormat::STANDARD));
+
+    ck_assert(addAcceptanceFilterRange(bus, 0x18daf100, 0x18daf1ff,
+                CanMessageFormat::EXTENDED, getCanBuses(), getCanBusCount()));
+    ck_assert(shouldAcceptMessage(bus, 0x18daf110, CanMessageFormat::EXTENDED));
+    ck_assert(!shouldAcceptMessage(bus, 0x18daf200,
+                CanMessageFormat::EXTENDED));
+
+    removeAcceptanceFilterRange(bus, 0x7e8, 0x7ef, CanMessageFormat::STANDARD,
+            getCanBuses(), getCanBusCount());
+    ck_assert(!shouldAcceptMessage(bus, 0x7e8, CanMessageFormat::STANDARD));
+    ck_assert_int_eq(countFilters(bus), 1);
+}
+END_TEST
+
+START_TEST (test_invalid_range_filter)
+{
+    CanBus* bus = &getCanBuses()[0];
+    ck_assert(!addAcceptanceFilterRange(bus, 0x7ef, 0x7e8,
+                CanMessageFormat::STANDARD, getCanBuses(), getCanBusCount()));
+    ck_assert_int_eq(countFilters(bus), 0);
+}
+END_TEST
+
+START_TEST (test_overlapping_range_filters)
+{
+    CanBus* bus = &getCanBuses()[0];
+    bus->bypassFilters = false;
+    addAcceptanceFilterRange(bus, 0x18daf100, 0x18daf10f,
+            CanMessageFormat::EXTENDED, getCanBuses(), getCanBusCount());
+    addAcceptanceFilter(bus, 0x18daf108, CanMessageFormat::EXTENDED,
+            getCanBuses(), getCanBusCount());
+    addAcceptanceFilter(bus, 0x7e8, CanMessageFormat::STANDARD,
+            getCanBuses(), getCanBusCount());
+    addAcceptanceFilterRange(bus, 0x7e0, 0x7ef, CanMessageFormat::STANDARD,
+            getCanBuses(), getCanBusCount());
+    ck_assert_int_eq(extendedRangeCount(bus), 1);
+
+    // removing the range leaves the single IDs it overlapped
+    removeAcceptanceFilterRange(bus, 0x18daf100, 0x18daf10f,
+            CanMessageFormat::EXTENDED, getCanBuses(), getCanBusCount());
+    removeAcceptanceFilterRange(bus, 0x7e0, 0x7ef, CanMessageFormat::STANDARD,
+            getCanBuses(), getCanBusCount());
+    ck_assert(shouldAcceptMessage(bus, 0x18daf108, CanMessageFormat::EXTENDED));
+    ck_assert(!shouldAcceptMessage(bus, 0x18daf107,
+                CanMessageFormat::EXTENDED));
+    ck_assert(shouldAcceptMessage(bus, 0x7e8, CanMessageFormat::STANDARD));
+    ck_assert(!shouldAcceptMessage(bus, 0x7e9, CanMessageFormat::STANDARD));
+}
+END_TEST
+
+START_TEST (test_merge_filter_ranges)
+{
+    AcceptanceFilterRange ranges[] = {{0x300, 0x300}, {0x101, 0x101},
+            {0x100, 0x100}, {0x104, 0x110}, {0x105, 0x106}, {0x200, 0x200}};
+    ck_assert_int_eq(mergeAcceptanceFilterRanges(ranges, 6, 10), 4);
+    ck_assert_int_eq(ranges[0].first, 0x100);
+    ck_assert_int_eq(ranges[0].last, 0x101);
+    ck_assert_int_eq(ranges[1].first, 0x104);
+    ck_assert_int_eq(ranges[1].last, 0x110);
+    ck_assert_int_eq(ranges[2].first, 0x200);
+    ck_assert_int_eq(ranges[3].first, 0x300);
+
+    // the closest ranges are merged first
+    ck_assert_int_eq(mergeAcceptanceFilterRanges(ranges, 4, 3), 3);
+    ck_assert_int_eq(ranges[0].first, 0x100);
+    ck_assert_int_eq(ranges[0].last, 0x110);
+
+    ck_assert_int_eq(mergeAcceptanceFilterRanges(ranges, 3, 1), 1);
+    ck_assert_int_eq(ranges[0].first, 0x100);
+    ck_assert_int_eq(ranges[0].last, 0x300);
+}
+END_TEST
+
+START_TEST (test_optimize_filters)
+{
+    CanBus* bus = &getCanBuses()[0];
+    for(uint32_t id = 0x7e8; id <= 0x7ef; id++) {
+        addAcceptanceFilter(bus, id, CanMessageFormat::STANDARD,
+                getCanBuses(), getCanBusCount());
+    }
+    addAcceptanceFilter(bus, 0x100, CanMessageFormat::STANDARD,
+            getCanBuses(), getCanBusCount());
+    addAcceptanceFilter(bus, 0x100, CanMessageFormat::EXTENDED,
+            getCanBuses(), getCanBusCount());
+
+    AcceptanceFilterRange ranges[MAX_ACCEPTANCE_FILTERS];
+    ck_assert_int_eq(optimizeAcceptanceFilters(bus,
+                CanMessageFormat::STANDARD, ranges, MAX_ACCEPTANCE_FILTERS), 2);
+    ck_assert_int_eq(ranges[1].first, 0x7e8);
+    ck_assert_int_eq(ranges[1].last, 0x7ef);
+    ck_assert_int_eq(optimizeAcceptanceFilters(bus,
+                CanMessageFormat::STANDARD, ranges, 1), 1);
+    ck_assert_int_eq(ranges[0].first, 0x100);
+    ck_assert_int_eq(ranges[0].last, 0x7ef);
+    ck_assert_int_eq(optimizeAcceptanceFilters(bus,
+                CanMessageFormat::EXTENDED, ranges, MAX_ACCEPTANCE_FILTERS), 1);
+}
+END_TEST
+
+START_TEST (test_default_filters_exceed_slots)
+{
+    CanBus* bus = &getCanBuses()[0];
+    bus->bypassFilters = false;
+    CanMessageDefinition messages[MAX_ACCEPTANCE_FILTERS * 2];
+    const int messageCount = sizeof(messages) / sizeof(messages[0]);
+    for(int i = 0; i < messageCount; i++) {
+        messages[i].bus = bus;
+        messages[i].id = 0x100 + i * 3;
+        messages[i].format = CanMessageFormat::STANDARD;
+    }
+
+    ck_assert(configureDefaultFilters(bus, messages, messageCount,
+                getCanBuses(), getCanBusCount()));
+    ck_assert(!bus->bypassFilters);
+    ck_assert(countFilters(bus) < MAX_ACCEPTANCE_FILTERS);
+    for(int i = 0; i < messageCount; i++) {
+        ck_assert(shouldAcceptMessage(bus, messages[i].id,
+                    CanMessageFormat::STANDARD));
+    }
+    ck_assert(!shouldAcceptMessage(bus, 0x100 - 1, CanMessageFormat::STANDARD));
+    ck_assert(!shouldAcceptMessage(bus, 0x7ff, CanMessageFormat::STANDARD));
+}
+END_TEST
+
+START_TEST (test_default_filters_consecutive_ids)
+{
+    CanBus* bus = &getCanBuses()[0];
+    bus->bypassFilters = false;
+    CanMessageDefinition messages[8];
+    for(int i = 0; i < 8; i++) {
+        messages[i].bus = bus;
+        messages[i].id = 0x200 + i;
+        messages[i].format = CanMessageFormat::STANDARD;
+    }
+
+    ck_assert(configureDefaultFilters(bus, messages, 8, getCanBuses(),
+                getCanBusCount()));
+    ck_assert_int_eq(countFilters(bus), 1);
+    ck_assert(shouldAcceptMessage(bus, 0x207, CanMessageFormat::STANDARD));
+    ck_assert(!shouldAcceptMessage(bus, 0x208, CanMessageFormat::STANDARD));
+}
+END_TEST
+
+START_TEST (test_queue_sizes_per_bus)
+{
+    ck_assert_int_eq(getCanBuses()[0].receiveQueue.maxLength,
+            CAN1_RECEIVE_QUEUE_SIZE);
+    ck_assert_int_eq(getCanBuses()[1].receiveQueue.maxLength,
+            CAN2_RECEIVE_QUEUE_SIZE);
+    ck_assert_int_eq(getCanBuses()[0].sendQueue.maxLength,
+            CAN1_SEND_QUEUE_SIZE);
+    ck_assert_int_eq(getCanBuses()[1].sendQueue.maxLength,
+            CAN2_SEND_QUEUE_SIZE);
+
+    QUEUE_TYPE(CanMessage)* queue = &getCanBuses()[1].receiveQueue;
+    CanMessage message = {0x42};
+    for(int i = 0; i < CAN2_RECEIVE_QUEUE_SIZE; i++) {
+        message.id = i;
+        ck_assert(QUEUE_PUSH(CanMessage, queue, message));
+    }
+    ck_assert(QUEUE_FULL(CanMessage, queue));
+    ck_assert(!QUEUE_PUSH(CanMessage, queue, message));
+    for(int i = 0; i < CAN2_RECEIVE_QUEUE_SIZE; i++) {
+        ck_assert_int_eq(QUEUE_POP(CanMessage, queue).id, i);
+    }
+    ck_assert(QUEUE_EMPTY(CanMessage, queue));
+}
+END_TEST
+
+START_TEST (test_queue_unknown_bus_address)
+{
+    CanBus bus = {500, 0x101};
+    bus.address = 3;
+    ck_assert(!can::initializeCommon(&bus));
+
+    CanMessage message = {0x42};
+    ck_assert(QUEUE_EMPTY(CanMessage, &bus.receiveQueue));
+    ck_assert(!QUEUE_PUSH(CanMessage, &bus.receiveQueue, message));
+    ck_assert(!QUEUE_PUSH(CanMessage, &bus.sendQueue, message));
+    ck_assert_int_eq(bus.receiveQueue.overflowCount, 1);
+    ck_assert_int_eq(QUEUE_POP(CanMessage, &bus.receiveQueue).id, 0);
+    // Controller 1's queue isn't touched
+    ck_assert(QUEUE_EMPTY(CanMessage, &getCanBuses()[0].receiveQueue));
+    can::destroy(&bus);
+}
+END_TEST
+
+START_TEST (test_queue_high_water_mark)
+{
+    QUEUE_TYPE(CanMessage)* queue = &getCanBuses()[0].receiveQueue;
+    CanMessage message = {0x42};
+    for(int i = 0; i < 3; i++) {
+        QUEUE_PUSH(CanMessage, queue, message);
+    }
+    QUEUE_POP(CanMessage, queue);
+    QUEUE_POP(CanMessage, queue);
+    QUEUE_PUSH(CanMessage, queue, message);
+    ck_assert_int_eq(QUEUE_LENGTH(CanMessage, queue), 2);
+    ck_assert_int_eq(queue->highWaterMark, 3);
+    ck_assert_int_eq(queue->overflowCount, 0);
+    ck_assert_int_eq(queue->lastOverflowTime, 0);
+}
+END_TEST
+
+START_TEST (test_queue_overflow)
+{
+    QUEUE_TYPE(CanMessage)* queue = &getCanBuses()[0].sendQueue;
+    CanMessage message = {0x42};
+    while(!QUEUE_FULL(CanMessage, queue)) {
+        QUEUE_PUSH(CanMessage, queue, message);
+    }
+
+    unsigned long startTime = FAKE_TIME;
+    ck_assert(!QUEUE_PUSH(CanMessage, queue, message));
+    FAKE_TIME += 1000;
+    ck_assert(!QUEUE_PUSH(CanMessage, queue, message));
+    ck_assert_int_eq(queue->overflowCount, 2);
+    ck_assert_int_eq(queue->lastOverflowTime, startTime + 1000);
+    FAKE_TIME = startTime;
+    ck_assert_int_eq(queue->highWaterMark, CAN1_SEND_QUEUE_SIZE);
+
+    QUEUE_INIT(CanMessage, queue);
+    ck_assert_int_eq(queue->overflowCount, 0);
+    ck_assert_int_eq(queue->highWaterMark, 0);
+}
+END_TEST
+
 Suite* canutilSuite(void) {
     Suite* s = suite_create("canutil");
     TCase *tc_core = tcase_create("core");
@@ -230,6 +911,8 @@ Suite* canutilSuite(void) {
     tcase_add_test(tc_core, test_lookup_writable_signal);
     tcase_add_test(tc_core, test_lookup_signal_state_by_name);
     tcase_add_test(tc_core, test_lookup_signal_state_by_value);
+    tcase_add_test(tc_core, test_pack_signal_value);
+    tcase_add_test(tc_core, test_pack_signal_value_inexact);
     tcase_add_test(tc_core, test_lookup_command);
     tcase_add_test(tc_core, test_set_acceptance_filter_status);
     suite_add_tcase(s, tc_core);
@@ -238,6 +921,7 @@ Suite* canutilSuite(void) {
     tcase_add_checked_fixture(tc_message_def, setup, teardown);
     tcase_add_test(tc_message_def, test_get_can_message_definition_predefined);
     tcase_add_test(tc_message_def, test_get_can_message_definition_undefined);
+    tcase_add_test(tc_message_def, test_get_can_message_definition_wrong_format);
     tcase_add_test(tc_message_def, test_register_can_message);
     tcase_add_test(tc_message_def, test_register_can_message_twice);
     tcase_add_test(tc_message_def, test_register_can_message_diff_bus);
@@ -246,6 +930,55 @@ Suite* canutilSuite(void) {
     tcase_add_test(tc_message_def, test_unregister_predefined);
     suite_add_tcase(s, tc_message_def);
 
+    TCase *tc_filters = tcase_create("filters");
+    tcase_add_checked_fixture(tc_filters, setup, teardown);
+    tcase_add_test(tc_filters, test_should_accept_no_filters);
+    tcase_add_test(tc_filters, test_should_accept_bypass);
+    tcase_add_test(tc_filters, test_should_accept_standard_filter);
+    tcase_add_test(tc_filters, test_should_accept_extended_filter);
+    tcase_add_test(tc_filters, test_should_accept_removed_filter);
+    tcase_add_test(tc_filters, test_batched_filter_update);
+    tcase_add_test(tc_filters, test_failed_filter_update);
+    tcase_add_test(tc_filters, test_failed_filter_update_restores_removed);
+    tcase_add_test(tc_filters, test_nested_filter_update);
+    tcase_add_test(tc_filters, test_unchanged_filter_update);
+    tcase_add_test(tc_filters, test_unbatched_filter_update);
+    tcase_add_test(tc_filters, test_should_accept_range_filter);
+    tcase_add_test(tc_filters, test_invalid_range_filter);
+    tcase_add_test(tc_filters, test_overlapping_range_filters);
+    tcase_add_test(tc_filters, test_merge_filter_ranges);
+    tcase_add_test(tc_filters, test_optimize_filters);
+    tcase_add_test(tc_filters, test_default_filters_exceed_slots);
+    tcase_add_test(tc_filters, test_default_filters_consecutive_ids);
+    suite_add_tcase(s, tc_filters);
+
+    TCase *tc_queues = tcase_create("queues");
+    tcase_add_checked_fixture(tc_queues, setup, teardown);
+    tcase_add_test(tc_queues, test_queue_sizes_per_bus);
+    tcase_add_test(tc_queues, test_queue_unknown_bus_address);
+    tcase_add_test(tc_queues, test_queue_high_water_mark);
+    tcase_add_test(tc_queues, test_queue_overflow);
+    suite_add_tcase(s, tc_queues);
+
+    TCase *tc_name_index = tcase_create("name_index");
+    tcase_add_checked_fixture(tc_name_index, setup, teardown);
+    tcase_add_test(tc_name_index, test_indexed_lookup_signal);
+    tcase_add_test(tc_name_index, test_indexed_lookup_writable_signal);
+    tcase_add_test(tc_name_index, test_indexed_lookup_signal_state_by_name);
+    tcase_add_test(tc_name_index, test_indexed_lookup_command);
+    tcase_add_test(tc_name_index, test_indexed_lookup_other_array);
+    suite_add_tcase(s, tc_name_index);
+
+    TCase *tc_message_index = tcase_create("message_index");
+    tcase_add_checked_fixture(tc_message_index, setup, teardown);
+    tcase_add_test(tc_message_index, test_build_message_index);
+    tcase_add_test(tc_message_index, test_lookup_message_index_entry);
+    tcase_add_test(tc_message_index, test_message_index_noncontiguous_signals);
+    tcase_add_test(tc_message_index, test_get_can_message_definition_indexed);
+    tcase_add_test(tc_message_index,
+            test_get_dynamic_message_definition_indexed);
+    suite_add_tcase(s, tc_message_index);
+
     return s;
 }
 
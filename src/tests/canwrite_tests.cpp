@@ -22,6 +22,7 @@ void setup() {
         getSignals()[i].sendSame = true;
         getSignals()[i].frequencyClock = {0};
     }
+    can::initializeCommon(&getCanBuses()[0]);
     QUEUE_INIT(CanMessage, &getCanBuses()[0].sendQueue);
 }
 
@@ -1,5 +1,6 @@
 #include <check.h>
 #include <stdint.h>
+#include <string>
 #include "signals.h"
 #include "config.h"
 #include "diagnostics.h"
@@ -7,6 +8,8 @@
 #include "lights.h"
 #include "config.h"
 #include "pipeline.h"
+#include "can/snapshot.h"
+#include "canutil_spy.h"
 
 namespace diagnostics = openxc::diagnostics;
 namespace usb = openxc::interface::usb;
@@ -64,11 +67,17 @@ void setup() {
     getConfiguration()->desiredRunLevel = openxc::config::RunLevel::ALL_IO;
     getConfiguration()->obd2BusAddress = 0;
     getConfiguration()->payloadFormat = PayloadFormat::JSON;
+    getConfiguration()->snapshotMode = false;
+    getConfiguration()->canReceiveBatchSize = DEFAULT_CAN_RECEIVE_BATCH_SIZE;
+    getConfiguration()->canReceiveBudgetUs = DEFAULT_CAN_RECEIVE_BUDGET_US;
+    // Most tests check the output right after translating
+    getConfiguration()->deferSerialization = false;
     initializeVehicleInterface();
     getConfiguration()->usb.configured = true;
     fail_unless(canQueueEmpty(0));
     getActiveMessageSet()->busCount = 2;
     getCanBuses()[0].rawWritable = true;
+    openxc::pipeline::initialize(&getConfiguration()->pipeline);
     resetQueues();
 
     CAN_MESSAGE.has_type = true;
@@ -827,6 +836,25 @@ START_TEST (test_bypass_command)
 }
 END_TEST
 
+START_TEST (test_bypass_command_failed)
+{
+    uint8_t request[] = "{\"command\": \"af_bypass\", \"bus\": 1, "
+            "\"bypass\": false}\0";
+    getCanBuses()[0].bypassFilters = true;
+    openxc::can::spy::setAcceptanceFilterTableFull(true);
+    ck_assert(handleIncomingMessage(request, sizeof(request), &DESCRIPTOR));
+    openxc::can::spy::setAcceptanceFilterTableFull(false);
+    // The bus can't be filtered, so it's still bypassed
+    ck_assert(getCanBuses()[0].bypassFilters);
+    getCanBuses()[0].bypassFilters = false;
+
+    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE) + 1];
+    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    snapshot[sizeof(snapshot) - 1] = NULL;
+    ck_assert(strstr((char*)snapshot, "false") != NULL);
+}
+END_TEST
+
 START_TEST (test_validate_payload_format_command)
 {
     CONTROL_COMMAND.control_command.type = openxc_ControlCommand_Type_PAYLOAD_FORMAT;
@@ -850,6 +878,20 @@ START_TEST (test_payload_format_command)
 }
 END_TEST
 
+START_TEST (test_raw_can_payload_format_command)
+{
+    uint8_t request[] = "{\"command\": \"payload_format\", \"format\": \"raw_can\"}\0";
+    ck_assert(handleIncomingMessage(request, sizeof(request), &DESCRIPTOR));
+    ck_assert_int_eq(PayloadFormat::RAW_CAN, getConfiguration()->payloadFormat);
+
+    // Commands are still JSON in the raw CAN format
+    uint8_t jsonRequest[] = "{\"command\": \"payload_format\", \"format\": \"json\"}\0";
+    ck_assert(handleIncomingMessage(jsonRequest, sizeof(jsonRequest),
+                &DESCRIPTOR));
+    ck_assert_int_eq(PayloadFormat::JSON, getConfiguration()->payloadFormat);
+}
+END_TEST
+
 START_TEST (test_validate_predefined_obd2_command)
 {
     CONTROL_COMMAND.control_command.type = openxc_ControlCommand_Type_PREDEFINED_OBD2_REQUESTS;
@@ -872,6 +914,216 @@ START_TEST (test_predefined_obd2_command)
 }
 END_TEST
 
+START_TEST (test_subscription_command)
+{
+    uint8_t request[] = "{\"command\": \"subscribe\", \"signals\": "
+            "[\"brake_pedal_status\"], \"classes\": [\"simple\"]}\0";
+    InterfaceDescriptor uartDescriptor = {
+        allowRawWrites: false,
+        type: InterfaceType::UART
+    };
+    ck_assert_int_eq(handleIncomingMessage(request, sizeof(request),
+                &uartDescriptor), sizeof(request) - 1);
+
+    openxc::pipeline::Subscription* subscription = &getConfiguration()->
+            pipeline.endpoints[InterfaceType::UART].subscription;
+    ck_assert_int_eq(subscription->mode,
+            openxc::pipeline::SubscriptionMode::INCLUDE_SIGNALS);
+    // brake_pedal_status is the third test signal
+    ck_assert_int_eq(subscription->signals[0], 1 << 2);
+    ck_assert(!(subscription->messageClasses & MESSAGE_CLASS_MASK(
+                    openxc::pipeline::MessageClass::CAN)));
+    ck_assert_int_eq(getConfiguration()->pipeline.endpoints[
+            InterfaceType::USB].subscription.mode,
+            openxc::pipeline::SubscriptionMode::ALL_SIGNALS);
+
+    ck_assert(!outputQueueEmpty());
+    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE) + 1];
+    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    snapshot[sizeof(snapshot) - 1] = NULL;
+    ck_assert(strstr((char*)snapshot, "\"subscribe\"") != NULL);
+    ck_assert(strstr((char*)snapshot, "true") != NULL);
+
+    uint8_t reset[] = "{\"command\": \"subscribe\", \"mode\": \"all\"}\0";
+    ck_assert(handleIncomingMessage(reset, sizeof(reset), &uartDescriptor));
+    ck_assert_int_eq(subscription->mode,
+            openxc::pipeline::SubscriptionMode::ALL_SIGNALS);
+    ck_assert_int_eq(subscription->messageClasses, ALL_MESSAGE_CLASSES);
+}
+END_TEST
+
+START_TEST (test_subscription_command_unrecognized_signal)
+{
+    uint8_t request[] = "{\"command\": \"subscribe\", \"mode\": \"exclude\", "
+            "\"signals\": [\"brake_pedal_status\", \"foo\"]}\0";
+    ck_assert(handleIncomingMessage(request, sizeof(request), &DESCRIPTOR));
+    ck_assert_int_eq(getConfiguration()->pipeline.endpoints[
+            InterfaceType::USB].subscription.mode,
+            openxc::pipeline::SubscriptionMode::ALL_SIGNALS);
+
+    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE) + 1];
+    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    snapshot[sizeof(snapshot) - 1] = NULL;
+    ck_assert_str_eq((char*)snapshot,
+            "{\"command_response\":\"subscribe\",\"status\":false}");
+}
+END_TEST
+
+START_TEST (test_subscription_command_invalid_class)
+{
+    uint8_t request[] = "{\"command\": \"subscribe\", "
+            "\"classes\": [\"simple\", [\"can\"]]}\0";
+    ck_assert_int_eq(handleIncomingMessage(request, sizeof(request),
+                &DESCRIPTOR), sizeof(request) - 1);
+    ck_assert_int_eq(getConfiguration()->pipeline.endpoints[
+            InterfaceType::USB].subscription.messageClasses,
+            ALL_MESSAGE_CLASSES);
+
+    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE) + 1];
+    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    snapshot[sizeof(snapshot) - 1] = NULL;
+    ck_assert(strstr((char*)snapshot, "false") != NULL);
+}
+END_TEST
+
+START_TEST (test_subscription_command_too_many_tokens)
+{
+    std::string request = "{\"command\": \"subscribe\", \"signals\": [";
+    for(int i = 0; i < MAX_JSON_TOKENS; i++) {
+        request += i == 0 ? "\"brake_pedal_status\"" :
+                ", \"brake_pedal_status\"";
+    }
+    request += "]}";
+    ck_assert_int_eq(handleIncomingMessage((uint8_t*)request.c_str(),
+                request.length() + 1, &DESCRIPTOR), request.length() + 1);
+    ck_assert_int_eq(getConfiguration()->pipeline.endpoints[
+            InterfaceType::USB].subscription.mode,
+            openxc::pipeline::SubscriptionMode::ALL_SIGNALS);
+
+    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE) + 1];
+    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    snapshot[sizeof(snapshot) - 1] = NULL;
+    ck_assert_str_eq((char*)snapshot,
+            "{\"command_response\":\"subscribe\",\"status\":false}");
+}
+END_TEST
+
+START_TEST (test_subscribe_in_simple_message_value)
+{
+    // Only a command named subscribe is a subscription
+    uint8_t request[] = "{\"name\": \"transmission_gear_position\", "
+            "\"value\": \"subscribe\"}\0";
+    ck_assert(handleIncomingMessage(request, sizeof(request), &DESCRIPTOR));
+    ck_assert(outputQueueEmpty());
+    ck_assert_int_eq(getConfiguration()->pipeline.endpoints[
+            InterfaceType::USB].subscription.mode,
+            openxc::pipeline::SubscriptionMode::ALL_SIGNALS);
+}
+END_TEST
+
+START_TEST (test_snapshot_command)
+{
+    getConfiguration()->snapshotMode = true;
+    openxc_DynamicField value = openxc::payload::wrapNumber(42);
+    ck_assert(openxc::can::snapshot::update(
+                &openxc::signals::getSignals()[0],
+                openxc::signals::getSignals(), &value, true));
+
+    uint8_t request[] = "{\"command\": \"snapshot\"}\0";
+    ck_assert_int_eq(handleIncomingMessage(request, sizeof(request),
+                &DESCRIPTOR), sizeof(request) - 1);
+
+    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE) + 1];
+    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    snapshot[sizeof(snapshot) - 1] = NULL;
+    ck_assert(strstr((char*)snapshot, "\"snapshot\"") != NULL);
+    ck_assert(strstr((char*)snapshot, "true") != NULL);
+    // The response comes first, then the value
+    char* published = (char*)snapshot + strlen((char*)snapshot) + 1;
+    ck_assert(strstr(published, "42") != NULL);
+}
+END_TEST
+
+START_TEST (test_snapshot_command_disabled)
+{
+    uint8_t request[] = "{\"command\": \"snapshot\"}\0";
+    ck_assert(handleIncomingMessage(request, sizeof(request), &DESCRIPTOR));
+
+    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE) + 1];
+    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    snapshot[sizeof(snapshot) - 1] = NULL;
+    ck_assert(strstr((char*)snapshot, "false") != NULL);
+}
+END_TEST
+
+START_TEST (test_metrics_command)
+{
+    uint8_t request[] = "{\"command\": \"metrics\"}\0";
+    ck_assert_int_eq(handleIncomingMessage(request, sizeof(request),
+                &DESCRIPTOR), sizeof(request) - 1);
+
+    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE) + 1];
+    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    snapshot[sizeof(snapshot) - 1] = NULL;
+    ck_assert(strstr((char*)snapshot, "\"metrics\"") != NULL);
+    ck_assert(strstr((char*)snapshot, "true") != NULL);
+    ck_assert(strstr((char*)snapshot, "\"total\"") != NULL);
+    ck_assert(strstr((char*)snapshot, "USB.messages_sent") != NULL);
+    // There are more metrics than fit in one response
+    ck_assert(strstr((char*)snapshot, "\"next\"") != NULL);
+    ck_assert_int_le(strlen((char*)snapshot), MAX_OUTGOING_PAYLOAD_SIZE);
+    ck_assert_int_eq(snapshot[strlen((char*)snapshot) - 1], '}');
+}
+END_TEST
+
+START_TEST (test_metrics_command_offset)
+{
+    uint8_t request[] = "{\"command\": \"metrics\", \"offset\": 1000}\0";
+    ck_assert(handleIncomingMessage(request, sizeof(request), &DESCRIPTOR));
+
+    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE) + 1];
+    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    snapshot[sizeof(snapshot) - 1] = NULL;
+    ck_assert(strstr((char*)snapshot, "\"metrics\"") != NULL);
+    ck_assert(strstr((char*)snapshot, "false") != NULL);
+}
+END_TEST
+
+START_TEST (test_can_receive_command)
+{
+    uint8_t request[] = "{\"command\": \"can_receive\", "
+            "\"batch_size\": 16, \"budget_us\": 0}\0";
+    ck_assert_int_eq(handleIncomingMessage(request, sizeof(request),
+                &DESCRIPTOR), sizeof(request) - 1);
+    ck_assert_int_eq(getConfiguration()->canReceiveBatchSize, 16);
+    ck_assert_int_eq(getConfiguration()->canReceiveBudgetUs, 0);
+
+    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE) + 1];
+    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    snapshot[sizeof(snapshot) - 1] = NULL;
+    ck_assert_str_eq((char*)snapshot, "{\"command_response\":\"can_receive\","
+            "\"status\":true,\"batch_size\":16,\"budget_us\":0}");
+}
+END_TEST
+
+START_TEST (test_can_receive_command_invalid)
+{
+    uint8_t request[] = "{\"command\": \"can_receive\", "
+            "\"batch_size\": 0, \"budget_us\": 100}\0";
+    ck_assert(handleIncomingMessage(request, sizeof(request), &DESCRIPTOR));
+    // Neither limit is changed
+    ck_assert_int_eq(getConfiguration()->canReceiveBatchSize,
+            DEFAULT_CAN_RECEIVE_BATCH_SIZE);
+    ck_assert_int_eq(getConfiguration()->canReceiveBudgetUs,
+            DEFAULT_CAN_RECEIVE_BUDGET_US);
+
+    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE) + 1];
+    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    snapshot[sizeof(snapshot) - 1] = NULL;
+    ck_assert(strstr((char*)snapshot, "false") != NULL);
+}
+END_TEST
+
 Suite* suite(void) {
     Suite* s = suite_create("commands");
     TCase *tc_complex_commands = tcase_create("complex_commands");
@@ -928,8 +1180,25 @@ Suite* suite(void) {
     tcase_add_test(tc_control_commands, test_device_id_message_in_stream);
     tcase_add_test(tc_control_commands, test_passthrough_request_message);
     tcase_add_test(tc_control_commands, test_bypass_command);
+    tcase_add_test(tc_control_commands, test_bypass_command_failed);
     tcase_add_test(tc_control_commands, test_payload_format_command);
+    tcase_add_test(tc_control_commands, test_raw_can_payload_format_command);
     tcase_add_test(tc_control_commands, test_predefined_obd2_command);
+    tcase_add_test(tc_control_commands, test_subscription_command);
+    tcase_add_test(tc_control_commands,
+            test_subscription_command_unrecognized_signal);
+    tcase_add_test(tc_control_commands,
+            test_subscription_command_invalid_class);
+    tcase_add_test(tc_control_commands,
+            test_subscription_command_too_many_tokens);
+    tcase_add_test(tc_control_commands,
+            test_subscribe_in_simple_message_value);
+    tcase_add_test(tc_control_commands, test_snapshot_command);
+    tcase_add_test(tc_control_commands, test_snapshot_command_disabled);
+    tcase_add_test(tc_control_commands, test_metrics_command);
+    tcase_add_test(tc_control_commands, test_metrics_command_offset);
+    tcase_add_test(tc_control_commands, test_can_receive_command);
+    tcase_add_test(tc_control_commands, test_can_receive_command_invalid);
     suite_add_tcase(s, tc_control_commands);
 
     TCase *tc_validation = tcase_create("validation");
@@ -4,6 +4,9 @@
 
 #include "commands/commands.h"
 #include "payload/json.h"
+#include "payload/payload.h"
+#include "util/numberformat.h"
+#include "util/jsontokenizer.h"
 
 namespace json = openxc::payload::json;
 
@@ -142,6 +145,212 @@ START_TEST (test_predefined_obd2_requests_request)
 }
 END_TEST
 
+START_TEST (test_serialize_simple)
+{
+    openxc_VehicleMessage message = {0};
+    message.has_type = true;
+    message.type = openxc_VehicleMessage_Type_SIMPLE;
+    message.has_simple_message = true;
+    strcpy(message.simple_message.name, "vehicle_speed");
+    message.simple_message.has_value = true;
+    message.simple_message.value.has_type = true;
+    message.simple_message.value.type = openxc_DynamicField_Type_NUM;
+    message.simple_message.value.has_numeric_value = true;
+    message.simple_message.value.numeric_value = 42;
+
+    uint8_t payload[256] = {0};
+    const char expected[] = "{\"name\":\"vehicle_speed\",\"value\":42}";
+    ck_assert_int_eq(json::serialize(&message, payload, sizeof(payload)),
+            sizeof(expected));
+    ck_assert_str_eq((char*)payload, expected);
+
+    message.simple_message.value.numeric_value = 42.5;
+    json::serialize(&message, payload, sizeof(payload));
+    ck_assert_str_eq((char*)payload,
+            "{\"name\":\"vehicle_speed\",\"value\":42.500000}");
+
+    message.simple_message.value.numeric_value = 1.0e10 + 0.5;
+    json::serialize(&message, payload, sizeof(payload));
+    ck_assert_str_eq((char*)payload,
+            "{\"name\":\"vehicle_speed\",\"value\":1.000000e+10}");
+
+    message.simple_message.value.numeric_value = -1.0e10;
+    json::serialize(&message, payload, sizeof(payload));
+    ck_assert_str_eq((char*)payload,
+            "{\"name\":\"vehicle_speed\",\"value\":-10000000000}");
+}
+END_TEST
+
+START_TEST (test_serialize_decimal_places)
+{
+    openxc_VehicleMessage message = {0};
+    message.has_type = true;
+    message.type = openxc_VehicleMessage_Type_SIMPLE;
+    message.has_simple_message = true;
+    strcpy(message.simple_message.name, "vehicle_speed");
+    message.simple_message.has_value = true;
+    message.simple_message.value.has_type = true;
+    message.simple_message.value.type = openxc_DynamicField_Type_NUM;
+    message.simple_message.value.has_numeric_value = true;
+    message.simple_message.value.numeric_value = 42.25;
+
+    uint8_t payload[256] = {0};
+    json::serialize(&message, payload, sizeof(payload), 1);
+    ck_assert_str_eq((char*)payload,
+            "{\"name\":\"vehicle_speed\",\"value\":42.2}");
+
+    json::serialize(&message, payload, sizeof(payload),
+            SHORTEST_DECIMAL_PLACES);
+    ck_assert_str_eq((char*)payload,
+            "{\"name\":\"vehicle_speed\",\"value\":42.25}");
+
+    // Whole numbers never have decimal places
+    message.simple_message.value.numeric_value = 42;
+    json::serialize(&message, payload, sizeof(payload), 3);
+    ck_assert_str_eq((char*)payload,
+            "{\"name\":\"vehicle_speed\",\"value\":42}");
+
+    // An invalid number of decimal places falls back to what cJSON does
+    message.simple_message.value.numeric_value = 0.5;
+    json::serialize(&message, payload, sizeof(payload), 42);
+    ck_assert_str_eq((char*)payload,
+            "{\"name\":\"vehicle_speed\",\"value\":0.500000}");
+}
+END_TEST
+
+START_TEST (test_serialize_simple_with_event)
+{
+    openxc_VehicleMessage message = {0};
+    message.has_type = true;
+    message.type = openxc_VehicleMessage_Type_SIMPLE;
+    message.has_simple_message = true;
+    strcpy(message.simple_message.name, "door_status");
+    message.simple_message.has_value = true;
+    message.simple_message.value.has_type = true;
+    message.simple_message.value.type = openxc_DynamicField_Type_STRING;
+    message.simple_message.value.has_string_value = true;
+    strcpy(message.simple_message.value.string_value, "driver");
+    message.simple_message.has_event = true;
+    message.simple_message.event.has_type = true;
+    message.simple_message.event.type = openxc_DynamicField_Type_BOOL;
+    message.simple_message.event.has_boolean_value = true;
+    message.simple_message.event.boolean_value = false;
+
+    uint8_t payload[256] = {0};
+    json::serialize(&message, payload, sizeof(payload));
+    ck_assert_str_eq((char*)payload,
+            "{\"name\":\"door_status\",\"value\":\"driver\",\"event\":false}");
+}
+END_TEST
+
+START_TEST (test_serialize_escaped_string)
+{
+    openxc_VehicleMessage message = {0};
+    message.has_type = true;
+    message.type = openxc_VehicleMessage_Type_COMMAND_RESPONSE;
+    message.has_command_response = true;
+    message.command_response.has_type = true;
+    message.command_response.type = openxc_ControlCommand_Type_VERSION;
+    message.command_response.has_message = true;
+    strcpy(message.command_response.message, "a \"b\"\\c\n\t\x01/");
+
+    uint8_t payload[256] = {0};
+    json::serialize(&message, payload, sizeof(payload));
+    ck_assert_str_eq((char*)payload, "{\"command_response\":\"version\","
+            "\"message\":\"a \\\"b\\\"\\\\c\\n\\t\\u0001/\"}");
+}
+END_TEST
+
+START_TEST (test_serialize_can)
+{
+    openxc_VehicleMessage message = {0};
+    message.has_type = true;
+    message.type = openxc_VehicleMessage_Type_CAN;
+    message.has_can_message = true;
+    message.can_message.has_bus = true;
+    message.can_message.bus = 1;
+    message.can_message.has_id = true;
+    message.can_message.id = 0x80000000;
+    message.can_message.has_data = true;
+    message.can_message.data.size = 3;
+    message.can_message.data.bytes[0] = 0x12;
+    message.can_message.data.bytes[1] = 0xab;
+    message.can_message.data.bytes[2] = 0x0;
+    message.can_message.has_frame_format = true;
+    message.can_message.frame_format = openxc_CanMessage_FrameFormat_EXTENDED;
+
+    uint8_t payload[256] = {0};
+    json::serialize(&message, payload, sizeof(payload));
+    ck_assert_str_eq((char*)payload, "{\"bus\":1,\"id\":2147483648,"
+            "\"data\":\"0x12ab00\",\"frame_format\":\"extended\"}");
+}
+END_TEST
+
+START_TEST (test_serialize_diagnostic)
+{
+    openxc_VehicleMessage message = {0};
+    message.has_type = true;
+    message.type = openxc_VehicleMessage_Type_DIAGNOSTIC;
+    message.has_diagnostic_response = true;
+    message.diagnostic_response.bus = 1;
+    message.diagnostic_response.message_id = 0x7e8;
+    message.diagnostic_response.mode = 1;
+    message.diagnostic_response.has_pid = true;
+    message.diagnostic_response.pid = 0xc;
+    message.diagnostic_response.success = false;
+    message.diagnostic_response.has_negative_response_code = true;
+    message.diagnostic_response.negative_response_code = 0x31;
+    message.diagnostic_response.has_payload = true;
+    message.diagnostic_response.payload.size = 2;
+    message.diagnostic_response.payload.bytes[0] = 0x1;
+    message.diagnostic_response.payload.bytes[1] = 0xff;
+
+    uint8_t payload[256] = {0};
+    json::serialize(&message, payload, sizeof(payload));
+    ck_assert_str_eq((char*)payload, "{\"bus\":1,\"id\":2024,\"mode\":1,"
+            "\"success\":false,\"pid\":12,\"negative_response_code\":49,"
+            "\"payload\":\"0x01ff\"}");
+
+    message.diagnostic_response.has_value = true;
+    message.diagnostic_response.value = 0.25;
+    json::serialize(&message, payload, sizeof(payload));
+    ck_assert_str_eq((char*)payload, "{\"bus\":1,\"id\":2024,\"mode\":1,"
+            "\"success\":false,\"pid\":12,\"negative_response_code\":49,"
+            "\"value\":0.250000}");
+}
+END_TEST
+
+START_TEST (test_serialize_unknown_command_response)
+{
+    openxc_VehicleMessage message = {0};
+    message.has_type = true;
+    message.type = openxc_VehicleMessage_Type_COMMAND_RESPONSE;
+    message.has_command_response = true;
+    message.command_response.has_type = true;
+    message.command_response.type = (openxc_ControlCommand_Type) 100;
+
+    uint8_t payload[256] = {0};
+    ck_assert_int_eq(json::serialize(&message, payload, sizeof(payload)), 0);
+}
+END_TEST
+
+START_TEST (test_serialize_truncated)
+{
+    openxc_VehicleMessage message = {0};
+    message.has_type = true;
+    message.type = openxc_VehicleMessage_Type_CAN;
+    message.has_can_message = true;
+    message.can_message.bus = 1;
+    message.can_message.id = 42;
+    message.can_message.data.size = 1;
+
+    uint8_t payload[8];
+    memset(payload, 'x', sizeof(payload));
+    ck_assert_int_eq(json::serialize(&message, payload, 4), 4);
+    ck_assert(!memcmp(payload, "{\"buxxxx", sizeof(payload)));
+}
+END_TEST
+
 START_TEST (test_deserialize_can_message_write)
 {
     uint8_t rawRequest[] = "{\"bus\": 1, \"id\": 42, \"data\": \"0x1234\"}\0";
@@ -173,6 +382,108 @@ START_TEST (test_deserialize_message_after_junk)
 }
 END_TEST
 
+START_TEST (test_deserialize_diagnostic_request)
+{
+    uint8_t rawRequest[] = "{\"command\": \"diagnostic_request\", "
+            "\"action\": \"add\", \"request\": {\"bus\": 1, \"id\": 2016, "
+            "\"mode\": 1, \"pid\": 12, \"payload\": \"0x1234\", "
+            "\"multiple_responses\": true, \"frequency\": 0.5, "
+            "\"decoded_type\": \"obd2\", \"name\": \"rpm\"}}";
+    openxc_VehicleMessage deserialized = {0};
+    ck_assert_int_eq(json::deserialize(rawRequest, sizeof(rawRequest),
+                &deserialized), sizeof(rawRequest));
+    ck_assert(validate(&deserialized));
+
+    openxc_DiagnosticControlCommand* command =
+            &deserialized.control_command.diagnostic_request;
+    ck_assert_int_eq(command->action, openxc_DiagnosticControlCommand_Action_ADD);
+    ck_assert_int_eq(command->request.bus, 1);
+    ck_assert_int_eq(command->request.message_id, 2016);
+    ck_assert_int_eq(command->request.mode, 1);
+    ck_assert_int_eq(command->request.pid, 12);
+    ck_assert_int_eq(command->request.payload.size, 2);
+    ck_assert_int_eq(command->request.payload.bytes[0], 0x12);
+    ck_assert_int_eq(command->request.payload.bytes[1], 0x34);
+    ck_assert(command->request.multiple_responses);
+    ck_assert(command->request.frequency == 0.5);
+    ck_assert_int_eq(command->request.decoded_type,
+            openxc_DiagnosticRequest_DecodedType_OBD2);
+    ck_assert_str_eq(command->request.name, "rpm");
+}
+END_TEST
+
+START_TEST (test_deserialize_field_names_ignore_case)
+{
+    uint8_t rawRequest[] = "{\"BUS\": 1, \"Id\": 42, \"data\": \"0x1234\"}";
+    openxc_VehicleMessage deserialized = {0};
+    json::deserialize(rawRequest, sizeof(rawRequest), &deserialized);
+    ck_assert(validate(&deserialized));
+    ck_assert_int_eq(deserialized.can_message.bus, 1);
+    ck_assert_int_eq(deserialized.can_message.id, 42);
+}
+END_TEST
+
+START_TEST (test_deserialize_simple_escaped_string)
+{
+    uint8_t rawRequest[] = "{\"name\": \"turn_signal_status\", "
+            "\"value\": \"le\\\"ft\\u00e9\"}";
+    openxc_VehicleMessage deserialized = {0};
+    json::deserialize(rawRequest, sizeof(rawRequest), &deserialized);
+    ck_assert(validate(&deserialized));
+    ck_assert_str_eq(deserialized.simple_message.name, "turn_signal_status");
+    ck_assert_str_eq(deserialized.simple_message.value.string_value,
+            "le\"ft\xc3\xa9");
+}
+END_TEST
+
+START_TEST (test_deserialize_malformed)
+{
+    uint8_t rawRequest[] = "{\"bus\": 1, \"id\": 42,, \"data\": \"0x1234\"}";
+    openxc_VehicleMessage deserialized = {0};
+    ck_assert_int_eq(json::deserialize(rawRequest, sizeof(rawRequest),
+                &deserialized), 0);
+    ck_assert(!validate(&deserialized));
+}
+END_TEST
+
+START_TEST (test_deserialize_command_name_not_string)
+{
+    uint8_t rawRequest[] = "{\"command\": 42}";
+    openxc_VehicleMessage deserialized = {0};
+    ck_assert_int_eq(json::deserialize(rawRequest, sizeof(rawRequest),
+                &deserialized), sizeof(rawRequest));
+    ck_assert(!validate(&deserialized));
+}
+END_TEST
+
+START_TEST (test_deserialize_too_many_tokens)
+{
+    std::string request = "{\"bus\": 1, \"id\": 42, \"data\": \"0x1234\", "
+            "\"extra\": [";
+    for(int i = 0; i < MAX_JSON_TOKENS; i++) {
+        request += i > 0 ? ", 1" : "1";
+    }
+    request += "]}";
+
+    openxc_VehicleMessage deserialized = {0};
+    ck_assert_int_eq(json::deserialize((uint8_t*)request.c_str(),
+                request.length() + 1, &deserialized), request.length() + 1);
+    ck_assert(!validate(&deserialized));
+}
+END_TEST
+
+START_TEST (test_deserialize_raw_can_payload_format)
+{
+    uint8_t rawRequest[] = "{\"command\": \"payload_format\", "
+            "\"format\": \"raw_can\"}";
+    openxc_VehicleMessage deserialized = {0};
+    json::deserialize(rawRequest, sizeof(rawRequest), &deserialized);
+    ck_assert(validate(&deserialized));
+    ck_assert_int_eq(deserialized.control_command.payload_format_command.format,
+            PAYLOAD_FORMAT_COMMAND_RAW_CAN);
+}
+END_TEST
+
 Suite* suite(void) {
     Suite* s = suite_create("json_payload");
     TCase *tc_json_payload = tcase_create("json_payload");
@@ -185,9 +496,24 @@ Suite* suite(void) {
     tcase_add_test(tc_json_payload, test_payload_format_request);
     tcase_add_test(tc_json_payload, test_predefined_obd2_requests_response);
     tcase_add_test(tc_json_payload, test_predefined_obd2_requests_request);
+    tcase_add_test(tc_json_payload, test_serialize_simple);
+    tcase_add_test(tc_json_payload, test_serialize_decimal_places);
+    tcase_add_test(tc_json_payload, test_serialize_simple_with_event);
+    tcase_add_test(tc_json_payload, test_serialize_escaped_string);
+    tcase_add_test(tc_json_payload, test_serialize_can);
+    tcase_add_test(tc_json_payload, test_serialize_diagnostic);
+    tcase_add_test(tc_json_payload, test_serialize_unknown_command_response);
+    tcase_add_test(tc_json_payload, test_serialize_truncated);
     tcase_add_test(tc_json_payload, test_deserialize_can_message_write);
     tcase_add_test(tc_json_payload, test_deserialize_can_message_write_with_format);
     tcase_add_test(tc_json_payload, test_deserialize_message_after_junk);
+    tcase_add_test(tc_json_payload, test_deserialize_diagnostic_request);
+    tcase_add_test(tc_json_payload, test_deserialize_field_names_ignore_case);
+    tcase_add_test(tc_json_payload, test_deserialize_simple_escaped_string);
+    tcase_add_test(tc_json_payload, test_deserialize_malformed);
+    tcase_add_test(tc_json_payload, test_deserialize_command_name_not_string);
+    tcase_add_test(tc_json_payload, test_deserialize_too_many_tokens);
+    tcase_add_test(tc_json_payload, test_deserialize_raw_can_payload_format);
     suite_add_tcase(s, tc_json_payload);
 
     return s;
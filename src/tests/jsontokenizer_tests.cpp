@@ -0,0 +1,226 @@
+#include <check.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util/jsontokenizer.h"
+
+namespace jsontokenizer = openxc::util::jsontokenizer;
+
+using openxc::util::jsontokenizer::JsonToken;
+using openxc::util::jsontokenizer::JsonTokenType;
+
+JsonToken tokens[MAX_JSON_TOKENS];
+
+static int tokenize(const char* json) {
+    return jsontokenizer::tokenize(json, strlen(json), tokens, MAX_JSON_TOKENS);
+}
+
+void setup() {
+    memset(tokens, 0, sizeof(tokens));
+}
+
+void teardown() {
+}
+
+START_TEST (test_tokenize_object)
+{
+    const char* json = "{\"bus\": 1, \"data\": \"0x12\"}";
+    ck_assert_int_eq(tokenize(json), 5);
+    ck_assert_int_eq(tokens[0].type, JsonTokenType::OBJECT);
+    ck_assert_int_eq(tokens[0].start, 0);
+    ck_assert_int_eq(tokens[0].end, strlen(json));
+    ck_assert_int_eq(tokens[1].type, JsonTokenType::STRING);
+    ck_assert(!strncmp(&json[tokens[1].start], "bus",
+                tokens[1].end - tokens[1].start));
+    ck_assert_int_eq(tokens[2].type, JsonTokenType::PRIMITIVE);
+    ck_assert(!strncmp(&json[tokens[2].start], "1",
+                tokens[2].end - tokens[2].start));
+    ck_assert_int_eq(tokens[4].type, JsonTokenType::STRING);
+    ck_assert(!strncmp(&json[tokens[4].start], "0x12",
+                tokens[4].end - tokens[4].start));
+}
+END_TEST
+
+START_TEST (test_tokenize_nested)
+{
+    const char* json = "{\"request\": {\"id\": [1, true, null]}, \"a\": {}}";
+    ck_assert_int_eq(tokenize(json), 10);
+    ck_assert_int_eq(tokens[2].type, JsonTokenType::OBJECT);
+    ck_assert_int_eq(tokens[4].type, JsonTokenType::ARRAY);
+    ck_assert_int_eq(tokens[9].type, JsonTokenType::OBJECT);
+    ck_assert_int_eq(tokens[9].end - tokens[9].start, 2);
+}
+END_TEST
+
+START_TEST (test_next_sibling)
+{
+    const char* json = "{\"request\": {\"id\": [1, true, null]}, \"a\": {}}";
+    int count = tokenize(json);
+    // The value of request is skipped along with everything inside it
+    ck_assert_int_eq(jsontokenizer::nextSibling(tokens, count, 2), 8);
+    // Each element of the array
+    ck_assert_int_eq(jsontokenizer::nextSibling(tokens, count, 5), 6);
+    ck_assert_int_eq(jsontokenizer::nextSibling(tokens, count, 0), count);
+}
+END_TEST
+
+START_TEST (test_tokenize_ignores_trailing_text)
+{
+    ck_assert_int_eq(tokenize("{\"a\": -1.5e3}junk"), 3);
+    ck_assert_int_eq(tokenize("  {}"), 1);
+}
+END_TEST
+
+START_TEST (test_tokenize_invalid)
+{
+    ck_assert_int_eq(tokenize("[1]"), JSON_ERROR_INVALID);
+    ck_assert_int_eq(tokenize("\"a\""), JSON_ERROR_INVALID);
+    ck_assert_int_eq(tokenize("{\"a\" 1}"), JSON_ERROR_INVALID);
+    ck_assert_int_eq(tokenize("{\"a\": 1,}"), JSON_ERROR_INVALID);
+    ck_assert_int_eq(tokenize("{1: 1}"), JSON_ERROR_INVALID);
+    ck_assert_int_eq(tokenize("{\"a\": tru}"), JSON_ERROR_INVALID);
+    ck_assert_int_eq(tokenize("{\"a\": 1.}"), JSON_ERROR_INVALID);
+    ck_assert_int_eq(tokenize("{\"a\": [1}"), JSON_ERROR_INVALID);
+    ck_assert_int_eq(tokenize("{\"a\": 1]"), JSON_ERROR_INVALID);
+}
+END_TEST
+
+START_TEST (test_tokenize_incomplete)
+{
+    ck_assert_int_eq(tokenize(""), JSON_ERROR_INCOMPLETE);
+    ck_assert_int_eq(tokenize("{\"a\": 1"), JSON_ERROR_INCOMPLETE);
+    ck_assert_int_eq(tokenize("{\"a\": 12"), JSON_ERROR_INCOMPLETE);
+    ck_assert_int_eq(tokenize("{\"a\": \"b\\\"}"), JSON_ERROR_INCOMPLETE);
+}
+END_TEST
+
+START_TEST (test_tokenize_too_deep)
+{
+    ck_assert_int_eq(tokenize("{\"a\": [[[[[[[1]]]]]]]}"), 10);
+    ck_assert_int_eq(tokenize("{\"a\": [[[[[[[[1]]]]]]]]}"),
+            JSON_ERROR_INVALID);
+}
+END_TEST
+
+START_TEST (test_tokenize_too_many_tokens)
+{
+    const char* json = "{\"a\": 1, \"b\": 2}";
+    ck_assert_int_eq(jsontokenizer::tokenize(json, strlen(json), tokens, 5),
+            5);
+    ck_assert_int_eq(jsontokenizer::tokenize(json, strlen(json), tokens, 4),
+            JSON_ERROR_TOO_MANY_TOKENS);
+}
+END_TEST
+
+START_TEST (test_find_field)
+{
+    const char* json = "{\"request\": {\"bus\": 2}, \"BUS\": 1, \"bus\": 3}";
+    int count = tokenize(json);
+    // The nested field isn't a match and the first match wins, ignoring case
+    int bus = jsontokenizer::findField(json, tokens, count, 0, "bus");
+    ck_assert_int_eq(jsontokenizer::toInt(json, &tokens[bus]), 1);
+
+    int request = jsontokenizer::findField(json, tokens, count, 0, "request");
+    bus = jsontokenizer::findField(json, tokens, count, request, "bus");
+    ck_assert_int_eq(jsontokenizer::toInt(json, &tokens[bus]), 2);
+
+    ck_assert_int_eq(jsontokenizer::findField(json, tokens, count, 0, "bu"),
+            NO_JSON_TOKEN);
+    ck_assert_int_eq(jsontokenizer::findField(json, tokens, count, bus, "bus"),
+            NO_JSON_TOKEN);
+}
+END_TEST
+
+START_TEST (test_value_types)
+{
+    const char* json = "{\"a\": true, \"b\": false, \"c\": null, \"d\": \"1\", "
+            "\"e\": -3.75}";
+    tokenize(json);
+    ck_assert(jsontokenizer::isBoolean(json, &tokens[2]));
+    ck_assert_int_eq(jsontokenizer::toInt(json, &tokens[2]), 1);
+    ck_assert(jsontokenizer::isBoolean(json, &tokens[4]));
+    ck_assert_int_eq(jsontokenizer::toInt(json, &tokens[4]), 0);
+    ck_assert(!jsontokenizer::isBoolean(json, &tokens[6]));
+    ck_assert(!jsontokenizer::isNumber(json, &tokens[6]));
+    ck_assert(jsontokenizer::isString(&tokens[8]));
+    ck_assert_int_eq(jsontokenizer::toInt(json, &tokens[8]), 0);
+    ck_assert(jsontokenizer::isNumber(json, &tokens[10]));
+    ck_assert(jsontokenizer::toDouble(json, &tokens[10]) == -3.75);
+    ck_assert_int_eq(jsontokenizer::toInt(json, &tokens[10]), -3);
+}
+END_TEST
+
+START_TEST (test_to_double)
+{
+    const char* numbers[] = {"0", "-0", "42", "0.5", "123.456", "1e3",
+            "2.5E-2", "-7e+2", "4294967295"};
+    char json[64];
+    for(size_t i = 0; i < sizeof(numbers) / sizeof(numbers[0]); i++) {
+        snprintf(json, sizeof(json), "{\"a\": %s}", numbers[i]);
+        ck_assert_int_eq(tokenize(json), 3);
+        ck_assert(jsontokenizer::toDouble(json, &tokens[2]) ==
+                strtod(numbers[i], NULL));
+    }
+}
+END_TEST
+
+START_TEST (test_copy_string)
+{
+    const char* json = "{\"a\": \"q\\\"b\\\\s\\/n\\nt\\t\", "
+            "\"b\": \"\\u00e9\\u20ac\\ud83d\\ude00\"}";
+    tokenize(json);
+    char text[32];
+    ck_assert(jsontokenizer::copyString(json, &tokens[2], text, sizeof(text)));
+    ck_assert_str_eq(text, "q\"b\\s/n\nt\t");
+    ck_assert(jsontokenizer::copyString(json, &tokens[4], text, sizeof(text)));
+    ck_assert_str_eq(text, "\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80");
+}
+END_TEST
+
+START_TEST (test_copy_string_truncated)
+{
+    const char* json = "{\"a\": \"abcdef\", \"b\": 1}";
+    tokenize(json);
+    char text[4];
+    ck_assert(!jsontokenizer::copyString(json, &tokens[2], text, sizeof(text)));
+    ck_assert_str_eq(text, "abc");
+    ck_assert(!jsontokenizer::copyString(json, &tokens[4], text, sizeof(text)));
+    ck_assert_str_eq(text, "");
+}
+END_TEST
+
+Suite* suite(void) {
+    Suite* s = suite_create("jsontokenizer");
+    TCase *tc_core = tcase_create("core");
+    tcase_add_checked_fixture (tc_core, setup, teardown);
+    tcase_add_test(tc_core, test_tokenize_object);
+    tcase_add_test(tc_core, test_tokenize_nested);
+    tcase_add_test(tc_core, test_next_sibling);
+    tcase_add_test(tc_core, test_tokenize_ignores_trailing_text);
+    tcase_add_test(tc_core, test_tokenize_invalid);
+    tcase_add_test(tc_core, test_tokenize_incomplete);
+    tcase_add_test(tc_core, test_tokenize_too_deep);
+    tcase_add_test(tc_core, test_tokenize_too_many_tokens);
+    tcase_add_test(tc_core, test_find_field);
+    tcase_add_test(tc_core, test_value_types);
+    tcase_add_test(tc_core, test_to_double);
+    tcase_add_test(tc_core, test_copy_string);
+    tcase_add_test(tc_core, test_copy_string_truncated);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void) {
+    int numberFailed;
+    Suite* s = suite();
+    SRunner *sr = srunner_create(s);
+    // Don't fork so we can actually use gdb
+    srunner_set_fork_status(sr, CK_NOFORK);
+    srunner_run_all(sr, CK_NORMAL);
+    numberFailed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (numberFailed == 0) ? 0 : 1;
+}
@@ -0,0 +1,155 @@
+#include <check.h>
+#include <stdint.h>
+
+#include "util/metrics.h"
+#include "config.h"
+#include "signals.h"
+
+namespace metrics = openxc::util::metrics;
+namespace statistics = openxc::util::statistics;
+
+using openxc::util::metrics::Metric;
+using openxc::util::statistics::Histogram;
+using openxc::config::getConfiguration;
+using openxc::signals::getCanBuses;
+
+unsigned int COUNTER;
+
+static int readGauge(void* context) {
+    return *(int*)context;
+}
+
+void setup() {
+    metrics::initialize();
+    COUNTER = 0;
+}
+
+void teardown() {
+}
+
+START_TEST (test_register_counter)
+{
+    ck_assert(metrics::registerCounter("test", NO_METRIC_INSTANCE, "counter",
+                &COUNTER));
+    ck_assert_int_eq(metrics::getMetricCount(), 1);
+
+    const Metric* metric = metrics::lookupMetric("test", NO_METRIC_INSTANCE,
+            "counter");
+    ck_assert(metric != NULL);
+    ck_assert_int_eq(metrics::read(metric), 0);
+    // The registry reads the counter itself, it doesn't need to be told
+    COUNTER += 42;
+    ck_assert_int_eq(metrics::read(metric), 42);
+}
+END_TEST
+
+START_TEST (test_register_gauge_and_histogram)
+{
+    int gauge = -3;
+    Histogram histogram;
+    statistics::initialize(&histogram);
+    statistics::update(&histogram, 10);
+    statistics::update(&histogram, 20);
+
+    ck_assert(metrics::registerGauge("test", 2, "gauge", readGauge, &gauge));
+    ck_assert(metrics::registerHistogram("test", NO_METRIC_INSTANCE,
+                "histogram", &histogram));
+    ck_assert_int_eq(metrics::read(metrics::lookupMetric("test", 2,
+                    "gauge")), -3);
+    ck_assert_int_eq(metrics::read(metrics::lookupMetric("test",
+                    NO_METRIC_INSTANCE, "histogram")), 2);
+    ck_assert(metrics::lookupMetric("test", NO_METRIC_INSTANCE,
+                "gauge") == NULL);
+}
+END_TEST
+
+START_TEST (test_register_replaces)
+{
+    unsigned int other = 7;
+    metrics::registerCounter("test", NO_METRIC_INSTANCE, "counter", &COUNTER);
+    metrics::registerCounter("test", NO_METRIC_INSTANCE, "counter", &other);
+    ck_assert_int_eq(metrics::getMetricCount(), 1);
+    ck_assert_int_eq(metrics::read(metrics::getMetric(0)), 7);
+    ck_assert(metrics::getMetric(1) == NULL);
+}
+END_TEST
+
+START_TEST (test_registry_full)
+{
+    static char names[MAX_METRICS][8];
+    for(int i = 0; i < MAX_METRICS; i++) {
+        sprintf(names[i], "m%d", i);
+        ck_assert(metrics::registerCounter("test", NO_METRIC_INSTANCE,
+                    names[i], &COUNTER));
+    }
+    ck_assert(!metrics::registerCounter("test", NO_METRIC_INSTANCE, "extra",
+                &COUNTER));
+    ck_assert_int_eq(metrics::getMetricCount(), MAX_METRICS);
+}
+END_TEST
+
+START_TEST (test_format_name)
+{
+    char name[32];
+    metrics::registerCounter("can", 1, "messages_received", &COUNTER);
+    metrics::registerCounter("USB", NO_METRIC_INSTANCE, "messages_sent",
+            &COUNTER);
+    ck_assert_int_eq(metrics::formatName(metrics::getMetric(0), name,
+                sizeof(name)), 22);
+    ck_assert_str_eq(name, "can1.messages_received");
+    metrics::formatName(metrics::getMetric(1), name, sizeof(name));
+    ck_assert_str_eq(name, "USB.messages_sent");
+
+    ck_assert_int_eq(metrics::formatName(metrics::getMetric(0), name, 10), -1);
+}
+END_TEST
+
+START_TEST (test_modules_register_metrics)
+{
+    openxc::pipeline::initialize(&getConfiguration()->pipeline);
+    openxc::can::initializeCommon(&getCanBuses()[0]);
+
+    const Metric* received = metrics::lookupMetric("can",
+            getCanBuses()[0].address, "messages_received");
+    ck_assert(received != NULL);
+    getCanBuses()[0].messagesReceived = 12;
+    ck_assert_int_eq(metrics::read(received), 12);
+
+    ck_assert(metrics::lookupMetric("USB", NO_METRIC_INSTANCE,
+                "messages_sent") != NULL);
+    ck_assert(metrics::lookupMetric("pipeline", NO_METRIC_INSTANCE,
+                "flush_time_us") != NULL);
+
+    // Initializing again doesn't add duplicates
+    int count = metrics::getMetricCount();
+    openxc::pipeline::initialize(&getConfiguration()->pipeline);
+    ck_assert_int_eq(metrics::getMetricCount(), count);
+}
+END_TEST
+
+Suite* suite(void) {
+    Suite* s = suite_create("metrics");
+    TCase *tc_core = tcase_create("core");
+    tcase_add_checked_fixture (tc_core, setup, teardown);
+    tcase_add_test(tc_core, test_register_counter);
+    tcase_add_test(tc_core, test_register_gauge_and_histogram);
+    tcase_add_test(tc_core, test_register_replaces);
+    tcase_add_test(tc_core, test_registry_full);
+    tcase_add_test(tc_core, test_format_name);
+    tcase_add_test(tc_core, test_modules_register_metrics);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void) {
+    int numberFailed;
+    Suite* s = suite();
+    SRunner *sr = srunner_create(s);
+    // Don't fork so we can actually use gdb
+    srunner_set_fork_status(sr, CK_NOFORK);
+    srunner_run_all(sr, CK_NORMAL);
+    numberFailed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (numberFailed == 0) ? 0 : 1;
+}
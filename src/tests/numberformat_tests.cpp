@@ -0,0 +1,161 @@
+#include <check.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "util/numberformat.h"
+
+namespace numberformat = openxc::util::numberformat;
+
+void setup() {
+}
+
+void teardown() {
+}
+
+START_TEST (test_format_integer)
+{
+    char text[MAX_FORMATTED_NUMBER_LENGTH];
+    ck_assert_int_eq(numberformat::formatInteger(0, text, sizeof(text)), 1);
+    ck_assert_str_eq(text, "0");
+    numberformat::formatInteger(-42, text, sizeof(text));
+    ck_assert_str_eq(text, "-42");
+    numberformat::formatInteger(INT_MAX, text, sizeof(text));
+    ck_assert_str_eq(text, "2147483647");
+    numberformat::formatInteger(INT_MIN, text, sizeof(text));
+    ck_assert_str_eq(text, "-2147483648");
+}
+END_TEST
+
+START_TEST (test_format_integer_too_long)
+{
+    char text[4];
+    ck_assert_int_eq(numberformat::formatInteger(999, text, sizeof(text)), 3);
+    ck_assert_int_eq(numberformat::formatInteger(1000, text, sizeof(text)), -1);
+}
+END_TEST
+
+START_TEST (test_format_decimal)
+{
+    char text[MAX_FORMATTED_NUMBER_LENGTH];
+    ck_assert_int_eq(numberformat::formatDecimal(42.5, 6, text, sizeof(text)),
+            9);
+    ck_assert_str_eq(text, "42.500000");
+    numberformat::formatDecimal(-0.25, 1, text, sizeof(text));
+    ck_assert_str_eq(text, "-0.2");
+    numberformat::formatDecimal(0.75, 1, text, sizeof(text));
+    ck_assert_str_eq(text, "0.8");
+    numberformat::formatDecimal(9.96, 1, text, sizeof(text));
+    ck_assert_str_eq(text, "10.0");
+    numberformat::formatDecimal(12.5, 0, text, sizeof(text));
+    ck_assert_str_eq(text, "12");
+    numberformat::formatDecimal(0.001, 2, text, sizeof(text));
+    ck_assert_str_eq(text, "0.00");
+}
+END_TEST
+
+START_TEST (test_format_decimal_matches_printf)
+{
+    char expected[MAX_FORMATTED_NUMBER_LENGTH];
+    char actual[MAX_FORMATTED_NUMBER_LENGTH];
+    srand(42);
+    for(int i = 0; i < 100000; i++) {
+        // A mix of magnitudes, including ones that aren't floats and ones too
+        // big for the fast path
+        double value = (rand() - RAND_MAX / 2) / (double)(1 << (rand() % 24));
+        if(i % 3 == 0) {
+            value = (float) value;
+        } else if(i % 7 == 0) {
+            value *= 1e6;
+        }
+        int decimalPlaces = i % (MAX_DECIMAL_PLACES + 1);
+        snprintf(expected, sizeof(expected), "%.*f", decimalPlaces, value);
+        ck_assert_int_eq(numberformat::formatDecimal(value, decimalPlaces,
+                    actual, sizeof(actual)), strlen(expected));
+        ck_assert_str_eq(actual, expected);
+    }
+}
+END_TEST
+
+START_TEST (test_format_decimal_invalid)
+{
+    char text[MAX_FORMATTED_NUMBER_LENGTH];
+    ck_assert_int_eq(numberformat::formatDecimal(1.5, -1, text, sizeof(text)),
+            -1);
+    ck_assert_int_eq(numberformat::formatDecimal(1.5, MAX_DECIMAL_PLACES + 1,
+                text, sizeof(text)), -1);
+    ck_assert_int_eq(numberformat::formatDecimal(1.5, 6, text, 8), -1);
+}
+END_TEST
+
+START_TEST (test_format_shortest)
+{
+    char text[MAX_FORMATTED_NUMBER_LENGTH];
+    numberformat::formatShortest(42.5, text, sizeof(text));
+    ck_assert_str_eq(text, "42.5");
+    numberformat::formatShortest(-0.125, text, sizeof(text));
+    ck_assert_str_eq(text, "-0.125");
+    numberformat::formatShortest(0.1, text, sizeof(text));
+    ck_assert_str_eq(text, "0.1");
+    numberformat::formatShortest(7, text, sizeof(text));
+    ck_assert_str_eq(text, "7");
+    // The float 0.1 isn't the double 0.1, but it's the float parsed from "0.1"
+    numberformat::formatShortest(0.1f, text, sizeof(text));
+    ck_assert_str_eq(text, "0.1");
+    numberformat::formatShortest(-1234.5678f, text, sizeof(text));
+    ck_assert_str_eq(text, "-1234.5677");
+    numberformat::formatShortest(16777217.0, text, sizeof(text));
+    ck_assert_str_eq(text, "16777217");
+}
+END_TEST
+
+START_TEST (test_format_shortest_round_trips)
+{
+    char text[MAX_FORMATTED_NUMBER_LENGTH];
+    srand(42);
+    for(int i = 0; i < 100000; i++) {
+        double value = (rand() - RAND_MAX / 2) / (double)(1 << (rand() % 24));
+        if(i % 2 == 0) {
+            value = (float) value;
+        } else if(i % 5 == 0) {
+            value /= 1000;
+        }
+        ck_assert(numberformat::formatShortest(value, text, sizeof(text)) > 0);
+        if(value == (float) value) {
+            ck_assert(strtof(text, NULL) == (float) value);
+        } else {
+            ck_assert(strtod(text, NULL) == value);
+        }
+    }
+}
+END_TEST
+
+Suite* suite(void) {
+    Suite* s = suite_create("numberformat");
+    TCase *tc_core = tcase_create("core");
+    tcase_add_checked_fixture (tc_core, setup, teardown);
+    tcase_add_test(tc_core, test_format_integer);
+    tcase_add_test(tc_core, test_format_integer_too_long);
+    tcase_add_test(tc_core, test_format_decimal);
+    tcase_add_test(tc_core, test_format_decimal_matches_printf);
+    tcase_add_test(tc_core, test_format_decimal_invalid);
+    tcase_add_test(tc_core, test_format_shortest);
+    tcase_add_test(tc_core, test_format_shortest_round_trips);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void) {
+    int numberFailed;
+    Suite* s = suite();
+    SRunner *sr = srunner_create(s);
+    // Don't fork so we can actually use gdb
+    srunner_set_fork_status(sr, CK_NOFORK);
+    srunner_run_all(sr, CK_NORMAL);
+    numberFailed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (numberFailed == 0) ? 0 : 1;
+}
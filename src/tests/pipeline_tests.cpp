@@ -3,6 +3,10 @@
 #include "pipeline.h"
 #include "emqueue.h"
 #include "config.h"
+#include "can/canread.h"
+#include "signals.h"
+#include "payload/rawcan.h"
+#include "util/numberformat.h"
 
 namespace uart = openxc::interface::uart;
 namespace network = openxc::interface::network;
@@ -10,7 +14,16 @@ namespace usb = openxc::interface::usb;
 
 using openxc::pipeline::Pipeline;
 using openxc::pipeline::MessageClass;
+using openxc::pipeline::PipelineEndpoint;
+using openxc::pipeline::SubscriptionMode;
+using openxc::pipeline::PipelineLane;
+using openxc::pipeline::DropPolicy;
+using openxc::pipeline::PayloadHeader;
+using openxc::payload::PayloadFormat;
+using openxc::interface::InterfaceType;
 using openxc::config::getConfiguration;
+using openxc::signals::getSignalCount;
+using openxc::signals::getSignals;
 
 QUEUE_TYPE(uint8_t)* OUTPUT_QUEUE = &getConfiguration()->usb.endpoints[IN_ENDPOINT_INDEX].queue;
 QUEUE_TYPE(uint8_t)* LOG_QUEUE = &getConfiguration()->usb.endpoints[LOG_ENDPOINT_INDEX].queue;
@@ -18,15 +31,81 @@ QUEUE_TYPE(uint8_t)* LOG_QUEUE = &getConfiguration()->usb.endpoints[LOG_ENDPOINT
 extern bool USB_PROCESSED;
 extern bool UART_PROCESSED;
 extern bool NETWORK_PROCESSED;
+extern unsigned long FAKE_TIME;
+extern unsigned int droppedMessagesByClass[MAX_PIPELINE_ENDPOINTS][
+        MESSAGE_CLASS_COUNT];
+
+/* A pipeline endpoint that records what it's sent, in place of a real
+ * interface.
+ */
+typedef struct {
+    bool connected;
+    bool full;
+    uint8_t received[MAX_OUTGOING_PAYLOAD_SIZE];
+    int receivedLength;
+    int messagesReceived;
+    int flushes;
+} RecordingSink;
+
+RecordingSink SINK;
+
+static bool sinkConnected(PipelineEndpoint* endpoint) {
+    return ((RecordingSink*)endpoint->context)->connected;
+}
+
+static bool sinkFits(PipelineEndpoint* endpoint, MessageClass messageClass,
+        uint8_t* message, int messageSize) {
+    return !((RecordingSink*)endpoint->context)->full;
+}
+
+static bool sinkEnqueue(PipelineEndpoint* endpoint, MessageClass messageClass,
+        uint8_t* message, int messageSize) {
+    RecordingSink* sink = (RecordingSink*)endpoint->context;
+    if(sink->full) {
+        return false;
+    }
+    memcpy(sink->received, message, messageSize);
+    sink->receivedLength = messageSize;
+    ++sink->messagesReceived;
+    return true;
+}
+
+static void sinkFlush(PipelineEndpoint* endpoint) {
+    ++((RecordingSink*)endpoint->context)->flushes;
+}
+
+const PipelineEndpoint SINK_ENDPOINT = {
+    name: "SINK",
+    messageClasses: MESSAGE_CLASS_MASK(MessageClass::SIMPLE),
+    overridePayloadFormat: false,
+    payloadFormat: PayloadFormat::JSON,
+    connected: sinkConnected,
+    fits: sinkFits,
+    enqueue: sinkEnqueue,
+    flush: sinkFlush,
+    queuedBytes: NULL,
+    receivedBytes: NULL,
+    context: &SINK,
+};
 
 void setup() {
     getConfiguration()->pipeline.usb = &getConfiguration()->usb;
     getConfiguration()->pipeline.uart = NULL;
     getConfiguration()->pipeline.network = NULL;
+    openxc::pipeline::initialize(&getConfiguration()->pipeline);
+    memset(&SINK, 0, sizeof(SINK));
+    SINK.connected = true;
     usb::initialize(&getConfiguration()->usb);
     uart::initialize(&getConfiguration()->uart);
     network::initialize(&getConfiguration()->network);
     getConfiguration()->usb.configured = true;
+    getConfiguration()->dropPolicy = DropPolicy::DROP_NEWEST;
+    getConfiguration()->pipelineFlushBudgetUs = 1000;
+    getConfiguration()->payloadFormat = PayloadFormat::JSON;
+    getConfiguration()->batchSize = 0;
+    getConfiguration()->deferSerialization = true;
+    getConfiguration()->jsonDecimalPlaces = 6;
+    getSignals()[0].hasDecimalPlaces = false;
     USB_PROCESSED = false;
     UART_PROCESSED = false;
     NETWORK_PROCESSED = false;
@@ -158,6 +237,877 @@ START_TEST (test_process_all)
 }
 END_TEST
 
+START_TEST (test_flush_latency)
+{
+    Pipeline* pipeline = &getConfiguration()->pipeline;
+    getConfiguration()->calculateMetrics = true;
+    openxc::util::statistics::initialize(
+            &pipeline->flushLatency[openxc::interface::InterfaceType::USB]);
+
+    const char* message = "message";
+    sendMessage(pipeline, (uint8_t*)message, 8, MessageClass::SIMPLE);
+    unsigned long startTime = FAKE_TIME;
+    FAKE_TIME += 2;
+    process(pipeline);
+    FAKE_TIME = startTime;
+    getConfiguration()->calculateMetrics = false;
+
+    ck_assert(QUEUE_EMPTY(uint8_t, OUTPUT_QUEUE));
+    ck_assert_int_eq(pipeline->flushLatency[
+            openxc::interface::InterfaceType::USB].count, 1);
+    ck_assert_int_eq(openxc::util::statistics::maximum(&pipeline->flushLatency[
+            openxc::interface::InterfaceType::USB]), 2000);
+    ck_assert_int_eq(pipeline->oldestQueuedTime[
+            openxc::interface::InterfaceType::USB], 0);
+}
+END_TEST
+
+static void fillQueue(QUEUE_TYPE(uint8_t)* queue) {
+    for(int i = 0; i < QUEUE_MAX_LENGTH(uint8_t) + 1; i++) {
+        QUEUE_PUSH(uint8_t, queue, (uint8_t) 128);
+    }
+    fail_unless(QUEUE_FULL(uint8_t, queue));
+}
+
+static int payloadsPooled(Pipeline* pipeline) {
+    return pipeline->payloadPool.count;
+}
+
+static PayloadHeader* pooledHeader(Pipeline* pipeline,
+        PayloadReference reference) {
+    return (PayloadHeader*) &pipeline->payloadPool.data[reference.offset];
+}
+
+static char* pooledPayload(Pipeline* pipeline, PayloadReference reference) {
+    return (char*) &pipeline->payloadPool.data[reference.offset +
+            sizeof(PayloadHeader)];
+}
+
+START_TEST (test_full_queue_deferred)
+{
+    Pipeline* pipeline = &getConfiguration()->pipeline;
+    pipeline->uart = &getConfiguration()->uart;
+    fillQueue(&pipeline->uart->sendQueue);
+
+    const char* message = "message";
+    sendMessage(pipeline, (uint8_t*)message, 8, MessageClass::SIMPLE);
+
+    ck_assert(QUEUE_FULL(uint8_t, &pipeline->uart->sendQueue));
+    ck_assert_int_eq(QUEUE_LENGTH(PayloadReference,
+                &pipeline->pendingPayloads[InterfaceType::UART][
+                    PipelineLane::NORMAL_LANE]), 1);
+    ck_assert_int_eq(payloadsPooled(pipeline), 1);
+
+    QUEUE_INIT(uint8_t, &pipeline->uart->sendQueue);
+    process(pipeline);
+
+    uint8_t snapshot[QUEUE_LENGTH(uint8_t, &pipeline->uart->sendQueue)];
+    ck_assert_int_eq(sizeof(snapshot), 8);
+    QUEUE_SNAPSHOT(uint8_t, &pipeline->uart->sendQueue, snapshot,
+            sizeof(snapshot));
+    ck_assert_str_eq((char*)snapshot, "message");
+    ck_assert(QUEUE_EMPTY(PayloadReference,
+                &pipeline->pendingPayloads[InterfaceType::UART][
+                    PipelineLane::NORMAL_LANE]));
+    ck_assert_int_eq(payloadsPooled(pipeline), 0);
+}
+END_TEST
+
+START_TEST (test_deferred_payload_shared)
+{
+    Pipeline* pipeline = &getConfiguration()->pipeline;
+    pipeline->uart = &getConfiguration()->uart;
+    pipeline->network = &getConfiguration()->network;
+    fillQueue(&pipeline->uart->sendQueue);
+    fillQueue(&pipeline->network->sendQueue);
+
+    const char* message = "message";
+    sendMessage(pipeline, (uint8_t*)message, 8, MessageClass::SIMPLE);
+
+    ck_assert_int_eq(payloadsPooled(pipeline), 1);
+    PayloadReference uartReference = QUEUE_PEEK(PayloadReference,
+            &pipeline->pendingPayloads[InterfaceType::UART][
+                    PipelineLane::NORMAL_LANE]);
+    PayloadReference networkReference = QUEUE_PEEK(PayloadReference,
+            &pipeline->pendingPayloads[InterfaceType::NETWORK][
+                    PipelineLane::NORMAL_LANE]);
+    ck_assert_int_eq(uartReference.offset, networkReference.offset);
+    ck_assert_int_eq(pooledHeader(pipeline, uartReference)->length, 8);
+    ck_assert_int_eq(pooledHeader(pipeline, uartReference)->references, 2);
+    ck_assert_str_eq(pooledPayload(pipeline, uartReference), "message");
+}
+END_TEST
+
+START_TEST (test_deferred_keeps_order)
+{
+    Pipeline* pipeline = &getConfiguration()->pipeline;
+    pipeline->uart = &getConfiguration()->uart;
+    fillQueue(&pipeline->uart->sendQueue);
+
+    const char* first = "first";
+    sendMessage(pipeline, (uint8_t*)first, 6, MessageClass::SIMPLE);
+    QUEUE_INIT(uint8_t, &pipeline->uart->sendQueue);
+
+    // There's room now, but the second message must wait behind the first
+    const char* second = "second";
+    sendMessage(pipeline, (uint8_t*)second, 7, MessageClass::SIMPLE);
+    ck_assert(QUEUE_EMPTY(uint8_t, &pipeline->uart->sendQueue));
+    ck_assert_int_eq(QUEUE_LENGTH(PayloadReference,
+                &pipeline->pendingPayloads[InterfaceType::UART][
+                    PipelineLane::NORMAL_LANE]), 2);
+    ck_assert_int_eq(payloadsPooled(pipeline), 2);
+
+    process(pipeline);
+    ck_assert(QUEUE_EMPTY(PayloadReference,
+                &pipeline->pendingPayloads[InterfaceType::UART][
+                    PipelineLane::NORMAL_LANE]));
+    ck_assert_int_eq(payloadsPooled(pipeline), 0);
+
+    uint8_t snapshot[QUEUE_LENGTH(uint8_t, &pipeline->uart->sendQueue)];
+    QUEUE_SNAPSHOT(uint8_t, &pipeline->uart->sendQueue, snapshot,
+            sizeof(snapshot));
+    ck_assert_int_eq(sizeof(snapshot), 13);
+    ck_assert_str_eq((char*)snapshot, "first");
+    ck_assert_str_eq((char*)snapshot + 6, "second");
+}
+END_TEST
+
+START_TEST (test_deferred_dropped_when_disconnected)
+{
+    Pipeline* pipeline = &getConfiguration()->pipeline;
+    pipeline->uart = &getConfiguration()->uart;
+    fillQueue(&pipeline->uart->sendQueue);
+
+    const char* message = "message";
+    sendMessage(pipeline, (uint8_t*)message, 8, MessageClass::SIMPLE);
+    ck_assert_int_eq(payloadsPooled(pipeline), 1);
+
+    pipeline->uart = NULL;
+    process(pipeline);
+    ck_assert(QUEUE_EMPTY(PayloadReference,
+                &pipeline->pendingPayloads[InterfaceType::UART][
+                    PipelineLane::NORMAL_LANE]));
+    ck_assert_int_eq(payloadsPooled(pipeline), 0);
+}
+END_TEST
+
+START_TEST (test_builtin_endpoints)
+{
+    Pipeline* pipeline = &getConfiguration()->pipeline;
+    ck_assert_int_eq(pipeline->endpointCount, PIPELINE_BUILTIN_ENDPOINT_COUNT);
+    ck_assert_str_eq(pipeline->endpoints[InterfaceType::USB].name, "USB");
+    ck_assert_str_eq(pipeline->endpoints[InterfaceType::UART].name, "UART");
+    ck_assert_str_eq(pipeline->endpoints[InterfaceType::NETWORK].name, "NET");
+}
+END_TEST
+
+START_TEST (test_register_endpoint)
+{
+    Pipeline* pipeline = &getConfiguration()->pipeline;
+    ck_assert_int_eq(openxc::pipeline::registerEndpoint(pipeline,
+                &SINK_ENDPOINT), PIPELINE_BUILTIN_ENDPOINT_COUNT);
+
+    const char* message = "message";
+    sendMessage(pipeline, (uint8_t*)message, 8, MessageClass::SIMPLE);
+    ck_assert_int_eq(SINK.messagesReceived, 1);
+    ck_assert_str_eq((char*)SINK.received, "message");
+    ck_assert(!QUEUE_EMPTY(uint8_t, OUTPUT_QUEUE));
+
+    process(pipeline);
+    ck_assert_int_eq(SINK.flushes, 1);
+    fail_unless(USB_PROCESSED);
+}
+END_TEST
+
+START_TEST (test_register_endpoint_invalid)
+{
+    Pipeline* pipeline = &getConfiguration()->pipeline;
+    PipelineEndpoint endpoint = SINK_ENDPOINT;
+    endpoint.enqueue = NULL;
+    ck_assert_int_eq(openxc::pipeline::registerEndpoint(pipeline, &endpoint),
+            -1);
+
+    for(int i = PIPELINE_BUILTIN_ENDPOINT_COUNT; i < MAX_PIPELINE_ENDPOINTS;
+            i++) {
+        ck_assert_int_eq(openxc::pipeline::registerEndpoint(pipeline,
+                    &SINK_ENDPOINT), i);
+    }
+    ck_assert_int_eq(openxc::pipeline::registerEndpoint(pipeline,
+                &SINK_ENDPOINT), -1);
+    ck_assert_int_eq(pipeline->endpointCount, MAX_PIPELINE_ENDPOINTS);
+}
+END_TEST
+
+START_TEST (test_endpoint_message_classes)
+{
+    Pipeline* pipeline = &getConfiguration()->pipeline;
+    openxc::pipeline::registerEndpoint(pipeline, &SINK_ENDPOINT);
+
+    const char* message = "message";
+    sendMessage(pipeline, (uint8_t*)message, 8, MessageClass::CAN);
+    sendMessage(pipeline, (uint8_t*)message, 8, MessageClass::LOG);
+    ck_assert_int_eq(SINK.messagesReceived, 0);
+}
+END_TEST
+
+START_TEST (test_disconnected_endpoint_skipped)
+{
+    Pipeline* pipeline = &getConfiguration()->pipeline;
+    openxc::pipeline::registerEndpoint(pipeline, &SINK_ENDPOINT);
+    SINK.connected = false;
+    // if the pipeline tried to send to the endpoint anyway, it would spin
+    // trying to flush it and then drop the message
+    SINK.full = true;
+
+    const char* message = "message";
+    sendMessage(pipeline, (uint8_t*)message, 8, MessageClass::SIMPLE);
+    ck_assert_int_eq(SINK.messagesReceived, 0);
+    ck_assert_int_eq(SINK.flushes, 0);
+    ck_assert(QUEUE_EMPTY(PayloadReference, &pipeline->pendingPayloads[
+                PIPELINE_BUILTIN_ENDPOINT_COUNT][PipelineLane::NORMAL_LANE]));
+}
+END_TEST
+
+START_TEST (test_endpoint_payload_format)
+{
+    Pipeline* pipeline = &getConfiguration()->pipeline;
+    getConfiguration()->payloadFormat = PayloadFormat::JSON;
+    PipelineEndpoint endpoint = SINK_ENDPOINT;
+    endpoint.overridePayloadFormat = true;
+    endpoint.payloadFormat = PayloadFormat::PROTOBUF;
+    openxc::pipeline::registerEndpoint(pipeline, &endpoint);
+
+    openxc::can::read::publishNumericalMessage("test", 42, pipeline);
+
+    ck_assert_int_eq(SINK.messagesReceived, 1);
+    ck_assert_int_eq(QUEUE_PEEK(uint8_t, OUTPUT_QUEUE), '{');
+    // protobuf payloads start with their length, not a JSON object
+    ck_assert_int_ne(SINK.received[0], '{');
+}
+END_TEST
+
+START_TEST (test_subscription_include_signals)
+{
+    Pipeline* pipeline = &getConfiguration()->pipeline;
+    int index = openxc::pipeline::registerEndpoint(pipeline, &SINK_ENDPOINT);
+    // transmission_gear_position is the second test signal
+    int signals[] = {1};
+    ck_assert(openxc::pipeline::subscribe(pipeline, index,
+                SubscriptionMode::INCLUDE_SIGNALS, signals, 1,
+                ALL_MESSAGE_CLASSES));
+
+    openxc::can::read::publishNumericalMessage("torque_at_transmission", 42,
+            pipeline);
+    openxc::can::read::publishNumericalMessage("test", 42, pipeline);
+    ck_assert_int_eq(SINK.messagesReceived, 0);
+    ck_assert(!QUEUE_EMPTY(uint8_t, OUTPUT_QUEUE));
+
+    openxc::can::read::publishNumericalMessage("transmission_gear_position",
+            42, pipeline);
+    ck_assert_int_eq(SINK.messagesReceived, 1);
+}
+END_TEST
+
+START_TEST (test_subscription_exclude_signals)
+{
+    Pipeline* pipeline = &getConfiguration()->pipeline;
+    int index = openxc::pipeline::registerEndpoint(pipeline, &SINK_ENDPOINT);
+    int signals[] = {0};
+    ck_assert(openxc::pipeline::subscribe(pipeline, index,
+                SubscriptionMode::EXCLUDE_SIGNALS, signals, 1,
+                ALL_MESSAGE_CLASSES));
+
+    openxc::can::read::publishNumericalMessage("torque_at_transmission", 42,
+            pipeline);
+    ck_assert_int_eq(SINK.messagesReceived, 0);
+    openxc::can::read::publishNumericalMessage("test", 42, pipeline);
+    ck_assert_int_eq(SINK.messagesReceived, 1);
+}
+END_TEST
+
+START_TEST (test_subscription_message_classes)
+{
+    Pipeline* pipeline = &getConfiguration()->pipeline;
+    ck_assert(openxc::pipeline::subscribe(pipeline, InterfaceType::USB,
+                SubscriptionMode::ALL_SIGNALS, NULL, 0,
+                MESSAGE_CLASS_MASK(MessageClass::CAN)));
+
+    const char* message = "message";
+    sendMessage(pipeline, (uint8_t*)message, 8, MessageClass::SIMPLE);
+    ck_assert(QUEUE_EMPTY(uint8_t, OUTPUT_QUEUE));
+
+    // command responses always go out, so the host can see if its commands
+    // worked
+    sendMessage(pipeline, (uint8_t*)message, 8,
+            MessageClass::COMMAND_RESPONSE);
+    ck_assert(!QUEUE_EMPTY(uint8_t, OUTPUT_QUEUE));
+
+    openxc::pipeline::unsubscribe(pipeline, InterfaceType::USB);
+    QUEUE_INIT(uint8_t, OUTPUT_QUEUE);
+    sendMessage(pipeline, (uint8_t*)message, 8, MessageClass::SIMPLE);
+    ck_assert(!QUEUE_EMPTY(uint8_t, OUTPUT_QUEUE));
+}
+END_TEST
+
+START_TEST (test_signal_subscribed_union)
+{
+    Pipeline* pipeline = &getConfiguration()->pipeline;
+    int signals[] = {0};
+    ck_assert(openxc::pipeline::subscribe(pipeline, InterfaceType::USB,
+                SubscriptionMode::INCLUDE_SIGNALS, signals, 1,
+                ALL_MESSAGE_CLASSES));
+    ck_assert(openxc::pipeline::signalSubscribed(pipeline, 0));
+    ck_assert(!openxc::pipeline::signalSubscribed(pipeline, 1));
+
+    openxc::pipeline::registerEndpoint(pipeline, &SINK_ENDPOINT);
+    ck_assert(openxc::pipeline::signalSubscribed(pipeline, 1));
+
+    SINK.connected = false;
+    ck_assert(!openxc::pipeline::signalSubscribed(pipeline, 1));
+}
+END_TEST
+
+START_TEST (test_subscribe_invalid)
+{
+    Pipeline* pipeline = &getConfiguration()->pipeline;
+    int signals[] = {0, MAX_SUBSCRIBED_SIGNALS};
+    ck_assert(!openxc::pipeline::subscribe(pipeline, InterfaceType::USB,
+                SubscriptionMode::INCLUDE_SIGNALS, signals, 2,
+                ALL_MESSAGE_CLASSES));
+    ck_assert_int_eq(pipeline->endpoints[InterfaceType::USB].subscription.mode,
+            SubscriptionMode::ALL_SIGNALS);
+    ck_assert(!openxc::pipeline::subscribe(pipeline, MAX_PIPELINE_ENDPOINTS,
+                SubscriptionMode::INCLUDE_SIGNALS, signals, 1,
+                ALL_MESSAGE_CLASSES));
+}
+END_TEST
+
+static QUEUE_TYPE(PayloadReference)* pendingUartPayloads(PipelineLane lane) {
+    return &getConfiguration()->pipeline.pendingPayloads[
+            InterfaceType::UART][lane];
+}
+
+/* Fill the UART's queue with a message for each of the characters, until
+ * it's backed up and they are all waiting in the pool.
+ */
+static void sendToFullUart(const char* characters, MessageClass messageClass) {
+    Pipeline* pipeline = &getConfiguration()->pipeline;
+    pipeline->uart = &getConfiguration()->uart;
+    fillQueue(&pipeline->uart->sendQueue);
+    for(size_t i = 0; i < strlen(characters); i++) {
+        char message[2] = {characters[i], '\0'};
+        sendMessage(pipeline, (uint8_t*)message, 2, messageClass);
+    }
+}
+
+START_TEST (test_response_uses_headroom)
+{
+    Pipeline* pipeline = &getConfiguration()->pipeline;
+    pipeline->uart = &getConfiguration()->uart;
+    QUEUE_TYPE(uint8_t)* queue = &pipeline->uart->sendQueue;
+    while(QUEUE_AVAILABLE(uint8_t, queue) > PRIORITY_HEADROOM_BYTES) {
+        QUEUE_PUSH(uint8_t, queue, (uint8_t) 128);
+    }
+
+    const char* message = "message";
+    sendMessage(pipeline, (uint8_t*)message, 8, MessageClass::SIMPLE);
+    ck_assert_int_eq(QUEUE_AVAILABLE(uint8_t, queue), PRIORITY_HEADROOM_BYTES);
+    ck_assert_int_eq(QUEUE_LENGTH(PayloadReference,
+                pendingUartPayloads(PipelineLane::NORMAL_LANE)), 1);
+
+    sendMessage(pipeline, (uint8_t*)message, 8,
+            MessageClass::COMMAND_RESPONSE);
+    ck_assert_int_eq(QUEUE_AVAILABLE(uint8_t, queue),
+            PRIORITY_HEADROOM_BYTES - 8);
+    ck_assert(QUEUE_EMPTY(PayloadReference,
+                pendingUartPayloads(PipelineLane::PRIORITY_LANE)));
+}
+END_TEST
+
+START_TEST (test_priority_lane_sent_first)
+{
+    Pipeline* pipeline = &getConfiguration()->pipeline;
+    sendToFullUart("ab", MessageClass::SIMPLE);
+    sendToFullUart("c", MessageClass::DIAGNOSTIC);
+    ck_assert_int_eq(QUEUE_LENGTH(PayloadReference,
+                pendingUartPayloads(PipelineLane::NORMAL_LANE)), 2);
+    ck_assert_int_eq(QUEUE_LENGTH(PayloadReference,
+                pendingUartPayloads(PipelineLane::PRIORITY_LANE)), 1);
+
+    QUEUE_INIT(uint8_t, &pipeline->uart->sendQueue);
+    process(pipeline);
+
+    uint8_t snapshot[QUEUE_LENGTH(uint8_t, &pipeline->uart->sendQueue)];
+    ck_assert_int_eq(sizeof(snapshot), 6);
+    QUEUE_SNAPSHOT(uint8_t, &pipeline->uart->sendQueue, snapshot,
+            sizeof(snapshot));
+    ck_assert_str_eq((char*)snapshot, "c");
+    ck_assert_str_eq((char*)snapshot + 2, "a");
+    ck_assert_str_eq((char*)snapshot + 4, "b");
+}
+END_TEST
+
+START_TEST (test_drop_newest)
+{
+    unsigned int dropped = droppedMessagesByClass[InterfaceType::UART][
+            MessageClass::SIMPLE];
+    sendToFullUart("012345678", MessageClass::SIMPLE);
+
+    QUEUE_TYPE(PayloadReference)* pending = pendingUartPayloads(
+            PipelineLane::NORMAL_LANE);
+    ck_assert_int_eq(QUEUE_LENGTH(PayloadReference, pending),
+            PAYLOAD_REFERENCE_QUEUE_SIZE);
+    ck_assert_int_eq(pooledPayload(&getConfiguration()->pipeline,
+            QUEUE_PEEK(PayloadReference, pending))[0], '0');
+    ck_assert_int_eq(droppedMessagesByClass[InterfaceType::UART][
+            MessageClass::SIMPLE], dropped + 1);
+}
+END_TEST
+
+START_TEST (test_drop_oldest)
+{
+    getConfiguration()->dropPolicy = DropPolicy::DROP_OLDEST;
+    unsigned int dropped = droppedMessagesByClass[InterfaceType::UART][
+            MessageClass::SIMPLE];
+    sendToFullUart("012345678", MessageClass::SIMPLE);
+
+    QUEUE_TYPE(PayloadReference)* pending = pendingUartPayloads(
+            PipelineLane::NORMAL_LANE);
+    ck_assert_int_eq(QUEUE_LENGTH(PayloadReference, pending),
+            PAYLOAD_REFERENCE_QUEUE_SIZE);
+    ck_assert_int_eq(pooledPayload(&getConfiguration()->pipeline,
+            QUEUE_PEEK(PayloadReference, pending))[0], '1');
+    ck_assert_int_eq(droppedMessagesByClass[InterfaceType::UART][
+            MessageClass::SIMPLE], dropped + 1);
+}
+END_TEST
+
+START_TEST (test_latest_value)
+{
+    Pipeline* pipeline = &getConfiguration()->pipeline;
+    getConfiguration()->dropPolicy = DropPolicy::LATEST_VALUE;
+    sendToFullUart("", MessageClass::SIMPLE);
+
+    openxc::can::read::publishNumericalMessage("torque_at_transmission", 1,
+            pipeline);
+    openxc::can::read::publishNumericalMessage("brake_pedal_status", 2,
+            pipeline);
+    openxc::can::read::publishNumericalMessage("torque_at_transmission", 3,
+            pipeline);
+    ck_assert_int_eq(QUEUE_LENGTH(PayloadReference,
+                pendingUartPayloads(PipelineLane::NORMAL_LANE)), 3);
+    ck_assert_int_eq(payloadsPooled(pipeline), 2);
+
+    QUEUE_INIT(uint8_t, &pipeline->uart->sendQueue);
+    process(pipeline);
+    ck_assert(QUEUE_EMPTY(PayloadReference,
+                pendingUartPayloads(PipelineLane::NORMAL_LANE)));
+    ck_assert_int_eq(payloadsPooled(pipeline), 0);
+
+    uint8_t snapshot[QUEUE_LENGTH(uint8_t, &pipeline->uart->sendQueue) + 1];
+    QUEUE_SNAPSHOT(uint8_t, &pipeline->uart->sendQueue, snapshot,
+            sizeof(snapshot));
+    snapshot[sizeof(snapshot) - 1] = '\0';
+    // The first message is a JSON object ending in a NULL, so the replaced
+    // value would be right here if it had been sent
+    char* first = (char*)snapshot;
+    ck_assert(strstr(first, "brake_pedal_status") != NULL);
+    char* second = first + strlen(first) + 1;
+    ck_assert(strstr(second, "torque_at_transmission") != NULL);
+    ck_assert(strstr(second, "3") != NULL);
+}
+END_TEST
+
+START_TEST (test_response_makes_room_in_pool)
+{
+    Pipeline* pipeline = &getConfiguration()->pipeline;
+    sendToFullUart("", MessageClass::SIMPLE);
+    unsigned int dropped = droppedMessagesByClass[InterfaceType::UART][
+            MessageClass::SIMPLE];
+
+    // The pool fills up before the lane does with messages this big
+    uint8_t message[200];
+    memset(message, 'x', sizeof(message));
+    while(droppedMessagesByClass[InterfaceType::UART][
+            MessageClass::SIMPLE] == dropped) {
+        sendMessage(pipeline, message, sizeof(message), MessageClass::SIMPLE);
+    }
+    int pooled = payloadsPooled(pipeline);
+    ck_assert(pooled < PAYLOAD_REFERENCE_QUEUE_SIZE);
+
+    sendMessage(pipeline, message, sizeof(message),
+            MessageClass::COMMAND_RESPONSE);
+    ck_assert_int_eq(QUEUE_LENGTH(PayloadReference,
+                pendingUartPayloads(PipelineLane::PRIORITY_LANE)), 1);
+    ck_assert_int_eq(QUEUE_LENGTH(PayloadReference,
+                pendingUartPayloads(PipelineLane::NORMAL_LANE)), pooled - 1);
+    ck_assert_int_eq(payloadsPooled(pipeline), pooled);
+    ck_assert_int_eq(droppedMessagesByClass[InterfaceType::UART][
+            MessageClass::SIMPLE], dropped + 2);
+}
+END_TEST
+
+START_TEST (test_response_does_not_drop_pinned_payloads)
+{
+    Pipeline* pipeline = &getConfiguration()->pipeline;
+    pipeline->uart = &getConfiguration()->uart;
+    pipeline->network = &getConfiguration()->network;
+    fillQueue(&pipeline->uart->sendQueue);
+    fillQueue(&pipeline->network->sendQueue);
+
+    uint8_t message[200];
+    memset(message, 'x', sizeof(message));
+    unsigned int dropped = droppedMessagesByClass[InterfaceType::UART][
+            MessageClass::SIMPLE];
+    while(droppedMessagesByClass[InterfaceType::UART][
+            MessageClass::SIMPLE] == dropped) {
+        sendMessage(pipeline, message, sizeof(message), MessageClass::SIMPLE);
+    }
+    int pooled = payloadsPooled(pipeline);
+    ++dropped;
+
+    // The network is still waiting for the oldest payload, so dropping the
+    // UART's reference to it wouldn't free any space for the response
+    unsigned int droppedResponses = droppedMessagesByClass[
+            InterfaceType::UART][MessageClass::COMMAND_RESPONSE];
+    sendMessage(pipeline, message, sizeof(message),
+            MessageClass::COMMAND_RESPONSE);
+    ck_assert_int_eq(droppedMessagesByClass[InterfaceType::UART][
+            MessageClass::COMMAND_RESPONSE], droppedResponses + 1);
+    ck_assert_int_eq(droppedMessagesByClass[InterfaceType::UART][
+            MessageClass::SIMPLE], dropped);
+    ck_assert_int_eq(QUEUE_LENGTH(PayloadReference,
+                pendingUartPayloads(PipelineLane::NORMAL_LANE)), pooled);
+    ck_assert_int_eq(payloadsPooled(pipeline), pooled);
+}
+END_TEST
+
+START_TEST (test_pool_reuses_space)
+{
+    Pipeline* pipeline = &getConfiguration()->pipeline;
+    sendToFullUart("", MessageClass::SIMPLE);
+
+    uint8_t message[200];
+    for(char c = 'a'; c <= 'c'; c++) {
+        memset(message, c, sizeof(message));
+        sendMessage(pipeline, message, sizeof(message), MessageClass::SIMPLE);
+    }
+    ck_assert_int_eq(payloadsPooled(pipeline), 3);
+
+    // Only one of them fits in the UART's queue at a time
+    QUEUE_INIT(uint8_t, &pipeline->uart->sendQueue);
+    process(pipeline);
+    ck_assert_int_eq(payloadsPooled(pipeline), 2);
+
+    // There's no room left at the end of the pool, so the next one takes the
+    // space the first one was using
+    memset(message, 'd', sizeof(message));
+    sendMessage(pipeline, message, sizeof(message), MessageClass::SIMPLE);
+    ck_assert_int_eq(payloadsPooled(pipeline), 3);
+    QUEUE_TYPE(PayloadReference)* pending = pendingUartPayloads(
+            PipelineLane::NORMAL_LANE);
+    PayloadReference newest = pending->elements[(pending->head +
+            QUEUE_MAX_LENGTH(PayloadReference)) %
+            (QUEUE_MAX_LENGTH(PayloadReference) + 1)];
+    ck_assert_int_eq(newest.offset, 0);
+
+    for(char c = 'b'; c <= 'd'; c++) {
+        QUEUE_INIT(uint8_t, &pipeline->uart->sendQueue);
+        process(pipeline);
+        ck_assert_int_eq(QUEUE_LENGTH(uint8_t, &pipeline->uart->sendQueue),
+                sizeof(message));
+        ck_assert_int_eq(QUEUE_PEEK(uint8_t, &pipeline->uart->sendQueue), c);
+    }
+    ck_assert_int_eq(payloadsPooled(pipeline), 0);
+    ck_assert_int_eq(pipeline->payloadPool.used, 0);
+}
+END_TEST
+
+START_TEST (test_send_does_not_flush)
+{
+    Pipeline* pipeline = &getConfiguration()->pipeline;
+    fillQueue(OUTPUT_QUEUE);
+
+    const char* message = "message";
+    sendMessage(pipeline, (uint8_t*)message, 8, MessageClass::SIMPLE);
+    fail_if(USB_PROCESSED);
+    ck_assert_int_eq(QUEUE_LENGTH(PayloadReference,
+                &pipeline->pendingPayloads[InterfaceType::USB][
+                    PipelineLane::NORMAL_LANE]), 1);
+}
+END_TEST
+
+/* Queue up messages for USB that need several flushes to get through, since
+ * only 2 fit in the queue at once.
+ */
+static void sendToFullUsb(int count) {
+    fillQueue(OUTPUT_QUEUE);
+    uint8_t message[100];
+    memset(message, 'x', sizeof(message));
+    for(int i = 0; i < count; i++) {
+        sendMessage(&getConfiguration()->pipeline, message, sizeof(message),
+                MessageClass::SIMPLE);
+    }
+}
+
+START_TEST (test_process_drains_pool)
+{
+    Pipeline* pipeline = &getConfiguration()->pipeline;
+    sendToFullUsb(6);
+    ck_assert_int_eq(payloadsPooled(pipeline), 6);
+
+    process(pipeline);
+    ck_assert_int_eq(payloadsPooled(pipeline), 0);
+    ck_assert_int_eq(QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE), 200);
+}
+END_TEST
+
+START_TEST (test_process_once_without_budget)
+{
+    Pipeline* pipeline = &getConfiguration()->pipeline;
+    getConfiguration()->pipelineFlushBudgetUs = 0;
+    sendToFullUsb(6);
+
+    process(pipeline);
+    ck_assert_int_eq(payloadsPooled(pipeline), 4);
+    ck_assert_int_eq(QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE), 200);
+}
+END_TEST
+
+START_TEST (test_process_stops_when_stalled)
+{
+    // The UART never drains in the tests, so flushing again can't help
+    Pipeline* pipeline = &getConfiguration()->pipeline;
+    sendToFullUart("ab", MessageClass::SIMPLE);
+
+    process(pipeline);
+    fail_unless(UART_PROCESSED);
+    ck_assert_int_eq(QUEUE_LENGTH(PayloadReference,
+                pendingUartPayloads(PipelineLane::NORMAL_LANE)), 2);
+}
+END_TEST
+
+START_TEST (test_batch_json)
+{
+    Pipeline* pipeline = &getConfiguration()->pipeline;
+    openxc::pipeline::registerEndpoint(pipeline, &SINK_ENDPOINT);
+    getConfiguration()->batchSize = 50;
+
+    openxc::can::read::publishNumericalMessage("test", 42, pipeline);
+    ck_assert_int_eq(SINK.messagesReceived, 0);
+    ck_assert(QUEUE_EMPTY(uint8_t, OUTPUT_QUEUE));
+
+    openxc::can::read::publishNumericalMessage("test", 43, pipeline);
+    ck_assert_int_eq(SINK.messagesReceived, 1);
+    ck_assert_int_eq(SINK.receivedLength, 56);
+    ck_assert_str_eq((char*)SINK.received,
+            "[{\"name\":\"test\",\"value\":42},"
+            "{\"name\":\"test\",\"value\":43}]");
+    ck_assert_int_eq(QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE), 56);
+}
+END_TEST
+
+START_TEST (test_no_batch_protobuf)
+{
+    Pipeline* pipeline = &getConfiguration()->pipeline;
+    PipelineEndpoint endpoint = SINK_ENDPOINT;
+    endpoint.overridePayloadFormat = true;
+    endpoint.payloadFormat = PayloadFormat::PROTOBUF;
+    openxc::pipeline::registerEndpoint(pipeline, &endpoint);
+    getConfiguration()->batchSize = 50;
+
+    // A batch would look just like a single message in the delimited stream
+    openxc::can::read::publishNumericalMessage("test", 42, pipeline);
+    ck_assert_int_eq(SINK.messagesReceived, 1);
+    openxc::can::read::publishNumericalMessage("test", 43, pipeline);
+    ck_assert_int_eq(SINK.messagesReceived, 2);
+    ck_assert_int_eq(pipeline->batches[PIPELINE_BUILTIN_ENDPOINT_COUNT].count,
+            0);
+}
+END_TEST
+
+START_TEST (test_batch_raw_can)
+{
+    Pipeline* pipeline = &getConfiguration()->pipeline;
+    PipelineEndpoint endpoint = SINK_ENDPOINT;
+    endpoint.overridePayloadFormat = true;
+    endpoint.payloadFormat = PayloadFormat::RAW_CAN;
+    endpoint.messageClasses = MESSAGE_CLASS_MASK(MessageClass::CAN);
+    openxc::pipeline::registerEndpoint(pipeline, &endpoint);
+    getConfiguration()->batchSize = 2 * RAW_CAN_TIMESTAMPED_RECORD_SIZE;
+
+    openxc_VehicleMessage message = {0};
+    message.has_type = true;
+    message.type = openxc_VehicleMessage_Type_CAN;
+    message.has_can_message = true;
+    message.can_message.bus = 1;
+    message.can_message.id = 0x42;
+    message.can_message.data.size = 1;
+    openxc::pipeline::publish(&message, pipeline);
+    ck_assert_int_eq(SINK.messagesReceived, 0);
+
+    // The record is stamped with when the message was received, not when it
+    // was serialized
+    pipeline->receiveTimestamp = 0x12345678;
+    openxc::pipeline::publish(&message, pipeline);
+    pipeline->receiveTimestamp = 0;
+    ck_assert_int_eq(SINK.messagesReceived, 1);
+    ck_assert_int_eq(SINK.received[2 * RAW_CAN_TIMESTAMPED_RECORD_SIZE - 1],
+            0x12);
+    ck_assert_int_eq(SINK.received[2 * RAW_CAN_TIMESTAMPED_RECORD_SIZE - 4],
+            0x78);
+    // The records are sent back to back, without any framing around them
+    ck_assert_int_eq(SINK.receivedLength, 2 * RAW_CAN_TIMESTAMPED_RECORD_SIZE);
+    ck_assert_int_eq(SINK.received[0], RAW_CAN_SYNC_BYTE);
+    ck_assert_int_eq(SINK.received[RAW_CAN_TIMESTAMPED_RECORD_SIZE],
+            RAW_CAN_SYNC_BYTE);
+}
+END_TEST
+
+START_TEST (test_batch_timeout)
+{
+    Pipeline* pipeline = &getConfiguration()->pipeline;
+    openxc::pipeline::registerEndpoint(pipeline, &SINK_ENDPOINT);
+    getConfiguration()->batchSize = 200;
+
+    openxc::can::read::publishNumericalMessage("test", 42, pipeline);
+    process(pipeline);
+    ck_assert_int_eq(SINK.messagesReceived, 0);
+
+    FAKE_TIME += getConfiguration()->batchTimeoutMs;
+    process(pipeline);
+    ck_assert_int_eq(SINK.messagesReceived, 1);
+    ck_assert_str_eq((char*)SINK.received,
+            "[{\"name\":\"test\",\"value\":42}]");
+}
+END_TEST
+
+START_TEST (test_publish_signal_deferred)
+{
+    Pipeline* pipeline = &getConfiguration()->pipeline;
+    openxc::pipeline::registerEndpoint(pipeline, &SINK_ENDPOINT);
+
+    openxc_DynamicField value = openxc::payload::wrapNumber(42);
+    ck_assert(openxc::pipeline::publishSignal(pipeline, 0, &value, NULL));
+    ck_assert_int_eq(SINK.messagesReceived, 0);
+    ck_assert(QUEUE_EMPTY(uint8_t, OUTPUT_QUEUE));
+
+    process(pipeline);
+    ck_assert_int_eq(SINK.messagesReceived, 1);
+    ck_assert_str_eq((char*)SINK.received,
+            "{\"name\":\"torque_at_transmission\",\"value\":42}");
+}
+END_TEST
+
+START_TEST (test_publish_signal_decimal_places)
+{
+    Pipeline* pipeline = &getConfiguration()->pipeline;
+    openxc::pipeline::registerEndpoint(pipeline, &SINK_ENDPOINT);
+
+    openxc_DynamicField value = openxc::payload::wrapNumber(42.25);
+    ck_assert(openxc::pipeline::publishSignal(pipeline, 0, &value, NULL));
+    process(pipeline);
+    ck_assert_str_eq((char*)SINK.received,
+            "{\"name\":\"torque_at_transmission\",\"value\":42.250000}");
+
+    getConfiguration()->jsonDecimalPlaces = SHORTEST_DECIMAL_PLACES;
+    ck_assert(openxc::pipeline::publishSignal(pipeline, 0, &value, NULL));
+    process(pipeline);
+    ck_assert_str_eq((char*)SINK.received,
+            "{\"name\":\"torque_at_transmission\",\"value\":42.25}");
+
+    // The signal's own decimal places win over the configuration's
+    getSignals()[0].hasDecimalPlaces = true;
+    getSignals()[0].decimalPlaces = 1;
+    ck_assert(openxc::pipeline::publishSignal(pipeline, 0, &value, NULL));
+    process(pipeline);
+    ck_assert_str_eq((char*)SINK.received,
+            "{\"name\":\"torque_at_transmission\",\"value\":42.2}");
+}
+END_TEST
+
+START_TEST (test_publish_signal_endpoint_format)
+{
+    Pipeline* pipeline = &getConfiguration()->pipeline;
+    PipelineEndpoint endpoint = SINK_ENDPOINT;
+    endpoint.overridePayloadFormat = true;
+    endpoint.payloadFormat = PayloadFormat::PROTOBUF;
+    openxc::pipeline::registerEndpoint(pipeline, &endpoint);
+
+    openxc_DynamicField value = openxc::payload::wrapNumber(42);
+    ck_assert(openxc::pipeline::publishSignal(pipeline, 0, &value, NULL));
+    // Serialize the record without flushing USB, by publishing another message
+    openxc::can::read::publishNumericalMessage("test", 43, pipeline);
+
+    ck_assert_int_eq(SINK.messagesReceived, 2);
+    ck_assert_int_ne(SINK.received[0], '{');
+    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE) + 1];
+    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    snapshot[sizeof(snapshot) - 1] = NULL;
+    ck_assert_str_eq((char*)snapshot,
+            "{\"name\":\"torque_at_transmission\",\"value\":42}");
+}
+END_TEST
+
+START_TEST (test_publish_signal_state_and_event)
+{
+    Pipeline* pipeline = &getConfiguration()->pipeline;
+    openxc::pipeline::registerEndpoint(pipeline, &SINK_ENDPOINT);
+
+    // transmission_gear_position has states
+    openxc_DynamicField value = {0};
+    value.has_type = true;
+    value.type = openxc_DynamicField_Type_STRING;
+    value.has_string_value = true;
+    strcpy(value.string_value, "third");
+    openxc_DynamicField event = openxc::payload::wrapBoolean(true);
+    ck_assert(openxc::pipeline::publishSignal(pipeline, 1, &value, &event));
+
+    process(pipeline);
+    ck_assert_int_eq(SINK.messagesReceived, 1);
+    ck_assert_str_eq((char*)SINK.received,
+            "{\"name\":\"transmission_gear_position\",\"value\":\"third\","
+            "\"event\":true}");
+}
+END_TEST
+
+START_TEST (test_publish_signal_not_recorded)
+{
+    Pipeline* pipeline = &getConfiguration()->pipeline;
+    openxc_DynamicField value = openxc::payload::wrapNumber(42);
+    ck_assert(!openxc::pipeline::publishSignal(pipeline, -1, &value, NULL));
+    ck_assert(!openxc::pipeline::publishSignal(pipeline, getSignalCount(),
+                &value, NULL));
+
+    openxc_DynamicField custom = {0};
+    custom.has_type = true;
+    custom.type = openxc_DynamicField_Type_STRING;
+    custom.has_string_value = true;
+    strcpy(custom.string_value, "not a state");
+    ck_assert(!openxc::pipeline::publishSignal(pipeline, 1, &custom, NULL));
+
+    getConfiguration()->deferSerialization = false;
+    ck_assert(!openxc::pipeline::publishSignal(pipeline, 0, &value, NULL));
+}
+END_TEST
+
+START_TEST (test_record_queue_full)
+{
+    Pipeline* pipeline = &getConfiguration()->pipeline;
+    openxc::pipeline::registerEndpoint(pipeline, &SINK_ENDPOINT);
+
+    openxc_DynamicField value = openxc::payload::wrapNumber(42);
+    for(int i = 0; i < SIGNAL_RECORD_QUEUE_SIZE; i++) {
+        ck_assert(openxc::pipeline::publishSignal(pipeline, 0, &value, NULL));
+    }
+    ck_assert_int_eq(SINK.messagesReceived, 0);
+
+    ck_assert(openxc::pipeline::publishSignal(pipeline, 0, &value, NULL));
+    ck_assert_int_eq(SINK.messagesReceived, SIGNAL_RECORD_QUEUE_SIZE);
+    ck_assert_int_eq(QUEUE_LENGTH(SignalRecord, &pipeline->records), 1);
+}
+END_TEST
+
 Suite* pipelineSuite(void) {
     Suite* s = suite_create("pipeline");
     TCase *tc_core = tcase_create("core");
@@ -172,6 +1122,44 @@ Suite* pipelineSuite(void) {
     tcase_add_test(tc_core, test_process_usb_and_uart);
     tcase_add_test(tc_core, test_process_usb);
     tcase_add_test(tc_core, test_log_to_usb);
+    tcase_add_test(tc_core, test_flush_latency);
+    tcase_add_test(tc_core, test_full_queue_deferred);
+    tcase_add_test(tc_core, test_deferred_payload_shared);
+    tcase_add_test(tc_core, test_deferred_keeps_order);
+    tcase_add_test(tc_core, test_deferred_dropped_when_disconnected);
+    tcase_add_test(tc_core, test_builtin_endpoints);
+    tcase_add_test(tc_core, test_register_endpoint);
+    tcase_add_test(tc_core, test_register_endpoint_invalid);
+    tcase_add_test(tc_core, test_endpoint_message_classes);
+    tcase_add_test(tc_core, test_disconnected_endpoint_skipped);
+    tcase_add_test(tc_core, test_endpoint_payload_format);
+    tcase_add_test(tc_core, test_subscription_include_signals);
+    tcase_add_test(tc_core, test_subscription_exclude_signals);
+    tcase_add_test(tc_core, test_subscription_message_classes);
+    tcase_add_test(tc_core, test_signal_subscribed_union);
+    tcase_add_test(tc_core, test_subscribe_invalid);
+    tcase_add_test(tc_core, test_response_uses_headroom);
+    tcase_add_test(tc_core, test_priority_lane_sent_first);
+    tcase_add_test(tc_core, test_drop_newest);
+    tcase_add_test(tc_core, test_drop_oldest);
+    tcase_add_test(tc_core, test_latest_value);
+    tcase_add_test(tc_core, test_response_makes_room_in_pool);
+    tcase_add_test(tc_core, test_response_does_not_drop_pinned_payloads);
+    tcase_add_test(tc_core, test_pool_reuses_space);
+    tcase_add_test(tc_core, test_send_does_not_flush);
+    tcase_add_test(tc_core, test_process_drains_pool);
+    tcase_add_test(tc_core, test_process_once_without_budget);
+    tcase_add_test(tc_core, test_process_stops_when_stalled);
+    tcase_add_test(tc_core, test_batch_json);
+    tcase_add_test(tc_core, test_no_batch_protobuf);
+    tcase_add_test(tc_core, test_batch_raw_can);
+    tcase_add_test(tc_core, test_batch_timeout);
+    tcase_add_test(tc_core, test_publish_signal_deferred);
+    tcase_add_test(tc_core, test_publish_signal_decimal_places);
+    tcase_add_test(tc_core, test_publish_signal_endpoint_format);
+    tcase_add_test(tc_core, test_publish_signal_state_and_event);
+    tcase_add_test(tc_core, test_publish_signal_not_recorded);
+    tcase_add_test(tc_core, test_record_queue_full);
     suite_add_tcase(s, tc_core);
 
     return s;
@@ -1,14 +1,19 @@
 #include "canutil_spy.h"
 
 static bool _acceptanceFiltersUpdated = false;
+static bool _acceptanceFilterTableFull = false;
 
 bool openxc::can::spy::acceptanceFiltersUpdated() {
     return _acceptanceFiltersUpdated;
 }
 
+void openxc::can::spy::setAcceptanceFilterTableFull(bool full) {
+    _acceptanceFilterTableFull = full;
+}
+
 bool openxc::can::updateAcceptanceFilterTable(CanBus* buses, const int busCount) {
     _acceptanceFiltersUpdated = true;
-    return true;
+    return !_acceptanceFilterTableFull;
 }
 
 void openxc::can::deinitialize(CanBus* bus) { }
@@ -9,6 +9,11 @@ namespace spy {
 
 bool acceptanceFiltersUpdated();
 
+/* Public: Make updateAcceptanceFilterTable(...) fail, like a CAN controller
+ * that doesn't have room for the filters.
+ */
+void setAcceptanceFilterTableFull(bool full);
+
 } // spy
 } // can
 } // openxc
@@ -0,0 +1,194 @@
+#include <check.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "config.h"
+#include "payload/payload.h"
+#include "payload/rawcan.h"
+
+namespace rawcan = openxc::payload::rawcan;
+namespace payload = openxc::payload;
+
+using openxc::config::getConfiguration;
+using openxc::payload::PayloadFormat;
+
+openxc_VehicleMessage message;
+uint8_t buffer[64];
+
+void setup() {
+    memset(buffer, 0xff, sizeof(buffer));
+    memset(&message, 0, sizeof(message));
+    message.has_type = true;
+    message.type = openxc_VehicleMessage_Type_CAN;
+    message.has_can_message = true;
+    message.can_message.has_bus = true;
+    message.can_message.bus = 1;
+    message.can_message.has_id = true;
+    message.can_message.id = 0x123;
+    message.can_message.has_data = true;
+    message.can_message.data.size = 3;
+    message.can_message.data.bytes[0] = 0x11;
+    message.can_message.data.bytes[1] = 0x22;
+    message.can_message.data.bytes[2] = 0x33;
+    getConfiguration()->rawCanTimestamps = false;
+}
+
+void teardown() {
+    getConfiguration()->rawCanTimestamps = DEFAULT_RAW_CAN_TIMESTAMPS_STATUS;
+}
+
+START_TEST (test_serialize_standard)
+{
+    const uint8_t expected[] = {0xa5, 0x03, 0x01, 0x23, 0x01, 0x00, 0x00,
+            0x11, 0x22, 0x33, 0x00, 0x00, 0x00, 0x00, 0x00};
+    ck_assert_int_eq(rawcan::serialize(&message, buffer, sizeof(buffer)),
+            RAW_CAN_RECORD_SIZE);
+    ck_assert(!memcmp(buffer, expected, sizeof(expected)));
+    // Nothing is written past the record
+    ck_assert_int_eq(buffer[RAW_CAN_RECORD_SIZE], 0xff);
+}
+END_TEST
+
+START_TEST (test_serialize_extended)
+{
+    message.can_message.bus = 2;
+    message.can_message.id = 0x18daf110;
+    message.can_message.has_frame_format = true;
+    message.can_message.frame_format = openxc_CanMessage_FrameFormat_EXTENDED;
+    message.can_message.data.size = 8;
+    for(int i = 0; i < 8; i++) {
+        message.can_message.data.bytes[i] = i + 1;
+    }
+
+    const uint8_t expected[] = {0xa5, 0x88, 0x02, 0x10, 0xf1, 0xda, 0x18,
+            0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08};
+    ck_assert_int_eq(rawcan::serialize(&message, buffer, sizeof(buffer)),
+            RAW_CAN_RECORD_SIZE);
+    ck_assert(!memcmp(buffer, expected, sizeof(expected)));
+}
+END_TEST
+
+START_TEST (test_serialize_with_timestamp)
+{
+    const uint8_t expected[] = {0xa5, 0x43, 0x01, 0x23, 0x01, 0x00, 0x00,
+            0x11, 0x22, 0x33, 0x00, 0x00, 0x00, 0x00, 0x00,
+            0x78, 0x56, 0x34, 0x12};
+    ck_assert_int_eq(rawcan::serialize(&message, buffer, sizeof(buffer), true,
+                0x12345678), RAW_CAN_TIMESTAMPED_RECORD_SIZE);
+    ck_assert(!memcmp(buffer, expected, sizeof(expected)));
+
+    getConfiguration()->rawCanTimestamps = true;
+    ck_assert_int_eq(rawcan::serialize(&message, buffer, sizeof(buffer)),
+            RAW_CAN_TIMESTAMPED_RECORD_SIZE);
+    ck_assert(buffer[1] & RAW_CAN_FLAG_TIMESTAMP);
+}
+END_TEST
+
+START_TEST (test_serialize_receive_timestamp)
+{
+    getConfiguration()->rawCanTimestamps = true;
+    const uint8_t timestamp[] = {0x78, 0x56, 0x34, 0x12};
+    ck_assert_int_eq(rawcan::serialize(&message, buffer, sizeof(buffer),
+                0x12345678UL), RAW_CAN_TIMESTAMPED_RECORD_SIZE);
+    ck_assert(!memcmp(&buffer[RAW_CAN_RECORD_SIZE], timestamp,
+                sizeof(timestamp)));
+
+    ck_assert_int_eq(payload::serialize(&message, buffer, sizeof(buffer),
+                PayloadFormat::RAW_CAN, 0, 0x12345678UL),
+            RAW_CAN_TIMESTAMPED_RECORD_SIZE);
+    ck_assert(!memcmp(&buffer[RAW_CAN_RECORD_SIZE], timestamp,
+                sizeof(timestamp)));
+
+    // Without timestamps, the receive time is left out
+    getConfiguration()->rawCanTimestamps = false;
+    ck_assert_int_eq(rawcan::serialize(&message, buffer, sizeof(buffer),
+                0x12345678UL), RAW_CAN_RECORD_SIZE);
+}
+END_TEST
+
+START_TEST (test_serialize_buffer_too_small)
+{
+    ck_assert_int_eq(rawcan::serialize(&message, buffer,
+                RAW_CAN_RECORD_SIZE - 1), 0);
+    ck_assert_int_eq(rawcan::serialize(&message, buffer,
+                RAW_CAN_TIMESTAMPED_RECORD_SIZE - 1, true, 0), 0);
+    ck_assert_int_eq(buffer[0], 0xff);
+}
+END_TEST
+
+START_TEST (test_serialize_not_can)
+{
+    message.type = openxc_VehicleMessage_Type_SIMPLE;
+    ck_assert_int_eq(rawcan::serialize(&message, buffer, sizeof(buffer)), 0);
+}
+END_TEST
+
+START_TEST (test_payload_format_can)
+{
+    ck_assert_int_eq(payload::serialize(&message, buffer, sizeof(buffer),
+                PayloadFormat::RAW_CAN), RAW_CAN_RECORD_SIZE);
+    ck_assert_int_eq(buffer[0], RAW_CAN_SYNC_BYTE);
+}
+END_TEST
+
+START_TEST (test_payload_format_other_messages_are_json)
+{
+    message.type = openxc_VehicleMessage_Type_COMMAND_RESPONSE;
+    message.has_command_response = true;
+    message.command_response.has_type = true;
+    message.command_response.type = openxc_ControlCommand_Type_VERSION;
+    message.command_response.has_status = true;
+    message.command_response.status = true;
+
+    int length = payload::serialize(&message, buffer, sizeof(buffer),
+            PayloadFormat::RAW_CAN);
+    ck_assert_int_gt(length, 0);
+    ck_assert_int_eq(buffer[0], '{');
+    ck_assert_int_eq(buffer[length - 1], '\0');
+}
+END_TEST
+
+START_TEST (test_payload_format_commands_are_json)
+{
+    uint8_t request[] = "{\"command\": \"version\"}";
+    openxc_VehicleMessage deserialized = {0};
+    ck_assert_int_eq(payload::deserialize(request, sizeof(request),
+                PayloadFormat::RAW_CAN, &deserialized), sizeof(request));
+    ck_assert_int_eq(deserialized.type,
+            openxc_VehicleMessage_Type_CONTROL_COMMAND);
+}
+END_TEST
+
+Suite* suite(void) {
+    Suite* s = suite_create("rawcan_payload");
+    TCase *tc_serialize = tcase_create("serialize");
+    tcase_add_checked_fixture(tc_serialize, setup, teardown);
+    tcase_add_test(tc_serialize, test_serialize_standard);
+    tcase_add_test(tc_serialize, test_serialize_extended);
+    tcase_add_test(tc_serialize, test_serialize_with_timestamp);
+    tcase_add_test(tc_serialize, test_serialize_receive_timestamp);
+    tcase_add_test(tc_serialize, test_serialize_buffer_too_small);
+    tcase_add_test(tc_serialize, test_serialize_not_can);
+    suite_add_tcase(s, tc_serialize);
+
+    TCase *tc_payload_format = tcase_create("payload_format");
+    tcase_add_checked_fixture(tc_payload_format, setup, teardown);
+    tcase_add_test(tc_payload_format, test_payload_format_can);
+    tcase_add_test(tc_payload_format, test_payload_format_other_messages_are_json);
+    tcase_add_test(tc_payload_format, test_payload_format_commands_are_json);
+    suite_add_tcase(s, tc_payload_format);
+
+    return s;
+}
+
+int main(void) {
+    int numberFailed;
+    Suite* s = suite();
+    SRunner *sr = srunner_create(s);
+    // Don't fork so we can actually use gdb
+    srunner_set_fork_status(sr, CK_NOFORK);
+    srunner_run_all(sr, CK_NORMAL);
+    numberFailed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (numberFailed == 0) ? 0 : 1;
+}
@@ -5,6 +5,7 @@
 
 using openxc::util::statistics::Statistic;
 using openxc::util::statistics::DeltaStatistic;
+using openxc::util::statistics::Histogram;
 
 namespace statistics = openxc::util::statistics;
 
@@ -93,6 +94,49 @@ START_TEST (test_delta_stat_exponential_average)
 }
 END_TEST
 
+START_TEST (test_histogram_buckets)
+{
+    Histogram histogram;
+    statistics::initialize(&histogram);
+    statistics::update(&histogram, 0);
+    statistics::update(&histogram, 1);
+    statistics::update(&histogram, 2);
+    statistics::update(&histogram, 3);
+    statistics::update(&histogram, 1000);
+    ck_assert_int_eq(histogram.count, 5);
+    ck_assert_int_eq(histogram.buckets[0], 2);
+    ck_assert_int_eq(histogram.buckets[1], 2);
+    ck_assert_int_eq(histogram.buckets[9], 1);
+    ck_assert_int_eq(statistics::maximum(&histogram), 1000);
+}
+END_TEST
+
+START_TEST (test_histogram_large_values)
+{
+    Histogram histogram;
+    statistics::initialize(&histogram);
+    statistics::update(&histogram, 0xffffffff);
+    ck_assert_int_eq(histogram.buckets[HISTOGRAM_BUCKET_COUNT - 1], 1);
+    ck_assert(statistics::percentile(&histogram, 50) == 0xffffffff);
+}
+END_TEST
+
+START_TEST (test_histogram_percentile)
+{
+    Histogram histogram;
+    statistics::initialize(&histogram);
+    ck_assert_int_eq(statistics::percentile(&histogram, 50), 0);
+
+    for(int i = 0; i < 99; i++) {
+        statistics::update(&histogram, 10);
+    }
+    statistics::update(&histogram, 5000);
+    ck_assert_int_eq(statistics::percentile(&histogram, 50), 15);
+    ck_assert_int_eq(statistics::percentile(&histogram, 99), 15);
+    ck_assert_int_eq(statistics::percentile(&histogram, 100), 5000);
+}
+END_TEST
+
 Suite* suite(void) {
     Suite* s = suite_create("statistics");
     TCase *tc_core = tcase_create("core");
@@ -103,6 +147,9 @@ Suite* suite(void) {
     tcase_add_test(tc_core, test_delta_stat_min_max);
     tcase_add_test(tc_core, test_delta_stat_exponential_average);
     tcase_add_test(tc_core, test_average_starts_at_first_value);
+    tcase_add_test(tc_core, test_histogram_buckets);
+    tcase_add_test(tc_core, test_histogram_large_values);
+    tcase_add_test(tc_core, test_histogram_percentile);
     suite_add_tcase(s, tc_core);
 
     return s;
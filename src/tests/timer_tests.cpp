@@ -6,6 +6,7 @@
 using openxc::util::time::systemTimeMs;
 using openxc::util::time::FrequencyClock;
 using openxc::util::time::tick;
+using openxc::util::time::elapsedUs;
 
 void setup() {
 }
@@ -101,6 +102,16 @@ START_TEST (test_nonconditional_tick)
 }
 END_TEST
 
+START_TEST (test_elapsed_us)
+{
+    ck_assert_int_eq(elapsedUs(100, 350), 250);
+    // The 32 bit clock wrapped around between the readings
+    ck_assert_int_eq(elapsedUs(0xfffffff0, 0x10), 0x20);
+    // The end reading is from before the start, e.g. taken in an interrupt
+    ck_assert_int_eq(elapsedUs(1000, 900), 0);
+}
+END_TEST
+
 Suite* suite(void) {
     Suite* s = suite_create("timer");
     TCase *tc_core = tcase_create("core");
@@ -111,6 +122,7 @@ Suite* suite(void) {
     tcase_add_test(tc_core, test_first_tick_always_true);
     tcase_add_test(tc_core, test_staggered_not_true_at_start);
     tcase_add_test(tc_core, test_nonconditional_tick);
+    tcase_add_test(tc_core, test_elapsed_us);
     suite_add_tcase(s, tc_core);
 
     return s;
@@ -6,6 +6,7 @@
 #include "config.h"
 #include "pipeline.h"
 #include "power.h"
+#include "util/timer.h"
 
 namespace diagnostics = openxc::diagnostics;
 namespace usb = openxc::interface::usb;
@@ -13,6 +14,7 @@ namespace usb = openxc::interface::usb;
 using openxc::pipeline::Pipeline;
 using openxc::signals::getCanBuses;
 using openxc::signals::getCanBusCount;
+using openxc::signals::getSignals;
 using openxc::config::getConfiguration;
 
 extern openxc::lights::RGB LIGHT_A_LAST_COLOR;
@@ -33,6 +35,8 @@ static bool canQueueEmpty(int bus) {
 void setup() {
     initializeVehicleInterface();
     fail_unless(canQueueEmpty(0));
+    getConfiguration()->canReceiveBatchSize = DEFAULT_CAN_RECEIVE_BATCH_SIZE;
+    getConfiguration()->canReceiveBudgetUs = DEFAULT_CAN_RECEIVE_BUDGET_US;
 }
 
 CanMessage message = {
@@ -89,6 +93,113 @@ START_TEST (test_update_data_lights_suspend)
 }
 END_TEST
 
+START_TEST (test_receive_can_batch)
+{
+    CanBus* bus = &getCanBuses()[0];
+    getConfiguration()->canReceiveBatchSize = 2;
+    getConfiguration()->canReceiveBudgetUs = 0;
+    unsigned int messagesReceived = bus->messagesReceived;
+    for(int i = 0; i < 3; i++) {
+        QUEUE_PUSH(CanMessage, &bus->receiveQueue, message);
+    }
+    receiveCan(&getConfiguration()->pipeline, bus);
+    ck_assert_int_eq(QUEUE_LENGTH(CanMessage, &bus->receiveQueue), 1);
+    ck_assert_int_eq(bus->messagesReceived, messagesReceived + 2);
+
+    receiveCan(&getConfiguration()->pipeline, bus);
+    ck_assert(QUEUE_EMPTY(CanMessage, &bus->receiveQueue));
+    ck_assert_int_eq(bus->messagesReceived, messagesReceived + 3);
+}
+END_TEST
+
+START_TEST (test_receive_can_batch_minimum)
+{
+    CanBus* bus = &getCanBuses()[0];
+    getConfiguration()->canReceiveBatchSize = 0;
+    QUEUE_PUSH(CanMessage, &bus->receiveQueue, message);
+    QUEUE_PUSH(CanMessage, &bus->receiveQueue, message);
+    receiveCan(&getConfiguration()->pipeline, bus);
+    ck_assert_int_eq(QUEUE_LENGTH(CanMessage, &bus->receiveQueue), 1);
+}
+END_TEST
+
+START_TEST (test_receive_can_batch_stats)
+{
+    CanBus* bus = &getCanBuses()[0];
+    getConfiguration()->calculateMetrics = true;
+    getConfiguration()->canReceiveBatchSize = 8;
+    for(int i = 0; i < 3; i++) {
+        QUEUE_PUSH(CanMessage, &bus->receiveQueue, message);
+    }
+    receiveCan(&getConfiguration()->pipeline, bus);
+    ck_assert_int_eq(openxc::util::statistics::maximum(
+                &bus->receiveBatchStats), 3);
+    getConfiguration()->calculateMetrics = false;
+}
+END_TEST
+
+START_TEST (test_receive_can_latency)
+{
+    CanBus* bus = &getCanBuses()[0];
+    getConfiguration()->calculateMetrics = true;
+    openxc::util::statistics::initialize(&bus->receiveLatency);
+
+    CanMessage stampedMessage = message;
+    stampedMessage.timestamp = openxc::util::time::systemTimeUs();
+    QUEUE_PUSH(CanMessage, &bus->receiveQueue, stampedMessage);
+    // messages that weren't stamped by the interrupt handler aren't measured
+    QUEUE_PUSH(CanMessage, &bus->receiveQueue, message);
+
+    unsigned long startTime = FAKE_TIME;
+    FAKE_TIME += 3;
+    receiveCan(&getConfiguration()->pipeline, bus);
+    FAKE_TIME = startTime;
+    getConfiguration()->calculateMetrics = false;
+
+    ck_assert_int_eq(bus->receiveLatency.count, 1);
+    ck_assert_int_eq(openxc::util::statistics::maximum(&bus->receiveLatency),
+            3000);
+    ck_assert_int_eq(getConfiguration()->pipeline.sourceTimestamp, 0);
+    ck_assert_int_eq(getConfiguration()->pipeline.receiveTimestamp, 0);
+}
+END_TEST
+
+static bool receiveBrakePedalMessage(bool indexedDecode,
+        bool messageIndexedDecode) {
+    CanBus* bus = &getCanBuses()[0];
+    CanSignal* signal = &getSignals()[2];
+    signal->received = false;
+    CanMessage brakeMessage = {
+        id: 2,
+        format: CanMessageFormat::STANDARD,
+        data: {0x80}
+    };
+    getConfiguration()->indexedDecode = indexedDecode;
+    signal->message->indexedDecode = messageIndexedDecode;
+    QUEUE_PUSH(CanMessage, &bus->receiveQueue, brakeMessage);
+    receiveCan(&getConfiguration()->pipeline, bus);
+    getConfiguration()->indexedDecode = DEFAULT_INDEXED_DECODE_STATUS;
+    signal->message->indexedDecode = false;
+    return signal->received;
+}
+
+START_TEST (test_receive_can_indexed_decode)
+{
+    // the generated decodeCanMessage for the tests doesn't translate it
+    fail_if(receiveBrakePedalMessage(false, true));
+    fail_unless(receiveBrakePedalMessage(true, true));
+    ck_assert_int_eq(getSignals()[2].lastValue, 1);
+}
+END_TEST
+
+START_TEST (test_receive_can_indexed_decode_not_opted_in)
+{
+    // generated definitions leave the flag unset, e.g. for custom handlers
+    fail_unless(getSignals()[2].message->indexedDecode == false);
+    fail_if(receiveBrakePedalMessage(true, false));
+}
+END_TEST
+
 START_TEST (test_loop)
 {
     firmwareLoop();
@@ -103,6 +214,12 @@ Suite* suite(void) {
     tcase_add_test(tc_core, test_update_data_lights_can_inactive);
     tcase_add_test(tc_core, test_update_data_lights_suspend);
 
+    tcase_add_test(tc_core, test_receive_can_batch);
+    tcase_add_test(tc_core, test_receive_can_batch_minimum);
+    tcase_add_test(tc_core, test_receive_can_batch_stats);
+    tcase_add_test(tc_core, test_receive_can_latency);
+    tcase_add_test(tc_core, test_receive_can_indexed_decode);
+    tcase_add_test(tc_core, test_receive_can_indexed_decode_not_opted_in);
     tcase_add_test(tc_core, test_loop);
 
     suite_add_tcase(s, tc_core);
@@ -1,37 +1,165 @@
+#include <string.h>
 #include "bytebuffer.h"
 #include "strutil.h"
 #include "util/log.h"
 
+// The queue's ring of storage has 1 more byte than it can hold, to tell a full
+// queue from an empty one.
+#define BYTE_QUEUE_STORAGE_SIZE (QUEUE_MAX_LENGTH(uint8_t) + 1)
+
+// The most bytes a varint can take to encode a 32 bit message length.
+#define MAX_VARINT_LENGTH 5
+
 QUEUE_DEFINE(uint8_t)
 
 using openxc::util::log::debug;
 using openxc::util::bytebuffer::IncomingMessageCallback;
+using openxc::util::bytebuffer::ByteSpan;
+using openxc::util::bytebuffer::MessageFramer;
+using openxc::payload::PayloadFormat;
 
-bool openxc::util::bytebuffer::processQueue(QUEUE_TYPE(uint8_t)* queue,
-        IncomingMessageCallback callback) {
-    int length = QUEUE_LENGTH(uint8_t, queue);
-    if(length == 0) {
-        return false;
+// A message that wraps around the end of a queue's storage is copied here, so
+// it can be passed to a callback in one piece.
+static uint8_t frameBuffer[QUEUE_MAX_LENGTH(uint8_t)];
+
+/* Private: Return the byte at an offset into the data returned by peek(...).
+ */
+static uint8_t byteAt(ByteSpan* spans, int offset) {
+    if(offset < spans[0].length) {
+        return spans[0].data[offset];
+    }
+    return spans[1].data[offset - spans[0].length];
+}
+
+/* Private: Start searching for the end of a new message, in the same format.
+ */
+static void resetFramer(MessageFramer* framer) {
+    framer->scannedLength = 0;
+    framer->messageLength = 0;
+}
+
+/* Private: Find the end of a JSON message, searching only the bytes that
+ * haven't been searched already.
+ *
+ * Returns the length of the message including its NULL delimiter, or 0 if it
+ * isn't complete yet.
+ */
+static int findDelimitedMessage(MessageFramer* framer, ByteSpan* spans,
+        int spanCount, int length) {
+    int offset = 0;
+    for(int i = 0; i < spanCount; i++) {
+        int start = framer->scannedLength - offset;
+        if(start < 0) {
+            start = 0;
+        }
+
+        if(start < spans[i].length) {
+            const uint8_t* delimiter = (const uint8_t*) memchr(
+                    &spans[i].data[start], '\0', spans[i].length - start);
+            if(delimiter != NULL) {
+                return offset + (delimiter - spans[i].data) + 1;
+            }
+        }
+        offset += spans[i].length;
+    }
+
+    framer->scannedLength = length;
+    return 0;
+}
+
+/* Private: Find the end of a protobuf message from its varint length prefix,
+ * which is only decoded once.
+ *
+ * Returns the length of the message including its prefix, 0 if it isn't
+ * complete yet, or -1 if the prefix is invalid or the message could never fit
+ * in the queue.
+ */
+static int findLengthPrefixedMessage(MessageFramer* framer, ByteSpan* spans,
+        int length) {
+    if(framer->messageLength == 0) {
+        uint32_t payloadLength = 0;
+        int prefixLength = 0;
+        bool prefixComplete = false;
+        while(!prefixComplete && prefixLength < length &&
+                prefixLength < MAX_VARINT_LENGTH) {
+            uint8_t byte = byteAt(spans, prefixLength);
+            payloadLength |= (uint32_t)(byte & 0x7f) << (7 * prefixLength);
+            prefixComplete = !(byte & 0x80);
+            ++prefixLength;
+        }
+
+        if(!prefixComplete) {
+            return prefixLength == MAX_VARINT_LENGTH ? -1 : 0;
+        } else if(payloadLength > (uint32_t) QUEUE_MAX_LENGTH(uint8_t) -
+                prefixLength) {
+            return -1;
+        }
+        framer->messageLength = prefixLength + payloadLength;
     }
+    return length >= framer->messageLength ? framer->messageLength : 0;
+}
 
-    uint8_t snapshot[length];
-    QUEUE_SNAPSHOT(uint8_t, queue, snapshot, length);
+void openxc::util::bytebuffer::initializeFramer(MessageFramer* framer) {
+    framer->format = PayloadFormat::JSON;
+    resetFramer(framer);
+}
+
+bool openxc::util::bytebuffer::processQueue(QUEUE_TYPE(uint8_t)* queue,
+        MessageFramer* framer, PayloadFormat format,
+        IncomingMessageCallback callback) {
     if(callback == NULL) {
         debug("Callback is NULL (%p) -- unable to handle queue at %p",
                 callback, queue);
         return false;
     }
 
-    size_t parsedLength = callback(snapshot, length);
-    for(size_t i = 0; i < parsedLength; i++) {
-        QUEUE_POP(uint8_t, queue);
+    if(framer->format != format) {
+        // Anything already searched was searched for the wrong delimiter
+        resetFramer(framer);
+        framer->format = format;
+    }
+
+    ByteSpan spans[BYTE_QUEUE_MAX_SPANS];
+    int spanCount = peek(queue, spans);
+    if(spanCount == 0) {
+        return false;
+    }
+
+    int length = 0;
+    for(int i = 0; i < spanCount; i++) {
+        length += spans[i].length;
+    }
+
+    int messageLength;
+    if(format == PayloadFormat::PROTOBUF) {
+        messageLength = findLengthPrefixedMessage(framer, spans, length);
+    } else {
+        messageLength = findDelimitedMessage(framer, spans, spanCount, length);
     }
 
-    if(QUEUE_FULL(uint8_t, queue)) {
+    if(messageLength < 0 ||
+            (messageLength == 0 && QUEUE_FULL(uint8_t, queue))) {
         debug("Incoming write is too long - dumping queue");
         QUEUE_INIT(uint8_t, queue);
+        resetFramer(framer);
+        return false;
+    } else if(messageLength == 0) {
+        return false;
+    }
+
+    // The callback needs the message in one piece
+    uint8_t* message = spans[0].data;
+    if(messageLength > spans[0].length) {
+        memcpy(frameBuffer, spans[0].data, spans[0].length);
+        memcpy(&frameBuffer[spans[0].length], spans[1].data,
+                messageLength - spans[0].length);
+        message = frameBuffer;
     }
-    return parsedLength > 0;
+
+    callback(message, messageLength);
+    consume(queue, messageLength);
+    resetFramer(framer);
+    return true;
 }
 
 bool openxc::util::bytebuffer::messageFits(QUEUE_TYPE(uint8_t)* queue, uint8_t* message,
@@ -42,10 +170,79 @@ bool openxc::util::bytebuffer::messageFits(QUEUE_TYPE(uint8_t)* queue, uint8_t*
 bool openxc::util::bytebuffer::conditionalEnqueue(QUEUE_TYPE(uint8_t)* queue, uint8_t* message,
         int messageSize) {
     if(messageFits(queue, message, messageSize)) {
-        for(int i = 0; i < messageSize; i++) {
-            QUEUE_PUSH(uint8_t, queue, (uint8_t)message[i]);
+        ByteSpan spans[BYTE_QUEUE_MAX_SPANS];
+        int spanCount = reserve(queue, messageSize, spans);
+        int copied = 0;
+        for(int i = 0; i < spanCount; i++) {
+            memcpy(spans[i].data, &message[copied], spans[i].length);
+            copied += spans[i].length;
         }
+        commit(queue, copied);
         return true;
     }
     return false;
 }
+
+int openxc::util::bytebuffer::reserve(QUEUE_TYPE(uint8_t)* queue, int length,
+        ByteSpan* spans) {
+    if(queue == NULL || length <= 0 ||
+            QUEUE_AVAILABLE(uint8_t, queue) < length) {
+        return 0;
+    }
+
+    int head = queue->head;
+    int firstLength = BYTE_QUEUE_STORAGE_SIZE - head;
+    if(firstLength > length) {
+        firstLength = length;
+    }
+
+    spans[0].data = &queue->elements[head];
+    spans[0].length = firstLength;
+    if(firstLength == length) {
+        return 1;
+    }
+
+    spans[1].data = &queue->elements[0];
+    spans[1].length = length - firstLength;
+    return 2;
+}
+
+void openxc::util::bytebuffer::commit(QUEUE_TYPE(uint8_t)* queue,
+        int length) {
+    queue->head = (queue->head + length) % BYTE_QUEUE_STORAGE_SIZE;
+}
+
+int openxc::util::bytebuffer::peek(QUEUE_TYPE(uint8_t)* queue,
+        ByteSpan* spans) {
+    if(queue == NULL) {
+        return 0;
+    }
+
+    // Read the head once, in case a writer in an interrupt handler is adding
+    // to the queue
+    int head = queue->head;
+    int tail = queue->tail;
+    if(head == tail) {
+        return 0;
+    }
+
+    spans[0].data = &queue->elements[tail];
+    if(head > tail) {
+        spans[0].length = head - tail;
+        return 1;
+    }
+
+    spans[0].length = BYTE_QUEUE_STORAGE_SIZE - tail;
+    if(head == 0) {
+        return 1;
+    }
+
+    spans[1].data = &queue->elements[0];
+    spans[1].length = head;
+    return 2;
+}
+
+void openxc::util::bytebuffer::consume(QUEUE_TYPE(uint8_t)* queue,
+        int length) {
+    queue->tail = (queue->tail + length) % BYTE_QUEUE_STORAGE_SIZE;
+}
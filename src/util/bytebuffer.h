@@ -3,9 +3,14 @@
 
 #include "emqueue.h"
 #include "commands/commands.h"
+#include "payload/payload.h"
 
 QUEUE_DECLARE(uint8_t, 320)
 
+// A byte queue's storage is a ring, so any range of bytes in it is split
+// across at most 2 contiguous regions.
+#define BYTE_QUEUE_MAX_SPANS 2
+
 namespace openxc {
 namespace util {
 namespace bytebuffer {
@@ -21,17 +26,63 @@ namespace bytebuffer {
  */
 typedef size_t (*IncomingMessageCallback)(uint8_t* buffer, size_t length);
 
-/* Public: Search for a complete message in the queue, remove it and pass it to
- * the callback. If no message is found, reset the queue back to empty if it's
- * full.
+/* Public: A contiguous region of a byte queue's storage.
+ *
+ * data - A pointer to the first byte of the region.
+ * length - The number of bytes in the region.
+ */
+typedef struct {
+    uint8_t* data;
+    int length;
+} ByteSpan;
+
+/* Public: The state of the search for the end of the message at the front of
+ * a byte queue, kept between calls to processQueue(...) so the bytes that
+ * arrived earlier don't have to be examined again. Zero it to initialize it,
+ * e.g. with initializeFramer(...).
+ *
+ * format - The payload format the queue was last framed with. JSON messages end
+ *      with a NULL character and protobuf messages start with their length as
+ *      a varint.
+ * scannedLength - The number of bytes at the front of the queue already
+ *      searched for the end of a JSON message without finding it.
+ * messageLength - The total length of the protobuf message at the front of the
+ *      queue including its length prefix, or 0 if it isn't known yet.
+ */
+typedef struct {
+    openxc::payload::PayloadFormat format;
+    int scannedLength;
+    int messageLength;
+} MessageFramer;
+
+/* Public: Reset a framer to start searching for a new message.
+ */
+void initializeFramer(MessageFramer* framer);
+
+/* Public: Search for a complete message in the queue, looking only at the bytes
+ * that arrived since the last call. If one is found, pass exactly that message
+ * to the callback and remove it from the queue. If no message is found, reset
+ * the queue back to empty if it's full.
+ *
+ * The callback is only ever given a complete message, so it's called once per
+ * message no matter how many pieces it arrived in. A message that wraps around
+ * the end of the queue's storage is copied to a static buffer first, so this
+ * must not be called from an interrupt handler.
  *
  * queue - The queue of bytes to check for a message.
- * callback - A function that will return true if an OpenXC message is found in
- *          the queue.
+ * framer - The state of the search for the end of the message, which must only
+ *      be used with this queue.
+ * format - The payload format of the messages, which determines how they're
+ *      delimited.
+ * callback - A function that will return the number of bytes read if an
+ *          OpenXC message is found in the payload.
  *
- * Returns true if a completed message was found in the queue and removed.
+ * Returns true if a completed message was found in the queue and removed, even
+ * if the callback couldn't parse it.
  */
-bool processQueue(QUEUE_TYPE(uint8_t)* queue, IncomingMessageCallback callback);
+bool processQueue(QUEUE_TYPE(uint8_t)* queue, MessageFramer* framer,
+        openxc::payload::PayloadFormat format,
+        IncomingMessageCallback callback);
 
 /* Public: Add the message to the byte queue if there is room.
  *
@@ -56,6 +107,51 @@ bool conditionalEnqueue(QUEUE_TYPE(uint8_t)* queue, uint8_t* message,
  */
 bool messageFits(QUEUE_TYPE(uint8_t)* queue, uint8_t* message, int messageSize);
 
+/* Public: Reserve room at the end of the byte queue to write data directly
+ * into its storage, e.g. with memcpy. The data isn't added to the queue until
+ * it's committed with commit(...).
+ *
+ * Only one writer may use this on a queue at a time, and nothing else may push
+ * to the queue between reserve(...) and commit(...).
+ *
+ * queue - The queue to reserve room in.
+ * length - The number of bytes to reserve.
+ * spans - An array of at least BYTE_QUEUE_MAX_SPANS spans to store the
+ *      regions of the queue's storage to write to, in order.
+ *
+ * Returns the number of spans used, or 0 if there isn't room for length bytes
+ * or queue is NULL.
+ */
+int reserve(QUEUE_TYPE(uint8_t)* queue, int length, ByteSpan* spans);
+
+/* Public: Add bytes written into space previously returned by reserve(...) to
+ * the end of the queue.
+ *
+ * queue - The queue to commit to.
+ * length - The number of bytes written, no more than were reserved.
+ */
+void commit(QUEUE_TYPE(uint8_t)* queue, int length);
+
+/* Public: Find the bytes waiting in the queue, so they can be read directly
+ * from its storage without removing them one by one. They stay in the queue
+ * until they're removed with consume(...).
+ *
+ * queue - The queue to read.
+ * spans - An array of at least BYTE_QUEUE_MAX_SPANS spans to store the
+ *      regions of the queue's storage with data, oldest first.
+ *
+ * Returns the number of spans used, or 0 if the queue is empty or NULL.
+ */
+int peek(QUEUE_TYPE(uint8_t)* queue, ByteSpan* spans);
+
+/* Public: Remove bytes previously returned by peek(...) from the front of the
+ * queue.
+ *
+ * queue - The queue to remove bytes from.
+ * length - The number of bytes to remove, no more than are in the queue.
+ */
+void consume(QUEUE_TYPE(uint8_t)* queue, int length);
+
 } // namespace bytebuffer
 } // namespace util
 } // namespace openxc
@@ -0,0 +1,466 @@
+#include "util/jsontokenizer.h"
+
+#include <math.h>
+#include <string.h>
+#include <strings.h>
+
+using openxc::util::jsontokenizer::JsonToken;
+using openxc::util::jsontokenizer::JsonTokenType;
+
+/* Private: What the tokenizer expects next in the text.
+ */
+typedef enum {
+    EXPECT_VALUE,
+    EXPECT_VALUE_OR_CLOSE,
+    EXPECT_KEY,
+    EXPECT_KEY_OR_CLOSE,
+    EXPECT_COLON,
+    EXPECT_COMMA_OR_CLOSE,
+} Expectation;
+
+static bool isWhitespace(char character) {
+    return character == ' ' || character == '\t' || character == '\n' ||
+        character == '\r';
+}
+
+static bool isDigit(char character) {
+    return character >= '0' && character <= '9';
+}
+
+static int hexDigitValue(char character) {
+    if(isDigit(character)) {
+        return character - '0';
+    } else if(character >= 'a' && character <= 'f') {
+        return character - 'a' + 10;
+    } else if(character >= 'A' && character <= 'F') {
+        return character - 'A' + 10;
+    }
+    return -1;
+}
+
+/* Private: Add a token to the array.
+ *
+ * Returns the index of the token, or JSON_ERROR_TOO_MANY_TOKENS if the array
+ * is full.
+ */
+static int addToken(JsonToken* tokens, int maxTokens, int* tokenCount,
+        JsonTokenType type, size_t start, size_t end) {
+    if(*tokenCount >= maxTokens) {
+        return JSON_ERROR_TOO_MANY_TOKENS;
+    }
+    tokens[*tokenCount].type = type;
+    tokens[*tokenCount].start = start;
+    tokens[*tokenCount].end = end;
+    return (*tokenCount)++;
+}
+
+/* Private: Find the closing quote of a string.
+ *
+ * position - The offset just after the opening quote.
+ *
+ * Returns the offset of the closing quote, or JSON_ERROR_INCOMPLETE if the
+ * text ends first.
+ */
+static int scanString(const char* json, size_t length, size_t position) {
+    for(; position < length; position++) {
+        if(json[position] == '\"') {
+            return position;
+        } else if(json[position] == '\\') {
+            // Skip whatever is escaped, which might be a quote
+            position++;
+        }
+    }
+    return JSON_ERROR_INCOMPLETE;
+}
+
+/* Private: Return true if the text is a JSON number, i.e. an optional minus
+ * sign, digits, then optionally a fraction and an exponent.
+ */
+static bool isValidNumber(const char* text, size_t length) {
+    size_t position = 0;
+    if(position < length && text[position] == '-') {
+        position++;
+    }
+
+    size_t digitsStart = position;
+    while(position < length && isDigit(text[position])) {
+        position++;
+    }
+    if(position == digitsStart) {
+        return false;
+    }
+
+    if(position < length && text[position] == '.') {
+        digitsStart = ++position;
+        while(position < length && isDigit(text[position])) {
+            position++;
+        }
+        if(position == digitsStart) {
+            return false;
+        }
+    }
+
+    if(position < length && (text[position] == 'e' ||
+                text[position] == 'E')) {
+        position++;
+        if(position < length && (text[position] == '+' ||
+                    text[position] == '-')) {
+            position++;
+        }
+        digitsStart = position;
+        while(position < length && isDigit(text[position])) {
+            position++;
+        }
+        if(position == digitsStart) {
+            return false;
+        }
+    }
+    return position == length;
+}
+
+static bool isValidPrimitive(const char* text, size_t length) {
+    return (length == 4 && !strncmp(text, "true", 4)) ||
+        (length == 5 && !strncmp(text, "false", 5)) ||
+        (length == 4 && !strncmp(text, "null", 4)) ||
+        isValidNumber(text, length);
+}
+
+int openxc::util::jsontokenizer::nextSibling(const JsonToken* tokens,
+        int tokenCount, int index) {
+    int next = index + 1;
+    while(next < tokenCount && tokens[next].start < tokens[index].end) {
+        next++;
+    }
+    return next;
+}
+
+int openxc::util::jsontokenizer::tokenize(const char* json, size_t length,
+        JsonToken* tokens, int maxTokens) {
+    if(length > MAX_JSON_LENGTH) {
+        return JSON_ERROR_INVALID;
+    }
+
+    // The open objects and arrays, innermost last
+    int containers[MAX_JSON_DEPTH];
+    int depth = 0;
+    int tokenCount = 0;
+    Expectation expected = EXPECT_VALUE;
+    size_t position = 0;
+    while(position < length) {
+        char character = json[position];
+        if(isWhitespace(character)) {
+            position++;
+            continue;
+        }
+
+        if(depth == 0 && character != '{') {
+            return JSON_ERROR_INVALID;
+        }
+
+        int token;
+        switch(character) {
+        case '{':
+        case '[':
+            if((expected != EXPECT_VALUE && expected != EXPECT_VALUE_OR_CLOSE)
+                    || depth >= MAX_JSON_DEPTH) {
+                return JSON_ERROR_INVALID;
+            }
+
+            token = addToken(tokens, maxTokens, &tokenCount,
+                    character == '{' ? JsonTokenType::OBJECT :
+                        JsonTokenType::ARRAY, position, position);
+            if(token < 0) {
+                return token;
+            }
+            containers[depth++] = token;
+            expected = character == '{' ? EXPECT_KEY_OR_CLOSE :
+                    EXPECT_VALUE_OR_CLOSE;
+            position++;
+            break;
+        case '}':
+        case ']': {
+            JsonTokenType type = character == '}' ? JsonTokenType::OBJECT :
+                    JsonTokenType::ARRAY;
+            if(tokens[containers[depth - 1]].type != type ||
+                    (expected != EXPECT_COMMA_OR_CLOSE && expected !=
+                        (type == JsonTokenType::OBJECT ? EXPECT_KEY_OR_CLOSE :
+                            EXPECT_VALUE_OR_CLOSE))) {
+                return JSON_ERROR_INVALID;
+            }
+
+            tokens[containers[--depth]].end = ++position;
+            if(depth == 0) {
+                return tokenCount;
+            }
+            expected = EXPECT_COMMA_OR_CLOSE;
+            break;
+        }
+        case '\"': {
+            bool key = expected == EXPECT_KEY ||
+                    expected == EXPECT_KEY_OR_CLOSE;
+            if(!key && expected != EXPECT_VALUE &&
+                    expected != EXPECT_VALUE_OR_CLOSE) {
+                return JSON_ERROR_INVALID;
+            }
+
+            int end = scanString(json, length, position + 1);
+            if(end < 0) {
+                return end;
+            }
+            token = addToken(tokens, maxTokens, &tokenCount,
+                    JsonTokenType::STRING, position + 1, end);
+            if(token < 0) {
+                return token;
+            }
+            position = end + 1;
+            expected = key ? EXPECT_COLON : EXPECT_COMMA_OR_CLOSE;
+            break;
+        }
+        case ':':
+            if(expected != EXPECT_COLON) {
+                return JSON_ERROR_INVALID;
+            }
+            expected = EXPECT_VALUE;
+            position++;
+            break;
+        case ',':
+            if(expected != EXPECT_COMMA_OR_CLOSE) {
+                return JSON_ERROR_INVALID;
+            }
+            expected = tokens[containers[depth - 1]].type ==
+                    JsonTokenType::OBJECT ? EXPECT_KEY : EXPECT_VALUE;
+            position++;
+            break;
+        default: {
+            if(expected != EXPECT_VALUE && expected != EXPECT_VALUE_OR_CLOSE) {
+                return JSON_ERROR_INVALID;
+            }
+
+            size_t end = position;
+            while(end < length && !isWhitespace(json[end]) &&
+                    strchr(",:]}\"", json[end]) == NULL) {
+                end++;
+            }
+            if(end == length) {
+                // The number might not be finished yet
+                return JSON_ERROR_INCOMPLETE;
+            } else if(!isValidPrimitive(&json[position], end - position)) {
+                return JSON_ERROR_INVALID;
+            }
+
+            token = addToken(tokens, maxTokens, &tokenCount,
+                    JsonTokenType::PRIMITIVE, position, end);
+            if(token < 0) {
+                return token;
+            }
+            position = end;
+            expected = EXPECT_COMMA_OR_CLOSE;
+            break;
+        }
+        }
+    }
+    return JSON_ERROR_INCOMPLETE;
+}
+
+int openxc::util::jsontokenizer::findField(const char* json,
+        const JsonToken* tokens, int tokenCount, int object,
+        const char* name) {
+    if(object < 0 || object >= tokenCount ||
+            tokens[object].type != JsonTokenType::OBJECT) {
+        return NO_JSON_TOKEN;
+    }
+
+    size_t nameLength = strlen(name);
+    int key = object + 1;
+    while(key + 1 < tokenCount && tokens[key].start < tokens[object].end) {
+        if((size_t)(tokens[key].end - tokens[key].start) == nameLength &&
+                !strncasecmp(&json[tokens[key].start], name, nameLength)) {
+            return key + 1;
+        }
+        key = nextSibling(tokens, tokenCount, key + 1);
+    }
+    return NO_JSON_TOKEN;
+}
+
+bool openxc::util::jsontokenizer::isString(const JsonToken* token) {
+    return token->type == JsonTokenType::STRING;
+}
+
+bool openxc::util::jsontokenizer::isBoolean(const char* json,
+        const JsonToken* token) {
+    return token->type == JsonTokenType::PRIMITIVE &&
+        (json[token->start] == 't' || json[token->start] == 'f');
+}
+
+bool openxc::util::jsontokenizer::isNumber(const char* json,
+        const JsonToken* token) {
+    return token->type == JsonTokenType::PRIMITIVE &&
+        (json[token->start] == '-' || isDigit(json[token->start]));
+}
+
+double openxc::util::jsontokenizer::toDouble(const char* json,
+        const JsonToken* token) {
+    if(!isNumber(json, token)) {
+        return 0;
+    }
+
+    // The same steps as cJSON's parse_number, so the results are identical
+    const char* number = &json[token->start];
+    double value = 0, sign = 1, scale = 0;
+    int subscale = 0, signsubscale = 1;
+    if(*number == '-') {
+        sign = -1;
+        number++;
+    }
+    if(*number == '0') {
+        number++;
+    }
+    while(isDigit(*number)) {
+        value = (value * 10.0) + (*number++ - '0');
+    }
+    if(*number == '.' && isDigit(number[1])) {
+        number++;
+        while(isDigit(*number)) {
+            value = (value * 10.0) + (*number++ - '0');
+            scale--;
+        }
+    }
+    if(*number == 'e' || *number == 'E') {
+        number++;
+        if(*number == '+') {
+            number++;
+        } else if(*number == '-') {
+            signsubscale = -1;
+            number++;
+        }
+        while(isDigit(*number)) {
+            subscale = (subscale * 10) + (*number++ - '0');
+        }
+    }
+    return sign * value * pow(10.0, (scale + subscale * signsubscale));
+}
+
+int openxc::util::jsontokenizer::toInt(const char* json,
+        const JsonToken* token) {
+    if(isNumber(json, token)) {
+        return (int) toDouble(json, token);
+    }
+    return token->type == JsonTokenType::PRIMITIVE && json[token->start] == 't';
+}
+
+/* Private: Read the 4 hex digits of a \u escape.
+ *
+ * Returns the code unit, or -1 if they aren't all hex digits.
+ */
+static long readCodeUnit(const char* text, const char* end) {
+    if(end - text < 4) {
+        return -1;
+    }
+
+    long codeUnit = 0;
+    for(int i = 0; i < 4; i++) {
+        int digit = hexDigitValue(text[i]);
+        if(digit < 0) {
+            return -1;
+        }
+        codeUnit = (codeUnit << 4) | digit;
+    }
+    return codeUnit;
+}
+
+/* Private: Write a code point as UTF-8.
+ *
+ * Returns the number of bytes written, from 1 to 4.
+ */
+static int encodeUtf8(long codePoint, char* utf8) {
+    if(codePoint < 0x80) {
+        utf8[0] = codePoint;
+        return 1;
+    } else if(codePoint < 0x800) {
+        utf8[0] = 0xc0 | (codePoint >> 6);
+        utf8[1] = 0x80 | (codePoint & 0x3f);
+        return 2;
+    } else if(codePoint < 0x10000) {
+        utf8[0] = 0xe0 | (codePoint >> 12);
+        utf8[1] = 0x80 | ((codePoint >> 6) & 0x3f);
+        utf8[2] = 0x80 | (codePoint & 0x3f);
+        return 3;
+    }
+    utf8[0] = 0xf0 | (codePoint >> 18);
+    utf8[1] = 0x80 | ((codePoint >> 12) & 0x3f);
+    utf8[2] = 0x80 | ((codePoint >> 6) & 0x3f);
+    utf8[3] = 0x80 | (codePoint & 0x3f);
+    return 4;
+}
+
+bool openxc::util::jsontokenizer::copyString(const char* json,
+        const JsonToken* token, char* buffer, size_t bufferSize) {
+    if(bufferSize == 0) {
+        return false;
+    } else if(!isString(token)) {
+        buffer[0] = '\0';
+        return false;
+    }
+
+    const char* next = &json[token->start];
+    const char* end = &json[token->end];
+    size_t length = 0;
+    bool fit = true;
+    while(next < end) {
+        char unescaped[4];
+        int unescapedLength = 1;
+        if(*next != '\\') {
+            unescaped[0] = *next++;
+        } else {
+            next++;
+            switch(*next++) {
+                case 'b': unescaped[0] = '\b'; break;
+                case 'f': unescaped[0] = '\f'; break;
+                case 'n': unescaped[0] = '\n'; break;
+                case 'r': unescaped[0] = '\r'; break;
+                case 't': unescaped[0] = '\t'; break;
+                case 'u': {
+                    long codePoint = readCodeUnit(next, end);
+                    if(codePoint < 0) {
+                        unescapedLength = 0;
+                        break;
+                    }
+                    next += 4;
+
+                    // A pair of code units for anything outside of the BMP
+                    if(codePoint >= 0xd800 && codePoint <= 0xdbff &&
+                            end - next >= 6 && next[0] == '\\' &&
+                            next[1] == 'u') {
+                        long low = readCodeUnit(next + 2, end);
+                        if(low >= 0xdc00 && low <= 0xdfff) {
+                            codePoint = 0x10000 + (((codePoint & 0x3ff) << 10) |
+                                    (low & 0x3ff));
+                            next += 6;
+                        }
+                    }
+
+                    if(codePoint == 0 || (codePoint >= 0xd800 &&
+                                codePoint <= 0xdfff)) {
+                        unescapedLength = 0;
+                    } else {
+                        unescapedLength = encodeUtf8(codePoint, unescaped);
+                    }
+                    break;
+                }
+                default:
+                    // \", \\, \/ and anything else is the character itself
+                    unescaped[0] = next[-1];
+                    break;
+            }
+        }
+
+        if(length + unescapedLength >= bufferSize) {
+            fit = false;
+            break;
+        }
+        memcpy(&buffer[length], unescaped, unescapedLength);
+        length += unescapedLength;
+    }
+    buffer[length] = '\0';
+    return fit;
+}
@@ -0,0 +1,147 @@
+#ifndef __JSONTOKENIZER_H__
+#define __JSONTOKENIZER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Enough for the largest command, a diagnostic request with every field set.
+#define MAX_JSON_TOKENS 40
+
+// The deepest nesting of objects and arrays the tokenizer accepts.
+#define MAX_JSON_DEPTH 8
+
+// The longest JSON text the tokenizer accepts, so token offsets fit in 16 bits.
+#define MAX_JSON_LENGTH 0xffff
+
+#define JSON_ERROR_INVALID -1
+#define JSON_ERROR_TOO_MANY_TOKENS -2
+#define JSON_ERROR_INCOMPLETE -3
+
+// Returned by findField(...) if the object doesn't have the field.
+#define NO_JSON_TOKEN -1
+
+namespace openxc {
+namespace util {
+namespace jsontokenizer {
+
+/* Public: The types of JSON tokens.
+ *
+ * OBJECT - An object, followed by a STRING token for each key and the token(s)
+ *      of its value.
+ * ARRAY - An array, followed by the token(s) of each element.
+ * STRING - A string, without the quotes and still escaped.
+ * PRIMITIVE - A number, true, false or null.
+ */
+typedef enum {
+    OBJECT,
+    ARRAY,
+    STRING,
+    PRIMITIVE,
+} JsonTokenType;
+
+/* Public: A token in a JSON text, which points into the text instead of
+ * copying from it. The tokens are in the order they appear in the text, so
+ * everything inside an object or array comes right after it.
+ *
+ * type - The JsonTokenType of the token.
+ * start - The offset of the first character of the token in the text.
+ * end - The offset just past the last character of the token.
+ */
+typedef struct {
+    JsonTokenType type;
+    uint16_t start;
+    uint16_t end;
+} JsonToken;
+
+/* Public: A JSON text, split into tokens in place.
+ *
+ * text - The JSON text, which the tokens point into.
+ * tokens - The tokens of the text, the root object first.
+ * tokenCount - The number of tokens.
+ */
+typedef struct {
+    const char* text;
+    JsonToken tokens[MAX_JSON_TOKENS];
+    int tokenCount;
+} JsonDocument;
+
+/* Public: Split a JSON object into tokens, without any heap allocations or
+ * recursion.
+ *
+ * The text has to start with the object, and anything after the end of the
+ * object is ignored.
+ *
+ * json - The JSON text. It doesn't need to be NULL terminated.
+ * length - The length of the text, at most MAX_JSON_LENGTH.
+ * tokens - An array to store the tokens in.
+ * maxTokens - The size of the tokens array.
+ *
+ * Returns the number of tokens, JSON_ERROR_INVALID if the text isn't a valid
+ * JSON object or it's nested more than MAX_JSON_DEPTH deep,
+ * JSON_ERROR_INCOMPLETE if the text ends before the object does, or
+ * JSON_ERROR_TOO_MANY_TOKENS if there isn't room for all of the tokens.
+ */
+int tokenize(const char* json, size_t length, JsonToken* tokens,
+        int maxTokens);
+
+/* Public: Find the value of a field in an object. Field names are compared
+ * without regard to case, and the first match wins, the same as cJSON.
+ *
+ * json - The JSON text that was tokenized.
+ * tokens - The tokens of the text.
+ * tokenCount - The number of tokens.
+ * object - The index of the object's token.
+ * name - The name of the field.
+ *
+ * Returns the index of the value's token, or NO_JSON_TOKEN if the object
+ * doesn't have the field or the token isn't an object.
+ */
+int findField(const char* json, const JsonToken* tokens, int tokenCount,
+        int object, const char* name);
+
+/* Public: Return the index of the token after a value and everything inside
+ * it, e.g. the next element of an array. This is tokenCount if it was the last
+ * value in the text.
+ */
+int nextSibling(const JsonToken* tokens, int tokenCount, int index);
+
+/* Public: Return true if the token is a string.
+ */
+bool isString(const JsonToken* token);
+
+/* Public: Return true if the token is true or false.
+ */
+bool isBoolean(const char* json, const JsonToken* token);
+
+/* Public: Return true if the token is a number.
+ */
+bool isNumber(const char* json, const JsonToken* token);
+
+/* Public: Read a number token exactly as cJSON would parse it, or 0 if the
+ * token isn't a number.
+ */
+double toDouble(const char* json, const JsonToken* token);
+
+/* Public: Read a token as an integer like cJSON's valueint - a number cast to
+ * an int, 1 for true, and 0 for anything else.
+ */
+int toInt(const char* json, const JsonToken* token);
+
+/* Public: Copy a string token to a buffer, unescaping it.
+ *
+ * json - The JSON text that was tokenized.
+ * token - The string token.
+ * buffer - The buffer to copy the NULL terminated string to.
+ * bufferSize - The size of the buffer.
+ *
+ * Returns true if the token is a string and it fit in the buffer. If it didn't
+ * fit, the buffer has as much of it as fit.
+ */
+bool copyString(const char* json, const JsonToken* token, char* buffer,
+        size_t bufferSize);
+
+} // namespace jsontokenizer
+} // namespace util
+} // namespace openxc
+
+#endif // __JSONTOKENIZER_H__
@@ -0,0 +1,115 @@
+#include "util/metrics.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "util/log.h"
+
+using openxc::util::log::debug;
+using openxc::util::metrics::Metric;
+using openxc::util::metrics::MetricType;
+using openxc::util::statistics::Histogram;
+
+static Metric METRICS[MAX_METRICS];
+static int METRIC_COUNT;
+
+void openxc::util::metrics::initialize() {
+    METRIC_COUNT = 0;
+}
+
+/* Private: Return the registry entry for a metric, reusing the existing one if
+ * it's already registered, or NULL if the registry is full.
+ */
+static Metric* claimMetric(const char* group, uint8_t instance,
+        const char* name) {
+    Metric* metric = (Metric*) openxc::util::metrics::lookupMetric(group,
+            instance, name);
+    if(metric == NULL) {
+        if(METRIC_COUNT >= MAX_METRICS) {
+            debug("No room to register metric %s.%s", group, name);
+            return NULL;
+        }
+        metric = &METRICS[METRIC_COUNT++];
+    }
+
+    memset(metric, 0, sizeof(Metric));
+    metric->group = group;
+    metric->instance = instance;
+    metric->name = name;
+    return metric;
+}
+
+bool openxc::util::metrics::registerCounter(const char* group,
+        uint8_t instance, const char* name, const unsigned int* counter) {
+    Metric* metric = claimMetric(group, instance, name);
+    if(metric != NULL) {
+        metric->type = MetricType::COUNTER;
+        metric->counter = counter;
+    }
+    return metric != NULL;
+}
+
+bool openxc::util::metrics::registerGauge(const char* group, uint8_t instance,
+        const char* name, int (*read)(void* context), void* context) {
+    Metric* metric = claimMetric(group, instance, name);
+    if(metric != NULL) {
+        metric->type = MetricType::GAUGE;
+        metric->read = read;
+        metric->context = context;
+    }
+    return metric != NULL;
+}
+
+bool openxc::util::metrics::registerHistogram(const char* group,
+        uint8_t instance, const char* name, const Histogram* histogram) {
+    Metric* metric = claimMetric(group, instance, name);
+    if(metric != NULL) {
+        metric->type = MetricType::HISTOGRAM;
+        metric->histogram = histogram;
+    }
+    return metric != NULL;
+}
+
+int openxc::util::metrics::getMetricCount() {
+    return METRIC_COUNT;
+}
+
+const Metric* openxc::util::metrics::getMetric(int index) {
+    return index >= 0 && index < METRIC_COUNT ? &METRICS[index] : NULL;
+}
+
+const Metric* openxc::util::metrics::lookupMetric(const char* group,
+        uint8_t instance, const char* name) {
+    for(int i = 0; i < METRIC_COUNT; i++) {
+        if(METRICS[i].instance == instance && !strcmp(METRICS[i].name, name) &&
+                !strcmp(METRICS[i].group, group)) {
+            return &METRICS[i];
+        }
+    }
+    return NULL;
+}
+
+long openxc::util::metrics::read(const Metric* metric) {
+    switch(metric->type) {
+        case MetricType::COUNTER:
+            return *metric->counter;
+        case MetricType::GAUGE:
+            return metric->read(metric->context);
+        case MetricType::HISTOGRAM:
+            return metric->histogram->count;
+    }
+    return 0;
+}
+
+int openxc::util::metrics::formatName(const Metric* metric, char* buffer,
+        size_t bufferSize) {
+    int length;
+    if(metric->instance == NO_METRIC_INSTANCE) {
+        length = snprintf(buffer, bufferSize, "%s.%s", metric->group,
+                metric->name);
+    } else {
+        length = snprintf(buffer, bufferSize, "%s%d.%s", metric->group,
+                metric->instance, metric->name);
+    }
+    return length < 0 || (size_t) length >= bufferSize ? -1 : length;
+}
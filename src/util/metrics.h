@@ -0,0 +1,131 @@
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "util/statistics.h"
+
+// Room for every metric the firmware registers: 5 for the pipeline, 5 for
+// each of the 3 built-in output interfaces, 6 for each of 2 CAN buses, 4 for
+// diagnostics and 1 for the main loop. Metrics of any other pipeline endpoints
+// are only registered if there's room left.
+#ifndef MAX_METRICS
+#define MAX_METRICS 37
+#endif
+
+// The instance of a metric that there's only one of, e.g. not per bus.
+#define NO_METRIC_INSTANCE 0
+
+namespace openxc {
+namespace util {
+namespace metrics {
+
+/* Public: The kinds of metrics in the registry.
+ *
+ * COUNTER - A count that only goes up, e.g. the number of messages received.
+ * GAUGE - A value that goes up and down, e.g. the length of a queue.
+ * HISTOGRAM - A histogram of observed values, e.g. latencies.
+ */
+typedef enum {
+    COUNTER,
+    GAUGE,
+    HISTOGRAM,
+} MetricType;
+
+/* Public: A named metric in the registry.
+ *
+ * The registry never copies or updates the values itself, it only points to
+ * the counters and histograms that the firmware already keeps, so updating a
+ * metric is as cheap as it was before it was registered. The values are only
+ * read when someone asks for them.
+ *
+ * group - The part of the firmware the metric is from, e.g. "can" or the name
+ *      of a pipeline endpoint.
+ * instance - Which one of the group it's from if there are several, e.g. the
+ *      bus address, or NO_METRIC_INSTANCE.
+ * name - The name of the metric within the group.
+ * type - The MetricType of the metric.
+ * counter - The value of a COUNTER.
+ * read - Return the current value of a GAUGE.
+ * context - Passed to the read function.
+ * histogram - The histogram for a HISTOGRAM.
+ */
+typedef struct {
+    const char* group;
+    uint8_t instance;
+    const char* name;
+    MetricType type;
+    const unsigned int* counter;
+    int (*read)(void* context);
+    void* context;
+    const openxc::util::statistics::Histogram* histogram;
+} Metric;
+
+/* Public: Remove every metric from the registry.
+ */
+void initialize();
+
+/* Public: Add a counter to the registry. If a metric with the same group,
+ * instance and name is already registered, it's replaced, so modules can
+ * register their metrics each time they're initialized.
+ *
+ * The group and name strings and the counter must outlive the registry entry.
+ *
+ * group - The part of the firmware the metric is from.
+ * instance - Which one of the group it's from, or NO_METRIC_INSTANCE.
+ * name - The name of the metric within the group.
+ * counter - The count to report.
+ *
+ * Returns true if the metric was registered, or false if the registry is full.
+ */
+bool registerCounter(const char* group, uint8_t instance, const char* name,
+        const unsigned int* counter);
+
+/* Public: Add a gauge to the registry, like registerCounter(...).
+ *
+ * read - Return the current value of the gauge. This is only called when the
+ *      metric is read.
+ * context - Passed to the read function.
+ */
+bool registerGauge(const char* group, uint8_t instance, const char* name,
+        int (*read)(void* context), void* context);
+
+/* Public: Add a histogram to the registry, like registerCounter(...).
+ */
+bool registerHistogram(const char* group, uint8_t instance, const char* name,
+        const openxc::util::statistics::Histogram* histogram);
+
+/* Public: Return the number of metrics in the registry.
+ */
+int getMetricCount();
+
+/* Public: Return the metric at an index in the registry, from 0 to
+ * getMetricCount() - 1, or NULL if the index is out of range. Metrics keep
+ * their index as long as the registry isn't initialized again.
+ */
+const Metric* getMetric(int index);
+
+/* Public: Find a metric in the registry by its group, instance and name.
+ *
+ * Returns the metric, or NULL if it isn't registered.
+ */
+const Metric* lookupMetric(const char* group, uint8_t instance,
+        const char* name);
+
+/* Public: Read the current value of a counter or gauge, or the number of
+ * values observed by a histogram.
+ */
+long read(const Metric* metric);
+
+/* Public: Write the full name of a metric, i.e. the group, instance (if any)
+ * and name separated like "can1.messages_received", to a buffer.
+ *
+ * Returns the length of the name, or -1 if it didn't fit.
+ */
+int formatName(const Metric* metric, char* buffer, size_t bufferSize);
+
+} // namespace metrics
+} // namespace util
+} // namespace openxc
+
+#endif // __METRICS_H__
@@ -0,0 +1,162 @@
+#include "util/numberformat.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+// 2^53, the first integer a double can't hold along with all of its neighbours.
+#define MAX_EXACT_DOUBLE_INTEGER 9007199254740992.0
+
+static const uint32_t POWERS_OF_10[MAX_DECIMAL_PLACES + 1] = {
+    1,
+    10,
+    100,
+    1000,
+    10000,
+    100000,
+    1000000,
+    10000000,
+    100000000,
+    1000000000
+};
+
+/* Private: Write the digits of an integer backwards, ending just before end.
+ *
+ * minimumDigits - Pad the number with leading zeros to at least this many
+ *      digits.
+ *
+ * Returns a pointer to the first digit.
+ */
+static char* writeDigits(uint32_t value, int minimumDigits, char* end) {
+    char* start = end;
+    do {
+        *--start = '0' + value % 10;
+        value /= 10;
+    } while(value > 0 || end - start < minimumDigits);
+    return start;
+}
+
+/* Private: Copy formatted text to the caller's buffer if it fits.
+ */
+static int copyText(const char* text, int length, char* buffer,
+        size_t bufferSize) {
+    if(length < 0 || (size_t) length >= bufferSize) {
+        return -1;
+    }
+    memcpy(buffer, text, length);
+    buffer[length] = '\0';
+    return length;
+}
+
+/* Private: Write a number that has already been scaled up by 10^decimalPlaces
+ * and rounded to an integer, putting the decimal point back in.
+ */
+static int formatScaled(bool negative, uint64_t scaled, int decimalPlaces,
+        char* buffer, size_t bufferSize) {
+    char text[MAX_FORMATTED_NUMBER_LENGTH];
+    char* end = text + sizeof(text);
+    char* start = end;
+
+    uint32_t wholePart = scaled / POWERS_OF_10[decimalPlaces];
+    if(decimalPlaces > 0) {
+        start = writeDigits(scaled % POWERS_OF_10[decimalPlaces],
+                decimalPlaces, start);
+        *--start = '.';
+    }
+    start = writeDigits(wholePart, 1, start);
+    if(negative) {
+        *--start = '-';
+    }
+    return copyText(start, end - start, buffer, bufferSize);
+}
+
+/* Private: Scale a non-negative number up by 10^decimalPlaces and round it to
+ * the nearest integer, with ties to even like printf.
+ */
+static uint64_t roundScaled(double magnitude, int decimalPlaces) {
+    double scaled = magnitude * POWERS_OF_10[decimalPlaces];
+    uint64_t rounded = (uint64_t) scaled;
+    double remainder = scaled - rounded;
+    if(remainder > 0.5 || (remainder == 0.5 && (rounded & 1))) {
+        ++rounded;
+    }
+    return rounded;
+}
+
+int openxc::util::numberformat::formatInteger(int32_t value, char* buffer,
+        size_t bufferSize) {
+    char text[12];
+    char* end = text + sizeof(text);
+    uint32_t magnitude = value < 0 ? -(uint32_t) value : value;
+    char* start = writeDigits(magnitude, 1, end);
+    if(value < 0) {
+        *--start = '-';
+    }
+    return copyText(start, end - start, buffer, bufferSize);
+}
+
+int openxc::util::numberformat::formatDecimal(double value, int decimalPlaces,
+        char* buffer, size_t bufferSize) {
+    if(decimalPlaces < 0 || decimalPlaces > MAX_DECIMAL_PLACES) {
+        return -1;
+    }
+
+    // A float has a 24 bit mantissa and 10^9 = 2^9 * 5^9 adds at most 21 bits,
+    // so scaling up a value that fits in a float is exact in a double and it's
+    // rounded only once, the same as printf. NaN and infinity fail both tests.
+    double magnitude = fabs(value);
+    if(value == (double)(float) value && magnitude < 1.0e9) {
+        return formatScaled(signbit(value), roundScaled(magnitude,
+                    decimalPlaces), decimalPlaces, buffer, bufferSize);
+    }
+
+    char text[MAX_FORMATTED_NUMBER_LENGTH];
+    return copyText(text, snprintf(text, sizeof(text), "%.*f", decimalPlaces,
+                value), buffer, bufferSize);
+}
+
+/* Private: Return true if a number that has been scaled up by
+ * 10^decimalPlaces and rounded to an integer parses back to the same float, the
+ * way strtof would.
+ */
+static bool roundTripsAsFloat(float magnitude, uint64_t scaled,
+        int decimalPlaces) {
+    // The points halfway to the neighbouring floats have at most 25 significant
+    // bits and 10^9 adds at most 21 more, so scaling them up is exact, and so
+    // is the scaled value as long as it's under 2^53.
+    double low = ((double) magnitude + nextafterf(magnitude, 0)) / 2 *
+            POWERS_OF_10[decimalPlaces];
+    double high = ((double) magnitude + nextafterf(magnitude, INFINITY)) / 2 *
+            POWERS_OF_10[decimalPlaces];
+    // A number exactly halfway rounds to the float with an even mantissa
+    uint32_t bits;
+    memcpy(&bits, &magnitude, sizeof(bits));
+    bool even = (bits & 1) == 0;
+    return (scaled > low || (even && scaled == low)) &&
+            (scaled < high || (even && scaled == high));
+}
+
+int openxc::util::numberformat::formatShortest(double value, char* buffer,
+        size_t bufferSize) {
+    double magnitude = fabs(value);
+    bool isFloat = value == (double)(float) value;
+    for(int decimalPlaces = 0; magnitude < 1.0e9 &&
+            decimalPlaces <= MAX_DECIMAL_PLACES &&
+            magnitude * POWERS_OF_10[decimalPlaces] <
+                MAX_EXACT_DOUBLE_INTEGER; decimalPlaces++) {
+        // For a double, the scaled value and the power of 10 are both exact,
+        // so dividing them is rounded correctly - i.e. it's exactly what
+        // parsing the text would give.
+        uint64_t scaled = roundScaled(magnitude, decimalPlaces);
+        if(isFloat ? roundTripsAsFloat((float) magnitude, scaled,
+                    decimalPlaces) :
+                (double) scaled / POWERS_OF_10[decimalPlaces] == magnitude) {
+            return formatScaled(signbit(value), scaled, decimalPlaces, buffer,
+                    bufferSize);
+        }
+    }
+
+    char text[MAX_FORMATTED_NUMBER_LENGTH];
+    return copyText(text, snprintf(text, sizeof(text),
+                isFloat ? "%.9g" : "%.17g", value), buffer, bufferSize);
+}
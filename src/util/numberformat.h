@@ -0,0 +1,78 @@
+#ifndef __NUMBERFORMAT_H__
+#define __NUMBERFORMAT_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The most decimal places formatDecimal(...) takes a fast path for.
+#define MAX_DECIMAL_PLACES 9
+
+// Pass as the number of decimal places to format a value with the shortest
+// text that parses back to exactly the same value.
+#define SHORTEST_DECIMAL_PLACES -1
+
+// Big enough for any formatted number, including the ones that fall back to
+// printf like 1e59 with no decimal places.
+#define MAX_FORMATTED_NUMBER_LENGTH 64
+
+namespace openxc {
+namespace util {
+namespace numberformat {
+
+/* Public: Write an integer as decimal text to a buffer, like "%d" in printf.
+ *
+ * value - The integer to format.
+ * buffer - The buffer to write the NULL terminated text to.
+ * bufferSize - The size of the buffer.
+ *
+ * Returns the length of the text, not including the NULL, or -1 if it didn't
+ * fit.
+ */
+int formatInteger(int32_t value, char* buffer, size_t bufferSize);
+
+/* Public: Write a number as decimal text with a fixed number of decimal places
+ * to a buffer, with exactly the same result as "%.*f" in printf.
+ *
+ * Values that fit in a float (which includes every signal value) and are
+ * smaller than 1e9 are formatted with one rounding step and integer math,
+ * which is much faster than printf on MCUs without an FPU. Anything else falls
+ * back to printf.
+ *
+ * value - The number to format.
+ * decimalPlaces - The number of digits after the decimal point, from 0 to
+ *      MAX_DECIMAL_PLACES. There's no decimal point if this is 0.
+ * buffer - The buffer to write the NULL terminated text to.
+ * bufferSize - The size of the buffer.
+ *
+ * Returns the length of the text, not including the NULL, or -1 if it didn't
+ * fit or decimalPlaces is out of range.
+ */
+int formatDecimal(double value, int decimalPlaces, char* buffer,
+        size_t bufferSize);
+
+/* Public: Write a number as the shortest decimal text that parses back to
+ * exactly the same value, e.g. 0.5 as "0.5" and not "0.500000".
+ *
+ * Signal values are floats, so if the number can be stored exactly in a float,
+ * the shortest text that parses back to that float (like strtof) is used, e.g.
+ * "0.1" for a float value of 0.1, which is the double 0.100000001490116...
+ * Anything else has to parse back to the same double (like strtod).
+ *
+ * Numbers with up to MAX_DECIMAL_PLACES significant decimal places are found
+ * with integer math, and anything else falls back to printf with "%.9g" for
+ * floats and "%.17g" for doubles, which may use an exponent.
+ *
+ * value - The number to format.
+ * buffer - The buffer to write the NULL terminated text to.
+ * bufferSize - The size of the buffer.
+ *
+ * Returns the length of the text, not including the NULL, or -1 if it didn't
+ * fit.
+ */
+int formatShortest(double value, char* buffer, size_t bufferSize);
+
+} // namespace numberformat
+} // namespace util
+} // namespace openxc
+
+#endif // __NUMBERFORMAT_H__
@@ -2,6 +2,7 @@
 
 #include <limits.h>
 #include <stddef.h>
+#include <string.h>
 
 #include "config.h"
 
@@ -17,6 +18,10 @@ void openxc::util::statistics::initialize(Statistic* stat) {
     stat->alpha = .1;
 }
 
+void openxc::util::statistics::initialize(Histogram* histogram) {
+    memset(histogram, 0, sizeof(Histogram));
+}
+
 void openxc::util::statistics::update(Statistic* stat, int newValue) {
     if(stat->min == INT_MAX && stat->max == INT_MIN) {
         stat->movingAverage = newValue;
@@ -35,6 +40,18 @@ void openxc::util::statistics::update(DeltaStatistic* stat, int newValue) {
     update(&stat->statistic, delta);
 }
 
+void openxc::util::statistics::update(Histogram* histogram,
+        unsigned long newValue) {
+    int bucket = 0;
+    for(unsigned long remaining = newValue >> 1; remaining > 0 &&
+            bucket < HISTOGRAM_BUCKET_COUNT - 1; remaining >>= 1) {
+        ++bucket;
+    }
+    ++histogram->buckets[bucket];
+    ++histogram->count;
+    histogram->max = MAX(newValue, histogram->max);
+}
+
 float openxc::util::statistics::exponentialMovingAverage(const Statistic* stat) {
     return stat->movingAverage;
 }
@@ -58,3 +75,26 @@ int openxc::util::statistics::maximum(const Statistic* stat) {
 int openxc::util::statistics::maximum(const DeltaStatistic* stat) {
     return stat->statistic.max;
 }
+
+unsigned long openxc::util::statistics::maximum(const Histogram* histogram) {
+    return histogram->max;
+}
+
+unsigned long openxc::util::statistics::percentile(const Histogram* histogram,
+        int percent) {
+    if(histogram->count == 0) {
+        return 0;
+    }
+
+    // the rank of the value we're looking for, rounded up
+    unsigned long rank = ((unsigned long long)histogram->count * percent + 99)
+            / 100;
+    unsigned long seen = 0;
+    for(int i = 0; i < HISTOGRAM_BUCKET_COUNT - 1; i++) {
+        seen += histogram->buckets[i];
+        if(seen >= rank && seen > 0) {
+            return MIN((2UL << i) - 1, histogram->max);
+        }
+    }
+    return histogram->max;
+}
@@ -1,6 +1,8 @@
 #ifndef _STATISTICS_H_
 #define _STATISTICS_H_
 
+#define HISTOGRAM_BUCKET_COUNT 20
+
 namespace openxc {
 namespace util {
 namespace statistics {
@@ -26,6 +28,23 @@ typedef struct {
     Statistic statistic;
 } DeltaStatistic;
 
+/* Public: A histogram of observed values with power of 2 bucket sizes, for
+ * measuring latencies where the outliers are as interesting as the average.
+ *
+ * Bucket 0 counts the values 0 and 1, and bucket N counts the values from 2^N
+ * up to 2^(N + 1) - 1. The last bucket also counts every value too large for
+ * the others. A zeroed Histogram is an empty one.
+ *
+ * buckets - the number of values observed in each bucket.
+ * count - the total number of values observed.
+ * max - the largest value observed.
+ */
+typedef struct {
+    unsigned int buckets[HISTOGRAM_BUCKET_COUNT];
+    unsigned int count;
+    unsigned long max;
+} Histogram;
+
 /* Public: Initialize a new Statistic.
  *
  * stat - the Statistic to initialize.
@@ -34,6 +53,8 @@ void initialize(Statistic* stat);
 
 void initialize(DeltaStatistic* stat);
 
+void initialize(Histogram* histogram);
+
 /* Public: Update the statistic with a new observed value.
  *
  * stat - the Statistic object to update.
@@ -43,6 +64,8 @@ void update(Statistic* stat, int newValue);
 
 void update(DeltaStatistic* stat, int newValue);
 
+void update(Histogram* histogram, unsigned long newValue);
+
 float exponentialMovingAverage(const Statistic* stat);
 
 float exponentialMovingAverage(const DeltaStatistic* stat);
@@ -55,6 +78,20 @@ int maximum(const Statistic* stat);
 
 int maximum(const DeltaStatistic* stat);
 
+unsigned long maximum(const Histogram* histogram);
+
+/* Public: Estimate a percentile of the values observed by a histogram.
+ *
+ * The estimate is the upper bound of the bucket the percentile falls in, so it
+ * may be up to twice the real value, but never less than it.
+ *
+ * histogram - the histogram to inspect.
+ * percent - the percentile to estimate, from 0 to 100.
+ *
+ * Returns the estimated value, or 0 if the histogram is empty.
+ */
+unsigned long percentile(const Histogram* histogram, int percent);
+
 
 } // namespace statistics
 } // namespace util
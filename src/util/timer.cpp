@@ -1,4 +1,5 @@
 #include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include "util/log.h"
 #include "util/timer.h"
@@ -14,6 +15,18 @@ unsigned long openxc::util::time::uptimeMs() {
     return systemTimeMs() - startupTimeMs();
 }
 
+unsigned long openxc::util::time::elapsedUs(unsigned long startTimeUs,
+        unsigned long endTimeUs) {
+    // The clock is 32 bits on the VI, so a difference of more than half of
+    // that is really a negative one
+    int32_t elapsed = (int32_t)(endTimeUs - startTimeUs);
+    return elapsed > 0 ? elapsed : 0;
+}
+
+unsigned long openxc::util::time::elapsedUs(unsigned long startTimeUs) {
+    return elapsedUs(startTimeUs, systemTimeUs());
+}
+
 /* Private: Return the period in ms given the frequency in hertz.
  */
 static float frequencyToPeriod(float frequency) {
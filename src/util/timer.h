@@ -68,6 +68,27 @@ void delayMs(unsigned long delayInMs);
  */
 unsigned long systemTimeMs();
 
+/* Public: Return the current system time in microseconds.
+ *
+ * This wraps around roughly every 71 minutes, so it's only meant for measuring
+ * short intervals - use systemTimeMs() for anything else.
+ */
+unsigned long systemTimeUs();
+
+/* Public: Return the number of microseconds between two readings of
+ * systemTimeUs(), allowing for it wrapping around.
+ *
+ * If the end reading is before the start, e.g. because one was taken in an
+ * interrupt handler while the clock was being updated, this returns 0 instead
+ * of a huge value.
+ */
+unsigned long elapsedUs(unsigned long startTimeUs, unsigned long endTimeUs);
+
+/* Public: Return the number of microseconds since a reading of systemTimeUs(),
+ * like elapsedUs(startTimeUs, systemTimeUs()).
+ */
+unsigned long elapsedUs(unsigned long startTimeUs);
+
 /* Public: Perform any one-time initialization required to use system times,
  * including those for system time and the delayMs function.
  */
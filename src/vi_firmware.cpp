@@ -16,6 +16,8 @@
 #include "data_emulator.h"
 #include "config.h"
 #include "commands/commands.h"
+#include "can/snapshot.h"
+#include "util/metrics.h"
 
 namespace uart = openxc::interface::uart;
 namespace network = openxc::interface::network;
@@ -30,6 +32,9 @@ namespace power = openxc::power;
 namespace bluetooth = openxc::bluetooth;
 namespace commands = openxc::commands;
 namespace config = openxc::config;
+namespace statistics = openxc::util::statistics;
+namespace snapshot = openxc::can::snapshot;
+namespace metrics = openxc::util::metrics;
 
 using openxc::util::log::debug;
 using openxc::signals::getCanBuses;
@@ -38,13 +43,18 @@ using openxc::signals::getSignals;
 using openxc::signals::getMessages;
 using openxc::signals::getMessageCount;
 using openxc::signals::getSignalCount;
+using openxc::signals::getCommands;
+using openxc::signals::getCommandCount;
 using openxc::pipeline::Pipeline;
 using openxc::config::getConfiguration;
 using openxc::config::PowerManagement;
 using openxc::config::RunLevel;
 
+#define LOOP_STATS_LOG_FREQUENCY_S 15
+
 static bool BUS_WAS_ACTIVE;
 static bool SUSPENDED;
+static statistics::Histogram LOOP_TIME;
 
 /* Public: Update the color and status of a board's light that shows the output
  * interface status. This function is intended to be called each time through
@@ -109,16 +119,76 @@ void initializeAllCan() {
         }
         can::initialize(bus, writable, getCanBuses(), getCanBusCount());
     }
+
+    can::buildMessageIndex(getCanBuses(), getCanBusCount(), getMessages(),
+            getMessageCount(), getSignals(), getSignalCount());
+    can::buildNameIndex(getSignals(), getSignalCount(), getCommands(),
+            getCommandCount());
+    can::read::initializeFixedPoint(getSignals(), getSignalCount());
+    snapshot::initialize();
+}
+
+/* Private: Translate the signals in a received CAN message with the extraction
+ * plan from the bus's message index, for the indexedDecode configuration
+ * option.
+ *
+ * Returns true if the message was translated. If false, the message isn't in
+ * the index or hasn't opted in with its indexedDecode flag, and it should be
+ * passed to the generated decodeCanMessage(...) instead.
+ */
+static bool decodeIndexedMessage(Pipeline* pipeline, CanBus* bus,
+        CanMessage* message) {
+    const CanMessageIndexEntry* entry = can::lookupMessageIndexEntry(bus,
+            message->id, message->format);
+    if(entry == NULL ||
+            !bus->indexedMessages[entry->messageIndex].indexedDecode) {
+        return false;
+    }
+    return can::read::translateMessage(bus, message, getSignals(),
+            getSignalCount(), pipeline);
 }
 
 /*
- * Check to see if a packet has been received. If so, read the packet and print
- * the packet payload to the uart monitor.
+ * Check to see if any packets have been received. If so, read the packets and
+ * translate them into the pipeline.
+ *
+ * If the indexedDecode configuration option is enabled, the signals in
+ * messages from the message index that set their own indexedDecode flag are
+ * translated by decodeIndexedMessage(...), and only the rest are passed to the
+ * generated decodeCanMessage(...).
+ *
+ * To keep up with bursts of CAN traffic, this processes up to
+ * canReceiveBatchSize messages from the bus's receive queue, stopping early if
+ * it runs over the canReceiveBudgetUs time budget.
+ *
+ * When metrics are enabled, this also records how long each message waited in
+ * the queue since the interrupt handler received it, and marks the pipeline
+ * with the time it was dequeued so the latency of publishing it can be measured.
  */
 void receiveCan(Pipeline* pipeline, CanBus* bus) {
-    if(!QUEUE_EMPTY(CanMessage, &bus->receiveQueue)) {
+    const uint8_t batchSize = getConfiguration()->canReceiveBatchSize;
+    const unsigned int budget = getConfiguration()->canReceiveBudgetUs;
+    unsigned long startTime = time::systemTimeUs();
+    unsigned long elapsedTime = 0;
+    int messagesProcessed = 0;
+    // Always process at least 1 message, even if the limits are set to 0
+    while(!QUEUE_EMPTY(CanMessage, &bus->receiveQueue) &&
+            (messagesProcessed == 0 || (messagesProcessed < batchSize &&
+                (budget == 0 || elapsedTime < budget)))) {
         CanMessage message = QUEUE_POP(CanMessage, &bus->receiveQueue);
-        signals::decodeCanMessage(pipeline, bus, &message);
+        pipeline->receiveTimestamp = message.timestamp;
+        if(getConfiguration()->calculateMetrics) {
+            pipeline->sourceTimestamp = time::systemTimeUs();
+            if(message.timestamp != 0) {
+                statistics::update(&bus->receiveLatency, time::elapsedUs(
+                            message.timestamp, pipeline->sourceTimestamp));
+            }
+        }
+
+        if(!getConfiguration()->indexedDecode ||
+                !decodeIndexedMessage(pipeline, bus, &message)) {
+            signals::decodeCanMessage(pipeline, bus, &message);
+        }
         if(bus->passthroughCanMessages) {
             openxc::can::read::passthroughMessage(bus, &message, getMessages(),
                     getMessageCount(), pipeline);
@@ -129,6 +199,36 @@ void receiveCan(Pipeline* pipeline, CanBus* bus) {
 
         diagnostics::receiveCanMessage(&getConfiguration()->diagnosticsManager,
                 bus, &message, pipeline);
+        pipeline->sourceTimestamp = 0;
+        pipeline->receiveTimestamp = 0;
+
+        ++messagesProcessed;
+        elapsedTime = time::elapsedUs(startTime);
+    }
+
+    if(messagesProcessed > 0 && getConfiguration()->calculateMetrics) {
+        statistics::update(&bus->receiveBatchStats, messagesProcessed);
+        statistics::update(&bus->receiveTimeStats, elapsedTime);
+    }
+}
+
+/* Public: Log how long each pass through the main loop takes, if metrics are
+ * enabled. This is rate limited and is intended to be called each time through
+ * the main loop.
+ *
+ * A long loop delays taking messages out of the CAN receive queues, so this
+ * is the first place to look if the Rx queue latency of the buses spikes.
+ */
+void logLoopStatistics() {
+    static unsigned long lastTimeLogged;
+    if(getConfiguration()->calculateMetrics && LOOP_TIME.count > 0 &&
+            time::systemTimeMs() - lastTimeLogged >
+                LOOP_STATS_LOG_FREQUENCY_S * 1000) {
+        debug("Main loop time p50: %luus, p99: %luus, max: %luus",
+                statistics::percentile(&LOOP_TIME, 50),
+                statistics::percentile(&LOOP_TIME, 99),
+                statistics::maximum(&LOOP_TIME));
+        lastTimeLogged = time::systemTimeMs();
     }
 }
 
@@ -152,6 +252,8 @@ void initializeVehicleInterface() {
     bluetooth::initialize(&getConfiguration()->uart);
 
     srand(time::systemTimeMs());
+    metrics::registerHistogram("loop", NO_METRIC_INSTANCE, "time_us",
+            &LOOP_TIME);
     initializeAllCan();
 
     char descriptor[128];
@@ -175,25 +277,24 @@ void initializeVehicleInterface() {
 }
 
 void firmwareLoop() {
+    unsigned long loopStartTime = time::systemTimeUs();
     if(getConfiguration()->runLevel != RunLevel::ALL_IO &&
             getConfiguration()->desiredRunLevel == RunLevel::ALL_IO) {
         initializeIO();
     }
 
     for(int i = 0; i < getCanBusCount(); i++) {
-        // In normal operation, if no output interface is enabled/attached (e.g.
-        // no USB or Bluetooth, the loop will stall here. Deep down in
-        // receiveCan when it tries to append messages to the queue it will
-        // reach a point where it tries to flush the (full) queue. Since nothing
-        // is attached, that will just keep timing out. Just be aware that if
-        // you need to modify the firmware to not use any interfaces, you'll
-        // have to change that or enable the flush functionality to write to
-        // your desired output interface.
+        // Publishing the messages translated here never waits for an output
+        // interface - if one is full or nothing is attached, the messages are
+        // held in the pipeline's pool or dropped, and the output is only
+        // flushed by pipeline::process at the end of the loop.
         CanBus* bus = &(getCanBuses()[i]);
         receiveCan(&getConfiguration()->pipeline, bus);
         diagnostics::sendRequests(&getConfiguration()->diagnosticsManager, bus);
     }
 
+    snapshot::loop(getSignals(), getSignalCount(),
+            &getConfiguration()->pipeline);
     diagnostics::obd2::loop(&getConfiguration()->diagnosticsManager);
 
     if(getConfiguration()->runLevel == RunLevel::ALL_IO) {
@@ -216,6 +317,7 @@ void firmwareLoop() {
 
     can::logBusStatistics(getCanBuses(), getCanBusCount());
     openxc::pipeline::logStatistics(&getConfiguration()->pipeline);
+    logLoopStatistics();
 
     if(getConfiguration()->emulatedData) {
         static bool connected = false;
@@ -233,4 +335,8 @@ void firmwareLoop() {
     }
 
     openxc::pipeline::process(&getConfiguration()->pipeline);
+
+    if(getConfiguration()->calculateMetrics) {
+        statistics::update(&LOOP_TIME, time::elapsedUs(loopStartTime));
+    }
 }